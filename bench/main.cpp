@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mildew/atom.hpp"
+#include "mildew/closurecompiler.hpp"
+#include "mildew/compiler.hpp"
+#include "mildew/interpreter.hpp"
+#include "mildew/lexer.hpp"
+#include "mildew/optimizer.hpp"
+#include "mildew/parser.hpp"
+#include "mildew/scheduler.hpp"
+
+/**
+ * Microbenchmarks for the virtual machine. Each script is compiled once and then run repeatedly with
+ * both dispatch loops so their throughput can be compared on the same build.
+ */
+
+struct Benchmark
+{
+    std::string name;
+    std::string source;
+};
+
+static const std::vector<Benchmark> kBenchmarks = {
+    {"loop", "let sum = 0; for(let i = 0; i < 1000000; ++i) { sum += i % 7; } sum;"},
+    {"numeric", "let x = 0.0; let y = 1.5; for(let i = 0; i < 300000; ++i) { x = x * 0.5 + y; "
+        "if(x > 2.0) { y -= 0.25; } else { y += 0.25; } } x;"},
+    {"fib", "function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); } fib(24);"},
+    {"locals", "function sum(n) { let s = 0; for(let i = 0; i < n; ++i) { let sq = i * i; s += sq % 7; } return s; } "
+        "sum(300000);"},
+    {"closures", "function counter() { let c = 0; return () => ++c; } let t = 0; "
+        "for(let i = 0; i < 30000; ++i) { let inc = counter(); inc(); t += inc(); } t;"},
+    {"fields", "let o = {x: 0, y: 1}; for(let i = 0; i < 300000; ++i) { o.x = o.x + o.y; } o.x;"},
+    {"instances", "class P { constructor(x, y) { this.x = x; this.y = y; } sum() { return this.x + this.y; } } "
+        "let t = 0; for(let i = 0; i < 100000; ++i) { let p = new P(i, 1); t += p.sum(); } t;"},
+    {"array", "let a = []; for(let i = 0; i < 100000; ++i) { a[i] = i; } let t = 0; "
+        "for(let i = 0; i < 100000; ++i) { t += a[i]; } t;"},
+    {"garbage", "let n = 0; for(let i = 0; i < 100000; ++i) { let o = {next: null, f: function() {}}; "
+        "o.next = o; n += 1; } n;"},
+    {"strings", "let s = ''; for(let i = 0; i < 20000; ++i) { s += `entry ${i}, `; } s.length;"}
+};
+
+static double TimeRun(mildew::Interpreter& interpreter, mildew::ScriptFunction* program, const int iterations)
+{
+    const auto kStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; ++i)
+    {
+        // every run gets a fresh scope so let declarations do not collide
+        auto env = std::make_shared<mildew::Environment>(interpreter.global_environment());
+        interpreter.vm().Run(program, env);
+    }
+    const auto kEnd = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(kEnd - kStart).count() / iterations;
+}
+
+// the same as TimeRun for a program compiled by ClosureCompiler
+static double TimeClosures(mildew::Interpreter& interpreter, mildew::ClosureRuntime& runtime,
+    mildew::ScriptFunction* program, const int iterations)
+{
+    const auto kStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; ++i)
+    {
+        auto env = std::make_shared<mildew::Environment>(interpreter.global_environment());
+        runtime.Run(program, env);
+    }
+    const auto kEnd = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(kEnd - kStart).count() / iterations;
+}
+
+static std::string LargeScript()
+{
+    std::string source;
+    while(source.size() < 2 * 1024 * 1024)
+        source += "function f(a, b) { let s = 'plain text'; s += \"escaped\\t\"; return a * 0x1F + b.length; }\n";
+    return source;
+}
+
+// tokenizes a large generated script, whose tokens are views into one shared copy of the text
+static void TimeTokenize(const int iterations)
+{
+    const auto source = LargeScript();
+    size_t num_tokens = 0;
+    const auto kStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; ++i)
+    {
+        mildew::Lexer lexer(source);
+        num_tokens = lexer.Tokenize().size();
+    }
+    const auto kEnd = std::chrono::steady_clock::now();
+    std::cout << "tokenize: " << num_tokens << " tokens from " << source.size() / 1024 << " KB in "
+              << std::chrono::duration<double, std::milli>(kEnd - kStart).count() / iterations << " ms" << std::endl;
+}
+
+// parses the same script into a syntax tree that is bump allocated from one arena
+static void TimeParse(const int iterations)
+{
+    const auto source = LargeScript();
+    size_t arena_bytes = 0;
+    const auto kStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; ++i)
+    {
+        mildew::Lexer lexer(source);
+        mildew::Arena arena;
+        mildew::Parser parser(lexer, arena);
+        parser.ParseProgram();
+        arena_bytes = arena.bytes_used();
+    }
+    const auto kEnd = std::chrono::steady_clock::now();
+    std::cout << "parse: " << arena_bytes / 1024 << " KB of nodes from " << source.size() / 1024 << " KB in "
+              << std::chrono::duration<double, std::milli>(kEnd - kStart).count() / iterations << " ms" << std::endl;
+}
+
+// runs a loop over global consts and a constant condition compiled with and without the optimizer
+static void TimeFolding(mildew::Interpreter& interpreter, const int iterations)
+{
+    const std::string kSource = "const kScale = 4; const kMask = (1 << 8) - 1; const kDebug = kScale > 8; let t = 0;"
+        " for(let i = 0; i < 300000; ++i) { if(kDebug) { t -= i; } t += (i * kScale) & kMask; } t;";
+    double times[2];
+    for(int optimize = 0; optimize < 2; ++optimize)
+    {
+        mildew::Lexer lexer(kSource);
+        mildew::Arena arena;
+        mildew::Parser parser(lexer, arena);
+        auto tree = parser.ParseProgram();
+        if(optimize)
+            tree = mildew::Optimizer(arena).Optimize(*tree);
+        mildew::Compiler compiler;
+        auto program = compiler.Compile(*tree, "folding");
+        interpreter.heap().AddRoots(&program, [&program](mildew::Heap& heap) { heap.Mark(program); });
+        times[optimize] = TimeRun(interpreter, program, iterations);
+        interpreter.heap().RemoveRoots(&program);
+    }
+    std::cout << "folding: unoptimized " << times[0] << " ms, optimized " << times[1] << " ms ("
+              << times[0] / times[1] << "x)" << std::endl;
+}
+
+// dispatches messages through one switch with many string cases, like a protocol handler, and one on integer codes
+static void TimeDispatch(mildew::Interpreter& interpreter, const int iterations)
+{
+    std::string source = "function handle(kind, code) { let r = 0; switch(kind) {";
+    for(int i = 0; i < 64; ++i)
+        source += " case 'message" + std::to_string(i) + "': r = " + std::to_string(i) + "; break;";
+    source += " default: r = -1; } switch(code) {";
+    for(int i = 0; i < 64; ++i)
+        source += " case " + std::to_string(i * 3) + ": r += " + std::to_string(i) + "; break;";
+    source += " } return r; } let kinds = []; for(let i = 0; i < 64; ++i) { kinds[i] = 'message' + i; }"
+        " let t = 0; for(let i = 0; i < 200000; ++i) { t += handle(kinds[i % 64], i % 192); } t;";
+    auto program = interpreter.Compile(source, "dispatch");
+    interpreter.heap().AddRoots(&program, [&program](mildew::Heap& heap) { heap.Mark(program); });
+    std::cout << "dispatch: " << TimeRun(interpreter, program, iterations) << " ms" << std::endl;
+    interpreter.heap().RemoveRoots(&program);
+}
+
+// evaluates one small script many times, as an embedder answering requests would, with and without the cache
+static double TimeEvaluate(mildew::Interpreter& interpreter, const size_t cache_capacity)
+{
+    const std::string kSource = "var request = {id: 1, items: [1, 2, 3]}; request.items.length + request.id;";
+    const auto kSavedCapacity = interpreter.script_cache().capacity();
+    interpreter.script_cache().capacity(cache_capacity);
+    const auto kStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < 10000; ++i)
+        interpreter.Evaluate(kSource, "request");
+    const auto kEnd = std::chrono::steady_clock::now();
+    interpreter.script_cache().capacity(kSavedCapacity);
+    return std::chrono::duration<double, std::milli>(kEnd - kStart).count();
+}
+
+// runs a request handler in one interpreter per thread, which share nothing, to show how throughput scales
+static void TimeIsolates(const int iterations)
+{
+    const std::string kHandler = "function handle(n) { let o = {total: 0, parts: []}; "
+        "for(let i = 0; i < 2000; ++i) { o.total += i % n; o.parts[i % 8] = `part ${i}`; } return o.total; }";
+    // at least a few threads even on small machines, where the extra ones only show the cost of sharing a core
+    const auto kMaxThreads = std::max(4u, std::thread::hardware_concurrency());
+    double single_rate = 0;
+    std::cout << "isolates:";
+    for(unsigned num_threads = 1; num_threads <= kMaxThreads; num_threads *= 2)
+    {
+        const int kRequests = 200 * iterations;
+        const auto kStart = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(unsigned t = 0; t < num_threads; ++t)
+        {
+            threads.emplace_back([&] {
+                mildew::Interpreter interpreter;
+                interpreter.Evaluate(kHandler);
+                for(int i = 0; i < kRequests; ++i)
+                    interpreter.Evaluate("handle(7);");
+            });
+        }
+        for(auto& thread : threads)
+            thread.join();
+        const auto kEnd = std::chrono::steady_clock::now();
+        const auto kRate = num_threads * kRequests / std::chrono::duration<double>(kEnd - kStart).count();
+        if(num_threads == 1)
+            single_rate = kRate;
+        std::cout << " " << num_threads << " threads " << static_cast<long>(kRate) << " runs/s ("
+                  << kRate / single_rate << "x)";
+    }
+    std::cout << std::endl;
+}
+
+// starts workers for a script with many functions, compiling it in each one or instantiating one shared program
+static void TimeWarmup(const int iterations)
+{
+    std::string source;
+    for(int i = 0; i < 200; ++i)
+    {
+        source += "function f" + std::to_string(i) + "(a, b) { let t = a; for(let i = 0; i < b; ++i) { "
+            "t = (t * 31 + i) % 1000; if(t > 500) { t -= " + std::to_string(i) + "; } } return t; }\n";
+    }
+    source += "f0(1, 10) + f199(2, 10);";
+    const int kWorkers = 20 * iterations;
+    const auto kCompileStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < kWorkers; ++i)
+    {
+        mildew::Interpreter interpreter;
+        interpreter.Evaluate(source, "workers");
+    }
+    const auto kCompileEnd = std::chrono::steady_clock::now();
+    std::shared_ptr<const mildew::CompiledProgram> program;
+    {
+        mildew::Interpreter interpreter;
+        program = interpreter.CompileShared(source, "workers");
+    }
+    const auto kSharedStart = std::chrono::steady_clock::now();
+    for(int i = 0; i < kWorkers; ++i)
+    {
+        mildew::Interpreter interpreter;
+        interpreter.Run(program);
+    }
+    const auto kSharedEnd = std::chrono::steady_clock::now();
+    const auto kCompileMs = std::chrono::duration<double, std::milli>(kCompileEnd - kCompileStart).count();
+    const auto kSharedMs = std::chrono::duration<double, std::milli>(kSharedEnd - kSharedStart).count();
+    std::cout << kWorkers << " worker warm-ups: compiled " << kCompileMs << " ms, shared " << kSharedMs << " ms ("
+              << kCompileMs / kSharedMs << "x), " << program->shared_bytes() << " bytes of code shared"
+              << std::endl;
+}
+
+// pushes calls of uneven length through the scheduler as fast as its queue takes them
+static void TimeScheduler(const int iterations)
+{
+    std::shared_ptr<const mildew::CompiledProgram> program;
+    {
+        mildew::Interpreter interpreter;
+        program = interpreter.CompileShared("function handle(n) { let t = 0; "
+            "for(let i = 0; i < n; ++i) { t = (t + i * 31) % 1009; } return t; }");
+    }
+    mildew::ScriptScheduler::Options options;
+    options.max_queued = 256;
+    mildew::ScriptScheduler scheduler(program, options);
+    const int kCalls = 2000 * iterations;
+    const auto kStart = std::chrono::steady_clock::now();
+    std::vector<std::future<mildew::TaskValue>> results;
+    for(int i = 0; i < kCalls; ++i)
+        results.emplace_back(scheduler.Submit("handle", {i % 16 == 0 ? 50000 : 2000}));
+    for(auto& result : results)
+        result.get();
+    const auto kEnd = std::chrono::steady_clock::now();
+    const auto kStats = scheduler.stats();
+    const auto kMicros = [](const std::chrono::nanoseconds duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+    std::cout << "scheduler: " << scheduler.num_threads() << " threads "
+              << static_cast<long>(kCalls / std::chrono::duration<double>(kEnd - kStart).count()) << " calls/s, "
+              << kStats.stolen << " stolen, max queue " << kStats.max_queue_depth << ", wait p50 < "
+              << kMicros(kStats.wait_latency.Percentile(0.5)) << " us p99 < "
+              << kMicros(kStats.wait_latency.Percentile(0.99)) << " us, run p50 < "
+              << kMicros(kStats.run_latency.Percentile(0.5)) << " us p99 < "
+              << kMicros(kStats.run_latency.Percentile(0.99)) << " us" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    using mildew::VirtualMachine;
+    const int kIterations = argc > 1 ? std::stoi(argv[1]) : 5;
+    mildew::Interpreter interpreter;
+    // the benchmarks compile outside of the interpreter, into its heap
+    mildew::Heap::Scope heap_scope(interpreter.heap());
+    mildew::ClosureRuntime closure_runtime(interpreter.global_environment(), interpreter.heap(), interpreter.vm());
+    std::cout << "threaded dispatch " << (VirtualMachine::kHasThreadedDispatch ? "available" : "unavailable")
+              << ", jit " << (VirtualMachine::kHasJit ? "available" : "unavailable") << ", " << kIterations
+              << " iterations per benchmark" << std::endl;
+    for(const auto& benchmark : kBenchmarks)
+    {
+        mildew::Lexer lexer(benchmark.source);
+        mildew::Arena arena;
+        mildew::Parser parser(lexer, arena);
+        mildew::Compiler compiler;
+        auto tree = mildew::Optimizer(arena).Optimize(*parser.ParseProgram());
+        auto program = compiler.Compile(*tree, benchmark.name);
+        auto closures = mildew::ClosureCompiler(closure_runtime).Compile(*tree, benchmark.name);
+        // the programs are only referenced from C++ between runs
+        interpreter.heap().AddRoots(&program, [&program, &closures](mildew::Heap& heap) {
+            heap.Mark(program);
+            heap.Mark(closures);
+        });
+
+        interpreter.vm().jit_enabled(false);
+        interpreter.vm().dispatch_mode(VirtualMachine::DispatchMode::SWITCH);
+        const auto kSwitchMs = TimeRun(interpreter, program, kIterations);
+        interpreter.vm().dispatch_mode(VirtualMachine::DispatchMode::THREADED);
+        const auto kThreadedMs = TimeRun(interpreter, program, kIterations);
+        interpreter.vm().jit_enabled(true);
+        const auto kJitMs = TimeRun(interpreter, program, kIterations);
+        const auto kClosuresMs = TimeClosures(interpreter, closure_runtime, closures, kIterations);
+        std::cout << benchmark.name << ": switch " << kSwitchMs << " ms, threaded " << kThreadedMs << " ms ("
+                  << kSwitchMs / kThreadedMs << "x), jit " << kJitMs << " ms (" << kThreadedMs / kJitMs
+                  << "x), closures " << kClosuresMs << " ms (" << kSwitchMs / kClosuresMs << "x)" << std::endl;
+        interpreter.heap().RemoveRoots(&program);
+    }
+    TimeTokenize(kIterations);
+    TimeParse(kIterations);
+    TimeFolding(interpreter, kIterations);
+    TimeDispatch(interpreter, kIterations);
+    TimeIsolates(kIterations);
+    TimeWarmup(kIterations);
+    TimeScheduler(kIterations);
+    const auto kUncachedMs = TimeEvaluate(interpreter, 0);
+    const auto kCachedMs = TimeEvaluate(interpreter, mildew::ScriptCache::kDefaultCapacity);
+    std::cout << "10000 evaluations: uncached " << kUncachedMs << " ms, cached " << kCachedMs << " ms ("
+              << kUncachedMs / kCachedMs << "x)" << std::endl;
+    const auto& stats = interpreter.heap().stats();
+    std::cout << "heap: " << stats.num_collections << " collections, " << stats.total_freed << " objects freed, "
+              << stats.heap_size << " bytes live, max pause "
+              << std::chrono::duration<double, std::milli>(stats.max_pause).count() << " ms, total pause "
+              << std::chrono::duration<double, std::milli>(stats.total_pause).count() << " ms" << std::endl;
+    const auto kAtoms = mildew::AtomTable::stats();
+    std::cout << "atoms: " << kAtoms.size << " interned, " << kAtoms.lookups << " lookups, hit rate "
+              << (kAtoms.lookups > 0 ? 100.0 * kAtoms.hits / kAtoms.lookups : 0.0) << "%" << std::endl;
+    return 0;
+}
\ No newline at end of file
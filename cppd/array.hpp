@@ -159,11 +159,11 @@ private:
 
     void Realloc(const size_t numToAdd)
     {
-        auto newCapacity = capacity_ ? NextPowerOf2(length_ - start_ + numToAdd) : 8;
+        auto newCapacity = capacity_ ? NextPowerOf2(length_ + numToAdd) : 8;
         auto newPtr = new T[newCapacity];
-        for(size_t i = start_, j = 0; i < length_ - start_; ++i, ++j)
+        for(size_t i = 0; i < length_; ++i)
         {
-            newPtr[j] = ptr_.get()[i];
+            newPtr[i] = ptr_.get()[start_ + i];
         }
         start_ = 0;
         is_slice_ = false;
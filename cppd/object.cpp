@@ -18,25 +18,22 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 namespace cppd
 {
 std::unordered_map<const std::type_info*, std::vector<RTTINode*>> Object::hierarchy_;
+std::shared_mutex Object::hierarchy_mutex_;
 
 int Object::SearchTree(const std::type_info& derived_t, const std::type_info& base_t, int accumulator)
 {
     // derived must have an entry
-    if(Object::hierarchy_.count(&derived_t) == 0)
+    auto found = Object::hierarchy_.find(&derived_t);
+    if(found == Object::hierarchy_.end())
         return -1;
-    auto parent_list = Object::hierarchy_[&derived_t];
-    std::cout << "Found parent list of " << derived_t.name() << std::endl;
-    std::cout << " Which has " << parent_list.size() << " elements" << std::endl;
-    for(const auto* parent_entry : parent_list)
+    for(const auto* parent_entry : found->second)
     {
         if(parent_entry->type_.hash_code() == base_t.hash_code())
         {
-            std::cout << "Found immediate parent" << std::endl;
             return accumulator + parent_entry->diff_;
         }
         else
         {
-            std::cout << "Recursively searching " << parent_entry->type_.name() << std::endl;
             auto result = Object::SearchTree(parent_entry->type_, base_t, parent_entry->diff_ + accumulator);
             if(result != -1)
                 return result;
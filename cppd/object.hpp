@@ -16,13 +16,13 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 
 #include <functional>
+#include <mutex>
+#include <shared_mutex>
 #include <type_traits>
 #include <typeinfo>
 #include <unordered_map>
 #include <vector>
 
-#include <iostream>
-
 namespace cppd
 {
 
@@ -38,7 +38,6 @@ class RTTINode
         auto derived = reinterpret_cast<Derived*>(1);
         auto base = static_cast<Base*>(derived);
         diff_ = reinterpret_cast<intptr_t>(base) - reinterpret_cast<intptr_t>(derived);
-        std::cout << "Diff " << typeid(Base).name() << " - " << typeid(Derived).name() << " = " << diff_ << std::endl;
     }
 
     const std::type_info& type_;
@@ -83,7 +82,7 @@ public:
     template<class C, class Parent>
     static void RegisterClassParent()
     {
-        std::cout << "Registering class " << typeid(C).name() << std::endl;
+        std::unique_lock lock(hierarchy_mutex_);
         using BaseClass = std::remove_cv_t<C>;
         using ParentClass = std::remove_cv_t<Parent>;
         if(hierarchy_.count(&typeid(C)) == 0)
@@ -96,7 +95,12 @@ public:
         }
         else // have to add to existing vector 
         {
-            // auto parent_list = hierarchy_[&typeid(C)];
+            // every thread running an interpreter may register the same classes
+            for(const auto* parent_entry : hierarchy_[&typeid(BaseClass)])
+            {
+                if(parent_entry->type_ == typeid(ParentClass))
+                    return;
+            }
             auto node = new RTTINode(typeid(ParentClass));
             node->SetDiff<BaseClass, ParentClass>();
             hierarchy_[&typeid(BaseClass)].emplace_back(node);
@@ -107,7 +111,7 @@ public:
     static void RegisterClassNoParent()
     {
         using BaseClass = std::remove_cv_t<C>;
-        std::cout << "Registering parentless class " << typeid(BaseClass).name() << std::endl;
+        std::unique_lock lock(hierarchy_mutex_);
         if(hierarchy_.count(&typeid(BaseClass)) > 0)
             return; // nothing to do
         hierarchy_[&typeid(BaseClass)] = std::vector<RTTINode*>();
@@ -120,6 +124,7 @@ public:
         if(typeid(Base).hash_code() == type_.hash_code())
             return reinterpret_cast<Base*>(ptr_); // nothing else to do already same type
         // is this a valid upcast?
+        std::shared_lock lock(hierarchy_mutex_);
         auto result = SearchTree(type_, typeid(Base));
         if(result == -1)
             return nullptr;
@@ -127,13 +132,16 @@ public:
     }
 
 private:
+    /// hierarchy_mutex_ must be held
     static int SearchTree(const std::type_info& derived_t, const std::type_info& base_t, int accumulator=0);
 
     void* ptr_;
     const std::type_info& type_;
     std::function<void()> destructor_;
 
+    // the registered classes are shared by every thread, so they are only read or changed under the lock
     static std::unordered_map<const std::type_info*, std::vector<RTTINode*>> hierarchy_;
+    static std::shared_mutex hierarchy_mutex_;
 };
 
 template<class C, typename... Args>
@@ -0,0 +1,185 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "atom.hpp"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace mildew
+{
+    // the names live in chunks that never move, so an atom is turned into its name without a lock
+    static constexpr size_t kChunkBits = 12;
+    static constexpr size_t kChunkSize = size_t(1) << kChunkBits;
+    static constexpr size_t kMaxChunks = size_t(1) << 12;
+
+    /**
+     * An open addressing hash table of the atoms that threads probe without a lock. A slot holds the hash of
+     * a name in its high half and its atom plus one in its low half, so an empty slot is zero. Slots are only
+     * written under the mutex of the table, and a full index is replaced by a larger copy.
+     */
+    struct AtomIndex
+    {
+        explicit AtomIndex(const size_t capacity)
+        : slots(new std::atomic<std::uint64_t>[capacity]()), mask(capacity - 1)
+        {
+        }
+
+        void Insert(const std::uint32_t hash, const Atom atom)
+        {
+            auto i = hash & mask;
+            while(slots[i].load(std::memory_order_relaxed) != 0)
+                i = (i + 1) & mask;
+            // publishes the name, which was stored first
+            slots[i].store((std::uint64_t(hash) << 32) | (static_cast<std::uint32_t>(atom) + 1),
+                std::memory_order_release);
+        }
+
+        std::unique_ptr<std::atomic<std::uint64_t>[]> slots;
+        size_t mask;
+    };
+
+    struct AtomTableData
+    {
+        AtomTableData()
+        {
+            indices.emplace_back(std::make_unique<AtomIndex>(1024));
+            index.store(indices.back().get());
+            for(const auto& name : {"prototype", "constructor", "length"})
+                Add(name);
+        }
+
+        ~AtomTableData()
+        {
+            for(auto& chunk : chunks)
+                delete[] chunk.load();
+        }
+
+        static std::uint32_t Hash(const std::string_view str)
+        {
+            return static_cast<std::uint32_t>(std::hash<std::string_view>()(str));
+        }
+
+        const std::string& Name(const Atom atom) const
+        {
+            const auto kId = static_cast<std::uint32_t>(atom);
+            return chunks[kId >> kChunkBits].load(std::memory_order_acquire)[kId & (kChunkSize - 1)];
+        }
+
+        Atom Find(const std::string_view str) const
+        {
+            const auto kHash = Hash(str);
+            const auto* current = index.load(std::memory_order_acquire);
+            for(auto i = kHash & current->mask;; i = (i + 1) & current->mask)
+            {
+                const auto kSlot = current->slots[i].load(std::memory_order_acquire);
+                if(kSlot == 0)
+                    return kNoAtom;
+                const auto kAtom = static_cast<Atom>(static_cast<std::uint32_t>(kSlot) - 1);
+                if((kSlot >> 32) == kHash && Name(kAtom) == str)
+                    return kAtom;
+            }
+        }
+
+        /// mutex must be held
+        Atom Add(const std::string& str)
+        {
+            const auto kId = size.load(std::memory_order_relaxed);
+            if(kId >= kChunkSize * kMaxChunks)
+                throw std::length_error("Too many atoms");
+            auto* chunk = chunks[kId >> kChunkBits].load(std::memory_order_relaxed);
+            if(chunk == nullptr)
+            {
+                chunk = new std::string[kChunkSize];
+                chunks[kId >> kChunkBits].store(chunk, std::memory_order_release);
+            }
+            chunk[kId & (kChunkSize - 1)] = str;
+            const auto kAtom = static_cast<Atom>(kId);
+            auto* current = index.load(std::memory_order_relaxed);
+            // at most half full, so probes stay short and always find an empty slot
+            if(2 * (kId + 1) > current->mask + 1)
+            {
+                auto larger = std::make_unique<AtomIndex>(2 * (current->mask + 1));
+                for(std::uint32_t id = 0; id < kId; ++id)
+                    larger->Insert(Hash(Name(static_cast<Atom>(id))), static_cast<Atom>(id));
+                current = larger.get();
+                // a thread may still be probing an old index, so they are all kept
+                indices.emplace_back(std::move(larger));
+            }
+            current->Insert(Hash(str), kAtom);
+            index.store(current, std::memory_order_release);
+            size.store(kId + 1, std::memory_order_release);
+            return kAtom;
+        }
+
+        std::mutex mutex; // serializes Add
+        std::array<std::atomic<std::string*>, kMaxChunks> chunks = {};
+        std::atomic<AtomIndex*> index = nullptr;
+        std::vector<std::unique_ptr<AtomIndex>> indices;
+        std::atomic<size_t> size = 0;
+    };
+
+    // counted per thread so that lookups made while scripts run do not share a cache line between threads
+    static thread_local AtomTableStats tls_lookups;
+
+    static AtomTableData& GetTable()
+    {
+        static AtomTableData table;
+        return table;
+    }
+
+    Atom AtomTable::Intern(const std::string& str)
+    {
+        auto found = Find(str);
+        if(found != kNoAtom)
+            return found;
+        auto& table = GetTable();
+        std::lock_guard lock(table.mutex);
+        // another thread may have added it since the lookup
+        found = table.Find(str);
+        if(found != kNoAtom)
+            return found;
+        return table.Add(str);
+    }
+
+    Atom AtomTable::Find(const std::string& str)
+    {
+        ++tls_lookups.lookups;
+        const auto kAtom = GetTable().Find(str);
+        if(kAtom != kNoAtom)
+            ++tls_lookups.hits;
+        return kAtom;
+    }
+
+    const std::string& AtomTable::Name(const Atom atom)
+    {
+        return GetTable().Name(atom);
+    }
+
+    AtomTableStats AtomTable::stats()
+    {
+        AtomTableStats result = tls_lookups;
+        result.size = GetTable().size.load();
+        return result;
+    }
+
+} // namespace mildew
\ No newline at end of file
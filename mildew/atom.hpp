@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace mildew
+{
+    /// an interned identifier or property name, equal atoms always name the same string
+    enum class Atom : std::uint32_t {};
+
+    constexpr Atom kNoAtom = static_cast<Atom>(0xFFFFFFFF);
+
+    // names the runtime looks up itself, interned in this order before anything else
+    constexpr Atom kAtomPrototype = static_cast<Atom>(0);
+    constexpr Atom kAtomConstructor = static_cast<Atom>(1);
+    constexpr Atom kAtomLength = static_cast<Atom>(2);
+
+    struct AtomTableStats
+    {
+        size_t size = 0;
+        size_t lookups = 0; // calls to Intern and Find on the calling thread
+        size_t hits = 0; // lookups of a string that was already interned
+    };
+
+    /**
+     * The process wide table of interned names. The lexer interns identifiers and the compiler interns
+     * the names in each ConstTable, so environments, shapes, and inline caches compare and hash 32-bit
+     * atoms instead of strings. Atoms are never removed, which keeps them valid for code shared between
+     * interpreters. All functions are safe to call from any thread. Find and Name take no lock, since
+     * scripts look up names computed at run time, so only adding an atom is serialized.
+     */
+    class AtomTable
+    {
+    public:
+        /// the atom for str, adding it if needed
+        static Atom Intern(const std::string& str);
+        /// the atom for str or kNoAtom if it was never interned, in which case no shape can contain it
+        static Atom Find(const std::string& str);
+        static const std::string& Name(Atom atom);
+        static AtomTableStats stats();
+    };
+
+} // namespace mildew
\ No newline at end of file
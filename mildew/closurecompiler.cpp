@@ -0,0 +1,1808 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "closurecompiler.hpp"
+
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+
+#include "errors.hpp"
+#include "types/array.hpp"
+#include "types/object.hpp"
+#include "types/string.hpp"
+#include "util/sfmt.hpp"
+#include "vm/inlinecache.hpp"
+#include "vm/operations.hpp"
+#include "vm/switchtable.hpp"
+#include "vm/virtualmachine.hpp"
+
+namespace mildew
+{
+    using BinaryFunction = ScriptAny (*)(const ScriptAny&, const ScriptAny&);
+
+    /// the native function of every ScriptFunction created from closure compiled code
+    struct ClosureInvoker
+    {
+        std::shared_ptr<const ClosureCode> code;
+        std::vector<std::shared_ptr<Upvalue>> upvalues;
+        std::shared_ptr<Environment> env;
+        ClosureRuntime* runtime;
+
+        ScriptAny operator()(Environment&, ScriptAny& this_value, const std::vector<ScriptAny>& args,
+            NativeFunctionError&) const
+        {
+            return runtime->Invoke(*code, upvalues, env, this_value, args.data(), args.size());
+        }
+    };
+
+    /// a field name with the inline cache of the site that accesses it
+    struct FieldSite
+    {
+        Atom atom;
+        std::string name;
+        InlineCache cache;
+    };
+
+    static ScriptAny GetMember(const ScriptAny& object, FieldSite& site)
+    {
+        const auto kType = object.type();
+        if(kType == ScriptAny::Type::OBJECT || kType == ScriptAny::Type::FUNCTION)
+            return site.cache.Get(ToObject(object), site.atom);
+        return GetField(object, site.name);
+    }
+
+    static void SetMember(const ScriptAny& object, FieldSite& site, const ScriptAny& value)
+    {
+        const auto kType = object.type();
+        if(kType == ScriptAny::Type::OBJECT || kType == ScriptAny::Type::FUNCTION)
+            site.cache.Set(ToObject(object), site.atom, value);
+        else
+            SetField(object, site.name, value);
+    }
+
+    static FieldSite MakeFieldSite(const std::string_view name)
+    {
+        return {AtomTable::Intern(std::string(name)), std::string(name), InlineCache()};
+    }
+
+    static void NewCells(ClosureFrame& frame, const std::vector<std::uint32_t>& cells)
+    {
+        for(const auto kCell : cells)
+            frame.cells[kCell] = std::make_shared<Upvalue>();
+    }
+
+    /// replaces cells with fresh ones holding the same values
+    static void CopyCells(ClosureFrame& frame, const std::vector<std::uint32_t>& cells)
+    {
+        for(const auto kCell : cells)
+            frame.cells[kCell] = std::make_shared<Upvalue>(*frame.cells[kCell]);
+    }
+
+    static ClosureStatement Sequence(std::vector<ClosureStatement> statements)
+    {
+        if(statements.size() == 1)
+            return std::move(statements[0]);
+        return [statements = std::move(statements)](ClosureFrame& f) {
+            for(const auto& statement : statements)
+            {
+                const auto kCompletion = statement(f);
+                if(kCompletion != Completion::NORMAL)
+                    return kCompletion;
+            }
+            return Completion::NORMAL;
+        };
+    }
+
+    /// opens a scope that has cells around its statement
+    static ClosureStatement WithCells(std::vector<std::uint32_t> cells, ClosureStatement statement)
+    {
+        if(cells.empty())
+            return statement;
+        return [cells = std::move(cells), statement = std::move(statement)](ClosureFrame& f) {
+            NewCells(f, cells);
+            return statement(f);
+        };
+    }
+
+    enum class LoopAction { NEXT, EXIT, PASS };
+
+    /// what a loop does when its body did not complete normally
+    static LoopAction LoopCompletion(ClosureFrame& frame, const Completion completion, const std::string& label)
+    {
+        if(completion == Completion::RETURN || (frame.label != nullptr && *frame.label != label))
+            return LoopAction::PASS;
+        frame.label = nullptr;
+        return completion == Completion::BREAK ? LoopAction::EXIT : LoopAction::NEXT;
+    }
+
+    // a node whose evaluation has no side effects and calls no function, so no collection can happen during it
+    static bool IsSimple(const ExpressionNode* node)
+    {
+        using Kind = ExpressionNode::Kind;
+        if(node == nullptr)
+            return true;
+        switch(node->kind)
+        {
+        case Kind::LITERAL:
+        case Kind::VAR_ACCESS:
+        case Kind::FUNCTION_LITERAL:
+        case Kind::LAMBDA:
+            return true;
+        case Kind::MEMBER_ACCESS:
+            return IsSimple(static_cast<const MemberAccessNode*>(node)->object_node);
+        case Kind::ARRAY_INDEX: {
+            const auto* ainode = static_cast<const ArrayIndexNode*>(node);
+            return IsSimple(ainode->object_node) && IsSimple(ainode->index_node);
+        }
+        case Kind::BINARY_OP: {
+            const auto* bonode = static_cast<const BinaryOpNode*>(node);
+            return !bonode->op_token.IsAssignmentOperator() && IsSimple(bonode->left_node)
+                && IsSimple(bonode->right_node);
+        }
+        case Kind::UNARY_OP: {
+            const auto* uonode = static_cast<const UnaryOpNode*>(node);
+            return uonode->op_token.type != Token::Type::INC && uonode->op_token.type != Token::Type::DEC
+                && IsSimple(uonode->operand_node);
+        }
+        case Kind::TERNIARY_OP: {
+            const auto* tonode = static_cast<const TerniaryOpNode*>(node);
+            return IsSimple(tonode->condition_node) && IsSimple(tonode->on_true_node)
+                && IsSimple(tonode->on_false_node);
+        }
+        default:
+            return false;
+        }
+    }
+
+    static const LiteralNode* AsConstant(const ExpressionNode& node)
+    {
+        if(node.kind != ExpressionNode::Kind::LITERAL)
+            return nullptr;
+        const auto& lnode = static_cast<const LiteralNode&>(node);
+        return lnode.literal_token.literal_flag == Token::LiteralFlag::TEMPLATE_STRING ? nullptr : &lnode;
+    }
+
+    static ScriptAny Add(const ScriptAny& a, const ScriptAny& b) { return a + b; }
+    static ScriptAny Subtract(const ScriptAny& a, const ScriptAny& b) { return a - b; }
+    static ScriptAny Multiply(const ScriptAny& a, const ScriptAny& b) { return a * b; }
+    static ScriptAny Divide(const ScriptAny& a, const ScriptAny& b) { return a / b; }
+    static ScriptAny Modulo(const ScriptAny& a, const ScriptAny& b) { return a % b; }
+    static ScriptAny Power(const ScriptAny& a, const ScriptAny& b) { return a.Pow(b); }
+    static ScriptAny BitAnd(const ScriptAny& a, const ScriptAny& b) { return a & b; }
+    static ScriptAny BitOr(const ScriptAny& a, const ScriptAny& b) { return a | b; }
+    static ScriptAny BitXor(const ScriptAny& a, const ScriptAny& b) { return a ^ b; }
+    static ScriptAny BitLeftShift(const ScriptAny& a, const ScriptAny& b) { return a << b; }
+    static ScriptAny BitRightShift(const ScriptAny& a, const ScriptAny& b) { return a >> b; }
+    static ScriptAny BitUnsignedRightShift(const ScriptAny& a, const ScriptAny& b) { return a.UnsignedRightShift(b); }
+    static ScriptAny Equals(const ScriptAny& a, const ScriptAny& b) { return ScriptAny(a == b); }
+    static ScriptAny NotEquals(const ScriptAny& a, const ScriptAny& b) { return ScriptAny(!(a == b)); }
+    static ScriptAny StrictEquals(const ScriptAny& a, const ScriptAny& b) { return ScriptAny(a.StrictEquals(b)); }
+    static ScriptAny StrictNotEquals(const ScriptAny& a, const ScriptAny& b) { return ScriptAny(!a.StrictEquals(b)); }
+    static ScriptAny LessThan(const ScriptAny& a, const ScriptAny& b) { return ScriptAny(a.IsLessThan(b)); }
+    static ScriptAny LessOrEqual(const ScriptAny& a, const ScriptAny& b) { return ScriptAny(a.IsLessOrEqual(b)); }
+    static ScriptAny GreaterThan(const ScriptAny& a, const ScriptAny& b) { return ScriptAny(b.IsLessThan(a)); }
+    static ScriptAny GreaterOrEqual(const ScriptAny& a, const ScriptAny& b) { return ScriptAny(b.IsLessOrEqual(a)); }
+
+    static ScriptAny InstanceOf(const ScriptAny& a, const ScriptAny& b)
+    {
+        return ScriptAny(ScriptFunction::IsInstanceOf(a.ToValue<ScriptObject>(), b.ToValue<ScriptFunction>()));
+    }
+
+    static BinaryFunction BinaryOperator(const Token& op_token)
+    {
+        if(op_token.IsKeyword("instanceof"))
+            return InstanceOf;
+        switch(op_token.type)
+        {
+        case Token::Type::PLUS: case Token::Type::PLUS_ASSIGN: return Add;
+        case Token::Type::DASH: case Token::Type::DASH_ASSIGN: return Subtract;
+        case Token::Type::STAR: case Token::Type::STAR_ASSIGN: return Multiply;
+        case Token::Type::FSLASH: case Token::Type::FSLASH_ASSIGN: return Divide;
+        case Token::Type::PERCENT: case Token::Type::PERCENT_ASSIGN: return Modulo;
+        case Token::Type::POW: case Token::Type::POW_ASSIGN: return Power;
+        case Token::Type::BIT_AND: case Token::Type::BAND_ASSIGN: return BitAnd;
+        case Token::Type::BIT_OR: case Token::Type::BOR_ASSIGN: return BitOr;
+        case Token::Type::BIT_XOR: case Token::Type::BXOR_ASSIGN: return BitXor;
+        case Token::Type::BIT_LSHIFT: case Token::Type::BLS_ASSIGN: return BitLeftShift;
+        case Token::Type::BIT_RSHIFT: case Token::Type::BRS_ASSIGN: return BitRightShift;
+        case Token::Type::BIT_URSHIFT: case Token::Type::BURS_ASSIGN: return BitUnsignedRightShift;
+        case Token::Type::EQUALS: return Equals;
+        case Token::Type::NEQUALS: return NotEquals;
+        case Token::Type::STRICT_EQUALS: return StrictEquals;
+        case Token::Type::STRICT_NEQUALS: return StrictNotEquals;
+        case Token::Type::LT: return LessThan;
+        case Token::Type::LE: return LessOrEqual;
+        case Token::Type::GT: return GreaterThan;
+        case Token::Type::GE: return GreaterOrEqual;
+        default:
+            throw ScriptCompileError(MakeString("Invalid binary operator ", op_token.Symbol(), " at ",
+                op_token.position));
+        }
+    }
+
+    /**
+     * The closures of a binary operator, with the operator a template argument so that it is inlined. An
+     * operand in a local slot or a constant is read in place, and otherwise the left operand is kept in a
+     * temporary slot while the right one runs unless the right one cannot reach a safepoint.
+     */
+    template<BinaryFunction kOp>
+    static ClosureExpression MakeBinary(ClosureExpression left, ClosureExpression right, const int left_slot,
+        const int right_slot, const ScriptAny* right_constant, const int temp)
+    {
+        if(left_slot >= 0 && right_constant != nullptr)
+        {
+            return [left_slot, kRight = *right_constant](ClosureFrame& f) {
+                return kOp(f.slots[left_slot], kRight);
+            };
+        }
+        if(left_slot >= 0 && right_slot >= 0)
+        {
+            return [left_slot, right_slot](ClosureFrame& f) {
+                return kOp(f.slots[left_slot], f.slots[right_slot]);
+            };
+        }
+        if(right_constant != nullptr)
+        {
+            return [left = std::move(left), kRight = *right_constant](ClosureFrame& f) {
+                return kOp(left(f), kRight);
+            };
+        }
+        if(temp < 0)
+        {
+            return [left = std::move(left), right = std::move(right)](ClosureFrame& f) {
+                const auto kLeft = left(f);
+                return kOp(kLeft, right(f));
+            };
+        }
+        return [left = std::move(left), right = std::move(right), temp](ClosureFrame& f) {
+            f.slots[temp] = left(f);
+            const auto kRight = right(f);
+            return kOp(f.slots[temp], kRight);
+        };
+    }
+
+    using BinaryMaker = ClosureExpression (*)(ClosureExpression, ClosureExpression, int, int, const ScriptAny*, int);
+
+    static BinaryMaker BinaryMakerFor(const BinaryFunction op)
+    {
+        static const std::pair<BinaryFunction, BinaryMaker> kMakers[] = {
+            {Add, MakeBinary<Add>}, {Subtract, MakeBinary<Subtract>}, {Multiply, MakeBinary<Multiply>},
+            {Divide, MakeBinary<Divide>}, {Modulo, MakeBinary<Modulo>}, {Power, MakeBinary<Power>},
+            {BitAnd, MakeBinary<BitAnd>}, {BitOr, MakeBinary<BitOr>}, {BitXor, MakeBinary<BitXor>},
+            {BitLeftShift, MakeBinary<BitLeftShift>}, {BitRightShift, MakeBinary<BitRightShift>},
+            {BitUnsignedRightShift, MakeBinary<BitUnsignedRightShift>}, {Equals, MakeBinary<Equals>},
+            {NotEquals, MakeBinary<NotEquals>}, {StrictEquals, MakeBinary<StrictEquals>},
+            {StrictNotEquals, MakeBinary<StrictNotEquals>}, {LessThan, MakeBinary<LessThan>},
+            {LessOrEqual, MakeBinary<LessOrEqual>}, {GreaterThan, MakeBinary<GreaterThan>},
+            {GreaterOrEqual, MakeBinary<GreaterOrEqual>}, {InstanceOf, MakeBinary<InstanceOf>}
+        };
+        for(const auto& [function, maker] : kMakers)
+        {
+            if(function == op)
+                return maker;
+        }
+        throw std::logic_error("Binary operator without closures");
+    }
+
+    ClosureRuntime::ClosureRuntime(const std::shared_ptr<Environment>& global_env, Heap& heap, VirtualMachine& vm)
+    : global_env_(global_env), heap_(heap), vm_(vm), stack_(kStackSize), cells_(kCellStackSize)
+    {
+        heap_.AddRoots(this, [this](Heap& h) { TraceRoots(h); });
+    }
+
+    ClosureRuntime::~ClosureRuntime()
+    {
+        heap_.RemoveRoots(this);
+    }
+
+    ScriptAny ClosureRuntime::Call(ScriptAny* callee, const size_t num_args, const bool is_new)
+    {
+        auto func = callee[0].ToValue<ScriptFunction>();
+        if(func == nullptr)
+            ThrowRuntimeError(MakeString(callee[0], " is not a function"));
+        auto& this_value = callee[1];
+        PrepareThis(heap_, func, this_value, is_new);
+        ScriptAny result;
+        if(func->type() == ScriptFunction::Type::SCRIPT_FUNCTION)
+        {
+            result = vm_.Call(func, this_value, std::vector<ScriptAny>(callee + 2, callee + 2 + num_args));
+        }
+        else if(auto invoker = func->native_function().target<ClosureInvoker>())
+        {
+            // compiled functions take their arguments straight from the slots of the caller
+            result = Invoke(*invoker->code, invoker->upvalues, invoker->env, this_value, callee + 2, num_args);
+        }
+        else
+        {
+            result = CallNative(func, *global_env_, this_value,
+                std::vector<ScriptAny>(callee + 2, callee + 2 + num_args));
+        }
+        if(is_new && !result.IsObject())
+            result = this_value;
+        return result;
+    }
+
+    ScriptAny ClosureRuntime::Invoke(const ClosureCode& code, const std::vector<std::shared_ptr<Upvalue>>& upvalues,
+        const std::shared_ptr<Environment>& env, const ScriptAny& this_value, const ScriptAny* args,
+        const size_t num_args)
+    {
+        if(depth_ >= kMaxCallDepth || top_ + code.num_slots > stack_.size()
+          || cell_top_ + code.num_cells > cells_.size())
+            ThrowRuntimeError("Maximum call stack size exceeded");
+        if(depth_ == 0)
+            error_where_.clear();
+        ClosureFrame frame{stack_.data() + top_, cells_.data() + cell_top_, &upvalues, &env, this};
+        frame.slots[0] = this_value;
+        frame.slots[1] = ScriptAny();
+        const auto kNumArgs = std::min(num_args, code.num_params);
+        for(size_t i = 0; i < kNumArgs; ++i)
+            frame.slots[2 + i] = args[i];
+        for(size_t i = 2 + kNumArgs; i < code.num_slots; ++i)
+            frame.slots[i] = ScriptAny();
+        // the cells left behind by a returned call may hold values the heap has already freed
+        for(size_t i = 0; i < code.num_cells; ++i)
+            frame.cells[i] = nullptr;
+
+        // the frame is popped however the call ends
+        struct PopFrame
+        {
+            ClosureRuntime& runtime;
+            size_t top;
+            size_t cell_top;
+
+            ~PopFrame()
+            {
+                runtime.top_ = top;
+                runtime.cell_top_ = cell_top;
+                --runtime.depth_;
+            }
+        } pop_frame{*this, top_, cell_top_};
+        top_ += code.num_slots;
+        cell_top_ += code.num_cells;
+        ++depth_;
+        Safepoint();
+        try
+        {
+            if(code.body(frame) == Completion::RETURN)
+                return frame.slots[1];
+            return ScriptAny();
+        }
+        catch(const ScriptRuntimeError& error)
+        {
+            if(error_where_.empty())
+                error_where_ = MakeString(" (", code.name, " line ", frame.line, ")");
+            if(depth_ > 1)
+                throw;
+            // report where the exception escaped once it leaves closure compiled code
+            auto where = std::move(error_where_);
+            error_where_.clear();
+            throw ScriptRuntimeError(error.what() + where, error.thrown_value());
+        }
+    }
+
+    ScriptFunction* ClosureRuntime::MakeFunction(const std::shared_ptr<const ClosureCode>& code,
+        const std::shared_ptr<ConstTable>& consts, const std::shared_ptr<Environment>& env,
+        std::vector<std::shared_ptr<Upvalue>> upvalues)
+    {
+        ClosureInvoker invoker{code, upvalues, env, this};
+        return ScriptFunction::Create(code->name, std::move(invoker), code->is_class, consts, env, std::move(upvalues));
+    }
+
+    ScriptAny ClosureRuntime::Run(ScriptFunction* program, const std::shared_ptr<Environment>& env)
+    {
+        Heap::Scope heap_scope(heap_);
+        const ClosureInvoker* invoker = nullptr;
+        if(program->type() == ScriptFunction::Type::NATIVE_FUNCTION)
+            invoker = program->native_function().target<ClosureInvoker>();
+        if(invoker == nullptr)
+            throw std::invalid_argument("ClosureRuntime can only run programs compiled by ClosureCompiler");
+        struct PopRun
+        {
+            std::vector<RunRoot>& runs;
+
+            ~PopRun() { runs.pop_back(); }
+        } pop_run{runs_};
+        runs_.push_back({program, env.get()});
+        return Invoke(*invoker->code, invoker->upvalues, env, ScriptAny(), nullptr, 0);
+    }
+
+    void ClosureRuntime::TraceRoots(Heap& heap)
+    {
+        heap.Mark(global_env_.get());
+        for(const auto& run : runs_)
+        {
+            heap.Mark(run.program);
+            heap.Mark(run.env);
+        }
+        for(size_t i = 0; i < top_; ++i)
+            heap.Mark(stack_[i]);
+        for(size_t i = 0; i < cell_top_; ++i)
+        {
+            if(cells_[i] != nullptr)
+                heap.Mark(cells_[i]->value);
+        }
+    }
+
+    ScriptFunction* ClosureCompiler::Compile(const BlockStatementNode& program, const std::string& name)
+    {
+        analyzer_.Analyze(program);
+        consts_ = std::make_shared<ConstTable>();
+        function_states_.clear();
+        function_states_.emplace_back();
+        current_line_ = program.line;
+        // the value of the last expression statement is the result of the program
+        const int kCompletion = AllocSlot();
+        state().completion_slot = kCompletion;
+        auto body = CompileStatements(program.statement_nodes);
+
+        auto code = std::make_shared<ClosureCode>();
+        code->name = name;
+        code->num_slots = state().max_slots;
+        code->num_cells = state().max_cells;
+        code->body = [body = std::move(body), kCompletion](ClosureFrame& f) {
+            if(body(f) != Completion::RETURN)
+                f.slots[1] = f.slots[kCompletion];
+            return Completion::RETURN;
+        };
+        function_states_.clear();
+        return runtime_.MakeFunction(code, consts_, runtime_.global_environment(), {});
+    }
+
+    ClosureExpression ClosureCompiler::VisitLiteralNode(const LiteralNode& lnode)
+    {
+        return [kValue = Constant(lnode.Value())](ClosureFrame&) { return kValue; };
+    }
+
+    ClosureExpression ClosureCompiler::VisitFunctionLiteralNode(const FunctionLiteralNode& flnode)
+    {
+        return MakeClosure(CompileFunction(&flnode, flnode.optional_name, flnode.arg_list, flnode.default_arguments,
+            flnode.statements, nullptr, flnode.is_class, flnode.is_generator), false);
+    }
+
+    ClosureExpression ClosureCompiler::VisitLambdaNode(const LambdaNode& lnode)
+    {
+        return MakeClosure(CompileFunction(&lnode, "<lambda>", lnode.argument_list, lnode.default_arguments,
+            lnode.statements, lnode.return_expression, false, false), true);
+    }
+
+    ClosureExpression ClosureCompiler::VisitTemplateStringNode(const TemplateStringNode& tsnode)
+    {
+        if(tsnode.nodes.size() == 0)
+            return [kEmpty = Constant(ScriptAny(std::string()))](ClosureFrame&) { return kEmpty; };
+        const int kMark = state().next_slot;
+        const int kBase = state().next_slot;
+        std::vector<ClosureExpression> parts;
+        for(const auto& node : tsnode.nodes)
+        {
+            AllocSlot();
+            parts.emplace_back(CompileExpression(*node));
+        }
+        FreeSlots(kMark);
+        return [parts = std::move(parts), kBase](ClosureFrame& f) {
+            for(size_t i = 0; i < parts.size(); ++i)
+                f.slots[kBase + i] = parts[i](f);
+            return ScriptAny(ScriptString::Join(f.slots + kBase, parts.size()));
+        };
+    }
+
+    ClosureExpression ClosureCompiler::VisitArrayLiteralNode(const ArrayLiteralNode& alnode)
+    {
+        const int kMark = state().next_slot;
+        const int kArray = AllocSlot();
+        std::vector<ClosureExpression> values;
+        for(const auto& node : alnode.value_nodes)
+            values.emplace_back(CompileExpression(*node));
+        FreeSlots(kMark);
+        return [values = std::move(values), kArray](ClosureFrame& f) {
+            auto array = f.runtime->heap().Make<ScriptArray>(std::initializer_list<ScriptAny>());
+            f.slots[kArray] = array;
+            for(const auto& value : values)
+            {
+                const auto kValue = value(f);
+                array->array.Push(kValue);
+            }
+            return f.slots[kArray];
+        };
+    }
+
+    ClosureExpression ClosureCompiler::VisitObjectLiteralNode(const ObjectLiteralNode& olnode)
+    {
+        const int kMark = state().next_slot;
+        const int kObject = AllocSlot();
+        std::vector<std::pair<FieldSite, ClosureExpression>> fields;
+        for(size_t i = 0; i < olnode.keys.size(); ++i)
+            fields.emplace_back(MakeFieldSite(olnode.keys[i]), CompileExpression(*olnode.value_nodes[i]));
+        FreeSlots(kMark);
+        return [fields = std::move(fields), kObject](ClosureFrame& f) mutable {
+            f.slots[kObject] = f.runtime->heap().Make<ScriptObject>("Object", nullptr);
+            for(auto& [site, value] : fields)
+            {
+                const auto kValue = value(f);
+                SetMember(f.slots[kObject], site, kValue);
+            }
+            return f.slots[kObject];
+        };
+    }
+
+    ClosureExpression ClosureCompiler::VisitClassLiteralNode(const ClassLiteralNode& clnode)
+    {
+        return CompileClass(*clnode.class_definition);
+    }
+
+    ClosureExpression ClosureCompiler::VisitBinaryOpNode(const BinaryOpNode& bonode)
+    {
+        if(bonode.op_token.IsAssignmentOperator())
+            return CompileAssignment(bonode);
+
+        auto left = CompileExpression(*bonode.left_node);
+        // the left operand is kept in a slot the right one cannot use while it runs
+        int temp = -1;
+        if(!IsSimple(bonode.right_node))
+            temp = AllocSlot();
+        auto right = CompileExpression(*bonode.right_node);
+        if(temp >= 0)
+            FreeSlots(temp);
+        switch(bonode.op_token.type)
+        {
+        case Token::Type::AND:
+            return [left = std::move(left), right = std::move(right)](ClosureFrame& f) {
+                auto value = left(f);
+                return value.ToValue<bool>() ? right(f) : value;
+            };
+        case Token::Type::OR:
+            return [left = std::move(left), right = std::move(right)](ClosureFrame& f) {
+                auto value = left(f);
+                return value.ToValue<bool>() ? value : right(f);
+            };
+        case Token::Type::NULLC:
+            return [left = std::move(left), right = std::move(right)](ClosureFrame& f) {
+                auto value = left(f);
+                const auto kType = value.type();
+                return kType == ScriptAny::Type::UNDEFINED || kType == ScriptAny::Type::NULL_ ? right(f) : value;
+            };
+        default:
+            break;
+        }
+
+        const auto kMaker = BinaryMakerFor(BinaryOperator(bonode.op_token));
+        const auto* constant = AsConstant(*bonode.right_node);
+        const auto kRightConstant = constant ? Constant(constant->Value()) : ScriptAny();
+        return kMaker(std::move(left), std::move(right), LocalSlot(*bonode.left_node), LocalSlot(*bonode.right_node),
+            constant ? &kRightConstant : nullptr, temp);
+    }
+
+    ClosureExpression ClosureCompiler::VisitUnaryOpNode(const UnaryOpNode& uonode)
+    {
+        if(uonode.op_token.type == Token::Type::INC || uonode.op_token.type == Token::Type::DEC)
+            return CompileIncDec(uonode);
+
+        auto operand = CompileExpression(*uonode.operand_node);
+        if(uonode.op_token.IsKeyword("typeof"))
+        {
+            return [operand = std::move(operand)](ClosureFrame& f) {
+                return ScriptAny(std::string(operand(f).TypeOf()));
+            };
+        }
+        switch(uonode.op_token.type)
+        {
+        case Token::Type::NOT:
+            return [operand = std::move(operand)](ClosureFrame& f) { return ScriptAny(!operand(f).ToValue<bool>()); };
+        case Token::Type::DASH:
+            return [operand = std::move(operand)](ClosureFrame& f) { return -operand(f); };
+        case Token::Type::PLUS:
+            return [operand = std::move(operand)](ClosureFrame& f) { return operand(f).ToNumber(); };
+        case Token::Type::BIT_NOT:
+            return [operand = std::move(operand)](ClosureFrame& f) { return ~operand(f); };
+        default:
+            throw ScriptCompileError(MakeString("Invalid unary operator ", uonode.op_token.Symbol(), " at ",
+                uonode.op_token.position));
+        }
+    }
+
+    ClosureExpression ClosureCompiler::VisitTerniaryOpNode(const TerniaryOpNode& tonode)
+    {
+        return [condition = CompileExpression(*tonode.condition_node),
+            on_true = CompileExpression(*tonode.on_true_node),
+            on_false = CompileExpression(*tonode.on_false_node)](ClosureFrame& f) {
+            return condition(f).ToValue<bool>() ? on_true(f) : on_false(f);
+        };
+    }
+
+    ClosureExpression ClosureCompiler::VisitVarAccessNode(const VarAccessNode& vanode)
+    {
+        if(vanode.var_token.text == "this")
+            return [](ClosureFrame& f) { return f.slots[0]; };
+        return LoadVariable(vanode.var_token);
+    }
+
+    ClosureExpression ClosureCompiler::VisitFunctionCallNode(const FunctionCallNode& fcnode)
+    {
+        const int kMark = state().next_slot;
+        // the callee, this, and arguments are in consecutive slots
+        const int kFunc = AllocSlot();
+        const int kThis = AllocSlot();
+        const auto& callee = *fcnode.function_to_call;
+        const bool kIsNew = fcnode.return_this;
+        std::vector<ClosureExpression> args;
+        const auto compile_args = [&]() {
+            for(const auto& arg : fcnode.argument_nodes)
+            {
+                AllocSlot();
+                args.emplace_back(CompileExpression(*arg));
+            }
+        };
+
+        if(callee.kind == ExpressionNode::Kind::MEMBER_ACCESS)
+        {
+            // a method call passes the object as this
+            const auto& manode = static_cast<const MemberAccessNode&>(callee);
+            const auto* member = static_cast<const VarAccessNode*>(manode.member_node);
+            const bool kSuper = manode.object_node->kind == ExpressionNode::Kind::SUPER;
+            auto object = CompileExpression(*manode.object_node);
+            compile_args();
+            FreeSlots(kMark);
+            return [object = std::move(object), site = MakeFieldSite(member->var_token.text), args = std::move(args),
+                kFunc, kSuper, kIsNew](ClosureFrame& f) mutable {
+                f.slots[kFunc + 1] = object(f);
+                f.slots[kFunc] = GetMember(f.slots[kFunc + 1], site);
+                // super.method() calls the base class method with the current this
+                if(kSuper)
+                    f.slots[kFunc + 1] = f.slots[0];
+                for(size_t i = 0; i < args.size(); ++i)
+                    f.slots[kFunc + 2 + i] = args[i](f);
+                return f.runtime->Call(f.slots + kFunc, args.size(), kIsNew);
+            };
+        }
+
+        // everything else sets up the callee and this before the arguments
+        std::function<void(ClosureFrame&)> prepare;
+        if(callee.kind == ExpressionNode::Kind::ARRAY_INDEX)
+        {
+            const auto& ainode = static_cast<const ArrayIndexNode&>(callee);
+            prepare = [object = CompileExpression(*ainode.object_node), index = CompileExpression(*ainode.index_node),
+                kFunc, kThis](ClosureFrame& f) {
+                f.slots[kThis] = object(f);
+                f.slots[kFunc] = index(f);
+                f.slots[kFunc] = GetIndex(f.slots[kThis], f.slots[kFunc]);
+            };
+        }
+        else if(callee.kind == ExpressionNode::Kind::SUPER)
+        {
+            // super() runs the base class constructor on the object under construction
+            const auto& snode = static_cast<const SuperNode&>(callee);
+            prepare = [base = CompileExpression(*snode.base_class), kFunc, kThis](ClosureFrame& f) {
+                f.slots[kFunc] = base(f);
+                f.slots[kThis] = f.slots[0];
+            };
+        }
+        else
+        {
+            auto function = CompileExpression(callee);
+            compile_args();
+            FreeSlots(kMark);
+            return [function = std::move(function), args = std::move(args), kFunc, kIsNew](ClosureFrame& f) {
+                f.slots[kFunc] = function(f);
+                f.slots[kFunc + 1] = ScriptAny();
+                for(size_t i = 0; i < args.size(); ++i)
+                    f.slots[kFunc + 2 + i] = args[i](f);
+                return f.runtime->Call(f.slots + kFunc, args.size(), kIsNew);
+            };
+        }
+        compile_args();
+        FreeSlots(kMark);
+        return [prepare = std::move(prepare), args = std::move(args), kFunc, kIsNew](ClosureFrame& f) {
+            prepare(f);
+            for(size_t i = 0; i < args.size(); ++i)
+                f.slots[kFunc + 2 + i] = args[i](f);
+            return f.runtime->Call(f.slots + kFunc, args.size(), kIsNew);
+        };
+    }
+
+    ClosureExpression ClosureCompiler::VisitArrayIndexNode(const ArrayIndexNode& ainode)
+    {
+        const auto* literal = AsConstant(*ainode.index_node);
+        if(literal && literal->literal_token.type == Token::Type::STRING)
+        {
+            return [object = CompileExpression(*ainode.object_node),
+                site = MakeFieldSite(literal->literal_token.text)](ClosureFrame& f) mutable {
+                return GetMember(object(f), site);
+            };
+        }
+        const int kObject = LocalSlot(*ainode.object_node);
+        const int kIndex = LocalSlot(*ainode.index_node);
+        if(kObject >= 0 && kIndex >= 0)
+            return [kObject, kIndex](ClosureFrame& f) { return GetIndex(f.slots[kObject], f.slots[kIndex]); };
+        auto object = CompileExpression(*ainode.object_node);
+        if(IsSimple(ainode.index_node))
+        {
+            return [object = std::move(object), index = CompileExpression(*ainode.index_node)](ClosureFrame& f) {
+                const auto kObjectValue = object(f);
+                return GetIndex(kObjectValue, index(f));
+            };
+        }
+        const int kTemp = AllocSlot();
+        auto index = CompileExpression(*ainode.index_node);
+        FreeSlots(kTemp);
+        return [object = std::move(object), index = std::move(index), kTemp](ClosureFrame& f) {
+            f.slots[kTemp] = object(f);
+            const auto kIndexValue = index(f);
+            return GetIndex(f.slots[kTemp], kIndexValue);
+        };
+    }
+
+    ClosureExpression ClosureCompiler::VisitMemberAccessNode(const MemberAccessNode& manode)
+    {
+        if(manode.member_node->kind != ExpressionNode::Kind::VAR_ACCESS)
+            throw ScriptCompileError(MakeString("Invalid member access ", manode.to_string(), " at ",
+                manode.dot_token.position));
+        auto site = MakeFieldSite(static_cast<const VarAccessNode*>(manode.member_node)->var_token.text);
+        const int kObject = LocalSlot(*manode.object_node);
+        if(kObject >= 0)
+        {
+            return [kObject, site = std::move(site)](ClosureFrame& f) mutable {
+                return GetMember(f.slots[kObject], site);
+            };
+        }
+        return [object = CompileExpression(*manode.object_node), site = std::move(site)](ClosureFrame& f) mutable {
+            return GetMember(object(f), site);
+        };
+    }
+
+    ClosureExpression ClosureCompiler::VisitNewExpressionNode(const NewExpressionNode& nenode)
+    {
+        return CompileExpression(*nenode.function_call_node);
+    }
+
+    ClosureExpression ClosureCompiler::VisitSuperNode(const SuperNode& snode)
+    {
+        // outside of a call super refers to the prototype of the base class
+        return [base = CompileExpression(*snode.base_class),
+            site = MakeFieldSite("prototype")](ClosureFrame& f) mutable {
+            return GetMember(base(f), site);
+        };
+    }
+
+    ClosureExpression ClosureCompiler::VisitYieldNode(const YieldNode&)
+    {
+        throw UnimplementedError("generators");
+    }
+
+    ClosureStatement ClosureCompiler::VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode)
+    {
+        const auto& qualifier = vdsnode.qualifier_token.text;
+        std::vector<ClosureExpression> declarations;
+        for(const auto& node : vdsnode.assignment_nodes)
+        {
+            if(node->kind == ExpressionNode::Kind::BINARY_OP)
+            {
+                const auto* bonode = static_cast<const BinaryOpNode*>(node);
+                const auto* vanode = static_cast<const VarAccessNode*>(bonode->left_node);
+                declarations.emplace_back(DeclareVariable(qualifier, vanode->var_token.text,
+                    CompileExpression(*bonode->right_node)));
+            }
+            else
+            {
+                if(qualifier == "const")
+                    throw ScriptCompileError(MakeString("Const declarations require a value at ",
+                        vdsnode.qualifier_token.position));
+                const auto& name = static_cast<const VarAccessNode*>(node)->var_token.text;
+                declarations.emplace_back(DeclareVariable(qualifier, name, [](ClosureFrame&) { return ScriptAny(); }));
+            }
+        }
+        return [declarations = std::move(declarations), kLine = current_line_](ClosureFrame& f) {
+            f.line = kLine;
+            for(const auto& declaration : declarations)
+                declaration(f);
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitBlockStatementNode(const BlockStatementNode& bsnode)
+    {
+        auto cells = EnterScope(&bsnode);
+        auto body = CompileStatements(bsnode.statement_nodes);
+        LeaveScope();
+        return WithCells(std::move(cells), std::move(body));
+    }
+
+    ClosureStatement ClosureCompiler::VisitIfStatementNode(const IfStatementNode& isnode)
+    {
+        auto condition = CompileExpression(*isnode.condition_node);
+        auto on_true = CompileStatement(*isnode.on_true_statement);
+        ClosureStatement on_false;
+        if(isnode.on_false_statement)
+            on_false = CompileStatement(*isnode.on_false_statement);
+        return [condition = std::move(condition), on_true = std::move(on_true), on_false = std::move(on_false),
+            kLine = current_line_](ClosureFrame& f) {
+            f.line = kLine;
+            if(condition(f).ToValue<bool>())
+                return on_true(f);
+            return on_false ? on_false(f) : Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitSwitchStatementNode(const SwitchStatementNode& ssnode)
+    {
+        auto cells = EnterScope(&ssnode);
+        auto value = CompileExpression(*ssnode.expression_node);
+        std::vector<SwitchTable::Case> cases;
+        for(const auto& jump : ssnode.jump_table)
+        {
+            cases.push_back({static_cast<std::uint32_t>(consts_->AddValue(jump.value)),
+                static_cast<std::uint32_t>(jump.statement_index)});
+        }
+        const auto kDefault = std::min(ssnode.default_statement_id, ssnode.statement_nodes.size());
+        SwitchTable table(*consts_, cases, static_cast<std::uint32_t>(kDefault));
+
+        state().jump_targets.push_back({"", false});
+        std::vector<ClosureStatement> statements;
+        for(const auto& stmt : ssnode.statement_nodes)
+            statements.emplace_back(CompileStatement(*stmt));
+        state().jump_targets.pop_back();
+        LeaveScope();
+        return [cells = std::move(cells), value = std::move(value), table = std::move(table),
+            statements = std::move(statements), kLine = current_line_](ClosureFrame& f) {
+            NewCells(f, cells);
+            f.line = kLine;
+            for(size_t i = table.Find(value(f)); i < statements.size(); ++i)
+            {
+                const auto kCompletion = statements[i](f);
+                if(kCompletion == Completion::NORMAL)
+                    continue;
+                if(kCompletion == Completion::BREAK && f.label == nullptr)
+                    break;
+                return kCompletion;
+            }
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitWhileStatementNode(const WhileStatementNode& wsnode)
+    {
+        auto condition = CompileExpression(*wsnode.condition_node);
+        state().jump_targets.push_back({wsnode.label, true});
+        auto body = CompileStatement(*wsnode.body_node);
+        state().jump_targets.pop_back();
+        return [condition = std::move(condition), body = std::move(body), label = std::string(wsnode.label),
+            kLine = current_line_](ClosureFrame& f) {
+            for(;;)
+            {
+                f.line = kLine;
+                if(!condition(f).ToValue<bool>())
+                    break;
+                const auto kCompletion = body(f);
+                if(kCompletion != Completion::NORMAL)
+                {
+                    const auto kAction = LoopCompletion(f, kCompletion, label);
+                    if(kAction == LoopAction::PASS)
+                        return kCompletion;
+                    if(kAction == LoopAction::EXIT)
+                        break;
+                }
+                f.runtime->Safepoint();
+            }
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode)
+    {
+        state().jump_targets.push_back({dwsnode.label, true});
+        auto body = CompileStatement(*dwsnode.body_node);
+        state().jump_targets.pop_back();
+        auto condition = CompileExpression(*dwsnode.condition_node);
+        return [condition = std::move(condition), body = std::move(body), label = std::string(dwsnode.label),
+            kLine = current_line_](ClosureFrame& f) {
+            for(;;)
+            {
+                const auto kCompletion = body(f);
+                if(kCompletion != Completion::NORMAL)
+                {
+                    const auto kAction = LoopCompletion(f, kCompletion, label);
+                    if(kAction == LoopAction::PASS)
+                        return kCompletion;
+                    if(kAction == LoopAction::EXIT)
+                        break;
+                }
+                f.line = kLine;
+                if(!condition(f).ToValue<bool>())
+                    break;
+                f.runtime->Safepoint();
+            }
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitForStatementNode(const ForStatementNode& fsnode)
+    {
+        auto cells = EnterScope(&fsnode);
+        ClosureStatement init;
+        if(fsnode.init_statement)
+            init = CompileStatement(*fsnode.init_statement);
+        ClosureExpression condition;
+        if(fsnode.condition_node)
+        {
+            const auto* literal = AsConstant(*fsnode.condition_node);
+            if(!(literal && literal->literal_token.IsKeyword("true")))
+                condition = CompileExpression(*fsnode.condition_node);
+        }
+        state().jump_targets.push_back({fsnode.label, true});
+        auto body = CompileStatement(*fsnode.body_node);
+        state().jump_targets.pop_back();
+        ClosureExpression increment;
+        if(fsnode.increment_node)
+            increment = CompileExpression(*fsnode.increment_node);
+        LeaveScope();
+        return [cells = std::move(cells), init = std::move(init), condition = std::move(condition),
+            body = std::move(body), increment = std::move(increment), label = std::string(fsnode.label),
+            kLine = current_line_](ClosureFrame& f) {
+            NewCells(f, cells);
+            if(init)
+                init(f);
+            for(;;)
+            {
+                f.line = kLine;
+                if(condition && !condition(f).ToValue<bool>())
+                    break;
+                const auto kCompletion = body(f);
+                if(kCompletion != Completion::NORMAL)
+                {
+                    const auto kAction = LoopCompletion(f, kCompletion, label);
+                    if(kAction == LoopAction::PASS)
+                        return kCompletion;
+                    if(kAction == LoopAction::EXIT)
+                        break;
+                }
+                // each iteration gets fresh cells holding the current values, so closures created in it keep theirs
+                CopyCells(f, cells);
+                if(increment)
+                    increment(f);
+                f.runtime->Safepoint();
+            }
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitForOfStatementNode(const ForOfStatementNode& fosnode)
+    {
+        const int kMark = state().next_slot;
+        auto object = CompileExpression(*fosnode.object_to_iterate);
+        // iteration state, then key and value
+        const int kIter = AllocSlot();
+        for(int i = 0; i < 4; ++i)
+            AllocSlot();
+        const bool kKeysOnly = fosnode.of_in_token.IsKeyword("in") && fosnode.var_access_nodes.size() == 1;
+
+        // each iteration gets a fresh scope so closures capture the current values
+        auto cells = EnterScope(&fosnode);
+        state().jump_targets.push_back({fosnode.label, true});
+        const auto& qualifier = fosnode.qualifier_token.text;
+        const auto read_slot = [](const int slot) {
+            return [slot](ClosureFrame& f) { return f.slots[slot]; };
+        };
+        std::vector<ClosureExpression> declarations;
+        if(fosnode.var_access_nodes.size() == 1)
+        {
+            declarations.emplace_back(DeclareVariable(qualifier, fosnode.var_access_nodes[0]->var_token.text,
+                read_slot(kKeysOnly ? kIter + 3 : kIter + 4)));
+        }
+        else
+        {
+            declarations.emplace_back(DeclareVariable(qualifier, fosnode.var_access_nodes[0]->var_token.text,
+                read_slot(kIter + 3)));
+            declarations.emplace_back(DeclareVariable(qualifier, fosnode.var_access_nodes[1]->var_token.text,
+                read_slot(kIter + 4)));
+        }
+        auto body = CompileStatement(*fosnode.body_node);
+        state().jump_targets.pop_back();
+        LeaveScope();
+        FreeSlots(kMark);
+        return [object = std::move(object), cells = std::move(cells), declarations = std::move(declarations),
+            body = std::move(body), label = std::string(fosnode.label), kIter,
+            kLine = current_line_](ClosureFrame& f) {
+            f.line = kLine;
+            f.slots[kIter] = object(f);
+            PrepareIteration(f.runtime->heap(), f.slots + kIter, f.slots[kIter]);
+            while(NextIteration(f.slots + kIter))
+            {
+                NewCells(f, cells);
+                for(const auto& declaration : declarations)
+                    declaration(f);
+                const auto kCompletion = body(f);
+                if(kCompletion != Completion::NORMAL)
+                {
+                    const auto kAction = LoopCompletion(f, kCompletion, label);
+                    if(kAction == LoopAction::PASS)
+                        return kCompletion;
+                    if(kAction == LoopAction::EXIT)
+                        break;
+                }
+                f.runtime->Safepoint();
+            }
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode& bocsnode)
+    {
+        const bool kIsBreak = bocsnode.break_or_continue.IsKeyword("break");
+        const auto& targets = state().jump_targets;
+        const bool kFound = std::any_of(targets.begin(), targets.end(), [&](const JumpTarget& target) {
+            return bocsnode.label != "" ? target.label == bocsnode.label : (kIsBreak || target.is_loop);
+        });
+        if(!kFound)
+            throw ScriptCompileError(MakeString("Invalid ", bocsnode.break_or_continue.text, " statement at line ",
+                bocsnode.line));
+        const auto kCompletion = kIsBreak ? Completion::BREAK : Completion::CONTINUE;
+        if(bocsnode.label == "")
+        {
+            return [kCompletion](ClosureFrame& f) {
+                f.label = nullptr;
+                return kCompletion;
+            };
+        }
+        return [kCompletion, label = std::string(bocsnode.label)](ClosureFrame& f) {
+            f.label = &label;
+            return kCompletion;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitReturnStatementNode(const ReturnStatementNode& rsnode)
+    {
+        if(rsnode.expression_node == nullptr)
+        {
+            return [](ClosureFrame& f) {
+                f.slots[1] = ScriptAny();
+                return Completion::RETURN;
+            };
+        }
+        return [value = CompileExpression(*rsnode.expression_node), kLine = current_line_](ClosureFrame& f) {
+            f.line = kLine;
+            f.slots[1] = value(f);
+            return Completion::RETURN;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitFunctionDeclarationStatementNode(
+        const FunctionDeclarationStatementNode& fdsnode)
+    {
+        auto func = MakeClosure(CompileFunction(&fdsnode, fdsnode.name, fdsnode.argument_names,
+            fdsnode.default_arguments, fdsnode.statement_nodes, nullptr, false, fdsnode.is_generator), false);
+        return [declaration = DeclareVariable("let", fdsnode.name, std::move(func)),
+            kLine = current_line_](ClosureFrame& f) {
+            f.line = kLine;
+            declaration(f);
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitThrowStatementNode(const ThrowStatementNode& tsnode)
+    {
+        return [value = CompileExpression(*tsnode.expression_node), kLine = current_line_](ClosureFrame& f)
+            -> Completion {
+            f.line = kLine;
+            const auto kValue = value(f);
+            throw ScriptRuntimeError(MakeString("Uncaught exception: ", kValue), kValue);
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode)
+    {
+        // the exception stays in a slot while a finally block runs, since nothing else keeps it alive
+        const int kMark = state().next_slot;
+        const int kException = AllocSlot();
+        auto try_block = CompileStatement(*tbsnode.try_block_node);
+        ClosureStatement finally_block;
+        if(tbsnode.finally_block_node)
+            finally_block = CompileStatement(*tbsnode.finally_block_node);
+        ClosureStatement catch_block;
+        if(tbsnode.catch_block_node)
+        {
+            auto cells = EnterScope(&tbsnode);
+            std::vector<ClosureStatement> statements;
+            if(tbsnode.exception_name != "")
+            {
+                statements.emplace_back([declaration = DeclareVariable("let", tbsnode.exception_name,
+                    [kException](ClosureFrame& f) { return f.slots[kException]; })](ClosureFrame& f) {
+                    declaration(f);
+                    return Completion::NORMAL;
+                });
+            }
+            statements.emplace_back(CompileStatement(*tbsnode.catch_block_node));
+            LeaveScope();
+            catch_block = WithCells(std::move(cells), Sequence(std::move(statements)));
+        }
+        FreeSlots(kMark);
+
+        return [try_block = std::move(try_block), catch_block = std::move(catch_block),
+            finally_block = std::move(finally_block), kException](ClosureFrame& f) {
+            auto completion = Completion::NORMAL;
+            try
+            {
+                completion = try_block(f);
+            }
+            catch(const ScriptRuntimeError& error)
+            {
+                f.slots[kException] = error.thrown_value();
+                if(!catch_block)
+                {
+                    const auto kFinally = finally_block(f);
+                    if(kFinally != Completion::NORMAL)
+                        return kFinally;
+                    throw;
+                }
+                f.runtime->ClearErrorLocation();
+                if(!finally_block)
+                    return catch_block(f);
+                try
+                {
+                    completion = catch_block(f);
+                }
+                catch(const ScriptRuntimeError& catch_error)
+                {
+                    // an exception thrown by the catch block still runs the finally block
+                    f.slots[kException] = catch_error.thrown_value();
+                    const auto kFinally = finally_block(f);
+                    if(kFinally != Completion::NORMAL)
+                        return kFinally;
+                    throw;
+                }
+            }
+            if(finally_block)
+            {
+                const auto kFinally = finally_block(f);
+                if(kFinally != Completion::NORMAL)
+                    return kFinally;
+            }
+            return completion;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitDeleteStatementNode(const DeleteStatementNode& dsnode)
+    {
+        const int kTemp = AllocSlot();
+        ClosureExpression object;
+        ClosureExpression key;
+        if(dsnode.access_node->kind == ExpressionNode::Kind::MEMBER_ACCESS)
+        {
+            const auto* manode = static_cast<const MemberAccessNode*>(dsnode.access_node);
+            const auto* member = static_cast<const VarAccessNode*>(manode->member_node);
+            object = CompileExpression(*manode->object_node);
+            key = VisitLiteralNode(LiteralNode(Token::CreateFakeToken(Token::Type::STRING, member->var_token.text)));
+        }
+        else if(dsnode.access_node->kind == ExpressionNode::Kind::ARRAY_INDEX)
+        {
+            const auto* ainode = static_cast<const ArrayIndexNode*>(dsnode.access_node);
+            object = CompileExpression(*ainode->object_node);
+            key = CompileExpression(*ainode->index_node);
+        }
+        else
+        {
+            throw ScriptCompileError(MakeString("Invalid operand for delete at ", dsnode.delete_token.position));
+        }
+        FreeSlots(kTemp);
+        return [object = std::move(object), key = std::move(key), kTemp, kLine = current_line_](ClosureFrame& f) {
+            f.line = kLine;
+            f.slots[kTemp] = object(f);
+            DeleteField(f.slots[kTemp], key(f));
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode)
+    {
+        return [declaration = DeclareVariable("let", cdsnode.class_definition->class_name,
+            CompileClass(*cdsnode.class_definition)), kLine = current_line_](ClosureFrame& f) {
+            f.line = kLine;
+            declaration(f);
+            return Completion::NORMAL;
+        };
+    }
+
+    ClosureStatement ClosureCompiler::VisitExpressionStatementNode(const ExpressionStatementNode& esnode)
+    {
+        if(esnode.expression_node == nullptr)
+            return [](ClosureFrame&) { return Completion::NORMAL; };
+        auto expression = CompileExpression(*esnode.expression_node);
+        if(state().completion_slot >= 0)
+        {
+            return [expression = std::move(expression), kSlot = state().completion_slot,
+                kLine = current_line_](ClosureFrame& f) {
+                f.line = kLine;
+                f.slots[kSlot] = expression(f);
+                return Completion::NORMAL;
+            };
+        }
+        return [expression = std::move(expression), kLine = current_line_](ClosureFrame& f) {
+            f.line = kLine;
+            expression(f);
+            return Completion::NORMAL;
+        };
+    }
+
+    int ClosureCompiler::AllocSlot()
+    {
+        auto& fstate = state();
+        const int kSlot = fstate.next_slot++;
+        fstate.max_slots = std::max(fstate.max_slots, fstate.next_slot);
+        return kSlot;
+    }
+
+    ClosureExpression ClosureCompiler::CompileAssignment(const BinaryOpNode& bonode)
+    {
+        const bool kCompound = bonode.op_token.type != Token::Type::ASSIGN;
+        const BinaryFunction kOp = kCompound ? BinaryOperator(bonode.op_token) : nullptr;
+        // the slots holding the target are reserved before the right side is compiled so it cannot reuse them
+        const int kMark = state().next_slot;
+        ClosureExpression result;
+        if(bonode.left_node->kind == ExpressionNode::Kind::VAR_ACCESS)
+        {
+            const auto& name_token = static_cast<const VarAccessNode*>(bonode.left_node)->var_token;
+            if(!kCompound)
+                return StoreVariable(name_token, CompileExpression(*bonode.right_node));
+            const int kSlot = LocalSlot(*bonode.left_node);
+            const auto* constant = AsConstant(*bonode.right_node);
+            if(kSlot >= 0 && constant != nullptr)
+            {
+                // the common i += 1, which reads and writes the variable in place
+                if(Resolve(name_token.text).is_const)
+                    throw ScriptCompileError(MakeString("Cannot reassign const ", name_token.text, " at ",
+                        name_token.position));
+                return [kSlot, kOp, kRight = Constant(constant->Value())](ClosureFrame& f) {
+                    return f.slots[kSlot] = kOp(f.slots[kSlot], kRight);
+                };
+            }
+            auto load = LoadVariable(name_token);
+            if(IsSimple(bonode.right_node))
+            {
+                result = StoreVariable(name_token, [load = std::move(load),
+                    right = CompileExpression(*bonode.right_node), kOp](ClosureFrame& f) {
+                    const auto kLeft = load(f);
+                    return kOp(kLeft, right(f));
+                });
+            }
+            else
+            {
+                const int kTemp = AllocSlot();
+                result = StoreVariable(name_token, [load = std::move(load),
+                    right = CompileExpression(*bonode.right_node), kOp, kTemp](ClosureFrame& f) {
+                    f.slots[kTemp] = load(f);
+                    const auto kRight = right(f);
+                    return kOp(f.slots[kTemp], kRight);
+                });
+            }
+        }
+        else if(bonode.left_node->kind == ExpressionNode::Kind::MEMBER_ACCESS)
+        {
+            const auto* manode = static_cast<const MemberAccessNode*>(bonode.left_node);
+            const auto* member = static_cast<const VarAccessNode*>(manode->member_node);
+            const int kObject = AllocSlot();
+            AllocSlot();
+            auto object = CompileExpression(*manode->object_node);
+            result = [object = std::move(object), right = CompileExpression(*bonode.right_node), kOp, kObject,
+                site = MakeFieldSite(member->var_token.text)](ClosureFrame& f) mutable {
+                f.slots[kObject] = object(f);
+                ScriptAny value;
+                if(kOp != nullptr)
+                {
+                    f.slots[kObject + 1] = GetMember(f.slots[kObject], site);
+                    const auto kRight = right(f);
+                    value = kOp(f.slots[kObject + 1], kRight);
+                }
+                else
+                {
+                    value = right(f);
+                }
+                SetMember(f.slots[kObject], site, value);
+                return value;
+            };
+        }
+        else if(bonode.left_node->kind == ExpressionNode::Kind::ARRAY_INDEX)
+        {
+            const auto* ainode = static_cast<const ArrayIndexNode*>(bonode.left_node);
+            const int kObject = AllocSlot();
+            AllocSlot();
+            AllocSlot();
+            auto object = CompileExpression(*ainode->object_node);
+            auto index = CompileExpression(*ainode->index_node);
+            result = [object = std::move(object), index = std::move(index),
+                right = CompileExpression(*bonode.right_node), kOp, kObject](ClosureFrame& f) {
+                f.slots[kObject] = object(f);
+                f.slots[kObject + 1] = index(f);
+                ScriptAny value;
+                if(kOp != nullptr)
+                {
+                    f.slots[kObject + 2] = GetIndex(f.slots[kObject], f.slots[kObject + 1]);
+                    const auto kRight = right(f);
+                    value = kOp(f.slots[kObject + 2], kRight);
+                }
+                else
+                {
+                    value = right(f);
+                }
+                SetIndex(f.slots[kObject], f.slots[kObject + 1], value);
+                return value;
+            };
+        }
+        else
+        {
+            throw ScriptCompileError(MakeString("Invalid assignment target ", bonode.left_node->to_string(),
+                " at ", bonode.op_token.position));
+        }
+        FreeSlots(kMark);
+        return result;
+    }
+
+    ClosureExpression ClosureCompiler::CompileClass(const ClassDefinition& cdef)
+    {
+        if(cdef.get_methods.size() || cdef.set_methods.size())
+            throw UnimplementedError("class getters and setters");
+        const auto& ctor = *cdef.constructor;
+        const int kClass = AllocSlot();
+        auto constructor = MakeClosure(CompileFunction(cdef.constructor, cdef.class_name, ctor.arg_list,
+            ctor.default_arguments, ctor.statements, nullptr, true, false), false);
+        ClosureExpression base;
+        if(cdef.base_class)
+            base = CompileExpression(*cdef.base_class);
+        std::vector<std::pair<FieldSite, ClosureExpression>> methods;
+        for(size_t i = 0; i < cdef.methods.size(); ++i)
+            methods.emplace_back(MakeFieldSite(cdef.method_names[i]), CompileExpression(*cdef.methods[i]));
+        std::vector<std::pair<FieldSite, ClosureExpression>> static_methods;
+        for(size_t i = 0; i < cdef.static_methods.size(); ++i)
+        {
+            static_methods.emplace_back(MakeFieldSite(cdef.static_method_names[i]),
+                CompileExpression(*cdef.static_methods[i]));
+        }
+        FreeSlots(kClass);
+        return [constructor = std::move(constructor), base = std::move(base), methods = std::move(methods),
+            static_methods = std::move(static_methods), kClass](ClosureFrame& f) mutable {
+            f.slots[kClass] = constructor(f);
+            if(base)
+            {
+                const auto kBaseValue = base(f);
+                auto ctor_func = f.slots[kClass].ToValue<ScriptFunction>();
+                auto base_func = kBaseValue.ToValue<ScriptFunction>();
+                if(base_func == nullptr)
+                    ThrowRuntimeError(MakeString("Class extends value ", kBaseValue, " is not a class"));
+                ctor_func->LookupField(kAtomPrototype).ToValue<ScriptObject>()->prototype(
+                    base_func->LookupField(kAtomPrototype).ToValue<ScriptObject>());
+                // static methods are inherited through the constructor's own prototype
+                ctor_func->prototype(base_func);
+            }
+            const auto kPrototype = f.slots[kClass].ToValue<ScriptObject>()->LookupField(kAtomPrototype);
+            for(auto& [site, method] : methods)
+                SetMember(kPrototype, site, method(f));
+            for(auto& [site, method] : static_methods)
+                SetMember(f.slots[kClass], site, method(f));
+            return f.slots[kClass];
+        };
+    }
+
+    std::shared_ptr<const ClosureCode> ClosureCompiler::CompileFunction(const void* owner, const std::string_view name,
+        const ArenaList<std::string_view>& args, const ArenaList<ExpressionNode*>& default_args,
+        const ArenaList<StatementNode*>& statements, const ExpressionNode* return_expression, bool is_class,
+        bool is_generator)
+    {
+        if(is_generator)
+            throw UnimplementedError("generators");
+        const auto kSavedLine = current_line_;
+        function_states_.emplace_back();
+        // arguments arrive in the slots after this and the return value
+        for(size_t i = 0; i < args.size(); ++i)
+            AllocSlot();
+        std::vector<ClosureStatement> statements_out;
+        auto cells = EnterScope(owner, &args);
+        const auto kFirstDefault = args.size() - default_args.size();
+        for(size_t i = 0; i < args.size(); ++i)
+        {
+            const int kSlot = static_cast<int>(2 + i);
+            if(i >= kFirstDefault)
+            {
+                statements_out.emplace_back([kSlot, value = CompileExpression(*default_args[i - kFirstDefault])](
+                    ClosureFrame& f) {
+                    if(f.slots[kSlot].type() == ScriptAny::Type::UNDEFINED)
+                        f.slots[kSlot] = value(f);
+                    return Completion::NORMAL;
+                });
+            }
+            // a captured parameter is copied into its cell before later defaults can refer to it
+            const auto kLocation = ResolveIn(0, args[i]);
+            if(kLocation.kind == Location::Kind::CELL)
+            {
+                statements_out.emplace_back([kSlot, kCell = kLocation.index](ClosureFrame& f) {
+                    f.cells[kCell]->value = f.slots[kSlot];
+                    return Completion::NORMAL;
+                });
+            }
+        }
+
+        if(return_expression)
+        {
+            statements_out.emplace_back([value = CompileExpression(*return_expression)](ClosureFrame& f) {
+                f.slots[1] = value(f);
+                return Completion::RETURN;
+            });
+        }
+        else
+        {
+            statements_out.emplace_back(CompileStatements(statements));
+        }
+
+        auto code = std::make_shared<ClosureCode>();
+        code->name = name.empty() ? "<anonymous function>" : std::string(name);
+        code->num_params = args.size();
+        code->num_slots = state().max_slots;
+        code->num_cells = state().max_cells;
+        code->is_class = is_class;
+        code->captures = std::move(state().captures);
+        code->body = WithCells(std::move(cells), Sequence(std::move(statements_out)));
+        function_states_.pop_back();
+        current_line_ = kSavedLine;
+        return code;
+    }
+
+    ClosureExpression ClosureCompiler::CompileIncDec(const UnaryOpNode& uonode)
+    {
+        const auto kOp = uonode.op_token.type == Token::Type::INC ? Add : Subtract;
+        const ScriptAny kOne(static_cast<std::int64_t>(1));
+        const bool kPostfix = uonode.is_postfix;
+        // for postfix the old value converted to a number is the result
+        const auto update = [kOp, kOne, kPostfix](const ScriptAny& old_value, ScriptAny& new_value) {
+            if(!kPostfix)
+                return new_value = kOp(old_value, kOne);
+            const auto kOld = old_value.ToNumber();
+            new_value = kOp(kOld, kOne);
+            return kOld;
+        };
+
+        const int kMark = state().next_slot;
+        ClosureExpression result;
+        if(uonode.operand_node->kind == ExpressionNode::Kind::VAR_ACCESS)
+        {
+            const auto& name_token = static_cast<const VarAccessNode*>(uonode.operand_node)->var_token;
+            const int kSlot = LocalSlot(*uonode.operand_node);
+            if(kSlot >= 0)
+            {
+                if(Resolve(name_token.text).is_const)
+                    throw ScriptCompileError(MakeString("Cannot reassign const ", name_token.text, " at ",
+                        name_token.position));
+                return [kSlot, update](ClosureFrame& f) {
+                    const auto kOld = f.slots[kSlot];
+                    return update(kOld, f.slots[kSlot]);
+                };
+            }
+            const int kResult = AllocSlot();
+            auto store = StoreVariable(name_token, [kResult](ClosureFrame& f) { return f.slots[kResult]; });
+            result = [load = LoadVariable(name_token), store = std::move(store), update, kResult](ClosureFrame& f) {
+                const auto kValue = update(load(f), f.slots[kResult]);
+                store(f);
+                return kValue;
+            };
+        }
+        else if(uonode.operand_node->kind == ExpressionNode::Kind::MEMBER_ACCESS)
+        {
+            const auto* manode = static_cast<const MemberAccessNode*>(uonode.operand_node);
+            const auto* member = static_cast<const VarAccessNode*>(manode->member_node);
+            const int kObject = AllocSlot();
+            AllocSlot();
+            result = [object = CompileExpression(*manode->object_node), site = MakeFieldSite(member->var_token.text),
+                update, kObject](ClosureFrame& f) mutable {
+                f.slots[kObject] = object(f);
+                const auto kValue = update(GetMember(f.slots[kObject], site), f.slots[kObject + 1]);
+                SetMember(f.slots[kObject], site, f.slots[kObject + 1]);
+                return kValue;
+            };
+        }
+        else if(uonode.operand_node->kind == ExpressionNode::Kind::ARRAY_INDEX)
+        {
+            const auto* ainode = static_cast<const ArrayIndexNode*>(uonode.operand_node);
+            const int kObject = AllocSlot();
+            AllocSlot();
+            AllocSlot();
+            result = [object = CompileExpression(*ainode->object_node), index = CompileExpression(*ainode->index_node),
+                update, kObject](ClosureFrame& f) {
+                f.slots[kObject] = object(f);
+                f.slots[kObject + 1] = index(f);
+                const auto kValue = update(GetIndex(f.slots[kObject], f.slots[kObject + 1]), f.slots[kObject + 2]);
+                SetIndex(f.slots[kObject], f.slots[kObject + 1], f.slots[kObject + 2]);
+                return kValue;
+            };
+        }
+        else
+        {
+            throw ScriptCompileError(MakeString("Invalid operand for ", uonode.op_token.Symbol(), " at ",
+                uonode.op_token.position));
+        }
+        FreeSlots(kMark);
+        return result;
+    }
+
+    ClosureStatement ClosureCompiler::CompileStatement(const StatementNode& node)
+    {
+        const auto kSavedLine = current_line_;
+        if(node.line != 0)
+            current_line_ = node.line;
+        auto statement = VisitStatement(node);
+        current_line_ = kSavedLine;
+        return statement;
+    }
+
+    ClosureStatement ClosureCompiler::CompileStatements(const ArenaList<StatementNode*>& statements)
+    {
+        // function declarations are hoisted to the top of their block
+        std::vector<ClosureStatement> compiled;
+        for(const auto& stmt : statements)
+        {
+            if(stmt->kind == StatementNode::Kind::FUNCTION_DECLARATION)
+                compiled.emplace_back(CompileStatement(*stmt));
+        }
+        for(const auto& stmt : statements)
+        {
+            if(stmt->kind != StatementNode::Kind::FUNCTION_DECLARATION)
+                compiled.emplace_back(CompileStatement(*stmt));
+        }
+        if(compiled.empty())
+            return [](ClosureFrame&) { return Completion::NORMAL; };
+        return Sequence(std::move(compiled));
+    }
+
+    ScriptAny ClosureCompiler::Constant(const ScriptAny& value)
+    {
+        return consts_->Get(consts_->AddValue(value));
+    }
+
+    ClosureExpression ClosureCompiler::DeclareVariable(const std::string_view qualifier, const std::string_view name,
+        ClosureExpression value)
+    {
+        if(name.size() > 0 && (name[0] == '{' || name[0] == '['))
+            throw UnimplementedError("destructuring declarations");
+        const bool kLexical = qualifier == "let" || qualifier == "const";
+        const auto& scopes = state().scopes;
+        // var belongs to the function scope and let or const to the innermost scope, outside of any function
+        // or tracked scope the variable is global
+        Location location{Location::Kind::GLOBAL, 0, 0, false};
+        if(!kLexical && !scopes.empty() && scopes[0].is_function)
+            location = ResolveIn(0, name);
+        else if(kLexical && !scopes.empty())
+            location = ResolveIn(scopes.size() - 1, name);
+        if(location.kind != Location::Kind::GLOBAL)
+            return StoreLocation(location, name, std::move(value));
+
+        const auto kAtom = AtomTable::Intern(std::string(name));
+        if(!kLexical)
+        {
+            return [value = std::move(value), kAtom, var_name = std::string(name)](ClosureFrame& f) {
+                auto declared = value(f);
+                auto& env = **f.env;
+                if(!env.DeclareVariable(kAtom, declared, false))
+                {
+                    bool failed_const = false;
+                    env.ReassignVariable(kAtom, declared, failed_const);
+                    if(failed_const)
+                        ThrowRuntimeError(MakeString("Cannot redeclare const ", var_name));
+                }
+                return declared;
+            };
+        }
+        return [value = std::move(value), kAtom, var_name = std::string(name),
+            kIsConst = qualifier == "const"](ClosureFrame& f) {
+            auto declared = value(f);
+            if(!(*f.env)->DeclareVariable(kAtom, declared, kIsConst))
+                ThrowRuntimeError(MakeString("Cannot redeclare variable ", var_name));
+            return declared;
+        };
+    }
+
+    std::vector<std::uint32_t> ClosureCompiler::EnterScope(const void* owner,
+        const ArenaList<std::string_view>* args)
+    {
+        auto& fstate = state();
+        LocalScope scope{{}, fstate.next_slot, fstate.next_cell, args != nullptr};
+        std::vector<std::uint32_t> new_cells;
+        if(auto info = analyzer_.Find(owner))
+        {
+            for(const auto& variable : info->variables)
+            {
+                Local local{variable.name, -1, 0, next_local_id_++, variable.is_const};
+                if(variable.is_captured)
+                {
+                    local.cell = static_cast<std::uint32_t>(fstate.next_cell++);
+                    fstate.max_cells = std::max(fstate.max_cells, fstate.next_cell);
+                    new_cells.emplace_back(local.cell);
+                }
+                else if(args != nullptr)
+                {
+                    // the last of several parameters with the same name wins
+                    for(size_t i = args->size(); i > 0 && local.slot < 0; --i)
+                    {
+                        if((*args)[i - 1] == variable.name)
+                            local.slot = static_cast<int>(i + 1);
+                    }
+                }
+                if(!variable.is_captured && local.slot < 0)
+                    local.slot = AllocSlot();
+                scope.locals.emplace_back(std::move(local));
+            }
+        }
+        fstate.scopes.emplace_back(std::move(scope));
+        // every entry gets fresh cells so closures created in a loop body each see their own variables
+        return new_cells;
+    }
+
+    void ClosureCompiler::FreeSlots(int mark)
+    {
+        state().next_slot = mark;
+    }
+
+    void ClosureCompiler::LeaveScope()
+    {
+        auto& fstate = state();
+        const auto kSlotMark = fstate.scopes.back().slot_mark;
+        fstate.next_cell = fstate.scopes.back().cell_mark;
+        fstate.scopes.pop_back();
+        FreeSlots(kSlotMark);
+    }
+
+    ClosureExpression ClosureCompiler::LoadVariable(const Token& name_token)
+    {
+        const auto kLocation = Resolve(name_token.text);
+        const auto kIndex = kLocation.index;
+        switch(kLocation.kind)
+        {
+        case Location::Kind::SLOT:
+            return [kIndex](ClosureFrame& f) { return f.slots[kIndex]; };
+        case Location::Kind::CELL:
+            return [kIndex](ClosureFrame& f) { return f.cells[kIndex]->value; };
+        case Location::Kind::UPVALUE:
+            return [kIndex](ClosureFrame& f) { return (*f.upvalues)[kIndex]->value; };
+        default:
+            break;
+        }
+        // identifiers were interned by the lexer
+        const auto kAtom = name_token.atom != kNoAtom ? name_token.atom
+            : AtomTable::Intern(std::string(name_token.text));
+        return [kAtom, name = std::string(name_token.text)](ClosureFrame& f) {
+            auto entry = (*f.env)->LookupVariable(kAtom);
+            if(entry == nullptr)
+                ThrowRuntimeError(MakeString("Undefined variable ", name));
+            return entry->value;
+        };
+    }
+
+    int ClosureCompiler::LocalSlot(const ExpressionNode& node)
+    {
+        if(node.kind != ExpressionNode::Kind::VAR_ACCESS)
+            return -1;
+        const auto& name = static_cast<const VarAccessNode&>(node).var_token.text;
+        if(name == "this")
+            return 0;
+        const auto kLocation = Resolve(name);
+        return kLocation.kind == Location::Kind::SLOT ? static_cast<int>(kLocation.index) : -1;
+    }
+
+    ClosureExpression ClosureCompiler::MakeClosure(std::shared_ptr<const ClosureCode> code, const bool bind_this)
+    {
+        return [code = std::move(code), consts = consts_, bind_this](ClosureFrame& f) {
+            std::vector<std::shared_ptr<Upvalue>> upvalues;
+            upvalues.reserve(code->captures.size());
+            for(const auto& capture : code->captures)
+                upvalues.emplace_back(capture.from_cell ? f.cells[capture.index] : (*f.upvalues)[capture.index]);
+            auto func = f.runtime->MakeFunction(code, consts, *f.env, std::move(upvalues));
+            if(bind_this)
+                func->Bind(f.slots[0]);
+            return ScriptAny(func);
+        };
+    }
+
+    ClosureCompiler::Location ClosureCompiler::Resolve(const std::string_view name)
+    {
+        return ResolveFrom(function_states_.size() - 1, name);
+    }
+
+    ClosureCompiler::Location ClosureCompiler::ResolveFrom(const size_t function_index, const std::string_view name)
+    {
+        auto& fstate = function_states_[function_index];
+        for(size_t i = fstate.scopes.size(); i > 0; --i)
+        {
+            for(const auto& local : fstate.scopes[i - 1].locals)
+            {
+                if(local.name != name)
+                    continue;
+                if(local.slot >= 0)
+                    return {Location::Kind::SLOT, static_cast<std::uint32_t>(local.slot), local.id, local.is_const};
+                return {Location::Kind::CELL, local.cell, local.id, local.is_const};
+            }
+        }
+        if(function_index == 0)
+            return {Location::Kind::GLOBAL, 0, 0, false};
+
+        const auto kOuter = ResolveFrom(function_index - 1, name);
+        if(kOuter.kind == Location::Kind::GLOBAL)
+            return kOuter;
+        // the scope analysis puts every variable used by a nested function in a cell
+        if(kOuter.kind == Location::Kind::SLOT)
+            throw ScriptCompileError(MakeString("Variable ", name, " was not captured at line ", current_line_));
+        for(size_t i = 0; i < fstate.capture_ids.size(); ++i)
+        {
+            if(fstate.capture_ids[i] == kOuter.id)
+                return {Location::Kind::UPVALUE, static_cast<std::uint32_t>(i), kOuter.id, kOuter.is_const};
+        }
+        fstate.captures.push_back({kOuter.kind == Location::Kind::CELL, kOuter.index});
+        fstate.capture_ids.push_back(kOuter.id);
+        return {Location::Kind::UPVALUE, static_cast<std::uint32_t>(fstate.captures.size() - 1), kOuter.id,
+            kOuter.is_const};
+    }
+
+    ClosureCompiler::Location ClosureCompiler::ResolveIn(const size_t scope_index, const std::string_view name) const
+    {
+        for(const auto& local : state().scopes[scope_index].locals)
+        {
+            if(local.name != name)
+                continue;
+            if(local.slot >= 0)
+                return {Location::Kind::SLOT, static_cast<std::uint32_t>(local.slot), local.id, local.is_const};
+            return {Location::Kind::CELL, local.cell, local.id, local.is_const};
+        }
+        return {Location::Kind::GLOBAL, 0, 0, false};
+    }
+
+    ClosureExpression ClosureCompiler::StoreLocation(const Location& location, const std::string_view name,
+        ClosureExpression value)
+    {
+        const auto kIndex = location.index;
+        switch(location.kind)
+        {
+        case Location::Kind::SLOT:
+            return [value = std::move(value), kIndex](ClosureFrame& f) { return f.slots[kIndex] = value(f); };
+        case Location::Kind::CELL:
+            return [value = std::move(value), kIndex](ClosureFrame& f) { return f.cells[kIndex]->value = value(f); };
+        case Location::Kind::UPVALUE:
+            return [value = std::move(value), kIndex](ClosureFrame& f) {
+                return (*f.upvalues)[kIndex]->value = value(f);
+            };
+        default:
+            throw std::logic_error(MakeString("Global variable ", name, " stored as a local"));
+        }
+    }
+
+    ClosureExpression ClosureCompiler::StoreVariable(const Token& name_token, ClosureExpression value)
+    {
+        const auto kLocation = Resolve(name_token.text);
+        if(kLocation.kind == Location::Kind::GLOBAL)
+        {
+            const auto kAtom = name_token.atom != kNoAtom ? name_token.atom
+                : AtomTable::Intern(std::string(name_token.text));
+            return [value = std::move(value), kAtom, name = std::string(name_token.text)](ClosureFrame& f) {
+                auto assigned = value(f);
+                bool failed_const = false;
+                if((*f.env)->ReassignVariable(kAtom, assigned, failed_const) == nullptr)
+                {
+                    if(failed_const)
+                        ThrowRuntimeError(MakeString("Cannot reassign const ", name));
+                    ThrowRuntimeError(MakeString("Cannot assign to undeclared variable ", name));
+                }
+                return assigned;
+            };
+        }
+        if(kLocation.is_const)
+            throw ScriptCompileError(MakeString("Cannot reassign const ", name_token.text, " at ",
+                name_token.position));
+        return StoreLocation(kLocation, name_token.text, std::move(value));
+    }
+
+} // namespace mildew
\ No newline at end of file
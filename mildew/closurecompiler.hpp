@@ -0,0 +1,281 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "environment.hpp"
+#include "heap.hpp"
+#include "nodes.hpp"
+#include "scopeanalyzer.hpp"
+#include "types/function.hpp"
+#include "visitors.hpp"
+#include "vm/consttable.hpp"
+
+namespace mildew
+{
+    class ClosureRuntime;
+    class VirtualMachine;
+
+    /// the state of one call of closure compiled code
+    struct ClosureFrame
+    {
+        ScriptAny* slots; // this, the return value, the parameters, then locals and temporaries
+        std::shared_ptr<Upvalue>* cells;
+        const std::vector<std::shared_ptr<Upvalue>>* upvalues;
+        const std::shared_ptr<Environment>* env; // where global names are looked up
+        ClosureRuntime* runtime;
+        const std::string* label = nullptr; // of the break or continue being passed up to its loop
+        size_t line = 0; // of the statement being run, for error messages
+    };
+
+    /// how a statement finished, anything but NORMAL is passed up to the loop, switch, or call that handles it
+    enum class Completion : std::uint8_t { NORMAL, BREAK, CONTINUE, RETURN };
+
+    using ClosureExpression = std::function<ScriptAny(ClosureFrame&)>;
+    using ClosureStatement = std::function<Completion(ClosureFrame&)>;
+
+    /// a function compiled by ClosureCompiler, shared by every closure created from its literal
+    struct ClosureCode
+    {
+        /// where a closure finds a captured variable when it is created
+        struct Capture
+        {
+            bool from_cell; // a cell of the creating frame, otherwise an upvalue of the creating closure
+            std::uint32_t index;
+        };
+
+        std::string name;
+        size_t num_params = 0;
+        size_t num_slots = 0;
+        size_t num_cells = 0;
+        bool is_class = false;
+        std::vector<Capture> captures;
+        ClosureStatement body;
+    };
+
+    /**
+     * Runs the code produced by ClosureCompiler. Like the registers of VirtualMachine, the slots of every
+     * active call live in one stack and the cells of their captured locals in another, both allocated up front
+     * and marked as roots of the heap, so the heap can be collected when a function is entered or a loop
+     * repeats. Compiled functions are native functions to the rest of the interpreter, and functions of
+     * other kinds are called through the virtual machine.
+     */
+    class ClosureRuntime
+    {
+    public:
+        static constexpr size_t kStackSize = 1 << 16;
+        static constexpr size_t kCellStackSize = 1 << 14;
+        /// lower than the limit of the virtual machine since every call nests C++ calls
+        static constexpr size_t kMaxCallDepth = 512;
+
+        ClosureRuntime(const std::shared_ptr<Environment>& global_env, Heap& heap, VirtualMachine& vm);
+        ClosureRuntime(const ClosureRuntime&) = delete;
+        ~ClosureRuntime();
+        ClosureRuntime& operator=(const ClosureRuntime&) = delete;
+
+        /// calls callee[0] with this in callee[1] and the arguments after it, all of which must be in slots
+        ScriptAny Call(ScriptAny* callee, size_t num_args, bool is_new);
+        /// runs code in a new frame
+        ScriptAny Invoke(const ClosureCode& code, const std::vector<std::shared_ptr<Upvalue>>& upvalues,
+            const std::shared_ptr<Environment>& env, const ScriptAny& this_value, const ScriptAny* args,
+            size_t num_args);
+        /// creates a function running code, which keeps the constants of its program alive
+        ScriptFunction* MakeFunction(const std::shared_ptr<const ClosureCode>& code,
+            const std::shared_ptr<ConstTable>& consts, const std::shared_ptr<Environment>& env,
+            std::vector<std::shared_ptr<Upvalue>> upvalues);
+        /// runs a program compiled by ClosureCompiler with env holding its global names
+        ScriptAny Run(ScriptFunction* program, const std::shared_ptr<Environment>& env);
+        /// every live value is in a slot or cell here, so the heap can be collected
+        void Safepoint()
+        {
+            if(heap_.collect_requested())
+                heap_.Collect();
+        }
+        /// forgets where the exception being handled was thrown once a script catches it
+        void ClearErrorLocation() { error_where_.clear(); }
+
+        const std::shared_ptr<Environment>& global_environment() const { return global_env_; }
+        Heap& heap() { return heap_; }
+    private:
+        // the programs being run, which nothing else may keep alive
+        struct RunRoot
+        {
+            ScriptFunction* program;
+            Environment* env;
+        };
+
+        void TraceRoots(Heap& heap);
+
+        std::shared_ptr<Environment> global_env_;
+        Heap& heap_;
+        VirtualMachine& vm_;
+        std::vector<ScriptAny> stack_;
+        std::vector<std::shared_ptr<Upvalue>> cells_;
+        size_t top_ = 0;
+        size_t cell_top_ = 0;
+        size_t depth_ = 0;
+        std::vector<RunRoot> runs_;
+        std::string error_where_; // the function and line an exception escaped from
+    };
+
+    /**
+     * Converts the tree produced by Parser::ParseProgram into a tree of pre-bound closures run by a
+     * ClosureRuntime, a second backend next to Compiler for running scripts without bytecode. Variables are
+     * resolved exactly as Compiler resolves them, with slots in place of registers, so each closure captures
+     * its children and the slot, cell, or atom of every variable it uses, and running a program is one call of
+     * its root closure with no dispatch on node kinds or token text. The program and every function created
+     * while it runs are native ScriptFunctions allocated from the current Heap. Constructs the backend does
+     * not handle throw UnimplementedError, after which the caller may compile the same tree with Compiler.
+     */
+    class ClosureCompiler : public ExpressionVisitor<ClosureCompiler, ClosureExpression>,
+        public StatementVisitor<ClosureCompiler, ClosureStatement>
+    {
+    public:
+        explicit ClosureCompiler(ClosureRuntime& runtime) : runtime_(runtime) {}
+        ClosureCompiler(const ClosureCompiler&) = delete;
+        ClosureCompiler& operator=(const ClosureCompiler&) = delete;
+
+        ScriptFunction* Compile(const BlockStatementNode& program, const std::string& name = "<program>");
+
+        ClosureExpression VisitLiteralNode(const LiteralNode& lnode);
+        ClosureExpression VisitFunctionLiteralNode(const FunctionLiteralNode& flnode);
+        ClosureExpression VisitLambdaNode(const LambdaNode& lnode);
+        ClosureExpression VisitTemplateStringNode(const TemplateStringNode& tsnode);
+        ClosureExpression VisitArrayLiteralNode(const ArrayLiteralNode& alnode);
+        ClosureExpression VisitObjectLiteralNode(const ObjectLiteralNode& olnode);
+        ClosureExpression VisitClassLiteralNode(const ClassLiteralNode& clnode);
+        ClosureExpression VisitBinaryOpNode(const BinaryOpNode& bonode);
+        ClosureExpression VisitUnaryOpNode(const UnaryOpNode& uonode);
+        ClosureExpression VisitTerniaryOpNode(const TerniaryOpNode& tonode);
+        ClosureExpression VisitVarAccessNode(const VarAccessNode& vanode);
+        ClosureExpression VisitFunctionCallNode(const FunctionCallNode& fcnode);
+        ClosureExpression VisitArrayIndexNode(const ArrayIndexNode& ainode);
+        ClosureExpression VisitMemberAccessNode(const MemberAccessNode& manode);
+        ClosureExpression VisitNewExpressionNode(const NewExpressionNode& nenode);
+        ClosureExpression VisitSuperNode(const SuperNode& snode);
+        ClosureExpression VisitYieldNode(const YieldNode& ynode);
+
+        ClosureStatement VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode);
+        ClosureStatement VisitBlockStatementNode(const BlockStatementNode& bsnode);
+        ClosureStatement VisitIfStatementNode(const IfStatementNode& isnode);
+        ClosureStatement VisitSwitchStatementNode(const SwitchStatementNode& ssnode);
+        ClosureStatement VisitWhileStatementNode(const WhileStatementNode& wsnode);
+        ClosureStatement VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode);
+        ClosureStatement VisitForStatementNode(const ForStatementNode& fsnode);
+        ClosureStatement VisitForOfStatementNode(const ForOfStatementNode& fosnode);
+        ClosureStatement VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode& bocsnode);
+        ClosureStatement VisitReturnStatementNode(const ReturnStatementNode& rsnode);
+        ClosureStatement VisitFunctionDeclarationStatementNode(const FunctionDeclarationStatementNode& fdsnode);
+        ClosureStatement VisitThrowStatementNode(const ThrowStatementNode& tsnode);
+        ClosureStatement VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode);
+        ClosureStatement VisitDeleteStatementNode(const DeleteStatementNode& dsnode);
+        ClosureStatement VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode);
+        ClosureStatement VisitExpressionStatementNode(const ExpressionStatementNode& esnode);
+
+    private:
+        struct Local
+        {
+            std::string name;
+            int slot; // -1 if the variable is captured and lives in a cell
+            std::uint32_t cell;
+            std::uint32_t id; // identifies the variable among the captures of nested functions
+            bool is_const;
+        };
+
+        struct LocalScope
+        {
+            std::vector<Local> locals;
+            int slot_mark;
+            int cell_mark;
+            bool is_function;
+        };
+
+        struct Location
+        {
+            enum class Kind { GLOBAL, SLOT, CELL, UPVALUE };
+            Kind kind;
+            std::uint32_t index; // slot, cell, or upvalue
+            std::uint32_t id;
+            bool is_const;
+        };
+
+        struct JumpTarget
+        {
+            std::string_view label;
+            bool is_loop;
+        };
+
+        struct FunctionState
+        {
+            int next_slot = 2;
+            int max_slots = 2;
+            int completion_slot = -1;
+            int next_cell = 0;
+            int max_cells = 0;
+            std::vector<ClosureCode::Capture> captures;
+            std::vector<std::uint32_t> capture_ids;
+            std::vector<JumpTarget> jump_targets;
+            std::vector<LocalScope> scopes;
+        };
+
+        int AllocSlot();
+        ClosureExpression CompileAssignment(const BinaryOpNode& bonode);
+        ClosureExpression CompileClass(const ClassDefinition& cdef);
+        ClosureExpression CompileExpression(const ExpressionNode& node) { return VisitExpression(node); }
+        std::shared_ptr<const ClosureCode> CompileFunction(const void* owner, std::string_view name,
+            const ArenaList<std::string_view>& args, const ArenaList<ExpressionNode*>& default_args,
+            const ArenaList<StatementNode*>& statements, const ExpressionNode* return_expression, bool is_class,
+            bool is_generator);
+        ClosureExpression CompileIncDec(const UnaryOpNode& uonode);
+        ClosureStatement CompileStatement(const StatementNode& node);
+        ClosureStatement CompileStatements(const ArenaList<StatementNode*>& statements);
+        /// the value of a literal, kept alive by the constant table of the program
+        ScriptAny Constant(const ScriptAny& value);
+        ClosureExpression DeclareVariable(std::string_view qualifier, std::string_view name,
+            ClosureExpression value);
+        /// opens the local scope of a node and returns the cells to create each time it is entered
+        std::vector<std::uint32_t> EnterScope(const void* owner, const ArenaList<std::string_view>* args = nullptr);
+        void FreeSlots(int mark);
+        void LeaveScope();
+        ClosureExpression LoadVariable(const Token& name_token);
+        /// the slot of a local variable or this, or -1 if the node is anything else
+        int LocalSlot(const ExpressionNode& node);
+        /// creates a closure of code capturing the variables of the running frame
+        ClosureExpression MakeClosure(std::shared_ptr<const ClosureCode> code, bool bind_this);
+        Location Resolve(std::string_view name);
+        Location ResolveFrom(size_t function_index, std::string_view name);
+        Location ResolveIn(size_t scope_index, std::string_view name) const;
+        ClosureExpression StoreLocation(const Location& location, std::string_view name, ClosureExpression value);
+        ClosureExpression StoreVariable(const Token& name_token, ClosureExpression value);
+
+        FunctionState& state() { return function_states_.back(); }
+        const FunctionState& state() const { return function_states_.back(); }
+
+        ClosureRuntime& runtime_;
+        ScopeAnalyzer analyzer_;
+        std::shared_ptr<ConstTable> consts_;
+        std::vector<FunctionState> function_states_;
+        std::uint32_t next_local_id_ = 0;
+        size_t current_line_ = 0;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,1324 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "compiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "errors.hpp"
+#include "util/sfmt.hpp"
+
+namespace mildew
+{
+    // number of array literal elements evaluated into registers before they are appended
+    static constexpr int kArrayAppendBatch = 32;
+
+    static OpCode BinaryOpCode(const Token& op_token)
+    {
+        if(op_token.IsKeyword("instanceof"))
+            return OpCode::INSTANCEOF;
+        switch(op_token.type)
+        {
+        case Token::Type::PLUS: case Token::Type::PLUS_ASSIGN: return OpCode::ADD;
+        case Token::Type::DASH: case Token::Type::DASH_ASSIGN: return OpCode::SUB;
+        case Token::Type::STAR: case Token::Type::STAR_ASSIGN: return OpCode::MUL;
+        case Token::Type::FSLASH: case Token::Type::FSLASH_ASSIGN: return OpCode::DIV;
+        case Token::Type::PERCENT: case Token::Type::PERCENT_ASSIGN: return OpCode::MOD;
+        case Token::Type::POW: case Token::Type::POW_ASSIGN: return OpCode::POW;
+        case Token::Type::BIT_AND: case Token::Type::BAND_ASSIGN: return OpCode::BIT_AND;
+        case Token::Type::BIT_OR: case Token::Type::BOR_ASSIGN: return OpCode::BIT_OR;
+        case Token::Type::BIT_XOR: case Token::Type::BXOR_ASSIGN: return OpCode::BIT_XOR;
+        case Token::Type::BIT_LSHIFT: case Token::Type::BLS_ASSIGN: return OpCode::BIT_LSHIFT;
+        case Token::Type::BIT_RSHIFT: case Token::Type::BRS_ASSIGN: return OpCode::BIT_RSHIFT;
+        case Token::Type::BIT_URSHIFT: case Token::Type::BURS_ASSIGN: return OpCode::BIT_URSHIFT;
+        case Token::Type::EQUALS: return OpCode::EQUALS;
+        case Token::Type::NEQUALS: return OpCode::NEQUALS;
+        case Token::Type::STRICT_EQUALS: return OpCode::STRICT_EQUALS;
+        case Token::Type::STRICT_NEQUALS: return OpCode::STRICT_NEQUALS;
+        case Token::Type::LT: return OpCode::LT;
+        case Token::Type::LE: return OpCode::LE;
+        case Token::Type::GT: return OpCode::GT;
+        case Token::Type::GE: return OpCode::GE;
+        default:
+            throw ScriptCompileError(MakeString("Invalid binary operator ", op_token.Symbol(), " at ",
+                op_token.position));
+        }
+    }
+
+    ScriptFunction* Compiler::Compile(const BlockStatementNode& program, const std::string& name)
+    {
+        analyzer_.Analyze(program);
+        function_states_.clear();
+        function_states_.emplace_back();
+        current_line_ = program.line;
+        // the value of the last expression statement is the result of the program
+        state().completion_register = AllocRegister();
+        Emit(EncodeABC(OpCode::LOAD_UNDEFINED, state().completion_register));
+        CompileStatements(program.statement_nodes);
+        Emit(EncodeABC(OpCode::RETURN, state().completion_register));
+
+        auto& fstate = state();
+        std::vector<std::uint8_t> bytecode(fstate.code.size() * sizeof(std::uint32_t));
+        std::memcpy(bytecode.data(), fstate.code.data(), bytecode.size());
+        auto result = ScriptFunction::Create(name, std::vector<std::string>(), bytecode, false, false,
+            fstate.const_table, fstate.max_registers, fstate.lines, fstate.num_inline_caches, fstate.max_cells, {},
+            fstate.switch_tables);
+        function_states_.clear();
+        return result;
+    }
+
+    void Compiler::VisitLiteralNode(const LiteralNode& lnode)
+    {
+        const int kDest = dest_register_;
+        auto value = lnode.Value();
+        switch(value.type())
+        {
+        case ScriptAny::Type::UNDEFINED:
+            Emit(EncodeABC(OpCode::LOAD_UNDEFINED, kDest));
+            break;
+        case ScriptAny::Type::NULL_:
+            Emit(EncodeABC(OpCode::LOAD_NULL, kDest));
+            break;
+        case ScriptAny::Type::BOOLEAN:
+            Emit(EncodeABC(OpCode::LOAD_BOOL, kDest, value.ToValue<bool>()));
+            break;
+        case ScriptAny::Type::INTEGER: {
+            const auto kInt = value.ToValue<std::int64_t>();
+            if(kInt >= -kSBxBias && kInt <= kSBxBias)
+            {
+                Emit(EncodeAsBx(OpCode::LOADI, kDest, static_cast<std::int32_t>(kInt)));
+                break;
+            }
+            Emit(EncodeABx(OpCode::LOADK, kDest, state().const_table->AddValue(value)));
+            break;
+        }
+        default:
+            Emit(EncodeABx(OpCode::LOADK, kDest, state().const_table->AddValue(value)));
+            break;
+        }
+    }
+
+    void Compiler::VisitFunctionLiteralNode(const FunctionLiteralNode& flnode)
+    {
+        const int kDest = dest_register_;
+        auto func = CompileFunction(&flnode, flnode.optional_name, flnode.arg_list, flnode.default_arguments,
+            flnode.statements, nullptr, flnode.is_class, flnode.is_generator);
+        Emit(EncodeABx(OpCode::CLOSURE, kDest, state().const_table->AddValue(ScriptAny(func))));
+    }
+
+    void Compiler::VisitLambdaNode(const LambdaNode& lnode)
+    {
+        const int kDest = dest_register_;
+        auto func = CompileFunction(&lnode, "<lambda>", lnode.argument_list, lnode.default_arguments, lnode.statements,
+            lnode.return_expression, false, false);
+        Emit(EncodeABx(OpCode::LAMBDA, kDest, state().const_table->AddValue(ScriptAny(func))));
+    }
+
+    void Compiler::VisitTemplateStringNode(const TemplateStringNode& tsnode)
+    {
+        const int kDest = dest_register_;
+        if(tsnode.nodes.size() == 0)
+        {
+            Emit(EncodeABx(OpCode::LOADK, kDest, StringConstant("")));
+            return;
+        }
+        const int kMark = state().next_register;
+        const int kBase = state().next_register;
+        for(const auto& node : tsnode.nodes)
+            CompileExpression(*node, AllocRegister());
+        Emit(EncodeABC(OpCode::CONCAT, kDest, kBase, tsnode.nodes.size()));
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitArrayLiteralNode(const ArrayLiteralNode& alnode)
+    {
+        const int kDest = dest_register_;
+        Emit(EncodeABC(OpCode::NEW_ARRAY, kDest));
+        for(size_t i = 0; i < alnode.value_nodes.size(); i += kArrayAppendBatch)
+        {
+            const int kMark = state().next_register;
+            const int kBase = state().next_register;
+            size_t count = 0;
+            for(size_t j = i; j < alnode.value_nodes.size() && count < kArrayAppendBatch; ++j, ++count)
+                CompileExpression(*alnode.value_nodes[j], AllocRegister());
+            Emit(EncodeABC(OpCode::ARRAY_APPEND, kDest, kBase, count));
+            FreeRegisters(kMark);
+        }
+    }
+
+    void Compiler::VisitObjectLiteralNode(const ObjectLiteralNode& olnode)
+    {
+        const int kDest = dest_register_;
+        Emit(EncodeABC(OpCode::NEW_OBJECT, kDest));
+        const int kMark = state().next_register;
+        const int kValue = AllocRegister();
+        for(size_t i = 0; i < olnode.keys.size(); ++i)
+        {
+            CompileExpression(*olnode.value_nodes[i], kValue);
+            Emit(EncodeABC(OpCode::SET_FIELD, kDest, kValue));
+            Emit(FieldOperand(StringConstant(olnode.keys[i])));
+        }
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitClassLiteralNode(const ClassLiteralNode& clnode)
+    {
+        ClassDefinitionToRegister(*clnode.class_definition, dest_register_);
+    }
+
+    void Compiler::VisitBinaryOpNode(const BinaryOpNode& bonode)
+    {
+        const int kDest = dest_register_;
+        if(bonode.op_token.IsAssignmentOperator())
+        {
+            CompileAssignment(bonode, kDest);
+            return;
+        }
+
+        switch(bonode.op_token.type)
+        {
+        case Token::Type::AND:
+        case Token::Type::OR:
+        case Token::Type::NULLC: {
+            CompileExpression(*bonode.left_node, kDest);
+            OpCode jump_op = OpCode::JMP_FALSE;
+            if(bonode.op_token.type == Token::Type::OR)
+                jump_op = OpCode::JMP_TRUE;
+            else if(bonode.op_token.type == Token::Type::NULLC)
+                jump_op = OpCode::JMP_NOT_NULLISH;
+            const auto kJump = EmitJump(jump_op, kDest);
+            CompileExpression(*bonode.right_node, kDest);
+            PatchJump(kJump);
+            return;
+        }
+        default:
+            break;
+        }
+
+        const auto kOp = BinaryOpCode(bonode.op_token);
+        const int kMark = state().next_register;
+        CompileExpression(*bonode.left_node, kDest);
+        const int kRight = AllocRegister();
+        CompileExpression(*bonode.right_node, kRight);
+        Emit(EncodeABC(kOp, kDest, kDest, kRight));
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitUnaryOpNode(const UnaryOpNode& uonode)
+    {
+        const int kDest = dest_register_;
+        if(uonode.op_token.type == Token::Type::INC || uonode.op_token.type == Token::Type::DEC)
+        {
+            CompileIncDec(uonode, kDest);
+            return;
+        }
+
+        OpCode op;
+        if(uonode.op_token.IsKeyword("typeof"))
+            op = OpCode::TYPEOF;
+        else
+        {
+            switch(uonode.op_token.type)
+            {
+            case Token::Type::NOT: op = OpCode::NOT; break;
+            case Token::Type::DASH: op = OpCode::NEGATE; break;
+            case Token::Type::PLUS: op = OpCode::TO_NUMBER; break;
+            case Token::Type::BIT_NOT: op = OpCode::BIT_NOT; break;
+            default:
+                throw ScriptCompileError(MakeString("Invalid unary operator ", uonode.op_token.Symbol(), " at ",
+                    uonode.op_token.position));
+            }
+        }
+        CompileExpression(*uonode.operand_node, kDest);
+        Emit(EncodeABC(op, kDest, kDest));
+    }
+
+    void Compiler::VisitTerniaryOpNode(const TerniaryOpNode& tonode)
+    {
+        const int kDest = dest_register_;
+        CompileExpression(*tonode.condition_node, kDest);
+        const auto kJumpFalse = EmitJump(OpCode::JMP_FALSE, kDest);
+        CompileExpression(*tonode.on_true_node, kDest);
+        const auto kJumpEnd = EmitJump(OpCode::JMP);
+        PatchJump(kJumpFalse);
+        CompileExpression(*tonode.on_false_node, kDest);
+        PatchJump(kJumpEnd);
+    }
+
+    void Compiler::VisitVarAccessNode(const VarAccessNode& vanode)
+    {
+        if(vanode.var_token.text == "this")
+        {
+            Emit(EncodeABC(OpCode::LOAD_THIS, dest_register_));
+            return;
+        }
+        LoadVariable(vanode.var_token, dest_register_);
+    }
+
+    void Compiler::VisitFunctionCallNode(const FunctionCallNode& fcnode)
+    {
+        const int kDest = dest_register_;
+        const int kMark = state().next_register;
+        // the callee, this, and arguments must be in consecutive registers
+        const int kFunc = (kDest + 1 == state().next_register) ? kDest : AllocRegister();
+        const int kThis = AllocRegister();
+        const auto& callee = *fcnode.function_to_call;
+        if(auto manode = dynamic_cast<const MemberAccessNode*>(&callee))
+        {
+            const auto* member = dynamic_cast<const VarAccessNode*>(manode->member_node);
+            if(dynamic_cast<const SuperNode*>(manode->object_node))
+            {
+                // super.method() calls the base class method with the current this
+                CompileExpression(*manode->object_node, kThis);
+                Emit(EncodeABC(OpCode::GET_FIELD, kFunc, kThis));
+                Emit(FieldOperand(StringConstant(member->var_token)));
+                Emit(EncodeABC(OpCode::LOAD_THIS, kThis));
+            }
+            else
+            {
+                CompileExpression(*manode->object_node, kThis);
+                Emit(EncodeABC(OpCode::GET_FIELD, kFunc, kThis));
+                Emit(FieldOperand(StringConstant(member->var_token)));
+            }
+        }
+        else if(auto ainode = dynamic_cast<const ArrayIndexNode*>(&callee))
+        {
+            CompileExpression(*ainode->object_node, kThis);
+            auto literal = dynamic_cast<const LiteralNode*>(ainode->index_node);
+            if(literal && literal->literal_token.type == Token::Type::STRING
+              && literal->literal_token.literal_flag != Token::LiteralFlag::TEMPLATE_STRING)
+            {
+                Emit(EncodeABC(OpCode::GET_FIELD, kFunc, kThis));
+                Emit(FieldOperand(StringConstant(literal->literal_token.text)));
+            }
+            else
+            {
+                CompileExpression(*ainode->index_node, kFunc);
+                Emit(EncodeABC(OpCode::GET_INDEX, kFunc, kThis, kFunc));
+            }
+        }
+        else if(auto snode = dynamic_cast<const SuperNode*>(&callee))
+        {
+            // super() runs the base class constructor on the object under construction
+            CompileExpression(*snode->base_class, kFunc);
+            Emit(EncodeABC(OpCode::LOAD_THIS, kThis));
+        }
+        else
+        {
+            CompileExpression(callee, kFunc);
+            Emit(EncodeABC(OpCode::LOAD_UNDEFINED, kThis));
+        }
+
+        if(fcnode.argument_nodes.size() >= kMaxRegisters - 2)
+            throw ScriptCompileError(MakeString("Too many arguments in function call at line ", current_line_));
+        for(const auto& arg : fcnode.argument_nodes)
+            CompileExpression(*arg, AllocRegister());
+        Emit(EncodeABC(fcnode.return_this ? OpCode::NEW : OpCode::CALL, kFunc, fcnode.argument_nodes.size()));
+        if(kFunc != kDest)
+            Emit(EncodeABC(OpCode::MOVE, kDest, kFunc));
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitArrayIndexNode(const ArrayIndexNode& ainode)
+    {
+        const int kDest = dest_register_;
+        const int kMark = state().next_register;
+        const int kObject = AllocRegister();
+        CompileExpression(*ainode.object_node, kObject);
+        auto literal = dynamic_cast<const LiteralNode*>(ainode.index_node);
+        if(literal && literal->literal_token.type == Token::Type::STRING
+          && literal->literal_token.literal_flag != Token::LiteralFlag::TEMPLATE_STRING)
+        {
+            Emit(EncodeABC(OpCode::GET_FIELD, kDest, kObject));
+            Emit(FieldOperand(StringConstant(literal->literal_token.text)));
+        }
+        else
+        {
+            const int kIndex = AllocRegister();
+            CompileExpression(*ainode.index_node, kIndex);
+            Emit(EncodeABC(OpCode::GET_INDEX, kDest, kObject, kIndex));
+        }
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitMemberAccessNode(const MemberAccessNode& manode)
+    {
+        const int kDest = dest_register_;
+        const auto* member = dynamic_cast<const VarAccessNode*>(manode.member_node);
+        if(member == nullptr)
+            throw ScriptCompileError(MakeString("Invalid member access ", manode.to_string(), " at ",
+                manode.dot_token.position));
+        CompileExpression(*manode.object_node, kDest);
+        Emit(EncodeABC(OpCode::GET_FIELD, kDest, kDest));
+        Emit(FieldOperand(StringConstant(member->var_token)));
+    }
+
+    void Compiler::VisitNewExpressionNode(const NewExpressionNode& nenode)
+    {
+        CompileExpression(*nenode.function_call_node, dest_register_);
+    }
+
+    void Compiler::VisitSuperNode(const SuperNode& snode)
+    {
+        // outside of a call super refers to the prototype of the base class
+        const int kDest = dest_register_;
+        CompileExpression(*snode.base_class, kDest);
+        Emit(EncodeABC(OpCode::GET_FIELD, kDest, kDest));
+        Emit(FieldOperand(StringConstant("prototype")));
+    }
+
+    void Compiler::VisitYieldNode(const YieldNode&)
+    {
+        throw UnimplementedError("generators");
+    }
+
+    void Compiler::VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode)
+    {
+        const int kMark = state().next_register;
+        const int kValue = AllocRegister();
+        const auto& qualifier = vdsnode.qualifier_token.text;
+        const bool kLexical = qualifier == "let" || qualifier == "const";
+        for(const auto& node : vdsnode.assignment_nodes)
+        {
+            const VarAccessNode* vanode = nullptr;
+            if(auto bonode = dynamic_cast<const BinaryOpNode*>(node))
+            {
+                vanode = dynamic_cast<const VarAccessNode*>(bonode->left_node);
+                // a let or const cannot be read by its own initializer so it can be computed in place
+                const auto kLocation = kLexical && !state().scopes.empty() ?
+                    ResolveIn(state().scopes.size() - 1, vanode->var_token.text) : Location{};
+                if(kLocation.kind == Location::Kind::REGISTER)
+                {
+                    CompileExpression(*bonode->right_node, kLocation.index);
+                    continue;
+                }
+                CompileExpression(*bonode->right_node, kValue);
+            }
+            else
+            {
+                vanode = dynamic_cast<const VarAccessNode*>(node);
+                if(qualifier == "const")
+                    throw ScriptCompileError(MakeString("Const declarations require a value at ",
+                        vdsnode.qualifier_token.position));
+                Emit(EncodeABC(OpCode::LOAD_UNDEFINED, kValue));
+            }
+            DeclareVariable(qualifier, vanode->var_token.text, kValue);
+        }
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitBlockStatementNode(const BlockStatementNode& bsnode)
+    {
+        EnterScope(&bsnode);
+        CompileStatements(bsnode.statement_nodes);
+        LeaveScope();
+    }
+
+    void Compiler::VisitIfStatementNode(const IfStatementNode& isnode)
+    {
+        const int kMark = state().next_register;
+        const int kCondition = AllocRegister();
+        CompileExpression(*isnode.condition_node, kCondition);
+        FreeRegisters(kMark);
+        const auto kJumpFalse = EmitJump(OpCode::JMP_FALSE, kCondition);
+        CompileStatement(*isnode.on_true_statement);
+        if(isnode.on_false_statement)
+        {
+            const auto kJumpEnd = EmitJump(OpCode::JMP);
+            PatchJump(kJumpFalse);
+            CompileStatement(*isnode.on_false_statement);
+            PatchJump(kJumpEnd);
+        }
+        else
+        {
+            PatchJump(kJumpFalse);
+        }
+    }
+
+    void Compiler::VisitSwitchStatementNode(const SwitchStatementNode& ssnode)
+    {
+        const auto kDepth = state().unwind_stack.size();
+        // the scope is opened before dispatch so every case label lands inside it
+        EnterScope(&ssnode);
+        const int kMark = state().next_register;
+        const int kValue = AllocRegister();
+        CompileExpression(*ssnode.expression_node, kValue);
+        std::vector<SwitchTable::Case> cases;
+        for(const auto& jump : ssnode.jump_table)
+            cases.push_back({static_cast<std::uint32_t>(state().const_table->AddValue(jump.value)), 0});
+        // the table is built once the case targets are known, nested switches take the slots after it
+        const auto kTable = state().switch_tables.size();
+        if(kTable > kMaxBx)
+            throw ScriptCompileError("Too many switch statements in one function");
+        state().switch_tables.emplace_back(*state().const_table, std::vector<SwitchTable::Case>(), 0);
+        Emit(EncodeABx(OpCode::SWITCH, kValue, static_cast<std::uint32_t>(kTable)));
+        FreeRegisters(kMark);
+
+        state().jump_targets.push_back({"", false, kDepth, 0, {}, {}});
+        std::vector<size_t> statement_starts;
+        for(const auto& stmt : ssnode.statement_nodes)
+        {
+            statement_starts.emplace_back(Here());
+            CompileStatement(*stmt);
+        }
+        statement_starts.emplace_back(Here());
+        for(size_t i = 0; i < cases.size(); ++i)
+            cases[i].target = static_cast<std::uint32_t>(statement_starts[ssnode.jump_table[i].statement_index]);
+        const auto kDefault = ssnode.default_statement_id < ssnode.statement_nodes.size()
+            ? statement_starts[ssnode.default_statement_id] : statement_starts.back();
+        state().switch_tables[kTable] = SwitchTable(*state().const_table, cases, static_cast<std::uint32_t>(kDefault));
+        LeaveScope();
+
+        auto target = std::move(state().jump_targets.back());
+        state().jump_targets.pop_back();
+        for(const auto jump : target.break_jumps)
+            PatchJump(jump);
+    }
+
+    void Compiler::VisitWhileStatementNode(const WhileStatementNode& wsnode)
+    {
+        const auto kStart = Here();
+        const int kMark = state().next_register;
+        const int kCondition = AllocRegister();
+        CompileExpression(*wsnode.condition_node, kCondition);
+        FreeRegisters(kMark);
+        const auto kJumpEnd = EmitJump(OpCode::JMP_FALSE, kCondition);
+        const auto kDepth = state().unwind_stack.size();
+        state().jump_targets.push_back({wsnode.label, true, kDepth, kDepth, {}, {}});
+        CompileStatement(*wsnode.body_node);
+        EmitJumpTo(OpCode::JMP, kStart);
+        PatchJump(kJumpEnd);
+
+        auto target = std::move(state().jump_targets.back());
+        state().jump_targets.pop_back();
+        for(const auto jump : target.break_jumps)
+            PatchJump(jump);
+        for(const auto jump : target.continue_jumps)
+            PatchJumpTo(jump, kStart);
+    }
+
+    void Compiler::VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode)
+    {
+        const auto kStart = Here();
+        const auto kDepth = state().unwind_stack.size();
+        state().jump_targets.push_back({dwsnode.label, true, kDepth, kDepth, {}, {}});
+        CompileStatement(*dwsnode.body_node);
+        const auto kContinue = Here();
+        const int kMark = state().next_register;
+        const int kCondition = AllocRegister();
+        CompileExpression(*dwsnode.condition_node, kCondition);
+        FreeRegisters(kMark);
+        EmitJumpTo(OpCode::JMP_TRUE, kStart, kCondition);
+
+        auto target = std::move(state().jump_targets.back());
+        state().jump_targets.pop_back();
+        for(const auto jump : target.break_jumps)
+            PatchJump(jump);
+        for(const auto jump : target.continue_jumps)
+            PatchJumpTo(jump, kContinue);
+    }
+
+    void Compiler::VisitForStatementNode(const ForStatementNode& fsnode)
+    {
+        EnterScope(&fsnode);
+        if(fsnode.init_statement)
+            CompileStatement(*fsnode.init_statement);
+
+        const auto kStart = Here();
+        size_t jump_end = static_cast<size_t>(-1);
+        auto literal = dynamic_cast<const LiteralNode*>(fsnode.condition_node);
+        if(fsnode.condition_node && !(literal && literal->literal_token.IsKeyword("true")))
+        {
+            const int kMark = state().next_register;
+            const int kCondition = AllocRegister();
+            CompileExpression(*fsnode.condition_node, kCondition);
+            FreeRegisters(kMark);
+            jump_end = EmitJump(OpCode::JMP_FALSE, kCondition);
+        }
+        const auto kDepth = state().unwind_stack.size();
+        state().jump_targets.push_back({fsnode.label, true, kDepth, kDepth, {}, {}});
+        CompileStatement(*fsnode.body_node);
+        const auto kContinue = Here();
+        // each iteration gets fresh cells holding the current values, so closures created in the body keep theirs
+        for(const auto& local : state().scopes.back().locals)
+        {
+            if(local.reg >= 0)
+                continue;
+            const int kMark = state().next_register;
+            const int kValue = AllocRegister();
+            Emit(EncodeABC(OpCode::GET_CELL, kValue, local.cell));
+            Emit(EncodeABC(OpCode::NEW_CELL, local.cell));
+            Emit(EncodeABC(OpCode::SET_CELL, kValue, local.cell));
+            FreeRegisters(kMark);
+        }
+        literal = dynamic_cast<const LiteralNode*>(fsnode.increment_node);
+        if(fsnode.increment_node && !(literal && literal->literal_token.IsKeyword("true")))
+        {
+            const int kMark = state().next_register;
+            CompileExpression(*fsnode.increment_node, AllocRegister());
+            FreeRegisters(kMark);
+        }
+        EmitJumpTo(OpCode::JMP, kStart);
+        if(jump_end != static_cast<size_t>(-1))
+            PatchJump(jump_end);
+
+        auto target = std::move(state().jump_targets.back());
+        state().jump_targets.pop_back();
+        for(const auto jump : target.break_jumps)
+            PatchJump(jump);
+        for(const auto jump : target.continue_jumps)
+            PatchJumpTo(jump, kContinue);
+        LeaveScope();
+    }
+
+    void Compiler::VisitForOfStatementNode(const ForOfStatementNode& fosnode)
+    {
+        const int kMark = state().next_register;
+        const int kObject = AllocRegister();
+        CompileExpression(*fosnode.object_to_iterate, kObject);
+        // iteration state, then key and value
+        const int kIter = AllocRegister();
+        for(int i = 0; i < 4; ++i)
+            AllocRegister();
+        const bool kKeysOnly = fosnode.of_in_token.IsKeyword("in") && fosnode.var_access_nodes.size() == 1;
+        Emit(EncodeABC(OpCode::ITER_PREP, kIter, kObject, kKeysOnly));
+
+        const auto kDepth = state().unwind_stack.size();
+        const auto kNext = Here();
+        const auto kJumpEnd = EmitJump(OpCode::ITER_NEXT, kIter);
+        // each iteration gets a fresh scope so closures capture the current values
+        EnterScope(&fosnode);
+        state().jump_targets.push_back({fosnode.label, true, kDepth, state().unwind_stack.size(), {}, {}});
+        const auto& qualifier = fosnode.qualifier_token.text;
+        if(fosnode.var_access_nodes.size() == 1)
+        {
+            DeclareVariable(qualifier, fosnode.var_access_nodes[0]->var_token.text, kKeysOnly ? kIter + 3 : kIter + 4);
+        }
+        else
+        {
+            DeclareVariable(qualifier, fosnode.var_access_nodes[0]->var_token.text, kIter + 3);
+            DeclareVariable(qualifier, fosnode.var_access_nodes[1]->var_token.text, kIter + 4);
+        }
+        CompileStatement(*fosnode.body_node);
+        const auto kContinue = Here();
+        LeaveScope();
+        EmitJumpTo(OpCode::JMP, kNext);
+        PatchJump(kJumpEnd);
+        FreeRegisters(kMark);
+
+        auto target = std::move(state().jump_targets.back());
+        state().jump_targets.pop_back();
+        for(const auto jump : target.break_jumps)
+            PatchJump(jump);
+        for(const auto jump : target.continue_jumps)
+            PatchJumpTo(jump, kContinue);
+    }
+
+    void Compiler::VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode& bocsnode)
+    {
+        const bool kIsBreak = bocsnode.break_or_continue.IsKeyword("break");
+        auto& targets = state().jump_targets;
+        for(size_t i = targets.size(); i > 0; --i)
+        {
+            auto& target = targets[i - 1];
+            if(bocsnode.label != "" ? (target.label != bocsnode.label) : (!kIsBreak && !target.is_loop))
+                continue;
+            CompileUnwindTo(kIsBreak ? target.break_unwind_depth : target.continue_unwind_depth);
+            // compiling finally blocks may have grown the target list
+            auto& patch_target = state().jump_targets[i - 1];
+            if(kIsBreak)
+                patch_target.break_jumps.emplace_back(EmitJump(OpCode::JMP));
+            else
+                patch_target.continue_jumps.emplace_back(EmitJump(OpCode::JMP));
+            return;
+        }
+        throw ScriptCompileError(MakeString("Invalid ", bocsnode.break_or_continue.text, " statement at line ",
+            bocsnode.line));
+    }
+
+    void Compiler::VisitReturnStatementNode(const ReturnStatementNode& rsnode)
+    {
+        const int kMark = state().next_register;
+        const int kValue = AllocRegister();
+        if(rsnode.expression_node)
+            CompileExpression(*rsnode.expression_node, kValue);
+        else
+            Emit(EncodeABC(OpCode::LOAD_UNDEFINED, kValue));
+        CompileUnwindTo(0);
+        Emit(EncodeABC(OpCode::RETURN, kValue));
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitFunctionDeclarationStatementNode(const FunctionDeclarationStatementNode& fdsnode)
+    {
+        const int kMark = state().next_register;
+        const int kFunc = AllocRegister();
+        auto func = CompileFunction(&fdsnode, fdsnode.name, fdsnode.argument_names, fdsnode.default_arguments,
+            fdsnode.statement_nodes, nullptr, false, fdsnode.is_generator);
+        Emit(EncodeABx(OpCode::CLOSURE, kFunc, state().const_table->AddValue(ScriptAny(func))));
+        DeclareVariable("let", fdsnode.name, kFunc);
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitThrowStatementNode(const ThrowStatementNode& tsnode)
+    {
+        const int kMark = state().next_register;
+        const int kValue = AllocRegister();
+        CompileExpression(*tsnode.expression_node, kValue);
+        Emit(EncodeABC(OpCode::THROW, kValue));
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode)
+    {
+        const int kMark = state().next_register;
+        const int kException = AllocRegister();
+        const auto* finally_block = tbsnode.finally_block_node;
+        std::vector<size_t> end_jumps;
+
+        const auto kTry = EmitJump(OpCode::TRY, kException);
+        state().unwind_stack.push_back({finally_block, state().scopes.size()});
+        CompileStatement(*tbsnode.try_block_node);
+        state().unwind_stack.pop_back();
+        Emit(EncodeABC(OpCode::END_TRY));
+        if(finally_block)
+            CompileStatement(*finally_block);
+        end_jumps.emplace_back(EmitJump(OpCode::JMP));
+        PatchJump(kTry);
+
+        if(tbsnode.catch_block_node)
+        {
+            size_t catch_try = 0;
+            const int kFinallyException = AllocRegister();
+            if(finally_block)
+            {
+                catch_try = EmitJump(OpCode::TRY, kFinallyException);
+                state().unwind_stack.push_back({finally_block, state().scopes.size()});
+            }
+            EnterScope(&tbsnode);
+            if(tbsnode.exception_name != "")
+                DeclareVariable("let", tbsnode.exception_name, kException);
+            CompileStatement(*tbsnode.catch_block_node);
+            LeaveScope();
+            if(finally_block)
+            {
+                state().unwind_stack.pop_back();
+                Emit(EncodeABC(OpCode::END_TRY));
+                CompileStatement(*finally_block);
+                end_jumps.emplace_back(EmitJump(OpCode::JMP));
+                // an exception thrown by the catch block still runs the finally block
+                PatchJump(catch_try);
+                CompileStatement(*finally_block);
+                Emit(EncodeABC(OpCode::THROW, kFinallyException));
+            }
+        }
+        else
+        {
+            CompileStatement(*finally_block);
+            Emit(EncodeABC(OpCode::THROW, kException));
+        }
+
+        for(const auto jump : end_jumps)
+            PatchJump(jump);
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitDeleteStatementNode(const DeleteStatementNode& dsnode)
+    {
+        const int kMark = state().next_register;
+        const int kObject = AllocRegister();
+        const int kKey = AllocRegister();
+        if(auto manode = dynamic_cast<const MemberAccessNode*>(dsnode.access_node))
+        {
+            const auto* member = dynamic_cast<const VarAccessNode*>(manode->member_node);
+            CompileExpression(*manode->object_node, kObject);
+            Emit(EncodeABx(OpCode::LOADK, kKey, StringConstant(member->var_token)));
+        }
+        else if(auto ainode = dynamic_cast<const ArrayIndexNode*>(dsnode.access_node))
+        {
+            CompileExpression(*ainode->object_node, kObject);
+            CompileExpression(*ainode->index_node, kKey);
+        }
+        else
+        {
+            throw ScriptCompileError(MakeString("Invalid operand for delete at ", dsnode.delete_token.position));
+        }
+        Emit(EncodeABC(OpCode::DELETE, kObject, kKey));
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode)
+    {
+        const int kMark = state().next_register;
+        const int kClass = AllocRegister();
+        ClassDefinitionToRegister(*cdsnode.class_definition, kClass);
+        DeclareVariable("let", cdsnode.class_definition->class_name, kClass);
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::VisitExpressionStatementNode(const ExpressionStatementNode& esnode)
+    {
+        if(esnode.expression_node == nullptr)
+            return;
+        const int kMark = state().next_register;
+        if(state().completion_register != -1)
+        {
+            CompileExpression(*esnode.expression_node, state().completion_register);
+        }
+        else
+        {
+            CompileExpression(*esnode.expression_node, AllocRegister());
+        }
+        FreeRegisters(kMark);
+    }
+
+    int Compiler::AllocRegister()
+    {
+        auto& fstate = state();
+        if(fstate.next_register >= kMaxRegisters)
+            throw ScriptCompileError(MakeString("Expression too complex at line ", current_line_));
+        const int kRegister = fstate.next_register++;
+        if(fstate.next_register > fstate.max_registers)
+            fstate.max_registers = fstate.next_register;
+        return kRegister;
+    }
+
+    void Compiler::ClassDefinitionToRegister(const ClassDefinition& cdef, int dest)
+    {
+        if(cdef.get_methods.size() || cdef.set_methods.size())
+            throw UnimplementedError("class getters and setters");
+        const int kMark = state().next_register;
+        const auto& ctor = *cdef.constructor;
+        auto ctor_func = CompileFunction(cdef.constructor, cdef.class_name, ctor.arg_list, ctor.default_arguments, ctor.statements,
+            nullptr, true, false);
+        Emit(EncodeABx(OpCode::CLOSURE, dest, state().const_table->AddValue(ScriptAny(ctor_func))));
+        if(cdef.base_class)
+        {
+            const int kBase = AllocRegister();
+            CompileExpression(*cdef.base_class, kBase);
+            Emit(EncodeABC(OpCode::INHERIT, dest, kBase));
+            FreeRegisters(kMark);
+        }
+
+        const int kProto = AllocRegister();
+        const int kMethod = AllocRegister();
+        Emit(EncodeABC(OpCode::GET_FIELD, kProto, dest));
+        Emit(FieldOperand(StringConstant("prototype")));
+        for(size_t i = 0; i < cdef.methods.size(); ++i)
+        {
+            CompileExpression(*cdef.methods[i], kMethod);
+            Emit(EncodeABC(OpCode::SET_FIELD, kProto, kMethod));
+            Emit(FieldOperand(StringConstant(cdef.method_names[i])));
+        }
+        for(size_t i = 0; i < cdef.static_methods.size(); ++i)
+        {
+            CompileExpression(*cdef.static_methods[i], kMethod);
+            Emit(EncodeABC(OpCode::SET_FIELD, dest, kMethod));
+            Emit(FieldOperand(StringConstant(cdef.static_method_names[i])));
+        }
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::CompileAssignment(const BinaryOpNode& bonode, int dest)
+    {
+        const bool kCompound = bonode.op_token.type != Token::Type::ASSIGN;
+        const OpCode kOp = kCompound ? BinaryOpCode(bonode.op_token) : OpCode::NOP;
+        const int kMark = state().next_register;
+        if(auto vanode = dynamic_cast<const VarAccessNode*>(bonode.left_node))
+        {
+            if(kCompound)
+            {
+                LoadVariable(vanode->var_token, dest);
+                const int kRight = AllocRegister();
+                CompileExpression(*bonode.right_node, kRight);
+                Emit(EncodeABC(kOp, dest, dest, kRight));
+            }
+            else
+            {
+                CompileExpression(*bonode.right_node, dest);
+            }
+            StoreVariable(vanode->var_token, dest);
+        }
+        else if(auto manode = dynamic_cast<const MemberAccessNode*>(bonode.left_node))
+        {
+            const auto* member = dynamic_cast<const VarAccessNode*>(manode->member_node);
+            const auto kName = StringConstant(member->var_token);
+            const int kObject = AllocRegister();
+            CompileExpression(*manode->object_node, kObject);
+            if(kCompound)
+            {
+                Emit(EncodeABC(OpCode::GET_FIELD, dest, kObject));
+                Emit(FieldOperand(kName));
+                const int kRight = AllocRegister();
+                CompileExpression(*bonode.right_node, kRight);
+                Emit(EncodeABC(kOp, dest, dest, kRight));
+            }
+            else
+            {
+                CompileExpression(*bonode.right_node, dest);
+            }
+            Emit(EncodeABC(OpCode::SET_FIELD, kObject, dest));
+            Emit(FieldOperand(kName));
+        }
+        else if(auto ainode = dynamic_cast<const ArrayIndexNode*>(bonode.left_node))
+        {
+            const int kObject = AllocRegister();
+            const int kIndex = AllocRegister();
+            CompileExpression(*ainode->object_node, kObject);
+            CompileExpression(*ainode->index_node, kIndex);
+            if(kCompound)
+            {
+                Emit(EncodeABC(OpCode::GET_INDEX, dest, kObject, kIndex));
+                const int kRight = AllocRegister();
+                CompileExpression(*bonode.right_node, kRight);
+                Emit(EncodeABC(kOp, dest, dest, kRight));
+            }
+            else
+            {
+                CompileExpression(*bonode.right_node, dest);
+            }
+            Emit(EncodeABC(OpCode::SET_INDEX, kObject, kIndex, dest));
+        }
+        else
+        {
+            throw ScriptCompileError(MakeString("Invalid assignment target ", bonode.left_node->to_string(),
+                " at ", bonode.op_token.position));
+        }
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::CompileExpression(const ExpressionNode& node, int dest)
+    {
+        const int kSaved = dest_register_;
+        dest_register_ = dest;
+        VisitExpression(node);
+        dest_register_ = kSaved;
+    }
+
+    ScriptFunction* Compiler::CompileFunction(const void* owner, const std::string_view name,
+        const ArenaList<std::string_view>& args, const ArenaList<ExpressionNode*>& default_args,
+        const ArenaList<StatementNode*>& statements, const ExpressionNode* return_expression, bool is_class,
+        bool is_generator)
+    {
+        if(is_generator)
+            throw UnimplementedError("generators");
+        if(args.size() >= kMaxRegisters)
+            throw ScriptCompileError(MakeString("Too many parameters for function ", name));
+        const auto kSavedLine = current_line_;
+        function_states_.emplace_back();
+        // arguments arrive in the first registers of the frame
+        for(size_t i = 0; i < args.size(); ++i)
+            AllocRegister();
+        EnterScope(owner, &args);
+        const auto kFirstDefault = args.size() - default_args.size();
+        for(size_t i = 0; i < args.size(); ++i)
+        {
+            if(i >= kFirstDefault)
+            {
+                const int kMark = state().next_register;
+                const int kTest = AllocRegister();
+                Emit(EncodeABC(OpCode::LOAD_UNDEFINED, kTest));
+                Emit(EncodeABC(OpCode::STRICT_EQUALS, kTest, i, kTest));
+                const auto kSkip = EmitJump(OpCode::JMP_FALSE, kTest);
+                CompileExpression(*default_args[i - kFirstDefault], i);
+                PatchJump(kSkip);
+                FreeRegisters(kMark);
+            }
+            // a captured parameter is copied into its cell before later defaults can refer to it
+            const auto kLocation = ResolveIn(0, args[i]);
+            if(kLocation.kind == Location::Kind::CELL)
+                StoreLocation(kLocation, i);
+        }
+
+        if(return_expression)
+        {
+            const int kResult = AllocRegister();
+            CompileExpression(*return_expression, kResult);
+            Emit(EncodeABC(OpCode::RETURN, kResult));
+        }
+        else
+        {
+            CompileStatements(statements);
+            Emit(EncodeABC(OpCode::RETURN_UNDEFINED));
+        }
+
+        auto fstate = std::move(state());
+        function_states_.pop_back();
+        current_line_ = kSavedLine;
+        std::vector<std::uint8_t> bytecode(fstate.code.size() * sizeof(std::uint32_t));
+        std::memcpy(bytecode.data(), fstate.code.data(), bytecode.size());
+        return ScriptFunction::Create(name.empty() ? "<anonymous function>" : std::string(name),
+            std::vector<std::string>(args.begin(), args.end()), bytecode, is_class,
+            is_generator, fstate.const_table, fstate.max_registers, fstate.lines, fstate.num_inline_caches,
+            fstate.max_cells, fstate.upvalues, fstate.switch_tables);
+    }
+
+    void Compiler::CompileIncDec(const UnaryOpNode& uonode, int dest)
+    {
+        const OpCode kOp = uonode.op_token.type == Token::Type::INC ? OpCode::ADD : OpCode::SUB;
+        const int kMark = state().next_register;
+        const int kOne = AllocRegister();
+        // for postfix the old value is kept in dest and the new value is computed in a temporary
+        const int kResult = uonode.is_postfix ? AllocRegister() : dest;
+        auto compute = [&]() {
+            if(uonode.is_postfix)
+                Emit(EncodeABC(OpCode::TO_NUMBER, dest, dest));
+            Emit(EncodeAsBx(OpCode::LOADI, kOne, 1));
+            Emit(EncodeABC(kOp, kResult, dest, kOne));
+        };
+
+        if(auto vanode = dynamic_cast<const VarAccessNode*>(uonode.operand_node))
+        {
+            LoadVariable(vanode->var_token, dest);
+            compute();
+            StoreVariable(vanode->var_token, kResult);
+        }
+        else if(auto manode = dynamic_cast<const MemberAccessNode*>(uonode.operand_node))
+        {
+            const auto* member = dynamic_cast<const VarAccessNode*>(manode->member_node);
+            const auto kName = StringConstant(member->var_token);
+            const int kObject = AllocRegister();
+            CompileExpression(*manode->object_node, kObject);
+            Emit(EncodeABC(OpCode::GET_FIELD, dest, kObject));
+            Emit(FieldOperand(kName));
+            compute();
+            Emit(EncodeABC(OpCode::SET_FIELD, kObject, kResult));
+            Emit(FieldOperand(kName));
+        }
+        else if(auto ainode = dynamic_cast<const ArrayIndexNode*>(uonode.operand_node))
+        {
+            const int kObject = AllocRegister();
+            const int kIndex = AllocRegister();
+            CompileExpression(*ainode->object_node, kObject);
+            CompileExpression(*ainode->index_node, kIndex);
+            Emit(EncodeABC(OpCode::GET_INDEX, dest, kObject, kIndex));
+            compute();
+            Emit(EncodeABC(OpCode::SET_INDEX, kObject, kIndex, kResult));
+        }
+        else
+        {
+            throw ScriptCompileError(MakeString("Invalid operand for ", uonode.op_token.Symbol(), " at ",
+                uonode.op_token.position));
+        }
+        FreeRegisters(kMark);
+    }
+
+    void Compiler::CompileStatement(const StatementNode& node)
+    {
+        const auto kSavedLine = current_line_;
+        if(node.line != 0)
+            current_line_ = node.line;
+        VisitStatement(node);
+        current_line_ = kSavedLine;
+    }
+
+    void Compiler::CompileStatements(const ArenaList<StatementNode*>& statements)
+    {
+        // function declarations are hoisted to the top of their block
+        for(const auto& stmt : statements)
+        {
+            if(dynamic_cast<const FunctionDeclarationStatementNode*>(stmt))
+                CompileStatement(*stmt);
+        }
+        for(const auto& stmt : statements)
+        {
+            if(!dynamic_cast<const FunctionDeclarationStatementNode*>(stmt))
+                CompileStatement(*stmt);
+        }
+    }
+
+    void Compiler::CompileUnwindTo(size_t unwind_depth)
+    {
+        auto saved_unwind_stack = state().unwind_stack;
+        for(size_t i = saved_unwind_stack.size(); i > unwind_depth; --i)
+        {
+            const auto& entry = saved_unwind_stack[i - 1];
+            state().unwind_stack.resize(i - 1);
+            Emit(EncodeABC(OpCode::END_TRY));
+            if(entry.finally_block)
+            {
+                // the scopes opened inside the try block are not visible to the finally block
+                auto saved_scopes = state().scopes;
+                state().scopes.resize(entry.num_scopes);
+                CompileStatement(*entry.finally_block);
+                state().scopes = std::move(saved_scopes);
+            }
+        }
+        state().unwind_stack = saved_unwind_stack;
+    }
+
+    void Compiler::DeclareVariable(const std::string_view qualifier, const std::string_view name, int src)
+    {
+        if(name.size() > 0 && (name[0] == '{' || name[0] == '['))
+            throw UnimplementedError("destructuring declarations");
+        const bool kLexical = qualifier == "let" || qualifier == "const";
+        const auto& scopes = state().scopes;
+        // var belongs to the function scope and let or const to the innermost scope, outside of any function
+        // or tracked scope the variable is global
+        Location location{};
+        if(!kLexical && !scopes.empty() && scopes[0].is_function)
+            location = ResolveIn(0, name);
+        else if(kLexical && !scopes.empty())
+            location = ResolveIn(scopes.size() - 1, name);
+        if(location.kind != Location::Kind::GLOBAL)
+        {
+            StoreLocation(location, src);
+            return;
+        }
+        OpCode op = OpCode::DECL_VAR;
+        if(qualifier == "let")
+            op = OpCode::DECL_LET;
+        else if(qualifier == "const")
+            op = OpCode::DECL_CONST;
+        Emit(EncodeABx(op, src, StringConstant(name)));
+    }
+
+    size_t Compiler::Emit(std::uint32_t instruction)
+    {
+        auto& fstate = state();
+        if(fstate.lines.size() == 0 || fstate.lines.back().line != current_line_)
+            fstate.lines.push_back({static_cast<std::uint32_t>(fstate.code.size()),
+                static_cast<std::uint32_t>(current_line_)});
+        fstate.code.emplace_back(instruction);
+        return fstate.code.size() - 1;
+    }
+
+    size_t Compiler::EmitJump(OpCode op, int a)
+    {
+        const auto kIndex = Emit(EncodeABC(op, a));
+        if(op == OpCode::TRY)
+            Emit(0);
+        return kIndex;
+    }
+
+    void Compiler::EmitJumpTo(OpCode op, size_t target, int a)
+    {
+        PatchJumpTo(EmitJump(op, a), target);
+    }
+
+    void Compiler::EnterScope(const void* owner, const ArenaList<std::string_view>* args)
+    {
+        auto& fstate = state();
+        LocalScope scope{{}, fstate.next_register, fstate.next_cell, args != nullptr};
+        std::vector<std::uint32_t> new_cells;
+        if(auto info = analyzer_.Find(owner))
+        {
+            for(const auto& variable : info->variables)
+            {
+                Local local{variable.name, -1, 0, next_local_id_++, variable.is_const};
+                if(variable.is_captured)
+                {
+                    if(fstate.next_cell >= kMaxCells)
+                        throw ScriptCompileError(MakeString("Too many captured variables at line ", current_line_));
+                    local.cell = static_cast<std::uint32_t>(fstate.next_cell++);
+                    fstate.max_cells = std::max(fstate.max_cells, fstate.next_cell);
+                    new_cells.emplace_back(local.cell);
+                }
+                else if(args != nullptr)
+                {
+                    // the last of several parameters with the same name wins
+                    for(size_t i = args->size(); i > 0 && local.reg < 0; --i)
+                    {
+                        if((*args)[i - 1] == variable.name)
+                            local.reg = static_cast<int>(i - 1);
+                    }
+                }
+                if(!variable.is_captured && local.reg < 0)
+                    local.reg = AllocRegister();
+                scope.locals.emplace_back(std::move(local));
+            }
+        }
+        fstate.scopes.emplace_back(std::move(scope));
+        // every entry gets fresh cells so closures created in a loop body each see their own variables
+        for(const auto kCell : new_cells)
+            Emit(EncodeABC(OpCode::NEW_CELL, kCell));
+    }
+
+    void Compiler::FreeRegisters(int mark)
+    {
+        state().next_register = mark;
+    }
+
+    void Compiler::LeaveScope()
+    {
+        auto& fstate = state();
+        const auto kRegisterMark = fstate.scopes.back().register_mark;
+        fstate.next_cell = fstate.scopes.back().cell_mark;
+        fstate.scopes.pop_back();
+        FreeRegisters(kRegisterMark);
+    }
+
+    void Compiler::LoadVariable(const Token& name_token, const int dest)
+    {
+        const auto kLocation = Resolve(name_token.text);
+        switch(kLocation.kind)
+        {
+        case Location::Kind::GLOBAL:
+            Emit(EncodeABx(OpCode::GET_VAR, dest, StringConstant(name_token)));
+            break;
+        case Location::Kind::REGISTER:
+            if(kLocation.index != static_cast<std::uint32_t>(dest))
+                Emit(EncodeABC(OpCode::MOVE, dest, kLocation.index));
+            break;
+        case Location::Kind::CELL:
+            Emit(EncodeABC(OpCode::GET_CELL, dest, kLocation.index));
+            break;
+        case Location::Kind::UPVALUE:
+            Emit(EncodeABC(OpCode::GET_UPVAL, dest, kLocation.index));
+            break;
+        }
+    }
+
+    void Compiler::PatchJump(size_t jump_index)
+    {
+        PatchJumpTo(jump_index, Here());
+    }
+
+    void Compiler::PatchJumpTo(size_t jump_index, size_t target)
+    {
+        auto& code = state().code;
+        const auto kInstruction = code[jump_index];
+        const auto kOp = GetOp(kInstruction);
+        if(kOp == OpCode::TRY)
+        {
+            code[jump_index + 1] = static_cast<std::uint32_t>(
+                static_cast<std::int64_t>(target) - static_cast<std::int64_t>(jump_index + 2));
+            return;
+        }
+        const auto kOffset = static_cast<std::int64_t>(target) - static_cast<std::int64_t>(jump_index + 1);
+        if(kOp == OpCode::JMP)
+        {
+            if(kOffset > kMaxSJ || kOffset < -kMaxSJ)
+                throw ScriptCompileError(MakeString("Jump too large at line ", current_line_));
+            code[jump_index] = EncodeSJ(kOp, static_cast<std::int32_t>(kOffset));
+        }
+        else
+        {
+            if(kOffset > kSBxBias || kOffset < -kSBxBias)
+                throw ScriptCompileError(MakeString("Conditional jump too large at line ", current_line_));
+            code[jump_index] = EncodeAsBx(kOp, GetA(kInstruction), static_cast<std::int32_t>(kOffset));
+        }
+    }
+
+    Compiler::Location Compiler::Resolve(const std::string_view name)
+    {
+        return ResolveFrom(function_states_.size() - 1, name);
+    }
+
+    Compiler::Location Compiler::ResolveFrom(const size_t function_index, const std::string_view name)
+    {
+        auto& fstate = function_states_[function_index];
+        for(size_t i = fstate.scopes.size(); i > 0; --i)
+        {
+            for(const auto& local : fstate.scopes[i - 1].locals)
+            {
+                if(local.name != name)
+                    continue;
+                if(local.reg >= 0)
+                    return {Location::Kind::REGISTER, static_cast<std::uint32_t>(local.reg), local.id, local.is_const};
+                return {Location::Kind::CELL, local.cell, local.id, local.is_const};
+            }
+        }
+        if(function_index == 0)
+            return {Location::Kind::GLOBAL, 0, 0, false};
+
+        const auto kOuter = ResolveFrom(function_index - 1, name);
+        if(kOuter.kind == Location::Kind::GLOBAL)
+            return kOuter;
+        // the scope analysis puts every variable used by a nested function in a cell
+        if(kOuter.kind == Location::Kind::REGISTER)
+            throw ScriptCompileError(MakeString("Variable ", name, " was not captured at line ", current_line_));
+        for(size_t i = 0; i < fstate.upvalue_ids.size(); ++i)
+        {
+            if(fstate.upvalue_ids[i] == kOuter.id)
+                return {Location::Kind::UPVALUE, static_cast<std::uint32_t>(i), kOuter.id, kOuter.is_const};
+        }
+        if(fstate.upvalues.size() >= kMaxUpvalues)
+            throw ScriptCompileError(MakeString("Too many upvalues in one function at line ", current_line_));
+        fstate.upvalues.push_back({kOuter.kind == Location::Kind::CELL, static_cast<std::uint8_t>(kOuter.index)});
+        fstate.upvalue_ids.push_back(kOuter.id);
+        return {Location::Kind::UPVALUE, static_cast<std::uint32_t>(fstate.upvalues.size() - 1), kOuter.id,
+            kOuter.is_const};
+    }
+
+    Compiler::Location Compiler::ResolveIn(const size_t scope_index, const std::string_view name) const
+    {
+        for(const auto& local : state().scopes[scope_index].locals)
+        {
+            if(local.name != name)
+                continue;
+            if(local.reg >= 0)
+                return {Location::Kind::REGISTER, static_cast<std::uint32_t>(local.reg), local.id, local.is_const};
+            return {Location::Kind::CELL, local.cell, local.id, local.is_const};
+        }
+        return {Location::Kind::GLOBAL, 0, 0, false};
+    }
+
+    void Compiler::StoreLocation(const Location& location, const int src)
+    {
+        switch(location.kind)
+        {
+        case Location::Kind::GLOBAL:
+            break;
+        case Location::Kind::REGISTER:
+            if(location.index != static_cast<std::uint32_t>(src))
+                Emit(EncodeABC(OpCode::MOVE, location.index, src));
+            break;
+        case Location::Kind::CELL:
+            Emit(EncodeABC(OpCode::SET_CELL, src, location.index));
+            break;
+        case Location::Kind::UPVALUE:
+            Emit(EncodeABC(OpCode::SET_UPVAL, src, location.index));
+            break;
+        }
+    }
+
+    void Compiler::StoreVariable(const Token& name_token, const int src)
+    {
+        const auto kLocation = Resolve(name_token.text);
+        if(kLocation.kind == Location::Kind::GLOBAL)
+        {
+            Emit(EncodeABx(OpCode::SET_VAR, src, StringConstant(name_token)));
+            return;
+        }
+        if(kLocation.is_const)
+            throw ScriptCompileError(MakeString("Cannot reassign const ", name_token.text, " at ",
+                name_token.position));
+        StoreLocation(kLocation, src);
+    }
+
+    std::uint32_t Compiler::FieldOperand(const std::uint32_t name)
+    {
+        // each field access gets its own cache until the slots run out, after which the rest go uncached
+        auto cache = InlineCache::kNone;
+        if(state().num_inline_caches < InlineCache::kNone)
+            cache = static_cast<std::uint32_t>(state().num_inline_caches++);
+        return name | (cache << 16);
+    }
+
+    std::uint32_t Compiler::StringConstant(const std::string_view str)
+    {
+        return static_cast<std::uint32_t>(state().const_table->AddString(std::string(str)));
+    }
+
+    std::uint32_t Compiler::StringConstant(const Token& token)
+    {
+        // identifiers were interned by the lexer
+        return static_cast<std::uint32_t>(state().const_table->AddString(std::string(token.text), token.atom));
+    }
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,196 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nodes.hpp"
+#include "scopeanalyzer.hpp"
+#include "types/function.hpp"
+#include "visitors.hpp"
+#include "vm/consttable.hpp"
+#include "vm/opcodes.hpp"
+
+namespace mildew
+{
+    /**
+     * Lowers the tree produced by Parser::ParseProgram into register based bytecode. Each function
+     * literal becomes a ScriptFunction prototype with its own bytecode and constant table, stored in the
+     * constant table of the enclosing function. The functions are allocated from the current Heap.
+     * Variables declared inside functions and blocks are resolved before the code is emitted: a variable
+     * that no nested function refers to lives in a register, and a captured variable is boxed in an upvalue
+     * cell created when its scope is entered. A nested function reaches the cell through its own list of
+     * upvalues filled in when the closure is created. Everything else is global.
+     */
+    class Compiler : public ExpressionVisitor<Compiler>, public StatementVisitor<Compiler>
+    {
+    public:
+        Compiler() {}
+        Compiler(const Compiler&) = delete;
+        Compiler& operator=(const Compiler&) = delete;
+
+        ScriptFunction* Compile(const BlockStatementNode& program,
+            const std::string& name = "<program>");
+
+        void VisitLiteralNode(const LiteralNode& lnode);
+        void VisitFunctionLiteralNode(const FunctionLiteralNode& flnode);
+        void VisitLambdaNode(const LambdaNode& lnode);
+        void VisitTemplateStringNode(const TemplateStringNode& tsnode);
+        void VisitArrayLiteralNode(const ArrayLiteralNode& alnode);
+        void VisitObjectLiteralNode(const ObjectLiteralNode& olnode);
+        void VisitClassLiteralNode(const ClassLiteralNode& clnode);
+        void VisitBinaryOpNode(const BinaryOpNode& bonode);
+        void VisitUnaryOpNode(const UnaryOpNode& uonode);
+        void VisitTerniaryOpNode(const TerniaryOpNode& tonode);
+        void VisitVarAccessNode(const VarAccessNode& vanode);
+        void VisitFunctionCallNode(const FunctionCallNode& fcnode);
+        void VisitArrayIndexNode(const ArrayIndexNode& ainode);
+        void VisitMemberAccessNode(const MemberAccessNode& manode);
+        void VisitNewExpressionNode(const NewExpressionNode& nenode);
+        void VisitSuperNode(const SuperNode& snode);
+        void VisitYieldNode(const YieldNode& ynode);
+
+        void VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode);
+        void VisitBlockStatementNode(const BlockStatementNode& bsnode);
+        void VisitIfStatementNode(const IfStatementNode& isnode);
+        void VisitSwitchStatementNode(const SwitchStatementNode& ssnode);
+        void VisitWhileStatementNode(const WhileStatementNode& wsnode);
+        void VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode);
+        void VisitForStatementNode(const ForStatementNode& fsnode);
+        void VisitForOfStatementNode(const ForOfStatementNode& fosnode);
+        void VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode& bocsnode);
+        void VisitReturnStatementNode(const ReturnStatementNode& rsnode);
+        void VisitFunctionDeclarationStatementNode(const FunctionDeclarationStatementNode& fdsnode);
+        void VisitThrowStatementNode(const ThrowStatementNode& tsnode);
+        void VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode);
+        void VisitDeleteStatementNode(const DeleteStatementNode& dsnode);
+        void VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode);
+        void VisitExpressionStatementNode(const ExpressionStatementNode& esnode);
+
+    private:
+        // try blocks that must be left when control exits them early with break, continue, or return
+        struct Unwind
+        {
+            const StatementNode* finally_block;
+            size_t num_scopes; // the number of local scopes visible to the finally block
+        };
+
+        struct Local
+        {
+            std::string name;
+            int reg; // -1 if the variable is captured and lives in a cell
+            std::uint32_t cell;
+            std::uint32_t id; // identifies the variable among the upvalues of nested functions
+            bool is_const;
+        };
+
+        struct LocalScope
+        {
+            std::vector<Local> locals;
+            int register_mark;
+            int cell_mark;
+            bool is_function;
+        };
+
+        struct Location
+        {
+            enum class Kind { GLOBAL, REGISTER, CELL, UPVALUE };
+            Kind kind;
+            std::uint32_t index; // register, cell, or upvalue
+            std::uint32_t id;
+            bool is_const;
+        };
+
+        struct JumpTarget
+        {
+            std::string_view label;
+            bool is_loop;
+            size_t break_unwind_depth;
+            size_t continue_unwind_depth;
+            std::vector<size_t> break_jumps;
+            std::vector<size_t> continue_jumps;
+        };
+
+        struct FunctionState
+        {
+            std::vector<std::uint32_t> code;
+            std::shared_ptr<ConstTable> const_table = std::make_shared<ConstTable>();
+            std::vector<LineInfo> lines;
+            int next_register = 0;
+            int max_registers = 0;
+            int completion_register = -1;
+            int next_cell = 0;
+            int max_cells = 0;
+            size_t num_inline_caches = 0;
+            std::vector<SwitchTable> switch_tables;
+            std::vector<UpvalueInfo> upvalues;
+            std::vector<std::uint32_t> upvalue_ids;
+            std::vector<Unwind> unwind_stack;
+            std::vector<JumpTarget> jump_targets;
+            std::vector<LocalScope> scopes;
+        };
+
+        int AllocRegister();
+        void ClassDefinitionToRegister(const ClassDefinition& cdef, int dest);
+        void CompileAssignment(const BinaryOpNode& bonode, int dest);
+        void CompileExpression(const ExpressionNode& node, int dest);
+        ScriptFunction* CompileFunction(const void* owner, std::string_view name,
+            const ArenaList<std::string_view>& args, const ArenaList<ExpressionNode*>& default_args,
+            const ArenaList<StatementNode*>& statements, const ExpressionNode* return_expression, bool is_class,
+            bool is_generator);
+        void CompileIncDec(const UnaryOpNode& uonode, int dest);
+        void CompileStatement(const StatementNode& node);
+        void CompileStatements(const ArenaList<StatementNode*>& statements);
+        void CompileUnwindTo(size_t unwind_depth);
+        void DeclareVariable(std::string_view qualifier, std::string_view name, int src);
+        size_t Emit(std::uint32_t instruction);
+        /// opens the local scope of a node, the parameters of a function scope stay in their registers
+        void EnterScope(const void* owner, const ArenaList<std::string_view>* args = nullptr);
+        size_t EmitJump(OpCode op, int a = 0);
+        void EmitJumpTo(OpCode op, size_t target, int a = 0);
+        /// the extra word of a field access: the name constant and a fresh inline cache slot
+        std::uint32_t FieldOperand(std::uint32_t name);
+        void FreeRegisters(int mark);
+        size_t Here() const { return state().code.size(); }
+        void LeaveScope();
+        void LoadVariable(const Token& name_token, int dest);
+        void PatchJump(size_t jump_index);
+        void PatchJumpTo(size_t jump_index, size_t target);
+        Location Resolve(std::string_view name);
+        /// resolves a name as seen from the function being compiled at the given depth
+        Location ResolveFrom(size_t function_index, std::string_view name);
+        /// the location of a variable declared in the given scope of the current function
+        Location ResolveIn(size_t scope_index, std::string_view name) const;
+        void StoreLocation(const Location& location, int src);
+        void StoreVariable(const Token& name_token, int src);
+        std::uint32_t StringConstant(std::string_view str);
+        std::uint32_t StringConstant(const Token& token);
+
+        FunctionState& state() { return function_states_.back(); }
+        const FunctionState& state() const { return function_states_.back(); }
+
+        ScopeAnalyzer analyzer_;
+        std::vector<FunctionState> function_states_;
+        int dest_register_ = 0;
+        std::uint32_t next_local_id_ = 0;
+        size_t current_line_ = 0;
+    };
+
+} // namespace mildew
\ No newline at end of file
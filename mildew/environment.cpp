@@ -17,5 +17,121 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 namespace mildew
 {
-    
-}
\ No newline at end of file
+    Environment::Environment(Interpreter* i)
+    : parent_(nullptr), name_("<global>"), interpreter_(i)
+    {
+    }
+
+    Environment::Environment(const std::shared_ptr<Environment>& par, const std::string n)
+    : parent_(par), name_(n), interpreter_(par ? par->interpreter_ : nullptr)
+    {
+    }
+
+    bool Environment::DeclareVariable(const Atom var_name, const ScriptAny& value, const bool is_const)
+    {
+        return value_table_.emplace(var_name, EnvEntry{is_const, value}).second;
+    }
+
+    bool Environment::DeclareVariable(const std::string& var_name, const ScriptAny& value, const bool is_const)
+    {
+        return DeclareVariable(AtomTable::Intern(var_name), value, is_const);
+    }
+
+    size_t Environment::Depth() const
+    {
+        size_t depth = 0;
+        for(auto env = parent_.get(); env != nullptr; env = env->parent_.get())
+            ++depth;
+        return depth;
+    }
+
+    void Environment::ForceRemoveVariable(const std::string& var_name)
+    {
+        const auto kAtom = AtomTable::Find(var_name);
+        if(kAtom != kNoAtom)
+            value_table_.erase(kAtom);
+    }
+
+    void Environment::ForceSetVariable(const std::string& var_name, const ScriptAny& value, const bool is_const)
+    {
+        value_table_[AtomTable::Intern(var_name)] = EnvEntry{is_const, value};
+    }
+
+    Environment& Environment::G()
+    {
+        auto env = this;
+        while(env->parent_ != nullptr)
+            env = env->parent_.get();
+        return *env;
+    }
+
+    EnvEntry* Environment::LookupVariable(const Atom var_name)
+    {
+        for(auto env = this; env != nullptr; env = env->parent_.get())
+        {
+            auto found = env->value_table_.find(var_name);
+            if(found != env->value_table_.end())
+                return &found->second;
+        }
+        return nullptr;
+    }
+
+    EnvEntry* Environment::LookupVariable(const std::string& var_name)
+    {
+        // a name that was never interned cannot have been declared
+        const auto kAtom = AtomTable::Find(var_name);
+        return kAtom != kNoAtom ? LookupVariable(kAtom) : nullptr;
+    }
+
+    ScriptAny* Environment::ReassignVariable(const Atom var_name, const ScriptAny& new_value, bool& failed_const)
+    {
+        failed_const = false;
+        auto entry = LookupVariable(var_name);
+        if(entry == nullptr)
+            return nullptr;
+        if(entry->is_const)
+        {
+            failed_const = true;
+            return nullptr;
+        }
+        entry->value = new_value;
+        return &entry->value;
+    }
+
+    ScriptAny* Environment::ReassignVariable(const std::string& var_name, const ScriptAny& new_value, 
+        bool& failed_const)
+    {
+        failed_const = false;
+        const auto kAtom = AtomTable::Find(var_name);
+        return kAtom != kNoAtom ? ReassignVariable(kAtom, new_value, failed_const) : nullptr;
+    }
+
+    ScriptAny* Environment::ReassignVariable(const std::string& var_name, const ScriptAny& new_value)
+    {
+        bool failed_const;
+        return ReassignVariable(var_name, new_value, failed_const);
+    }
+
+    void Environment::UnsetVariable(const std::string& var_name)
+    {
+        const auto kAtom = AtomTable::Find(var_name);
+        if(kAtom == kNoAtom)
+            return;
+        for(auto env = this; env != nullptr; env = env->parent_.get())
+        {
+            if(env->value_table_.erase(kAtom) > 0)
+                return;
+        }
+    }
+
+    bool Environment::VariableExists(const std::string& var_name)
+    {
+        return LookupVariable(var_name) != nullptr;
+    }
+
+    Interpreter* Environment::interpreter()
+    {
+        return interpreter_;
+    }
+
+} // namespace mildew
\ No newline at end of file
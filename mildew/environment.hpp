@@ -15,10 +15,12 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
 
+#include "atom.hpp"
 #include "types/any.hpp"
 
 namespace mildew
@@ -33,15 +35,20 @@ namespace mildew
     
     class Environment
     {
+    public:
         Environment(Interpreter* i); // global environment
         Environment(const std::shared_ptr<Environment>& par, const std::string n = "<environment>");
 
+        // the std::string overloads intern the name, the virtual machine passes atoms from its constants
+        bool DeclareVariable(Atom var_name, const ScriptAny& value, const bool is_const);
         bool DeclareVariable(const std::string& var_name, const ScriptAny& value, const bool is_const);
         size_t Depth() const;
         void ForceRemoveVariable(const std::string& var_name);
         void ForceSetVariable(const std::string& var_name, const ScriptAny& value, const bool is_const);
         Environment& G();
+        EnvEntry* LookupVariable(Atom var_name);
         EnvEntry* LookupVariable(const std::string& var_name);
+        ScriptAny* ReassignVariable(Atom var_name, const ScriptAny& new_value, bool& failed_const);
         ScriptAny* ReassignVariable(const std::string& var_name, const ScriptAny& new_value, bool& failed_const);
         ScriptAny* ReassignVariable(const std::string& var_name, const ScriptAny& new_value);
         void UnsetVariable(const std::string& var_name);
@@ -53,8 +60,10 @@ namespace mildew
     private:
         std::shared_ptr<Environment> parent_;
         std::string name_;
-        std::unordered_map<std::string, EnvEntry> value_table_;
+        std::unordered_map<Atom, EnvEntry> value_table_;
         Interpreter* interpreter_; // environments must never outlive host interpreter
+        std::uint32_t gc_epoch_ = 0; // last collection that marked this environment
+        friend class Heap;
     };
 }
 
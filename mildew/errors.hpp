@@ -19,6 +19,8 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <stdexcept>
 #include <string>
 
+#include "types/any.hpp"
+
 namespace mildew
 {
     class ScriptCompileError : public std::logic_error
@@ -29,6 +31,32 @@ namespace mildew
         {}
     };
 
+    /// thrown when a bytecode image cannot be written, read, or does not match this build of the interpreter
+    class ImageError : public std::runtime_error
+    {
+    public:
+        ImageError(const std::string& msg)
+        : std::runtime_error(msg)
+        {}
+    };
+
+    /**
+     * Thrown out of the virtual machine when a script exception is not caught by the script. The thrown
+     * script value is preserved so the host can inspect it.
+     */
+    class ScriptRuntimeError : public std::runtime_error
+    {
+    public:
+        ScriptRuntimeError(const std::string& msg, const ScriptAny& thrown = ScriptAny())
+        : std::runtime_error(msg), thrown_value_(thrown)
+        {}
+
+        const ScriptAny& thrown_value() const { return thrown_value_; }
+
+    private:
+        ScriptAny thrown_value_;
+    };
+
     class UnimplementedError : public std::runtime_error
     {
     public:
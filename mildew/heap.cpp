@@ -0,0 +1,159 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "heap.hpp"
+
+#include <algorithm>
+
+#include "environment.hpp"
+#include "types/object.hpp"
+#include "vm/consttable.hpp"
+
+namespace mildew
+{
+    static thread_local Heap* tl_current_heap = nullptr;
+
+    Heap::~Heap()
+    {
+        while(objects_ != nullptr)
+        {
+            auto next = objects_->gc_next_;
+            delete objects_;
+            objects_ = next;
+        }
+        if(tl_current_heap == this)
+            tl_current_heap = nullptr;
+    }
+
+    void Heap::AddRoots(const void* owner, const RootTracer& tracer)
+    {
+        roots_.emplace_back(owner, tracer);
+    }
+
+    void Heap::RemoveRoots(const void* owner)
+    {
+        roots_.erase(std::remove_if(roots_.begin(), roots_.end(),
+            [owner](const auto& root) { return root.first == owner; }), roots_.end());
+    }
+
+    void Heap::Collect()
+    {
+        const auto kStart = std::chrono::steady_clock::now();
+        ++epoch_;
+        for(const auto& [owner, tracer] : roots_)
+            tracer(*this);
+        while(!gray_.empty())
+        {
+            auto obj = gray_.back();
+            gray_.pop_back();
+            obj->Trace(*this);
+        }
+        Sweep();
+        next_collection_ = std::max(min_threshold_, static_cast<size_t>(stats_.heap_size * growth_factor_));
+        const auto kPause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - kStart);
+        ++stats_.num_collections;
+        stats_.last_pause = kPause;
+        stats_.max_pause = std::max(stats_.max_pause, kPause);
+        stats_.total_pause += kPause;
+    }
+
+    void Heap::Mark(const ScriptAny& value)
+    {
+        if(value.IsObject())
+            Mark(value.ToValue<ScriptObject>());
+    }
+
+    void Heap::Mark(ScriptObject* obj)
+    {
+        if(obj == nullptr || obj->gc_marked_)
+            return;
+        obj->gc_marked_ = true;
+        gray_.push_back(obj);
+    }
+
+    void Heap::Mark(Environment* env)
+    {
+        for(; env != nullptr && env->gc_epoch_ != epoch_; env = env->parent_.get())
+        {
+            env->gc_epoch_ = epoch_;
+            for(const auto& [name, entry] : env->value_table_)
+                Mark(entry.value);
+        }
+    }
+
+    void Heap::Mark(const ConstTable* const_table)
+    {
+        // closures of the same function literal share one table, which only needs to be traced once
+        if(const_table == nullptr || const_table->gc_epoch_ == epoch_)
+            return;
+        const_table->gc_epoch_ = epoch_;
+        for(const auto& value : *const_table)
+            Mark(value);
+    }
+
+    void Heap::min_threshold(const size_t bytes)
+    {
+        min_threshold_ = bytes;
+        next_collection_ = std::max(min_threshold_, static_cast<size_t>(stats_.heap_size * growth_factor_));
+    }
+
+    Heap& Heap::Current()
+    {
+        static thread_local Heap default_heap;
+        return tl_current_heap != nullptr ? *tl_current_heap : default_heap;
+    }
+
+    Heap* Heap::SetCurrent(Heap* heap)
+    {
+        auto previous = tl_current_heap;
+        tl_current_heap = heap;
+        return previous;
+    }
+
+    void Heap::Track(ScriptObject* obj, const size_t size)
+    {
+        // constructors do not add fields, so every object starts out with the empty shape
+        obj->shape_ = &empty_shape_;
+        obj->gc_next_ = objects_;
+        obj->gc_size_ = static_cast<std::uint32_t>(size);
+        objects_ = obj;
+        stats_.heap_size += size;
+        ++stats_.num_objects;
+    }
+
+    void Heap::Sweep()
+    {
+        auto link = &objects_;
+        while(*link != nullptr)
+        {
+            auto obj = *link;
+            if(obj->gc_marked_)
+            {
+                obj->gc_marked_ = false;
+                link = &obj->gc_next_;
+            }
+            else
+            {
+                *link = obj->gc_next_;
+                stats_.heap_size -= obj->gc_size_;
+                --stats_.num_objects;
+                ++stats_.total_freed;
+                delete obj;
+            }
+        }
+    }
+
+} // namespace mildew
\ No newline at end of file
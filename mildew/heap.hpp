@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "types/any.hpp"
+#include "types/shape.hpp"
+
+namespace mildew
+{
+    class ConstTable;
+    class Environment;
+
+    struct HeapStats
+    {
+        size_t heap_size = 0; // bytes of live script objects, not counting their dictionaries or elements
+        size_t num_objects = 0;
+        size_t num_collections = 0;
+        size_t total_freed = 0; // objects freed by every collection so far
+        std::chrono::nanoseconds last_pause{0};
+        std::chrono::nanoseconds max_pause{0};
+        std::chrono::nanoseconds total_pause{0};
+    };
+
+    /**
+     * Owns every ScriptObject and frees the unreachable ones with a mark and sweep collection. Roots are
+     * supplied precisely by registered root sources such as the VirtualMachine, which marks its registers,
+     * call frames, and environment chains. A collection only starts at a safepoint where all live values
+     * are held by a root source, so native code that keeps script objects in C++ variables across a call
+     * back into the virtual machine must register them with AddRoots.
+     */
+    class Heap
+    {
+    public:
+        using RootTracer = std::function<void(Heap&)>;
+
+        Heap() {}
+        Heap(const Heap&) = delete;
+        ~Heap();
+        Heap& operator=(const Heap&) = delete;
+
+        /// allocates an object owned by this heap
+        template<typename T, typename... Args>
+        T* Make(Args&&... args)
+        {
+            auto obj = new T(std::forward<Args>(args)...);
+            Track(obj, sizeof(T));
+            return obj;
+        }
+
+        void AddRoots(const void* owner, const RootTracer& tracer);
+        void RemoveRoots(const void* owner);
+
+        void Collect();
+        /// true once enough has been allocated since the last collection that the next safepoint should collect
+        bool collect_requested() const { return stats_.heap_size >= next_collection_; }
+
+        void Mark(const ScriptAny& value);
+        void Mark(ScriptObject* obj);
+        void Mark(Environment* env);
+        void Mark(const ConstTable* const_table);
+
+        /// the root of the transition tree shared by every object of this heap
+        Shape* empty_shape() { return &empty_shape_; }
+        const HeapStats& stats() const { return stats_; }
+        double growth_factor() const { return growth_factor_; }
+        /// after a collection the next one is requested when the heap grows to this multiple of the live size
+        void growth_factor(const double factor) { growth_factor_ = factor; }
+        size_t min_threshold() const { return min_threshold_; }
+        void min_threshold(const size_t bytes);
+
+        /// the heap that new objects are allocated from on this thread
+        static Heap& Current();
+        /// makes heap current for this thread and returns the previously current heap, nullptr for the default
+        static Heap* SetCurrent(Heap* heap);
+
+        /// makes a heap current for the lifetime of the scope
+        class Scope
+        {
+        public:
+            explicit Scope(Heap& heap) : previous_(SetCurrent(&heap)) {}
+            Scope(const Scope&) = delete;
+            ~Scope() { SetCurrent(previous_); }
+            Scope& operator=(const Scope&) = delete;
+        private:
+            Heap* previous_;
+        };
+
+    private:
+        void Track(ScriptObject* obj, size_t size);
+        void Sweep();
+
+        Shape empty_shape_;
+        ScriptObject* objects_ = nullptr;
+        std::vector<ScriptObject*> gray_;
+        std::vector<std::pair<const void*, RootTracer>> roots_;
+        std::uint32_t epoch_ = 0;
+        HeapStats stats_;
+        size_t min_threshold_ = 1 << 20;
+        size_t next_collection_ = 1 << 20;
+        double growth_factor_ = 2.0;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -15,42 +15,163 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include "interpreter.hpp"
 
-#include <iostream>
-
+#include "compiler.hpp"
 #include "errors.hpp"
 #include "lexer.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
+#include "vm/image.hpp"
 
 namespace mildew
 {
+    static void AddLexerErrors(std::vector<std::string>& errors, const Lexer& lexer)
+    {
+        errors.emplace_back("Lexer Errors");
+        errors.insert(std::end(errors), std::begin(lexer.errors()), std::end(lexer.errors()));
+    }
+
+    Interpreter::Interpreter()
+    : heap_(std::make_unique<Heap>()), global_environment_(std::make_shared<Environment>(this)), 
+      vm_(std::make_unique<VirtualMachine>(global_environment_, *heap_))
+    {
+        heap_->AddRoots(&script_cache_, [this](Heap& heap) {
+            script_cache_.Trace(heap);
+            for(const auto& entry : instances_)
+            {
+                if(!entry.second.program.expired())
+                    heap.Mark(entry.second.function);
+            }
+        });
+    }
+
+    Interpreter::~Interpreter()
+    {
+        heap_->RemoveRoots(&script_cache_);
+        // a heap left current by a scope that outlives the interpreter must not be allocated from again
+        if(&Heap::Current() == heap_.get())
+            Heap::SetCurrent(nullptr);
+    }
+
     ScriptAny Interpreter::Evaluate(const std::string& code, const std::string& name)
     {
         errors_.clear();
-        auto lexer = Lexer(code);
-        auto tokens = lexer.Tokenize();
-        if(lexer.HasErrors())
+        auto program = script_cache_.Find(code, name);
+        if(program == nullptr)
         {
-            errors_.emplace_back("Lexer Errors");
-            errors_.insert(std::end(errors_), std::begin(lexer.errors()), std::end(lexer.errors()));
-            return ScriptAny();
+            program = Compile(code, name);
+            if(program == nullptr)
+                return ScriptAny();
+            script_cache_.Insert(code, name, program);
         }
-        std::cout << "Tokens for program " << name << std::endl;
-        for(const auto& token : tokens)
-            std::cout << token << " ";
-        std::cout << std::endl;
-        auto parser = Parser(tokens);
+        return Run(program);
+    }
+
+    ScriptFunction* Interpreter::Compile(const std::string& code, const std::string& name)
+    {
+        return Compile(code, name, backend_);
+    }
+
+    std::shared_ptr<const CompiledProgram> Interpreter::CompileShared(const std::string& code,
+        const std::string& name)
+    {
+        // closures are native functions of this heap, so only bytecode can be shared
+        const auto program = Compile(code, name, Backend::BYTECODE);
+        if(program == nullptr)
+            return nullptr;
+        return CompiledProgram::Create(*program);
+    }
+
+    ScriptFunction* Interpreter::Instantiate(const std::shared_ptr<const CompiledProgram>& program)
+    {
+        // the address of a freed program may be reused by a new one, so freed programs are forgotten first
+        for(auto entry = instances_.begin(); entry != instances_.end();)
+            entry = entry->second.program.expired() ? instances_.erase(entry) : std::next(entry);
+        const auto found = instances_.find(program.get());
+        if(found != instances_.end())
+            return found->second.function;
+        Heap::Scope heap_scope(*heap_);
+        const auto instance = program->Instantiate();
+        instances_.emplace(program.get(), Instance{program, instance});
+        return instance;
+    }
+
+    ScriptFunction* Interpreter::Compile(const std::string& code, const std::string& name, const Backend backend)
+    {
+        errors_.clear();
+        Heap::Scope heap_scope(*heap_);
+        auto lexer = Lexer(code);
         try 
         {
-            auto program = parser.ParseProgram();
-            std::cout << "Parse program success" << std::endl;
-            std::cout << program->to_string() << std::endl;
+            // the syntax tree only has to outlive the compiler
+            Arena arena;
+            // the parser reads the tokens as it goes, so lexer errors are only known once it is done
+            auto parser = Parser(lexer, arena);
+            auto tree = parser.ParseProgram();
+            if(lexer.HasErrors())
+            {
+                AddLexerErrors(errors_, lexer);
+                return nullptr;
+            }
+            tree = Optimizer(arena).Optimize(*tree);
+            if(backend == Backend::CLOSURES)
+            {
+                if(closure_runtime_ == nullptr)
+                    closure_runtime_ = std::make_unique<ClosureRuntime>(global_environment_, *heap_, *vm_);
+                try
+                {
+                    ClosureCompiler closure_compiler(*closure_runtime_);
+                    return closure_compiler.Compile(*tree, name);
+                }
+                catch(const UnimplementedError&)
+                {
+                    // constructs the closure compiler does not handle still run as bytecode
+                }
+            }
+            Compiler compiler;
+            return compiler.Compile(*tree, name);
         }
         catch(const ScriptCompileError& compile_error)
         {
+            if(lexer.HasErrors())
+            {
+                AddLexerErrors(errors_, lexer);
+                return nullptr;
+            }
             errors_.emplace_back(compile_error.what());
-            return ScriptAny();
+            return nullptr;
         }
-        return ScriptAny();
+        catch(const UnimplementedError& unimplemented)
+        {
+            errors_.emplace_back(unimplemented.what());
+            return nullptr;
+        }
+    }
+
+    ScriptFunction* Interpreter::LoadImage(const std::string& path)
+    {
+        Heap::Scope heap_scope(*heap_);
+        return BytecodeImage::Load(path);
+    }
+
+    ScriptAny Interpreter::Run(ScriptFunction* program)
+    {
+        Heap::Scope heap_scope(*heap_);
+        if(program->type() == ScriptFunction::Type::NATIVE_FUNCTION && closure_runtime_ != nullptr)
+            return closure_runtime_->Run(program, global_environment_);
+        return vm_->Run(program, global_environment_);
+    }
+
+    void Interpreter::backend(const Backend backend)
+    {
+        if(backend == backend_)
+            return;
+        backend_ = backend;
+        script_cache_.Clear();
+    }
+
+    void Interpreter::ForceSetGlobal(const std::string& name, const ScriptAny& value, const bool is_const)
+    {
+        global_environment_->ForceSetVariable(name, value, is_const);
     }
 
 } // namespace mildew
\ No newline at end of file
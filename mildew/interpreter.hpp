@@ -15,29 +15,104 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #pragma once
 
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "closurecompiler.hpp"
+#include "environment.hpp"
+#include "heap.hpp"
+#include "scriptcache.hpp"
 #include "types/any.hpp"
+#include "vm/compiledprogram.hpp"
+#include "vm/virtualmachine.hpp"
 
 namespace mildew
 {
 
+    /**
+     * An isolated script runtime with its own heap, global environment, virtual machine, and script cache.
+     * Interpreters share no mutable state except the atom table and the cppd class registry, which are
+     * synchronized, so any number of them may run at once on different threads. A single Interpreter is not
+     * synchronized and must only be used by one thread at a time. Its methods make its heap current for the
+     * calling thread while they run. ScriptFunction::Create and other allocations made by the host outside of
+     * them use the thread's current heap, so a host allocating for an interpreter holds a Heap::Scope of heap().
+     */
     class Interpreter
     {
     public:
-        Interpreter() {}
+        /// what Compile turns scripts into, either bytecode for vm() or closures for a ClosureRuntime
+        enum class Backend { BYTECODE, CLOSURES };
+
+        Interpreter();
         Interpreter(const Interpreter& i) = delete;
-        ~Interpreter() {}
+        ~Interpreter();
 
+        /**
+         * Compiles and runs code in the global environment. Lexer and compile errors are collected in
+         * errors() and an undefined value is returned, while uncaught script exceptions propagate as
+         * ScriptRuntimeError. Objects in the returned value may be collected by the next Evaluate unless
+         * they are reachable from the global environment. The program compiled from the same code and name
+         * is reused from script_cache() while it stays cached.
+         */
         ScriptAny Evaluate(const std::string& code, const std::string& name = "<program>");
+        /**
+         * Compiles code without running it. Errors are collected in errors() as by Evaluate and nullptr is
+         * returned. Like a program from LoadImage, the program is not a root of the heap, so a host that runs
+         * other code before Run must register it with Heap::AddRoots.
+         */
+        ScriptFunction* Compile(const std::string& code, const std::string& name = "<program>");
+        /**
+         * Compiles code to bytecode that any interpreter can run, whatever its backend, so that a pool of
+         * interpreters compiles a script once. Errors are collected in errors() and nullptr is returned.
+         */
+        std::shared_ptr<const CompiledProgram> CompileShared(const std::string& code,
+            const std::string& name = "<program>");
+        /**
+         * The functions of a shared program in this heap, built on first use and reused while the host keeps
+         * the program alive. The interpreter does not keep the program alive, and forgets the functions once
+         * it is freed, so they can be collected unless the script stored them elsewhere.
+         */
+        ScriptFunction* Instantiate(const std::shared_ptr<const CompiledProgram>& program);
+        /// loads a program saved with BytecodeImage::Save, throws ImageError if it cannot be loaded
+        ScriptFunction* LoadImage(const std::string& path);
+        /// runs a program in the global environment
+        ScriptAny Run(ScriptFunction* program);
+        ScriptAny Run(const std::shared_ptr<const CompiledProgram>& program) { return Run(Instantiate(program)); }
+        void ForceSetGlobal(const std::string& name, const ScriptAny& value, const bool is_const = false);
         bool HasErrors() const { return errors_.size() != 0; }
 
         Interpreter& operator=(const Interpreter& i) = delete;
 
+        Backend backend() const { return backend_; }
+        /// programs compiled for the other backend stay valid, but the script cache is cleared
+        void backend(Backend backend);
         const std::vector<std::string>& errors() const { return errors_; }
+        std::shared_ptr<Environment> global_environment() const { return global_environment_; }
+        Heap& heap() { return *heap_; }
+        ScriptCache& script_cache() { return script_cache_; }
+        VirtualMachine& vm() { return *vm_; }
     private:
+        ScriptFunction* Compile(const std::string& code, const std::string& name, Backend backend);
+
+        // declared first so that it is destroyed after everything that refers to script objects
+        std::unique_ptr<Heap> heap_;
         std::vector<std::string> errors_;
+        std::shared_ptr<Environment> global_environment_;
+        std::unique_ptr<VirtualMachine> vm_;
+        // created when the first program is compiled to closures
+        std::unique_ptr<ClosureRuntime> closure_runtime_;
+        Backend backend_ = Backend::BYTECODE;
+        ScriptCache script_cache_;
+        // the functions in this heap of each shared program that has run here and is still alive
+        struct Instance
+        {
+            std::weak_ptr<const CompiledProgram> program;
+            ScriptFunction* function;
+        };
+        std::unordered_map<const CompiledProgram*, Instance> instances_;
     };
 
 } // namespace mildew
\ No newline at end of file
@@ -83,10 +83,11 @@ namespace mildew
         }
         else if(ch == '\n')
         {
-            ++line;
+            if(line < kMaxLine)
+                ++line;
             column = 1;
         }
-        else
+        else if(column < kMaxColumn)
         {
             ++column;
         }
@@ -98,6 +99,11 @@ namespace mildew
         return os;
     }
 
+    std::string_view Source::Store(std::string text)
+    {
+        return stored_.emplace_back(std::move(text));
+    }
+
     bool Token::IsAssignmentOperator() const
     {
         return (type == Type::ASSIGN || 
@@ -116,12 +122,12 @@ namespace mildew
         );
     }
 
-    bool Token::IsIdentifier(const std::string& id) const
+    bool Token::IsIdentifier(const std::string_view id) const
     {
         return type == Type::IDENTIFIER && text == id;
     }
 
-    bool Token::IsKeyword(const std::string& keyword) const
+    bool Token::IsKeyword(const std::string_view keyword) const
     {
         return type == Type::KEYWORD && text == keyword;
     }
@@ -133,7 +139,7 @@ namespace mildew
         case Type::EOF_:
             return "\0";
         case Type::KEYWORD: case Type::INTEGER: case Type::DOUBLE: case Type::STRING: case Type::IDENTIFIER: case Type::REGEX:
-            return text;
+            return std::string(text);
         case Type::NOT: return "!";
         case Type::AND: return "&&";
         case Type::OR: return "||";
@@ -183,7 +189,7 @@ namespace mildew
         case Type::RBRACKET: return "]";
         case Type::SEMICOLON: return ";";
         case Type::COMMA: return ",";
-        case Type::LABEL: return text + ":";
+        case Type::LABEL: return std::string(text) + ":";
         case Type::QUESTION: return "?";
         case Type::COLON: return ":";
         case Type::ARROW: return "=>";
@@ -193,12 +199,12 @@ namespace mildew
         return "<invalid symbol>";
     }
 
-    Token Token::CreateFakeToken(const Type type, const std::string& text)
+    Token Token::CreateFakeToken(const Type type, const std::string_view text)
     {
         return Token{type, {0, 0}, text, LiteralFlag::NONE};
     }
 
-    Token Token::CreateInvalidToken(const Position& pos, const std::string& text)
+    Token Token::CreateInvalidToken(const Position& pos, const std::string_view text)
     {
         return Token{Type::INVALID, pos, text, LiteralFlag::NONE};
     }
@@ -282,7 +288,7 @@ namespace mildew
         return os;
     }
 
-    const std::unordered_set<std::string> Lexer::kKeywords = 
+    const std::unordered_set<std::string_view> Lexer::kKeywords = 
     {
         "true", "false", "undefined", "null",
         "var", "let", "const", 
@@ -301,59 +307,74 @@ namespace mildew
         {'0', '\0'}, {'\'', '\''}, {'"', '"'}, {'\\', '\\'}
     };
 
-    std::vector<Token> Lexer::Tokenize()
+    Token Lexer::NextToken()
     {
-        std::vector<Token> tokens;
-        if(text_ == "")
-            return tokens;
         while(index_ < text_.length())
         {
             while(IsWhiteSpace(CurrentChar()))
                 AdvanceChar();
             char c = CurrentChar();
+            Token token;
+            bool has_token = true;
             switch(c)
             {
-            case '\'': case '"': case '`': tokens.emplace_back(MakeStringToken(tokens)); break;
-            case '>': tokens.emplace_back(MakeRAngleBracketToken()); break;
-            case '<': tokens.emplace_back(MakeLAngleBracketToken()); break;
-            case '=': tokens.emplace_back(MakeEqualToken()); break;
-            case '!': tokens.emplace_back(MakeNotToken()); break;
-            case '&': tokens.emplace_back(MakeAndToken()); break;
-            case '|': tokens.emplace_back(MakeOrToken()); break;
-            case '+': tokens.emplace_back(MakePlusToken()); break;
-            case '-': tokens.emplace_back(MakeDashToken()); break;
-            case '*': tokens.emplace_back(MakeStarToken()); break;
-            case '/': HandleFSlash(tokens); break;
-            case '%': tokens.emplace_back(MakePercentToken()); break;
-            case '^': tokens.emplace_back(MakeXorToken()); break;
-            case '~': tokens.emplace_back(Token(Token::Type::BIT_NOT, pos_)); break;
-            case '(': tokens.emplace_back(Token(Token::Type::LPAREN, pos_)); break;
-            case ')': tokens.emplace_back(Token(Token::Type::RPAREN, pos_)); break;
-            case '{': tokens.emplace_back(Token(Token::Type::LBRACE, pos_)); break;
-            case '}': tokens.emplace_back(Token(Token::Type::RBRACE, pos_)); break;
-            case '[': tokens.emplace_back(Token(Token::Type::LBRACKET, pos_)); break;
-            case ']': tokens.emplace_back(Token(Token::Type::RBRACKET, pos_)); break;
-            case ';': tokens.emplace_back(Token(Token::Type::SEMICOLON, pos_)); break;
-            case ',': tokens.emplace_back(Token(Token::Type::COMMA, pos_)); break;
-            case '.': {
-                auto dots = MakeDotTokens();
-                tokens.insert(std::end(tokens), std::begin(dots), std::end(dots));
-                break;
-            }
-            case ':': tokens.emplace_back(Token(Token::Type::COLON, pos_)); break;
-            case '?': tokens.emplace_back(MakeQuestionToken()); break;
-            case '\0': tokens.emplace_back(Token(Token::Type::EOF_, pos_)); break;
+            case '\'': case '"': case '`': token = MakeStringToken(true); break;
+            case '>': token = MakeRAngleBracketToken(); break;
+            case '<': token = MakeLAngleBracketToken(); break;
+            case '=': token = MakeEqualToken(); break;
+            case '!': token = MakeNotToken(); break;
+            case '&': token = MakeAndToken(); break;
+            case '|': token = MakeOrToken(); break;
+            case '+': token = MakePlusToken(); break;
+            case '-': token = MakeDashToken(); break;
+            case '*': token = MakeStarToken(); break;
+            case '/': has_token = HandleFSlash(token); break;
+            case '%': token = MakePercentToken(); break;
+            case '^': token = MakeXorToken(); break;
+            case '~': token = Token(Token::Type::BIT_NOT, pos_); break;
+            case '(': token = Token(Token::Type::LPAREN, pos_); break;
+            case ')': token = Token(Token::Type::RPAREN, pos_); break;
+            case '{': token = Token(Token::Type::LBRACE, pos_); break;
+            case '}': token = Token(Token::Type::RBRACE, pos_); break;
+            case '[': token = Token(Token::Type::LBRACKET, pos_); break;
+            case ']': token = Token(Token::Type::RBRACKET, pos_); break;
+            case ';': token = Token(Token::Type::SEMICOLON, pos_); break;
+            case ',': token = Token(Token::Type::COMMA, pos_); break;
+            case '.': token = MakeDotToken(); break;
+            case ':': token = Token(Token::Type::COLON, pos_); break;
+            case '?': token = MakeQuestionToken(); break;
+            case '\0': token = Token(Token::Type::EOF_, pos_); break;
             default:
                 if(StartsKWorID(c))
-                    tokens.emplace_back(MakeIdKwOrLabel(tokens));
+                    token = MakeIdKwOrLabel();
                 else if(IsDigit(c))
-                    tokens.emplace_back(MakeIntOrDoubleToken());
+                    token = MakeIntOrDoubleToken();
                 else 
+                {
                     AddError("Invalid character ", c, " at ", pos_);
+                    has_token = false;
+                }
             }
             AdvanceChar();
+            if(has_token)
+            {
+                previous_ = token;
+                return token;
+            }
         }
-        tokens.emplace_back(Token(Token::Type::EOF_));
+        return Token(Token::Type::EOF_);
+    }
+
+    std::vector<Token> Lexer::Tokenize()
+    {
+        std::vector<Token> tokens;
+        if(text_ == "")
+            return tokens;
+        do 
+        {
+            tokens.emplace_back(NextToken());
+        } 
+        while(tokens.back().type != Token::Type::EOF_);
         return tokens;
     }
 
@@ -365,11 +386,9 @@ namespace mildew
         return ret;
     }
 
-    bool Lexer::CanMakeRegex(const std::vector<Token>& tokens) const
+    bool Lexer::CanMakeRegex() const
     {
-        if(tokens.size() == 0)
-            return true;
-        switch((tokens.end() - 1)->type)
+        switch(previous_.type)
         {
         case Token::Type::IDENTIFIER:
         case Token::Type::INTEGER:
@@ -381,7 +400,7 @@ namespace mildew
         case Token::Type::DEC:
             return false;
         case Token::Type::KEYWORD: {
-            const std::string& text = (tokens.end() - 1)->text;
+            const auto text = previous_.text;
             if(text == "null" || text == "true" || text == "false")
                 return false;
             return true;
@@ -398,7 +417,26 @@ namespace mildew
         return '\0';
     }
 
-    void Lexer::HandleFSlash(std::vector<Token>& tokens)
+    size_t Lexer::FindRawStringQuote() const
+    {
+        auto skip_white_space = [this](size_t i) {
+            while(i < text_.length() && IsWhiteSpace(text_[i]))
+                ++i;
+            return i;
+        };
+        auto i = skip_white_space(index_);
+        if(i >= text_.length() || text_[i] != '.')
+            return 0;
+        i = skip_white_space(i + 1);
+        if(text_.compare(i, 3, "raw") != 0 || (i + 3 < text_.length() && ContinuesKWorID(text_[i + 3])))
+            return 0;
+        i = skip_white_space(i + 3);
+        if(i < text_.length() && (text_[i] == '\'' || text_[i] == '"' || text_[i] == '`'))
+            return i;
+        return 0;
+    }
+
+    bool Lexer::HandleFSlash(Token& token)
     {
         if(Match('*')) // block comment
         {
@@ -412,6 +450,7 @@ namespace mildew
                 AdvanceChar();
             }
             AdvanceChar();
+            return false;
         }
         else if(Match('/')) // single line comment
         {
@@ -419,8 +458,9 @@ namespace mildew
             {
                 AdvanceChar();
             }
+            return false;
         }
-        else if(CanMakeRegex(tokens))
+        else if(CanMakeRegex())
         {
             std::string accum = "";
             auto start_pos = pos_;
@@ -464,20 +504,21 @@ namespace mildew
             {
                 AddError("Malformed/invalid regex literal at position ",
                     start_pos);
-                return;
+                return false;
             }
-            tokens.emplace_back(Token(Token::Type::REGEX, start_pos, accum));
+            token = Token(Token::Type::REGEX, start_pos, source_->Store(std::move(accum)));
         }
         else if(PeekChar() == '=')
         {
             const auto start_pos = pos_;
             AdvanceChar();
-            tokens.emplace_back(Token(Token::Type::FSLASH_ASSIGN, start_pos));
+            token = Token(Token::Type::FSLASH_ASSIGN, start_pos);
         }
         else 
         {
-            tokens.emplace_back(Token(Token::Type::FSLASH, pos_));
+            token = Token(Token::Type::FSLASH, pos_);
         }
+        return true;
     }
 
     Token Lexer::MakeAndToken()
@@ -502,21 +543,17 @@ namespace mildew
             return Token(Token::Type::DASH, start_pos);
     }
 
-    std::vector<Token> Lexer::MakeDotTokens()
+    Token Lexer::MakeDotToken()
     {
         auto start_pos = pos_;
-        if(Match('.'))
-        {
-            if(Match('.'))
-                return std::vector<Token>({Token(Token::Type::TDOT, start_pos)});
-            else 
-                return std::vector<Token>({Token(Token::Type::DOT, start_pos),
-                    Token(Token::Type::DOT, pos_)});
-        }
-        else 
+        // only three dots make a spread token, two dots are two dot tokens
+        if(PeekChar() == '.' && index_ + 2 < text_.length() && text_[index_ + 2] == '.')
         {
-            return std::vector<Token>({Token(Token::Type::DOT, pos_)});
+            AdvanceChar();
+            AdvanceChar();
+            return Token(Token::Type::TDOT, start_pos);
         }
+        return Token(Token::Type::DOT, start_pos);
     }
 
     Token Lexer::MakeEqualToken()
@@ -539,7 +576,7 @@ namespace mildew
         }
     }
 
-    Token Lexer::MakeIdKwOrLabel(const std::vector<Token>& tokens)
+    Token Lexer::MakeIdKwOrLabel()
     {
         const auto start = index_;
         auto start_pos = pos_;
@@ -547,12 +584,27 @@ namespace mildew
         while(ContinuesKWorID(CurrentChar()))
             AdvanceChar();
         auto text = text_.substr(start, index_ - start);
+        if(text == "String")
+        {
+            // String.raw followed by a string literal is read as one string without escape sequences
+            const auto kQuote = FindRawStringQuote();
+            if(kQuote != 0)
+            {
+                while(index_ < kQuote)
+                    AdvanceChar();
+                return MakeStringToken(false);
+            }
+        }
         --index_;
+        Token token(Token::Type::IDENTIFIER, start_pos, text);
         if(text == "return" || text == "throw" || text == "delete"
           || text == "catch" || text == "finally")
         {
-            if(tokens.size() > 0 && (tokens.end() -1)->type == Token::Type::DOT)
-                return Token(Token::Type::IDENTIFIER, start_pos, text);
+            if(previous_.type == Token::Type::DOT)
+            {
+                token.atom = AtomTable::Intern(std::string(text));
+                return token;
+            }
         }
 
         if(kKeywords.count(text) > 0)
@@ -561,12 +613,10 @@ namespace mildew
         }
         else if(Match(':'))
         {
-            return Token(Token::Type::LABEL, start_pos, text);
-        }
-        else 
-        {
-            return Token(Token::Type::IDENTIFIER, start_pos, text);
+            token.type = Token::Type::LABEL;
         }
+        token.atom = AtomTable::Intern(std::string(text));
+        return token;
     }
 
     Token Lexer::MakeIntOrDoubleToken()
@@ -756,42 +806,38 @@ namespace mildew
         }
     }
 
-    Token Lexer::MakeStringToken(std::vector<Token>& previous)
+    Token Lexer::MakeStringToken(const bool escape_chars)
     {
         const char kCloseQuote = CurrentChar();
         auto start_pos = pos_;
         AdvanceChar();
-        std::string text = "";
-        bool escape_chars = true;
-        if(previous.size() >= 3)
-        {
-            if((previous.end()-1)->IsIdentifier("raw") &&
-               (previous.end()-2)->type == Token::Type::DOT &&
-               (previous.end()-3)->IsIdentifier("String"))
-            {
-                escape_chars = false;
-                previous.resize(previous.size() - 3);
-            }
-        }
+        // a literal without escape sequences is a slice of the source, the others are decoded into a copy
+        const auto kStart = index_;
+        std::string decoded;
+        bool has_escapes = false;
+        auto slice = [&]() { return text_.substr(kStart, index_ - kStart); };
         const Token::LiteralFlag kLflag = kCloseQuote == '`' ? Token::LiteralFlag::TEMPLATE_STRING : Token::LiteralFlag::NONE;
         while(CurrentChar() != kCloseQuote)
         {
             if(CurrentChar() == '\0')
             {
                 AddError("Missing close quote at ", pos_);
-                return Token::CreateInvalidToken(pos_, text);
+                return Token::CreateInvalidToken(pos_, has_escapes ? source_->Store(decoded) : slice());
             }
             else if(CurrentChar() == '\n' && kLflag != Token::LiteralFlag::TEMPLATE_STRING)
             {
                 AddError("Line breaks inside regular string literals are not allowed at", pos_);
-                return Token::CreateInvalidToken(pos_, text);
+                return Token::CreateInvalidToken(pos_, has_escapes ? source_->Store(decoded) : slice());
             }
             else if(CurrentChar() == '\\' && escape_chars)
             {
+                if(!has_escapes)
+                    decoded = slice();
+                has_escapes = true;
                 AdvanceChar();
                 if(kEscapeChars.count(CurrentChar()) > 0)
                 {
-                    text += kEscapeChars.at(CurrentChar());
+                    decoded += kEscapeChars.at(CurrentChar());
                 }
                 else if(CurrentChar() == 'u')
                 {
@@ -819,12 +865,12 @@ namespace mildew
                     --index_;
                     try 
                     {
-                        text += cppd::EncodeChar32(std::stoi(accum, nullptr, 16));
+                        decoded += cppd::EncodeChar32(std::stoi(accum, nullptr, 16));
                     }
                     catch(const std::exception&)
                     {
                         AddError("Invalid UTF32 at ", pos_);
-                        return Token::CreateInvalidToken(pos_, accum);
+                        return Token::CreateInvalidToken(pos_, source_->Store(accum));
                     }
                 }
                 else if(CurrentChar() == 'x')
@@ -837,27 +883,29 @@ namespace mildew
                     try 
                     {
                         const char result = std::stoi(accum, nullptr, 16);
-                        text += result;
+                        decoded += result;
                     }
                     catch(const std::exception&)
                     {
                         AddError("Invalid hexadecimal number at ", pos_);
-                        return Token::CreateInvalidToken(pos_, accum);
+                        return Token::CreateInvalidToken(pos_, source_->Store(accum));
                     }
                 }
                 else 
                 {
                     AddError("Unknown escape character ", CurrentChar(), " at ", pos_);
-                    return Token::CreateInvalidToken(start_pos, text);
+                    return Token::CreateInvalidToken(start_pos, source_->Store(decoded));
                 }
             }
-            else 
+            else if(has_escapes)
             {
-                text += CurrentChar();
+                decoded += CurrentChar();
             }
             AdvanceChar();
         }
-        return Token(Token::Type::STRING, start_pos, text, kLflag);
+        if(has_escapes)
+            return Token(Token::Type::STRING, start_pos, source_->Store(std::move(decoded)), kLflag);
+        return Token(Token::Type::STRING, start_pos, slice(), kLflag);
     }
 
     Token Lexer::MakeXorToken()
@@ -15,26 +15,59 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #pragma once
 
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "atom.hpp"
+
 namespace mildew
 {
+    /// a line and column packed in 32 bits, each stops counting at its limit since they only feed error messages
     struct Position final
     {
-        int line=0, column=0;
+        static constexpr std::uint32_t kMaxLine = (1u << 20) - 1;
+        static constexpr std::uint32_t kMaxColumn = (1u << 12) - 1;
+
+        std::uint32_t line : 20;
+        std::uint32_t column : 12;
         void Advance(const char ch);
     };
 
     std::ostream& operator<<(std::ostream& os, const Position& pos);
 
+    /**
+     * The immutable text of a script, shared by the lexer, the tokens, and the trees parsed from them. Tokens
+     * refer to their text with views into the script, so tokenizing copies nothing. The few token texts that
+     * are not a slice of the script, such as string literals with escape sequences, are stored here as well.
+     * The Source must outlive every token and tree that refers to it.
+     */
+    class Source final
+    {
+    public:
+        explicit Source(std::string text) : text_(std::move(text)) {}
+        Source(const Source&) = delete;
+        Source& operator=(const Source&) = delete;
+
+        /// keeps a text that is not part of the script for as long as the source exists
+        std::string_view Store(std::string text);
+        std::string_view text() const { return text_; }
+
+    private:
+        const std::string text_;
+        std::deque<std::string> stored_; // a deque never moves the strings it already holds
+    };
+
     struct Token final
     {
-        enum class Type 
+        enum class Type : std::uint8_t
         {
             EOF_, KEYWORD, INTEGER, DOUBLE, STRING, IDENTIFIER, REGEX,
             NOT, AND, OR, GT, GE, LT, LE,
@@ -55,26 +88,28 @@ namespace mildew
             INVALID
         };
 
-        enum class LiteralFlag
+        enum class LiteralFlag : std::uint8_t
         {
             NONE, BINARY, OCTAL, HEXADECIMAL, TEMPLATE_STRING
         };
 
-        Token(const Token::Type t = Token::Type::EOF_, const Position& p = {0,0}, const std::string& txt = "", const LiteralFlag lflag = LiteralFlag::NONE)
+        Token(const Token::Type t = Token::Type::EOF_, const Position& p = {0,0}, const std::string_view txt = {}, const LiteralFlag lflag = LiteralFlag::NONE)
         : type{t}, position{p}, text{txt}, literal_flag{lflag} {}
 
         bool IsAssignmentOperator() const;
-        bool IsIdentifier(const std::string& id) const;
-        bool IsKeyword(const std::string& keyword) const;
+        bool IsIdentifier(const std::string_view id) const;
+        bool IsKeyword(const std::string_view keyword) const;
         std::string Symbol() const;
 
-        static Token CreateFakeToken(const Type type, const std::string& text);
-        static Token CreateInvalidToken(const Position& pos, const std::string& text = "");
+        /// text must outlive the token, like the text of every other token
+        static Token CreateFakeToken(const Type type, const std::string_view text);
+        static Token CreateInvalidToken(const Position& pos, const std::string_view text = {});
 
         Type type = Type::EOF_;
         Position position = {0, 0};
-        std::string text;
+        std::string_view text; // a view into the Source the token was read from, empty for punctuation
         LiteralFlag literal_flag = LiteralFlag::NONE;
+        Atom atom = kNoAtom; // the interned text of identifiers and labels
     };
 
     std::ostream& operator<<(std::ostream& os, const Token::Type token_type);
@@ -82,13 +117,20 @@ namespace mildew
 
     struct Lexer final
     {
-        Lexer(const std::string& text) : text_(text) {}
+        Lexer(std::string text) : Lexer(std::make_shared<Source>(std::move(text))) {}
+        Lexer(const std::shared_ptr<Source>& source) : source_(source), text_(source->text()) {}
+        /// tokenizes a part of a source, which is how the expressions of template strings are read
+        Lexer(const std::shared_ptr<Source>& source, const std::string_view text) : source_(source), text_(text) {}
         
-        bool HasErrors() { return errors_.size() != 0; }
+        bool HasErrors() const { return errors_.size() != 0; }
         const std::vector<std::string>& errors() const { return errors_; }
+        /// reads the next token, or an EOF token once the end of the text is reached
+        Token NextToken();
+        const std::shared_ptr<Source>& source() const { return source_; }
+        /// reads every remaining token, the last of which is EOF unless the text is empty
         std::vector<Token> Tokenize();
 
-        static const std::unordered_set<std::string> kKeywords;
+        static const std::unordered_set<std::string_view> kKeywords;
         static const std::unordered_map<char, char> kEscapeChars;
 
     private:
@@ -100,14 +142,17 @@ namespace mildew
             errors_.emplace_back(ss.str());
         }
         char AdvanceChar();
-        bool CanMakeRegex(const std::vector<Token>& tokens) const;
+        bool CanMakeRegex() const;
         char CurrentChar() const;
-        void HandleFSlash(std::vector<Token>& tokens);
+        /// the index of the quote that starts the string after a String.raw, or 0 if there is none
+        size_t FindRawStringQuote() const;
+        /// a comment or a malformed regex produces no token
+        bool HandleFSlash(Token& token);
         Token MakeAndToken();
         Token MakeDashToken();
-        std::vector<Token> MakeDotTokens();
+        Token MakeDotToken();
         Token MakeEqualToken();
-        Token MakeIdKwOrLabel(const std::vector<Token>& tokens);
+        Token MakeIdKwOrLabel();
         Token MakeIntOrDoubleToken();
         Token MakeLAngleBracketToken();
         Token MakeNotToken();
@@ -117,14 +162,16 @@ namespace mildew
         Token MakeQuestionToken();
         Token MakeRAngleBracketToken();
         Token MakeStarToken();
-        Token MakeStringToken(std::vector<Token>& previous);
+        Token MakeStringToken(bool escape_chars);
         Token MakeXorToken();
         bool Match(const char ch);
         char PeekChar() const;
 
         Position pos_ = {1, 1};
-        std::string text_;
+        std::shared_ptr<Source> source_;
+        std::string_view text_;
         size_t index_ = 0;
+        Token previous_; // regex literals and keywords used as field names depend on the token before them
         std::vector<std::string> errors_;
     };
 }
\ No newline at end of file
@@ -16,33 +16,72 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "nodes.hpp"
 
 #include <sstream>
+#include <stdexcept>
 
-#include "visitors.hpp"
+#include "errors.hpp"
+#include "util/sfmt.hpp"
 
 namespace mildew
 {
-    std::ostream& operator<<(std::ostream& os, const ExpressionNode& node)
+    static std::string LabelPrefix(const std::string_view label)
     {
-        os << node.to_string();
-        return os;
+        return label.empty() ? "" : std::string(label) + ": ";
     }
 
-    std::any LiteralNode::Accept(IExpressionVisitor& visitor) const
+    std::ostream& operator<<(std::ostream& os, const ExpressionNode& node)
     {
-        return visitor.VisitLiteralNode(*this);
+        os << node.to_string();
+        return os;
     }
 
     std::string LiteralNode::to_string() const
     {
-        std::string result = literal_token.text;
+        std::string result(literal_token.text);
         if(literal_token.type == Token::Type::STRING)
             result = '"' + result + '"';
         return result;
     }
 
-    std::any FunctionLiteralNode::Accept(IExpressionVisitor& visitor) const
+    ScriptAny LiteralNode::Value() const
     {
-        return visitor.VisitFunctionLiteralNode(*this);
+        switch(literal_token.type)
+        {
+        case Token::Type::KEYWORD:
+            if(literal_token.text == "true")
+                return ScriptAny(true);
+            else if(literal_token.text == "false")
+                return ScriptAny(false);
+            else if(literal_token.text == "null")
+                return ScriptAny(nullptr);
+            return ScriptAny();
+        case Token::Type::INTEGER: {
+            int base = 10;
+            std::string digits(literal_token.text);
+            switch(literal_token.literal_flag)
+            {
+            case Token::LiteralFlag::BINARY: base = 2; digits = literal_token.text.substr(2); break;
+            case Token::LiteralFlag::OCTAL: base = 8; digits = literal_token.text.substr(2); break;
+            case Token::LiteralFlag::HEXADECIMAL: base = 16; digits = literal_token.text.substr(2); break;
+            default: break;
+            }
+            try
+            {
+                return ScriptAny(static_cast<std::int64_t>(std::stoll(digits, nullptr, base)));
+            }
+            catch(const std::out_of_range&)
+            {
+                return ScriptAny(std::stod(std::string(literal_token.text)));
+            }
+        }
+        case Token::Type::DOUBLE:
+            return ScriptAny(std::stod(std::string(literal_token.text)));
+        case Token::Type::STRING:
+            return ScriptAny(std::string(literal_token.text));
+        case Token::Type::REGEX:
+            throw UnimplementedError("regular expression literals");
+        default:
+            throw ScriptCompileError(MakeString("Invalid literal ", literal_token, " at ", literal_token.position));
+        }
     }
 
     std::string FunctionLiteralNode::to_string() const
@@ -64,11 +103,6 @@ namespace mildew
         return output;
     }
 
-    std::any LambdaNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitLambdaNode(*this);
-    }
-
     std::string LambdaNode::to_string() const
     {
         std::string result = "(";
@@ -96,18 +130,13 @@ namespace mildew
         return result;
     }
 
-    std::any TemplateStringNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitTemplateStringNode(*this);
-    }
-
     std::string TemplateStringNode::to_string() const
     {
         std::ostringstream ss;
         ss << '`';
         for(const auto& node : nodes)
         {
-            if(const auto lit = std::dynamic_pointer_cast<LiteralNode>(node))
+            if(const auto lit = dynamic_cast<const LiteralNode*>(node))
                 ss << lit->literal_token.text;
             else
                 ss << "${" << node->to_string() << '}';
@@ -116,11 +145,6 @@ namespace mildew
         return ss.str();
     }
 
-    std::any ArrayLiteralNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitArrayLiteralNode(*this);
-    }
-
     std::string ArrayLiteralNode::to_string() const
     {
         std::string result = "[";
@@ -134,11 +158,6 @@ namespace mildew
         return result;
     }
 
-    std::any ObjectLiteralNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitObjectLiteralNode(*this);
-    }
-
     std::string ObjectLiteralNode::to_string() const
     {
         if(keys.size() != value_nodes.size())
@@ -146,7 +165,7 @@ namespace mildew
         std::string result = "{";
         for(size_t i = 0; i < keys.size(); ++i)
         {
-            result += keys[i] + ':' + value_nodes[i]->to_string();
+            result += std::string(keys[i]) + ':' + value_nodes[i]->to_string();
             if(i < keys.size() - 1)
                 result += ", ";
         }
@@ -158,38 +177,23 @@ namespace mildew
     {
         std::string result = "class ";
         if(class_name != "")
-            result += class_name + ' ';
+            result += std::string(class_name) + ' ';
         if(base_class)
             result += "extends " + base_class->to_string();
         result += "{ <class definition...> }";
         return result;
     }
 
-    std::any ClassLiteralNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitClassLiteralNode(*this);
-    }
-
     std::string ClassLiteralNode::to_string() const
     {
         return class_definition->to_string();
     }
 
-    std::any BinaryOpNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitBinaryOpNode(*this);
-    }
-
     std::string BinaryOpNode::to_string() const
     {
         return "(" + left_node->to_string() + op_token.Symbol() + right_node->to_string() + ")";
     }
 
-    std::any UnaryOpNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitUnaryOpNode(*this);
-    }
-
     std::string UnaryOpNode::to_string() const 
     {
         if(is_postfix)
@@ -198,30 +202,15 @@ namespace mildew
             return "(" + op_token.Symbol() + operand_node->to_string() + ")";
     }
 
-    std::any TerniaryOpNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitTerniaryOpNode(*this);
-    }
-
     std::string TerniaryOpNode::to_string() const
     {
         return "(" + condition_node->to_string() + " ? " + on_true_node->to_string() + " : "
             + on_false_node->to_string() + ")";
     }
 
-    std::any VarAccessNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitVarAccessNode(*this);
-    }
-
     std::string VarAccessNode::to_string() const
     {
-        return var_token.text;
-    }
-
-    std::any FunctionCallNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitFunctionCallNode(*this);
+        return std::string(var_token.text);
     }
 
     std::string FunctionCallNode::to_string() const
@@ -237,51 +226,26 @@ namespace mildew
         return result;
     }
 
-    std::any ArrayIndexNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitArrayIndexNode(*this);
-    }
-
     std::string ArrayIndexNode::to_string() const
     {
         return object_node->to_string() + '[' + index_node->to_string() + ']';
     }
 
-    std::any MemberAccessNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitMemberAccessNode(*this);
-    }
-
     std::string MemberAccessNode::to_string() const
     {
         return object_node->to_string() + '.' + member_node->to_string();
     }
 
-    std::any NewExpressionNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitNewExpressionNode(*this);
-    }
-
     std::string NewExpressionNode::to_string() const
     {
         return "new " + function_call_node->to_string();
     }
 
-    std::any SuperNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitSuperNode(*this);
-    }
-
     std::string SuperNode::to_string() const
     {
         return "super";
     }
 
-    std::any YieldNode::Accept(IExpressionVisitor& visitor) const
-    {
-        return visitor.VisitYieldNode(*this);
-    }
-
     std::string YieldNode::to_string() const
     {
         return "yield " + (yield_expression_node ? yield_expression_node->to_string() : "");
@@ -293,14 +257,9 @@ namespace mildew
         return os;
     }
 
-    std::any VarDeclarationStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitVarDeclarationStatementNode(*this);
-    }
-
     std::string VarDeclarationStatementNode::to_string() const
     {
-        std::string result = qualifier_token.text + ' ';
+        std::string result = std::string(qualifier_token.text) + ' ';
         for(size_t i = 0; i < assignment_nodes.size(); ++i)
         {
             result += assignment_nodes[i]->to_string();
@@ -311,11 +270,6 @@ namespace mildew
         return result;
     }
 
-    std::any BlockStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitBlockStatementNode(*this);
-    }
-
     std::string BlockStatementNode::to_string() const
     {
         std::string result = "{\n";
@@ -325,11 +279,6 @@ namespace mildew
         return result;
     }
 
-    std::any IfStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitIfStatementNode(*this);
-    }
-
     std::string IfStatementNode::to_string() const
     {
         std::string result = "if(" + condition_node->to_string() + ") " + on_true_statement->to_string();
@@ -338,82 +287,47 @@ namespace mildew
         return result;
     }
 
-    std::any SwitchStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitSwitchStatementNode(*this);
-    }
-
     std::string SwitchStatementNode::to_string() const
     {
         // TODO complete
         return "switch(" + expression_node->to_string() + "){...}";
     }
 
-    std::any WhileStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitWhileStatementNode(*this);
-    }
-
     std::string WhileStatementNode::to_string() const
     {
-        return ((label == "")? "" : (label + ": ")) + "while(" + condition_node->to_string() + ") " 
+        return LabelPrefix(label) + "while(" + condition_node->to_string() + ") " 
             + body_node->to_string();
     }
 
-    std::any DoWhileStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitDoWhileStatementNode(*this);
-    }
-
     std::string DoWhileStatementNode::to_string() const
     {
-        return ((label == "") ? "" : (label + ": ")) + "do " + body_node->to_string() + " while("
+        return LabelPrefix(label) + "do " + body_node->to_string() + " while("
             + condition_node->to_string() + ");";
     }
 
-    std::any ForStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitForStatementNode(*this);
-    }
-
     std::string ForStatementNode::to_string() const
     {
-        return ((label == "") ? "" : (label + ": ")) + "for(" + (init_statement? init_statement->to_string(): "")
+        return LabelPrefix(label) + "for(" + (init_statement? init_statement->to_string(): "")
             + "; " + (condition_node? condition_node->to_string(): "") + "; "
             + (increment_node? increment_node->to_string(): "") + ") " + body_node->to_string();
     }
 
-    std::any ForOfStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitForOfStatementNode(*this);
-    }
-
     std::string ForOfStatementNode::to_string() const
     {
-        std::string result = ((label == "") ? "" : (label + ": ")) + "for(" + qualifier_token.text + ' ';
+        std::string result = LabelPrefix(label) + "for(" + std::string(qualifier_token.text) + ' ';
         for(size_t i = 0; i < var_access_nodes.size(); ++i)
         {
             result += var_access_nodes[i]->to_string();
             if(i < var_access_nodes.size() - 1)
                 result += ", ";
         }
-        result += ' ' + of_in_token.text + object_to_iterate->to_string() + ") " + body_node->to_string();
+        result += ' ' + std::string(of_in_token.text) + object_to_iterate->to_string() + ") " + body_node->to_string();
         return result;
     }
 
-    std::any BreakOrContinueStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitBreakOrContinueStatementNode(*this);
-    }
-
     std::string BreakOrContinueStatementNode::to_string() const
     {
-        return break_or_continue.text + ((label == "") ? "": (" " + label)) + ';';
-    }
-
-    std::any ReturnStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitReturnStatementNode(*this);
+        return std::string(break_or_continue.text) + (label.empty() ? "" : " " + std::string(label)) + ';';
     }
 
     std::string ReturnStatementNode::to_string() const
@@ -421,14 +335,9 @@ namespace mildew
         return "return" + (expression_node? (" " + expression_node->to_string()): "") + ";";
     }
 
-    std::any FunctionDeclarationStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitFunctionDeclarationStatementNode(*this);
-    }
-
     std::string FunctionDeclarationStatementNode::to_string() const
     {
-        std::string result = "function " + name + "(";
+        std::string result = "function " + std::string(name) + "(";
         for(size_t i = 0; i < argument_names.size(); ++i)
         {
             result += argument_names[i];
@@ -445,54 +354,29 @@ namespace mildew
         return result;
     }
 
-    std::any ThrowStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitThrowStatementNode(*this);
-    }
-
     std::string ThrowStatementNode::to_string() const
     {
         return "throw " + expression_node->to_string() + ";";
     }
 
-    std::any TryBlockStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitTryBlockStatementNode(*this);
-    }
-
     std::string TryBlockStatementNode::to_string() const
     {
         return "try " + try_block_node->to_string() 
-            + (catch_block_node? ("catch(" + exception_name + ")" + catch_block_node->to_string()): "")
+            + (catch_block_node? ("catch(" + std::string(exception_name) + ")" + catch_block_node->to_string()): "")
             + (finally_block_node? ("finally " + finally_block_node->to_string()): "")
             + ';';
     }
 
-    std::any DeleteStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitDeleteStatementNode(*this);
-    }
-
     std::string DeleteStatementNode::to_string() const
     {
         return "delete " + access_node->to_string() + ';';
     }
 
-    std::any ClassDeclarationStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitClassDeclarationStatementNode(*this);
-    }
-
     std::string ClassDeclarationStatementNode::to_string() const
     {
         return class_definition->to_string();
     }
 
-    std::any ExpressionStatementNode::Accept(IStatementVisitor& visitor) const
-    {
-        return visitor.VisitExpressionStatementNode(*this);
-    }
-
     std::string ExpressionStatementNode::to_string() const
     {
         if(expression_node)
@@ -500,4 +384,73 @@ namespace mildew
         else 
             return "<empty expression statement>;"; // for debugging
     }
+
+    std::string_view DeclaredName(const ExpressionNode& node)
+    {
+        if(auto bonode = dynamic_cast<const BinaryOpNode*>(&node))
+            return static_cast<const VarAccessNode&>(*bonode->left_node).var_token.text;
+        return static_cast<const VarAccessNode&>(node).var_token.text;
+    }
+
+    bool IsLexical(const Token& qualifier)
+    {
+        return qualifier.text == "let" || qualifier.text == "const";
+    }
+
+    // var declarations belong to the enclosing function no matter how deeply they are nested in statements
+    void CollectVarNames(const StatementNode* node, std::vector<std::string_view>& names)
+    {
+        if(node == nullptr)
+            return;
+        if(auto vdsnode = dynamic_cast<const VarDeclarationStatementNode*>(node))
+        {
+            if(IsLexical(vdsnode->qualifier_token))
+                return;
+            for(const auto& assignment : vdsnode->assignment_nodes)
+                names.emplace_back(DeclaredName(*assignment));
+        }
+        else if(auto bsnode = dynamic_cast<const BlockStatementNode*>(node))
+        {
+            for(const auto& stmt : bsnode->statement_nodes)
+                CollectVarNames(stmt, names);
+        }
+        else if(auto isnode = dynamic_cast<const IfStatementNode*>(node))
+        {
+            CollectVarNames(isnode->on_true_statement, names);
+            CollectVarNames(isnode->on_false_statement, names);
+        }
+        else if(auto wsnode = dynamic_cast<const WhileStatementNode*>(node))
+        {
+            CollectVarNames(wsnode->body_node, names);
+        }
+        else if(auto dwsnode = dynamic_cast<const DoWhileStatementNode*>(node))
+        {
+            CollectVarNames(dwsnode->body_node, names);
+        }
+        else if(auto fsnode = dynamic_cast<const ForStatementNode*>(node))
+        {
+            CollectVarNames(fsnode->init_statement, names);
+            CollectVarNames(fsnode->body_node, names);
+        }
+        else if(auto fosnode = dynamic_cast<const ForOfStatementNode*>(node))
+        {
+            if(!IsLexical(fosnode->qualifier_token))
+            {
+                for(const auto& vanode : fosnode->var_access_nodes)
+                    names.emplace_back(vanode->var_token.text);
+            }
+            CollectVarNames(fosnode->body_node, names);
+        }
+        else if(auto tbsnode = dynamic_cast<const TryBlockStatementNode*>(node))
+        {
+            CollectVarNames(tbsnode->try_block_node, names);
+            CollectVarNames(tbsnode->catch_block_node, names);
+            CollectVarNames(tbsnode->finally_block_node, names);
+        }
+        else if(auto ssnode = dynamic_cast<const SwitchStatementNode*>(node))
+        {
+            for(const auto& stmt : ssnode->statement_nodes)
+                CollectVarNames(stmt, names);
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,744 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "optimizer.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+
+namespace mildew
+{
+    // the visitors see nodes through const references, but every node was made mutable in an arena
+    template<typename T>
+    static T* Mutable(const T& node)
+    {
+        return const_cast<T*>(&node);
+    }
+
+    static const LiteralNode& AsLiteral(const ExpressionNode* node)
+    {
+        return static_cast<const LiteralNode&>(*node);
+    }
+
+    static bool IsDeclaration(const StatementNode* node)
+    {
+        return node->kind == StatementNode::Kind::VAR_DECLARATION
+            || node->kind == StatementNode::Kind::FUNCTION_DECLARATION
+            || node->kind == StatementNode::Kind::CLASS_DECLARATION;
+    }
+
+    // a branch that declares a variable of the enclosing scope is kept, because the variable exists even if the
+    // branch never runs
+    static bool CanRemove(const StatementNode* node)
+    {
+        if(node == nullptr)
+            return true;
+        if(IsDeclaration(node))
+            return false;
+        std::vector<std::string_view> var_names;
+        CollectVarNames(node, var_names);
+        return var_names.empty();
+    }
+
+    // the shortest text that reads back as the same double
+    static std::string DoubleText(const double value)
+    {
+        char buffer[32];
+        for(int precision = 15; precision <= 17; ++precision)
+        {
+            std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+            if(std::strtod(buffer, nullptr) == value)
+                break;
+        }
+        return buffer;
+    }
+
+    // operators are evaluated exactly as the virtual machine evaluates their opcodes
+    static std::optional<ScriptAny> FoldBinary(const Token& op_token, const ScriptAny& left, const ScriptAny& right)
+    {
+        switch(op_token.type)
+        {
+        case Token::Type::PLUS: return left + right;
+        case Token::Type::DASH: return left - right;
+        case Token::Type::STAR: return left * right;
+        case Token::Type::FSLASH: return left / right;
+        case Token::Type::PERCENT: return left % right;
+        case Token::Type::POW: return left.Pow(right);
+        case Token::Type::BIT_AND: return left & right;
+        case Token::Type::BIT_OR: return left | right;
+        case Token::Type::BIT_XOR: return left ^ right;
+        case Token::Type::BIT_LSHIFT: return left << right;
+        case Token::Type::BIT_RSHIFT: return left >> right;
+        case Token::Type::BIT_URSHIFT: return left.UnsignedRightShift(right);
+        case Token::Type::EQUALS: return ScriptAny(left == right);
+        case Token::Type::NEQUALS: return ScriptAny(!(left == right));
+        case Token::Type::STRICT_EQUALS: return ScriptAny(left.StrictEquals(right));
+        case Token::Type::STRICT_NEQUALS: return ScriptAny(!left.StrictEquals(right));
+        case Token::Type::LT: return ScriptAny(left.IsLessThan(right));
+        case Token::Type::LE: return ScriptAny(left.IsLessOrEqual(right));
+        case Token::Type::GT: return ScriptAny(right.IsLessThan(left));
+        case Token::Type::GE: return ScriptAny(right.IsLessOrEqual(left));
+        default: return std::nullopt;
+        }
+    }
+
+    static std::optional<ScriptAny> FoldUnary(const Token& op_token, const ScriptAny& operand)
+    {
+        if(op_token.IsKeyword("typeof"))
+            return ScriptAny(std::string(operand.TypeOf()));
+        switch(op_token.type)
+        {
+        case Token::Type::NOT: return ScriptAny(!operand.ToValue<bool>());
+        case Token::Type::DASH: return -operand;
+        case Token::Type::PLUS: return operand.ToNumber();
+        case Token::Type::BIT_NOT: return ~operand;
+        default: return std::nullopt;
+        }
+    }
+
+    BlockStatementNode* Optimizer::Optimize(const BlockStatementNode& program)
+    {
+        scopes_.clear();
+        PushFunctionScope(ArenaList<std::string_view>(), program.statement_nodes);
+        const auto kStatements = OptimizeStatements(program.statement_nodes, false);
+        PopScope();
+        if(kStatements.begin() == program.statement_nodes.begin())
+            return Mutable(program);
+        return arena_.Make<BlockStatementNode>(program.line, kStatements);
+    }
+
+    ExpressionNode* Optimizer::Optimize(const ExpressionNode& expression)
+    {
+        scopes_.clear();
+        return VisitExpression(expression);
+    }
+
+    bool Optimizer::IsConstant(const ExpressionNode* node)
+    {
+        return node != nullptr && node->kind == ExpressionNode::Kind::LITERAL
+            && AsLiteral(node).literal_token.type != Token::Type::REGEX;
+    }
+
+    ExpressionNode* Optimizer::VisitLiteralNode(const LiteralNode& lnode)
+    {
+        return Mutable(lnode);
+    }
+
+    ExpressionNode* Optimizer::VisitFunctionLiteralNode(const FunctionLiteralNode& flnode)
+    {
+        PushFunctionScope(flnode.arg_list, flnode.statements);
+        if(!flnode.optional_name.empty())
+            Declare(flnode.optional_name);
+        const auto kDefaultArgs = OptimizeExpressions(flnode.default_arguments);
+        const auto kStatements = OptimizeStatements(flnode.statements, false);
+        PopScope();
+        if(kDefaultArgs.begin() == flnode.default_arguments.begin() && kStatements.begin() == flnode.statements.begin())
+            return Mutable(flnode);
+        return arena_.Make<FunctionLiteralNode>(flnode.token, flnode.arg_list, kDefaultArgs, kStatements,
+            flnode.optional_name, flnode.is_class, flnode.is_generator);
+    }
+
+    ExpressionNode* Optimizer::VisitLambdaNode(const LambdaNode& lnode)
+    {
+        PushFunctionScope(lnode.argument_list, lnode.statements);
+        const auto kDefaultArgs = OptimizeExpressions(lnode.default_arguments);
+        if(lnode.return_expression)
+        {
+            const auto kReturn = OptimizeExpression(lnode.return_expression);
+            PopScope();
+            if(kDefaultArgs.begin() == lnode.default_arguments.begin() && kReturn == lnode.return_expression)
+                return Mutable(lnode);
+            return arena_.Make<LambdaNode>(lnode.arrow_token, lnode.argument_list, kDefaultArgs, kReturn);
+        }
+        const auto kStatements = OptimizeStatements(lnode.statements, false);
+        PopScope();
+        if(kDefaultArgs.begin() == lnode.default_arguments.begin() && kStatements.begin() == lnode.statements.begin())
+            return Mutable(lnode);
+        return arena_.Make<LambdaNode>(lnode.arrow_token, lnode.argument_list, kDefaultArgs, kStatements);
+    }
+
+    ExpressionNode* Optimizer::VisitTemplateStringNode(const TemplateStringNode& tsnode)
+    {
+        const auto kNodes = OptimizeExpressions(tsnode.nodes);
+        if(kNodes.begin() == tsnode.nodes.begin())
+            return Mutable(tsnode);
+        return arena_.Make<TemplateStringNode>(kNodes);
+    }
+
+    ExpressionNode* Optimizer::VisitArrayLiteralNode(const ArrayLiteralNode& alnode)
+    {
+        const auto kValues = OptimizeExpressions(alnode.value_nodes);
+        if(kValues.begin() == alnode.value_nodes.begin())
+            return Mutable(alnode);
+        return arena_.Make<ArrayLiteralNode>(kValues);
+    }
+
+    ExpressionNode* Optimizer::VisitObjectLiteralNode(const ObjectLiteralNode& olnode)
+    {
+        const auto kValues = OptimizeExpressions(olnode.value_nodes);
+        if(kValues.begin() == olnode.value_nodes.begin())
+            return Mutable(olnode);
+        return arena_.Make<ObjectLiteralNode>(olnode.keys, kValues);
+    }
+
+    ExpressionNode* Optimizer::VisitClassLiteralNode(const ClassLiteralNode& clnode)
+    {
+        auto cdef = OptimizeClass(*clnode.class_definition);
+        if(cdef == clnode.class_definition)
+            return Mutable(clnode);
+        return arena_.Make<ClassLiteralNode>(clnode.class_token, cdef);
+    }
+
+    ExpressionNode* Optimizer::VisitBinaryOpNode(const BinaryOpNode& bonode)
+    {
+        ExpressionNode* left = nullptr;
+        ExpressionNode* right = nullptr;
+        if(bonode.op_token.IsAssignmentOperator())
+        {
+            left = OptimizeTarget(bonode.left_node);
+            right = OptimizeExpression(bonode.right_node);
+        }
+        else
+        {
+            left = OptimizeExpression(bonode.left_node);
+            const auto kType = bonode.op_token.type;
+            // a logical operator with a known left operand is either that operand or its right operand
+            if(IsConstant(left) && (kType == Token::Type::AND || kType == Token::Type::OR
+              || kType == Token::Type::NULLC))
+            {
+                const auto kValue = AsLiteral(left).Value();
+                bool is_left = false;
+                if(kType == Token::Type::AND)
+                    is_left = !kValue.ToValue<bool>();
+                else if(kType == Token::Type::OR)
+                    is_left = kValue.ToValue<bool>();
+                else
+                    is_left = kValue.type() != ScriptAny::Type::UNDEFINED && kValue.type() != ScriptAny::Type::NULL_;
+                return is_left ? left : OptimizeExpression(bonode.right_node);
+            }
+            right = OptimizeExpression(bonode.right_node);
+            if(IsConstant(left) && IsConstant(right))
+            {
+                const auto kResult = FoldBinary(bonode.op_token, AsLiteral(left).Value(), AsLiteral(right).Value());
+                if(kResult)
+                {
+                    if(auto literal = MakeLiteral(*kResult, bonode.op_token.position))
+                        return literal;
+                }
+            }
+        }
+        if(left == bonode.left_node && right == bonode.right_node)
+            return Mutable(bonode);
+        return arena_.Make<BinaryOpNode>(bonode.op_token, left, right);
+    }
+
+    ExpressionNode* Optimizer::VisitUnaryOpNode(const UnaryOpNode& uonode)
+    {
+        ExpressionNode* operand = nullptr;
+        if(uonode.op_token.type == Token::Type::INC || uonode.op_token.type == Token::Type::DEC)
+        {
+            operand = OptimizeTarget(uonode.operand_node);
+        }
+        else
+        {
+            operand = OptimizeExpression(uonode.operand_node);
+            if(IsConstant(operand))
+            {
+                const auto kResult = FoldUnary(uonode.op_token, AsLiteral(operand).Value());
+                if(kResult)
+                {
+                    if(auto literal = MakeLiteral(*kResult, uonode.op_token.position))
+                        return literal;
+                }
+            }
+        }
+        if(operand == uonode.operand_node)
+            return Mutable(uonode);
+        return arena_.Make<UnaryOpNode>(uonode.op_token, operand, uonode.is_postfix);
+    }
+
+    ExpressionNode* Optimizer::VisitTerniaryOpNode(const TerniaryOpNode& tonode)
+    {
+        auto condition = OptimizeExpression(tonode.condition_node);
+        if(IsConstant(condition))
+        {
+            if(AsLiteral(condition).Value().ToValue<bool>())
+                return OptimizeExpression(tonode.on_true_node);
+            return OptimizeExpression(tonode.on_false_node);
+        }
+        auto on_true = OptimizeExpression(tonode.on_true_node);
+        auto on_false = OptimizeExpression(tonode.on_false_node);
+        if(condition == tonode.condition_node && on_true == tonode.on_true_node && on_false == tonode.on_false_node)
+            return Mutable(tonode);
+        return arena_.Make<TerniaryOpNode>(condition, on_true, on_false);
+    }
+
+    ExpressionNode* Optimizer::VisitVarAccessNode(const VarAccessNode& vanode)
+    {
+        // the innermost scope that declares the name decides what it refers to
+        for(auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope)
+        {
+            auto found = scope->variables.find(vanode.var_token.text);
+            if(found == scope->variables.end())
+                continue;
+            if(found->second == nullptr)
+                break;
+            auto token = found->second->literal_token;
+            token.position = vanode.var_token.position;
+            return arena_.Make<LiteralNode>(token);
+        }
+        return Mutable(vanode);
+    }
+
+    ExpressionNode* Optimizer::VisitFunctionCallNode(const FunctionCallNode& fcnode)
+    {
+        auto function = OptimizeExpression(fcnode.function_to_call);
+        const auto kArgs = OptimizeExpressions(fcnode.argument_nodes);
+        if(function == fcnode.function_to_call && kArgs.begin() == fcnode.argument_nodes.begin())
+            return Mutable(fcnode);
+        return arena_.Make<FunctionCallNode>(function, kArgs, fcnode.return_this);
+    }
+
+    ExpressionNode* Optimizer::VisitArrayIndexNode(const ArrayIndexNode& ainode)
+    {
+        auto object = OptimizeExpression(ainode.object_node);
+        auto index = OptimizeExpression(ainode.index_node);
+        if(object == ainode.object_node && index == ainode.index_node)
+            return Mutable(ainode);
+        return arena_.Make<ArrayIndexNode>(object, index);
+    }
+
+    ExpressionNode* Optimizer::VisitMemberAccessNode(const MemberAccessNode& manode)
+    {
+        // the member is a field name and not a variable
+        auto object = OptimizeExpression(manode.object_node);
+        if(object == manode.object_node)
+            return Mutable(manode);
+        return arena_.Make<MemberAccessNode>(object, manode.dot_token, manode.member_node);
+    }
+
+    ExpressionNode* Optimizer::VisitNewExpressionNode(const NewExpressionNode& nenode)
+    {
+        auto call = static_cast<FunctionCallNode*>(VisitFunctionCallNode(*nenode.function_call_node));
+        if(call == nenode.function_call_node)
+            return Mutable(nenode);
+        return arena_.Make<NewExpressionNode>(call);
+    }
+
+    ExpressionNode* Optimizer::VisitSuperNode(const SuperNode& snode)
+    {
+        return Mutable(snode);
+    }
+
+    ExpressionNode* Optimizer::VisitYieldNode(const YieldNode& ynode)
+    {
+        auto expression = OptimizeExpression(ynode.yield_expression_node);
+        if(expression == ynode.yield_expression_node)
+            return Mutable(ynode);
+        return arena_.Make<YieldNode>(ynode.yield_token, expression);
+    }
+
+    StatementNode* Optimizer::VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode)
+    {
+        const bool kIsConst = vdsnode.qualifier_token.text == "const";
+        std::vector<ExpressionNode*> nodes;
+        bool is_changed = false;
+        for(const auto& node : vdsnode.assignment_nodes)
+        {
+            auto result = node;
+            if(node->kind == ExpressionNode::Kind::BINARY_OP)
+            {
+                const auto& bonode = static_cast<const BinaryOpNode&>(*node);
+                auto value = OptimizeExpression(bonode.right_node);
+                if(value != bonode.right_node)
+                    result = arena_.Make<BinaryOpNode>(bonode.op_token, bonode.left_node, value);
+                if(kIsConst && IsConstant(value))
+                    BindConstant(DeclaredName(*node), &AsLiteral(value));
+            }
+            is_changed = is_changed || result != node;
+            nodes.push_back(result);
+        }
+        if(!is_changed)
+            return Mutable(vdsnode);
+        return arena_.Make<VarDeclarationStatementNode>(vdsnode.line, vdsnode.qualifier_token,
+            arena_.MakeList(nodes));
+    }
+
+    StatementNode* Optimizer::VisitBlockStatementNode(const BlockStatementNode& bsnode)
+    {
+        PushScope(true);
+        DeclareLexical(bsnode.statement_nodes);
+        const auto kStatements = OptimizeStatements(bsnode.statement_nodes, false);
+        PopScope();
+        if(kStatements.begin() == bsnode.statement_nodes.begin())
+            return Mutable(bsnode);
+        return arena_.Make<BlockStatementNode>(bsnode.line, kStatements);
+    }
+
+    StatementNode* Optimizer::VisitIfStatementNode(const IfStatementNode& isnode)
+    {
+        auto condition = OptimizeExpression(isnode.condition_node);
+        if(IsConstant(condition))
+        {
+            const bool kIsTrue = AsLiteral(condition).Value().ToValue<bool>();
+            const auto taken = kIsTrue ? isnode.on_true_statement : isnode.on_false_statement;
+            const auto skipped = kIsTrue ? isnode.on_false_statement : isnode.on_true_statement;
+            // a declaration must stay in a branch, where it is not hoisted into the enclosing block
+            if(CanRemove(skipped) && (taken == nullptr || !IsDeclaration(taken)))
+                return OptimizeStatement(taken);
+        }
+        auto on_true = OptimizeBody(isnode.on_true_statement);
+        auto on_false = OptimizeBody(isnode.on_false_statement);
+        if(condition == isnode.condition_node && on_true == isnode.on_true_statement
+          && on_false == isnode.on_false_statement)
+            return Mutable(isnode);
+        return arena_.Make<IfStatementNode>(isnode.line, condition, on_true, on_false);
+    }
+
+    StatementNode* Optimizer::VisitSwitchStatementNode(const SwitchStatementNode& ssnode)
+    {
+        auto expression = OptimizeExpression(ssnode.expression_node);
+        PushScope(false);
+        DeclareLexical(ssnode.statement_nodes);
+        // the jump table refers to the statements by index
+        const auto kStatements = OptimizeStatements(ssnode.statement_nodes, true);
+        PopScope();
+        if(expression == ssnode.expression_node && kStatements.begin() == ssnode.statement_nodes.begin())
+            return Mutable(ssnode);
+        return arena_.Make<SwitchStatementNode>(ssnode.line, expression, kStatements, ssnode.default_statement_id,
+            ssnode.jump_table);
+    }
+
+    StatementNode* Optimizer::VisitWhileStatementNode(const WhileStatementNode& wsnode)
+    {
+        auto condition = OptimizeExpression(wsnode.condition_node);
+        auto body = OptimizeBody(wsnode.body_node);
+        if(condition == wsnode.condition_node && body == wsnode.body_node)
+            return Mutable(wsnode);
+        return arena_.Make<WhileStatementNode>(wsnode.line, condition, body, wsnode.label);
+    }
+
+    StatementNode* Optimizer::VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode)
+    {
+        auto body = OptimizeBody(dwsnode.body_node);
+        auto condition = OptimizeExpression(dwsnode.condition_node);
+        if(condition == dwsnode.condition_node && body == dwsnode.body_node)
+            return Mutable(dwsnode);
+        return arena_.Make<DoWhileStatementNode>(dwsnode.line, body, condition, dwsnode.label);
+    }
+
+    StatementNode* Optimizer::VisitForStatementNode(const ForStatementNode& fsnode)
+    {
+        PushScope(true);
+        if(fsnode.init_statement)
+            DeclareLexical(ArenaList<StatementNode*>(&fsnode.init_statement, 1));
+        auto init = OptimizeStatement(fsnode.init_statement);
+        auto condition = OptimizeExpression(fsnode.condition_node);
+        auto increment = OptimizeExpression(fsnode.increment_node);
+        auto body = OptimizeBody(fsnode.body_node);
+        PopScope();
+        if(init == fsnode.init_statement && condition == fsnode.condition_node
+          && increment == fsnode.increment_node && body == fsnode.body_node)
+            return Mutable(fsnode);
+        return arena_.Make<ForStatementNode>(fsnode.line, init, condition, increment, body, fsnode.label);
+    }
+
+    StatementNode* Optimizer::VisitForOfStatementNode(const ForOfStatementNode& fosnode)
+    {
+        auto object = OptimizeExpression(fosnode.object_to_iterate);
+        PushScope(true);
+        for(const auto& vanode : fosnode.var_access_nodes)
+            Declare(vanode->var_token.text);
+        auto body = OptimizeBody(fosnode.body_node);
+        PopScope();
+        if(object == fosnode.object_to_iterate && body == fosnode.body_node)
+            return Mutable(fosnode);
+        return arena_.Make<ForOfStatementNode>(fosnode.line, fosnode.qualifier_token, fosnode.of_in_token,
+            fosnode.var_access_nodes, object, body, fosnode.label);
+    }
+
+    StatementNode* Optimizer::VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode& bocsnode)
+    {
+        return Mutable(bocsnode);
+    }
+
+    StatementNode* Optimizer::VisitReturnStatementNode(const ReturnStatementNode& rsnode)
+    {
+        auto expression = OptimizeExpression(rsnode.expression_node);
+        if(expression == rsnode.expression_node)
+            return Mutable(rsnode);
+        return arena_.Make<ReturnStatementNode>(rsnode.line, expression);
+    }
+
+    StatementNode* Optimizer::VisitFunctionDeclarationStatementNode(const FunctionDeclarationStatementNode& fdsnode)
+    {
+        PushFunctionScope(fdsnode.argument_names, fdsnode.statement_nodes);
+        const auto kDefaultArgs = OptimizeExpressions(fdsnode.default_arguments);
+        const auto kStatements = OptimizeStatements(fdsnode.statement_nodes, false);
+        PopScope();
+        if(kDefaultArgs.begin() == fdsnode.default_arguments.begin()
+          && kStatements.begin() == fdsnode.statement_nodes.begin())
+            return Mutable(fdsnode);
+        return arena_.Make<FunctionDeclarationStatementNode>(fdsnode.line, fdsnode.name, fdsnode.argument_names,
+            kDefaultArgs, kStatements, fdsnode.is_generator);
+    }
+
+    StatementNode* Optimizer::VisitThrowStatementNode(const ThrowStatementNode& tsnode)
+    {
+        auto expression = OptimizeExpression(tsnode.expression_node);
+        if(expression == tsnode.expression_node)
+            return Mutable(tsnode);
+        return arena_.Make<ThrowStatementNode>(tsnode.line, expression);
+    }
+
+    StatementNode* Optimizer::VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode)
+    {
+        auto try_block = OptimizeBody(tbsnode.try_block_node);
+        StatementNode* catch_block = nullptr;
+        if(tbsnode.catch_block_node)
+        {
+            PushScope(true);
+            if(tbsnode.exception_name != "")
+                Declare(tbsnode.exception_name);
+            catch_block = OptimizeBody(tbsnode.catch_block_node);
+            PopScope();
+        }
+        auto finally_block = OptimizeBody(tbsnode.finally_block_node);
+        if(try_block == tbsnode.try_block_node && catch_block == tbsnode.catch_block_node
+          && finally_block == tbsnode.finally_block_node)
+            return Mutable(tbsnode);
+        return arena_.Make<TryBlockStatementNode>(tbsnode.line, try_block, tbsnode.exception_name, catch_block,
+            finally_block);
+    }
+
+    StatementNode* Optimizer::VisitDeleteStatementNode(const DeleteStatementNode& dsnode)
+    {
+        auto access = OptimizeTarget(dsnode.access_node);
+        if(access == dsnode.access_node)
+            return Mutable(dsnode);
+        return arena_.Make<DeleteStatementNode>(dsnode.line, dsnode.delete_token, access);
+    }
+
+    StatementNode* Optimizer::VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode)
+    {
+        auto cdef = OptimizeClass(*cdsnode.class_definition);
+        if(cdef == cdsnode.class_definition)
+            return Mutable(cdsnode);
+        return arena_.Make<ClassDeclarationStatementNode>(cdsnode.line, cdsnode.class_token, cdef);
+    }
+
+    StatementNode* Optimizer::VisitExpressionStatementNode(const ExpressionStatementNode& esnode)
+    {
+        auto expression = OptimizeExpression(esnode.expression_node);
+        if(expression == esnode.expression_node)
+            return Mutable(esnode);
+        return arena_.Make<ExpressionStatementNode>(esnode.line, expression);
+    }
+
+    void Optimizer::BindConstant(const std::string_view name, const LiteralNode* value)
+    {
+        // a const that is not declared on entering its scope could be skipped, as in if(x) const y = 1;
+        auto& scope = scopes_.back();
+        auto found = scope.variables.find(name);
+        if(scope.allows_constants && found != scope.variables.end())
+            found->second = value;
+    }
+
+    void Optimizer::Declare(const std::string_view name)
+    {
+        scopes_.back().variables[name] = nullptr;
+    }
+
+    void Optimizer::DeclareLexical(const ArenaList<StatementNode*>& statements)
+    {
+        for(const auto& stmt : statements)
+        {
+            if(auto vdsnode = dynamic_cast<const VarDeclarationStatementNode*>(stmt))
+            {
+                if(!IsLexical(vdsnode->qualifier_token))
+                    continue;
+                for(const auto& node : vdsnode->assignment_nodes)
+                    Declare(DeclaredName(*node));
+            }
+            else if(auto fdsnode = dynamic_cast<const FunctionDeclarationStatementNode*>(stmt))
+            {
+                Declare(fdsnode->name);
+            }
+            else if(auto cdsnode = dynamic_cast<const ClassDeclarationStatementNode*>(stmt))
+            {
+                Declare(cdsnode->class_definition->class_name);
+            }
+        }
+    }
+
+    LiteralNode* Optimizer::MakeLiteral(const ScriptAny& value, const Position& position)
+    {
+        switch(value.type())
+        {
+        case ScriptAny::Type::UNDEFINED:
+            return arena_.Make<LiteralNode>(Token(Token::Type::KEYWORD, position, "undefined"));
+        case ScriptAny::Type::NULL_:
+            return arena_.Make<LiteralNode>(Token(Token::Type::KEYWORD, position, "null"));
+        case ScriptAny::Type::BOOLEAN:
+            return arena_.Make<LiteralNode>(Token(Token::Type::KEYWORD, position,
+                value.ToValue<bool>() ? "true" : "false"));
+        case ScriptAny::Type::INTEGER:
+            return arena_.Make<LiteralNode>(Token(Token::Type::INTEGER, position,
+                arena_.CopyString(std::to_string(value.ToValue<std::int64_t>()))));
+        case ScriptAny::Type::DOUBLE:
+            return arena_.Make<LiteralNode>(Token(Token::Type::DOUBLE, position,
+                arena_.CopyString(DoubleText(value.ToValue<double>()))));
+        case ScriptAny::Type::STRING: {
+            const auto kText = value.ToString();
+            if(kText.size() > kMaxStringLength)
+                return nullptr;
+            return arena_.Make<LiteralNode>(Token(Token::Type::STRING, position, arena_.CopyString(kText)));
+        }
+        default:
+            return nullptr;
+        }
+    }
+
+    StatementNode* Optimizer::OptimizeBody(const StatementNode* node)
+    {
+        if(node == nullptr)
+            return nullptr;
+        auto result = OptimizeStatement(node);
+        if(result == nullptr)
+            return arena_.Make<BlockStatementNode>(node->line, ArenaList<StatementNode*>());
+        return result;
+    }
+
+    ClassDefinition* Optimizer::OptimizeClass(const ClassDefinition& cdef)
+    {
+        auto base_class = OptimizeExpression(cdef.base_class);
+        auto constructor = cdef.constructor;
+        if(constructor)
+            constructor = static_cast<FunctionLiteralNode*>(VisitFunctionLiteralNode(*constructor));
+        const auto kMethods = OptimizeMethods(cdef.methods);
+        const auto kGetMethods = OptimizeMethods(cdef.get_methods);
+        const auto kSetMethods = OptimizeMethods(cdef.set_methods);
+        const auto kStaticMethods = OptimizeMethods(cdef.static_methods);
+        if(base_class == cdef.base_class && constructor == cdef.constructor && kMethods.begin() == cdef.methods.begin()
+          && kGetMethods.begin() == cdef.get_methods.begin() && kSetMethods.begin() == cdef.set_methods.begin()
+          && kStaticMethods.begin() == cdef.static_methods.begin())
+            return Mutable(cdef);
+        return arena_.Make<ClassDefinition>(cdef.class_name, constructor, cdef.method_names, kMethods,
+            cdef.get_method_names, kGetMethods, cdef.set_method_names, kSetMethods, cdef.static_method_names,
+            kStaticMethods, base_class);
+    }
+
+    ExpressionNode* Optimizer::OptimizeExpression(const ExpressionNode* node)
+    {
+        if(node == nullptr)
+            return nullptr;
+        return VisitExpression(*node);
+    }
+
+    // a list that did not change is returned as it was, so callers compare the data of lists to find changes
+    ArenaList<ExpressionNode*> Optimizer::OptimizeExpressions(const ArenaList<ExpressionNode*>& nodes)
+    {
+        std::vector<ExpressionNode*> results;
+        bool is_changed = false;
+        for(const auto& node : nodes)
+        {
+            results.push_back(OptimizeExpression(node));
+            is_changed = is_changed || results.back() != node;
+        }
+        return is_changed ? arena_.MakeList(results) : nodes;
+    }
+
+    ArenaList<FunctionLiteralNode*> Optimizer::OptimizeMethods(const ArenaList<FunctionLiteralNode*>& methods)
+    {
+        std::vector<FunctionLiteralNode*> results;
+        bool is_changed = false;
+        for(const auto& method : methods)
+        {
+            results.push_back(static_cast<FunctionLiteralNode*>(VisitFunctionLiteralNode(*method)));
+            is_changed = is_changed || results.back() != method;
+        }
+        return is_changed ? arena_.MakeList(results) : methods;
+    }
+
+    StatementNode* Optimizer::OptimizeStatement(const StatementNode* node)
+    {
+        if(node == nullptr)
+            return nullptr;
+        return VisitStatement(*node);
+    }
+
+    ArenaList<StatementNode*> Optimizer::OptimizeStatements(const ArenaList<StatementNode*>& statements,
+        const bool keep_positions)
+    {
+        // function declarations are hoisted to the top of their block by the compiler, so they are visited
+        // before the consts declared in the block are known
+        std::vector<StatementNode*> results(statements.size());
+        for(size_t i = 0; i < statements.size(); ++i)
+        {
+            if(statements[i]->kind == StatementNode::Kind::FUNCTION_DECLARATION)
+                results[i] = OptimizeStatement(statements[i]);
+        }
+        for(size_t i = 0; i < statements.size(); ++i)
+        {
+            if(statements[i]->kind != StatementNode::Kind::FUNCTION_DECLARATION)
+                results[i] = keep_positions ? OptimizeBody(statements[i]) : OptimizeStatement(statements[i]);
+        }
+        bool is_changed = false;
+        size_t num_kept = 0;
+        for(size_t i = 0; i < statements.size(); ++i)
+        {
+            is_changed = is_changed || results[i] != statements[i];
+            if(results[i] != nullptr)
+                results[num_kept++] = results[i];
+        }
+        results.resize(num_kept);
+        return is_changed ? arena_.MakeList(results) : statements;
+    }
+
+    ExpressionNode* Optimizer::OptimizeTarget(ExpressionNode* node)
+    {
+        if(node->kind == ExpressionNode::Kind::VAR_ACCESS)
+            return node;
+        return OptimizeExpression(node);
+    }
+
+    void Optimizer::PopScope()
+    {
+        scopes_.pop_back();
+    }
+
+    void Optimizer::PushFunctionScope(const ArenaList<std::string_view>& args,
+        const ArenaList<StatementNode*>& statements)
+    {
+        PushScope(true);
+        for(const auto& arg : args)
+            Declare(arg);
+        std::vector<std::string_view> var_names;
+        for(const auto& stmt : statements)
+            CollectVarNames(stmt, var_names);
+        for(const auto& name : var_names)
+            Declare(name);
+        DeclareLexical(statements);
+    }
+
+    void Optimizer::PushScope(const bool allows_constants)
+    {
+        scopes_.push_back({{}, allows_constants});
+    }
+
+} // namespace mildew
\ No newline at end of file
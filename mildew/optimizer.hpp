@@ -0,0 +1,121 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "nodes.hpp"
+#include "util/arena.hpp"
+#include "visitors.hpp"
+
+namespace mildew
+{
+    /**
+     * Rewrites a syntax tree before it is compiled. Operators whose operands are known at compile time are
+     * evaluated with the same ScriptAny operations the virtual machine uses, references to a const that was
+     * initialized with such a value are replaced by the value wherever the const is certainly initialized, and
+     * the branches of if statements and conditional expressions that can never run are dropped. New nodes are
+     * made in the arena and unchanged subtrees are shared with the original tree, which is left as it was.
+     */
+    class Optimizer : public ExpressionVisitor<Optimizer, ExpressionNode*>,
+                      public StatementVisitor<Optimizer, StatementNode*>
+    {
+    public:
+        explicit Optimizer(Arena& arena) : arena_(arena) {}
+        Optimizer(const Optimizer&) = delete;
+        Optimizer& operator=(const Optimizer&) = delete;
+
+        BlockStatementNode* Optimize(const BlockStatementNode& program);
+        /// folds an expression on its own, so variables it refers to are never replaced
+        ExpressionNode* Optimize(const ExpressionNode& expression);
+
+        /// true for a literal whose value is known at compile time, which a regular expression is not
+        static bool IsConstant(const ExpressionNode* node);
+
+        ExpressionNode* VisitLiteralNode(const LiteralNode& lnode);
+        ExpressionNode* VisitFunctionLiteralNode(const FunctionLiteralNode& flnode);
+        ExpressionNode* VisitLambdaNode(const LambdaNode& lnode);
+        ExpressionNode* VisitTemplateStringNode(const TemplateStringNode& tsnode);
+        ExpressionNode* VisitArrayLiteralNode(const ArrayLiteralNode& alnode);
+        ExpressionNode* VisitObjectLiteralNode(const ObjectLiteralNode& olnode);
+        ExpressionNode* VisitClassLiteralNode(const ClassLiteralNode& clnode);
+        ExpressionNode* VisitBinaryOpNode(const BinaryOpNode& bonode);
+        ExpressionNode* VisitUnaryOpNode(const UnaryOpNode& uonode);
+        ExpressionNode* VisitTerniaryOpNode(const TerniaryOpNode& tonode);
+        ExpressionNode* VisitVarAccessNode(const VarAccessNode& vanode);
+        ExpressionNode* VisitFunctionCallNode(const FunctionCallNode& fcnode);
+        ExpressionNode* VisitArrayIndexNode(const ArrayIndexNode& ainode);
+        ExpressionNode* VisitMemberAccessNode(const MemberAccessNode& manode);
+        ExpressionNode* VisitNewExpressionNode(const NewExpressionNode& nenode);
+        ExpressionNode* VisitSuperNode(const SuperNode& snode);
+        ExpressionNode* VisitYieldNode(const YieldNode& ynode);
+
+        // statements that are removed become nullptr
+        StatementNode* VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode);
+        StatementNode* VisitBlockStatementNode(const BlockStatementNode& bsnode);
+        StatementNode* VisitIfStatementNode(const IfStatementNode& isnode);
+        StatementNode* VisitSwitchStatementNode(const SwitchStatementNode& ssnode);
+        StatementNode* VisitWhileStatementNode(const WhileStatementNode& wsnode);
+        StatementNode* VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode);
+        StatementNode* VisitForStatementNode(const ForStatementNode& fsnode);
+        StatementNode* VisitForOfStatementNode(const ForOfStatementNode& fosnode);
+        StatementNode* VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode& bocsnode);
+        StatementNode* VisitReturnStatementNode(const ReturnStatementNode& rsnode);
+        StatementNode* VisitFunctionDeclarationStatementNode(const FunctionDeclarationStatementNode& fdsnode);
+        StatementNode* VisitThrowStatementNode(const ThrowStatementNode& tsnode);
+        StatementNode* VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode);
+        StatementNode* VisitDeleteStatementNode(const DeleteStatementNode& dsnode);
+        StatementNode* VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode);
+        StatementNode* VisitExpressionStatementNode(const ExpressionStatementNode& esnode);
+
+    private:
+        /// longer strings are left to be made at run time rather than stored in the program
+        static constexpr size_t kMaxStringLength = 4096;
+
+        struct Scope
+        {
+            /// the literal value of each const known at this point of the scope, nullptr for other variables
+            std::unordered_map<std::string_view, const LiteralNode*> variables;
+            /// false for switch bodies, where a case label can jump past the declaration of a const
+            bool allows_constants;
+        };
+
+        void BindConstant(std::string_view name, const LiteralNode* value);
+        void Declare(std::string_view name);
+        void DeclareLexical(const ArenaList<StatementNode*>& statements);
+        LiteralNode* MakeLiteral(const ScriptAny& value, const Position& position);
+        /// a statement that must still be there, such as a loop body, becomes an empty block when removed
+        StatementNode* OptimizeBody(const StatementNode* node);
+        ClassDefinition* OptimizeClass(const ClassDefinition& cdef);
+        ExpressionNode* OptimizeExpression(const ExpressionNode* node);
+        ArenaList<ExpressionNode*> OptimizeExpressions(const ArenaList<ExpressionNode*>& nodes);
+        ArenaList<FunctionLiteralNode*> OptimizeMethods(const ArenaList<FunctionLiteralNode*>& methods);
+        StatementNode* OptimizeStatement(const StatementNode* node);
+        ArenaList<StatementNode*> OptimizeStatements(const ArenaList<StatementNode*>& statements,
+            bool keep_positions);
+        /// the variable stored to by an assignment stays a variable, only the parts of an element access fold
+        ExpressionNode* OptimizeTarget(ExpressionNode* node);
+        void PopScope();
+        void PushFunctionScope(const ArenaList<std::string_view>& args, const ArenaList<StatementNode*>& statements);
+        void PushScope(bool allows_constants);
+
+        Arena& arena_;
+        std::vector<Scope> scopes_;
+    };
+
+} // namespace mildew
\ No newline at end of file
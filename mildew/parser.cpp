@@ -16,10 +16,13 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "parser.hpp"
 
 #include <algorithm>
+#include <stdexcept>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "errors.hpp"
 #include "lexer.hpp"
+#include "optimizer.hpp"
 #include "util/sfmt.hpp"
 
 namespace mildew
@@ -185,17 +188,17 @@ namespace mildew
             || token.IsKeyword("for");
     }
 
-    std::shared_ptr<ExpressionNode> Parser::ParseExpression(int min_prec)
+    ExpressionNode* Parser::ParseExpression(int min_prec)
     {
-        std::shared_ptr<ExpressionNode> primary_left = nullptr;
+        ExpressionNode* primary_left = nullptr;
         CheckEOF("expression");
         const int un_op_prec = UnaryOpPrecedence(*current_token_);
         if(un_op_prec > min_prec)
         {
-            const auto& op_token = *current_token_;
+            const auto op_token = *current_token_;
             NextToken();
             primary_left = ParsePrimaryExpression();
-            primary_left = std::make_shared<UnaryOpNode>(op_token, primary_left);
+            primary_left = arena_.Make<UnaryOpNode>(op_token, primary_left);
         }
         else 
         {
@@ -207,17 +210,17 @@ namespace mildew
         {
             if(UnaryOpPrecedence(*current_token_, true) >= min_prec)
             {
-                if(auto uop_node = std::dynamic_pointer_cast<UnaryOpNode>(primary_left))
-                    primary_left = std::make_shared<UnaryOpNode>(uop_node->op_token, 
-                        std::make_shared<UnaryOpNode>(*current_token_, uop_node->operand_node, true)
+                if(auto uop_node = dynamic_cast<UnaryOpNode*>(primary_left))
+                    primary_left = arena_.Make<UnaryOpNode>(uop_node->op_token, 
+                        arena_.Make<UnaryOpNode>(*current_token_, uop_node->operand_node, true)
                     );
                 else 
-                    primary_left = std::make_shared<UnaryOpNode>(*current_token_, primary_left, true);
+                    primary_left = arena_.Make<UnaryOpNode>(*current_token_, primary_left, true);
                 NextToken();
             }
             else 
             {
-                const auto& op_token = *current_token_;
+                const auto op_token = *current_token_;
                 const auto prec = BinaryOpPrecedence(op_token);
                 const auto is_left_assoc = IsBinaryOpLeftAssoc(op_token);
                 const auto next_min_prec = is_left_assoc? (prec + 1) : prec;
@@ -227,23 +230,23 @@ namespace mildew
                     auto on_true = ParseExpression();
                     Consume(Token::Type::COLON, "terniary expression");
                     auto on_false = ParseExpression();
-                    primary_left = std::make_shared<TerniaryOpNode>(primary_left, on_true, on_false);
+                    primary_left = arena_.Make<TerniaryOpNode>(primary_left, on_true, on_false);
                 }
                 else if(op_token.type == Token::Type::DOT)
                 {
                     auto right = ParsePrimaryExpression();
-                    if(std::dynamic_pointer_cast<VarAccessNode>(right) == nullptr)
+                    if(dynamic_cast<VarAccessNode*>(right) == nullptr)
                         throw ScriptCompileError(MakeString("Right hand side of `.` operator must be identifier at ", 
                             current_token_->position));
                     if(un_op_prec != 0 && prec > un_op_prec)
                     {
-                        auto uon = std::dynamic_pointer_cast<UnaryOpNode>(primary_left);
-                        primary_left = std::make_shared<UnaryOpNode>(uon->op_token, 
-                            std::make_shared<MemberAccessNode>(uon->operand_node, op_token, right));
+                        auto uon = dynamic_cast<UnaryOpNode*>(primary_left);
+                        primary_left = arena_.Make<UnaryOpNode>(uon->op_token, 
+                            arena_.Make<MemberAccessNode>(uon->operand_node, op_token, right));
                     }
                     else 
                     {
-                        primary_left = std::make_shared<MemberAccessNode>(primary_left, op_token, right);
+                        primary_left = arena_.Make<MemberAccessNode>(primary_left, op_token, right);
                     }
                 }
                 else if(op_token.type == Token::Type::LBRACKET)
@@ -252,13 +255,13 @@ namespace mildew
                     Consume(Token::Type::RBRACKET, "index expression");
                     if(un_op_prec != 0 && prec > un_op_prec)
                     {
-                        auto uon = std::dynamic_pointer_cast<UnaryOpNode>(primary_left);
-                        primary_left = std::make_shared<UnaryOpNode>(uon->op_token, 
-                            std::make_shared<ArrayIndexNode>(uon->operand_node, index));
+                        auto uon = dynamic_cast<UnaryOpNode*>(primary_left);
+                        primary_left = arena_.Make<UnaryOpNode>(uon->op_token, 
+                            arena_.Make<ArrayIndexNode>(uon->operand_node, index));
                     }
                     else 
                     {
-                        primary_left = std::make_shared<ArrayIndexNode>(primary_left, index);
+                        primary_left = arena_.Make<ArrayIndexNode>(primary_left, index);
                     }
                 }
                 else if(op_token.type == Token::Type::LPAREN)
@@ -267,13 +270,13 @@ namespace mildew
                     NextToken(); // consume )
                     if(un_op_prec != 0 && prec > un_op_prec)
                     {
-                        auto uon = std::dynamic_pointer_cast<UnaryOpNode>(primary_left);
-                        primary_left = std::make_shared<UnaryOpNode>(uon->op_token, 
-                            std::make_shared<FunctionCallNode>(uon->operand_node, params));
+                        auto uon = dynamic_cast<UnaryOpNode*>(primary_left);
+                        primary_left = arena_.Make<UnaryOpNode>(uon->op_token, 
+                            arena_.Make<FunctionCallNode>(uon->operand_node, params));
                     }
                     else 
                     {
-                        primary_left = std::make_shared<FunctionCallNode>(primary_left, params);
+                        primary_left = arena_.Make<FunctionCallNode>(primary_left, params);
                     }
                 }
                 else 
@@ -281,29 +284,29 @@ namespace mildew
                     auto primary_right = ParseExpression(next_min_prec);
                     if(op_token.IsAssignmentOperator())
                     {
-                        if(!(std::dynamic_pointer_cast<VarAccessNode>(primary_left) ||
-                          std::dynamic_pointer_cast<MemberAccessNode>(primary_left) ||
-                          std::dynamic_pointer_cast<ArrayIndexNode>(primary_left)))
+                        if(!(dynamic_cast<VarAccessNode*>(primary_left) ||
+                          dynamic_cast<MemberAccessNode*>(primary_left) ||
+                          dynamic_cast<ArrayIndexNode*>(primary_left)))
                         {
                             throw ScriptCompileError(MakeString("Invalid left hand operand for assignment ",
                                 primary_left->to_string(), " at ", op_token.position));
                         }
                     }
-                    primary_left = std::make_shared<BinaryOpNode>(op_token, primary_left, primary_right);
+                    primary_left = arena_.Make<BinaryOpNode>(op_token, primary_left, primary_right);
                 }
             }
         }
         return primary_left;
     }
 
-    std::shared_ptr<BlockStatementNode> Parser::ParseProgram()
+    BlockStatementNode* Parser::ParseProgram()
     {
         CheckEOF("parse program");
         const auto kLineNo = current_token_->position.line;
         function_context_stack_.push({FunctionContext::Type::NORMAL, 0, 0, {}});
         auto statements = ParseStatements(Token::Type::EOF_);
         function_context_stack_.pop();
-        return std::make_shared<BlockStatementNode>(kLineNo, statements);
+        return arena_.Make<BlockStatementNode>(kLineNo, statements);
     }
 
     void Parser::CheckEOF(const std::string& where) const
@@ -339,54 +342,31 @@ namespace mildew
         NextToken();
     }
 
-    ScriptAny Parser::EvaluateCTFE(const std::shared_ptr<ExpressionNode>& expr)
+    ScriptAny Parser::EvaluateCTFE(ExpressionNode* expr)
     {
-        // for now just accept literals
-        auto literal_node = std::dynamic_pointer_cast<LiteralNode>(expr);
-        if(literal_node == nullptr)
+        // the variables in scope are not known while parsing, so only operators over literals are evaluated
+        auto folded = Optimizer(arena_).Optimize(*expr);
+        if(!Optimizer::IsConstant(folded))
             return ScriptAny();
-        
-        if(literal_node->literal_token.IsKeyword("true"))
-            return ScriptAny(true);
-        else if(literal_node->literal_token.IsKeyword("false"))
-            return ScriptAny(false);
-        else if(literal_node->literal_token.IsKeyword("null"))
-            return ScriptAny(nullptr);
-        else if(literal_node->literal_token.IsKeyword("undefined"))
-            return ScriptAny();
-        else if(literal_node->literal_token.type == Token::Type::DOUBLE)
-            return ScriptAny(std::stod(literal_node->literal_token.text, nullptr));
-        else if(literal_node->literal_token.type == Token::Type::STRING)
-            return ScriptAny(literal_node->literal_token.text);
-        else if(literal_node->literal_token.type == Token::Type::INTEGER)
-        {
-            switch(literal_node->literal_token.literal_flag)
-            {
-            case Token::LiteralFlag::BINARY:
-                return ScriptAny(std::stoi(literal_node->literal_token.text.substr(2), nullptr, 2));
-            case Token::LiteralFlag::HEXADECIMAL:
-                return ScriptAny(std::stoi(literal_node->literal_token.text.substr(2), nullptr, 16));
-            case Token::LiteralFlag::OCTAL:
-                return ScriptAny(std::stoi(literal_node->literal_token.text.substr(2), nullptr, 8));
-            default:
-                return ScriptAny(std::stoi(literal_node->literal_token.text, nullptr, 10));
-            }
-        }
-        return ScriptAny();
+        return static_cast<const LiteralNode&>(*folded).Value();
     }
 
     void Parser::NextToken()
     {
-        if(token_index_ >= tokens_.size())
+        // reading past the EOF token leaves no current token, as if the stream had run out
+        if(cursor_ > 0 && (current_token_ == nullptr || current_token_->type == Token::Type::EOF_))
+        {
             current_token_ = nullptr;
-        else
-            current_token_ = &tokens_[token_index_++];
+            return;
+        }
+        current_token_ = &Lookahead(0);
+        ++cursor_;
     }
 
-    std::tuple<std::vector<std::string>, std::vector<std::shared_ptr<ExpressionNode>>> Parser::ParseArgumentList()
+    std::tuple<ArenaList<std::string_view>, ArenaList<ExpressionNode*>> Parser::ParseArgumentList()
     {
-        std::vector<std::string> arg_list;
-        std::vector<std::shared_ptr<ExpressionNode>> def_args;
+        std::vector<std::string_view> arg_list;
+        std::vector<ExpressionNode*> def_args;
         while(current_token_->type != Token::Type::RPAREN && current_token_->type != Token::Type::EOF_)
         {
             arg_list.emplace_back(current_token_->text);
@@ -407,17 +387,17 @@ namespace mildew
                 throw ScriptCompileError(MakeString("Arguments must be separated by comma not ",
                     *current_token_, " at ", current_token_->position));
         }
-        return std::tuple(arg_list, def_args);
+        return std::tuple(arena_.MakeList(arg_list), arena_.MakeList(def_args));
     }
 
-    std::shared_ptr<ClassDeclarationStatementNode> Parser::ParseClassDeclarationStatement()
+    ClassDeclarationStatementNode* Parser::ParseClassDeclarationStatement()
     {
         const auto kLineNumber = current_token_->position.line;
-        const auto& kClassToken = *current_token_;
+        const auto kClassToken = *current_token_;
         NextToken();
-        const std::string& kClassName = current_token_->text;
+        const auto kClassName = current_token_->text;
         Consume(Token::Type::IDENTIFIER, "class declaration");
-        std::shared_ptr<ExpressionNode> base_class = nullptr;
+        ExpressionNode* base_class = nullptr;
         if(current_token_->IsKeyword("extends"))
         {
             NextToken();
@@ -425,28 +405,28 @@ namespace mildew
             base_class_stack_.push(base_class);
         }
         auto class_def = ParseClassDefinition(kClassToken, kClassName, base_class);
-        return std::make_shared<ClassDeclarationStatementNode>(kLineNumber, kClassToken, class_def);
+        return arena_.Make<ClassDeclarationStatementNode>(kLineNumber, kClassToken, class_def);
     }
 
     enum class PropertyType { NONE, GET, SET, STATIC };
 
-    std::shared_ptr<ClassDefinition> Parser::ParseClassDefinition(const Token& class_token, 
-            const std::string& class_name, const std::shared_ptr<ExpressionNode>& base_class)
+    ClassDefinition* Parser::ParseClassDefinition(const Token& class_token, 
+            const std::string_view class_name, ExpressionNode* base_class)
     {
         Consume(Token::Type::LBRACE, "class definition");
-        std::shared_ptr<FunctionLiteralNode> constructor = nullptr;
-        std::vector<std::string> method_names;
-        std::vector<std::shared_ptr<FunctionLiteralNode>> methods;
-        std::vector<std::string> get_method_names;
-        std::vector<std::shared_ptr<FunctionLiteralNode>> get_methods;
-        std::vector<std::string> set_method_names;
-        std::vector<std::shared_ptr<FunctionLiteralNode>> set_methods;
-        std::vector<std::string> static_method_names;
-        std::vector<std::shared_ptr<FunctionLiteralNode>> static_methods;
+        FunctionLiteralNode* constructor = nullptr;
+        std::vector<std::string_view> method_names;
+        std::vector<FunctionLiteralNode*> methods;
+        std::vector<std::string_view> get_method_names;
+        std::vector<FunctionLiteralNode*> get_methods;
+        std::vector<std::string_view> set_method_names;
+        std::vector<FunctionLiteralNode*> set_methods;
+        std::vector<std::string_view> static_method_names;
+        std::vector<FunctionLiteralNode*> static_methods;
         while(current_token_->type != Token::Type::RBRACE && current_token_->type != Token::Type::EOF_)
         {
             PropertyType ptype = PropertyType::NONE;
-            std::string current_method_name = "";
+            std::string_view current_method_name;
             if(current_token_->IsIdentifier("get"))
             {
                 ptype = PropertyType::GET;
@@ -462,7 +442,7 @@ namespace mildew
                 ptype = PropertyType::STATIC;
                 NextToken();
             }
-            const auto& kIdToken = *current_token_;
+            const auto kIdToken = *current_token_;
             Consume(Token::Type::IDENTIFIER, "class definition");
             current_method_name = kIdToken.text;
             Consume(Token::Type::LPAREN, "class definition");
@@ -489,11 +469,11 @@ namespace mildew
                     int num_supers = 0;
                     for(const auto& stmt : statements)
                     {
-                        if(auto expr_stmt = std::dynamic_pointer_cast<ExpressionStatementNode>(stmt))
+                        if(auto expr_stmt = dynamic_cast<ExpressionStatementNode*>(stmt))
                         {
-                            if(auto fcn = std::dynamic_pointer_cast<FunctionCallNode>(expr_stmt->expression_node))
+                            if(auto fcn = dynamic_cast<FunctionCallNode*>(expr_stmt->expression_node))
                             {
-                                if(auto supernode = std::dynamic_pointer_cast<SuperNode>(fcn->function_to_call))
+                                if(dynamic_cast<SuperNode*>(fcn->function_to_call) != nullptr)
                                     num_supers++;
                             }
                         }
@@ -501,47 +481,47 @@ namespace mildew
                     if(num_supers != 1)
                         throw ScriptCompileError(MakeString("Derived class constructors must have one super call at ",
                             class_token.position));
-                    constructor = std::make_shared<FunctionLiteralNode>(kIdToken, arg_names, def_args, statements, 
-                        class_name, true);
                 }
-                else 
+                constructor = arena_.Make<FunctionLiteralNode>(kIdToken, arg_names, def_args, statements, 
+                    class_name, true);
+            }
+            else 
+            {
+                switch(ptype)
                 {
-                    switch(ptype)
-                    {
-                    case PropertyType::NONE: {
-                        const auto kTrueName = (class_name != "<anonymous class>" && class_name != "") ?
-                            (class_name + ".prototype." + current_method_name) :
-                            current_method_name;
-                        methods.emplace_back(std::make_shared<FunctionLiteralNode>(kIdToken, arg_names, def_args,
-                            statements, kTrueName));
-                        method_names.emplace_back(current_method_name);
-                        break;
-                    }
-                    case PropertyType::GET:
-                        get_methods.emplace_back(std::make_shared<FunctionLiteralNode>(kIdToken, arg_names,
-                            def_args, statements));
-                        get_method_names.emplace_back(current_method_name);
-                        break;
-                    case PropertyType::SET:
-                        set_methods.emplace_back(std::make_shared<FunctionLiteralNode>(kIdToken, arg_names,
-                            def_args, statements));
-                        set_method_names.emplace_back(current_method_name);
-                        break;
-                    case PropertyType::STATIC: {
-                        const auto kTrueName = (class_name != "<anonymous class>" && class_name != "") ?
-                            (class_name + "." + current_method_name) : current_method_name;
-                        static_methods.emplace_back(std::make_shared<FunctionLiteralNode>(kIdToken, arg_names,
-                            def_args, statements, kTrueName));
-                        static_method_names.emplace_back(current_method_name);
-                        break;
-                    }
-                    }
+                case PropertyType::NONE: {
+                    const auto kTrueName = (class_name != "<anonymous class>" && class_name != "") ?
+                        arena_.CopyString(MakeString(class_name, ".prototype.", current_method_name)) :
+                        current_method_name;
+                    methods.emplace_back(arena_.Make<FunctionLiteralNode>(kIdToken, arg_names, def_args,
+                        statements, kTrueName));
+                    method_names.emplace_back(current_method_name);
+                    break;
+                }
+                case PropertyType::GET:
+                    get_methods.emplace_back(arena_.Make<FunctionLiteralNode>(kIdToken, arg_names,
+                        def_args, statements));
+                    get_method_names.emplace_back(current_method_name);
+                    break;
+                case PropertyType::SET:
+                    set_methods.emplace_back(arena_.Make<FunctionLiteralNode>(kIdToken, arg_names,
+                        def_args, statements));
+                    set_method_names.emplace_back(current_method_name);
+                    break;
+                case PropertyType::STATIC: {
+                    const auto kTrueName = (class_name != "<anonymous class>" && class_name != "") ?
+                        arena_.CopyString(MakeString(class_name, ".", current_method_name)) : current_method_name;
+                    static_methods.emplace_back(arena_.Make<FunctionLiteralNode>(kIdToken, arg_names,
+                        def_args, statements, kTrueName));
+                    static_method_names.emplace_back(current_method_name);
+                    break;
+                }
                 }
             }
         }
         NextToken(); // eat } of class body
 
-        std::unordered_map<std::string, bool> mname_map;
+        std::unordered_map<std::string_view, bool> mname_map;
         for(const auto& mname : method_names)
         {
             if(mname_map.count(mname) > 0)
@@ -554,27 +534,28 @@ namespace mildew
 
         if(constructor == nullptr)
         {
-            constructor = std::make_shared<FunctionLiteralNode>(class_token, std::vector<std::string>(), 
-                std::vector<std::shared_ptr<ExpressionNode>>(), std::vector<std::shared_ptr<StatementNode>>(), 
-                class_name, true);
+            constructor = arena_.Make<FunctionLiteralNode>(class_token, ArenaList<std::string_view>(), 
+                ArenaList<ExpressionNode*>(), ArenaList<StatementNode*>(), class_name, true);
         }
         if(base_class != nullptr)
             base_class_stack_.pop();
-        return std::make_shared<ClassDefinition>(class_name, constructor, method_names, methods, get_method_names,
-            get_methods, set_method_names, set_methods, static_method_names, static_methods, base_class);
+        return arena_.Make<ClassDefinition>(class_name, constructor, arena_.MakeList(method_names),
+            arena_.MakeList(methods), arena_.MakeList(get_method_names), arena_.MakeList(get_methods),
+            arena_.MakeList(set_method_names), arena_.MakeList(set_methods), arena_.MakeList(static_method_names),
+            arena_.MakeList(static_methods), base_class);
     }
 
-    std::shared_ptr<ClassLiteralNode> Parser::ParseClassExpression()
+    ClassLiteralNode* Parser::ParseClassExpression()
     {
-        const auto& class_token = *current_token_;
+        const auto class_token = *current_token_;
         NextToken();
-        std::string class_name = "<anonymous class>";
+        std::string_view class_name = "<anonymous class>";
         if(current_token_->type == Token::Type::IDENTIFIER)
         {
             class_name = current_token_->text;
             NextToken();
         }
-        std::shared_ptr<ExpressionNode> base_class = nullptr;
+        ExpressionNode* base_class = nullptr;
         if(current_token_->IsKeyword("extends"))
         {
             NextToken();
@@ -582,12 +563,12 @@ namespace mildew
             base_class_stack_.push(base_class);
         }
         auto class_def = ParseClassDefinition(class_token, class_name, base_class);
-        return std::make_shared<ClassLiteralNode>(class_token, class_def);
+        return arena_.Make<ClassLiteralNode>(class_token, class_def);
     }
 
-    std::vector<std::shared_ptr<ExpressionNode>> Parser::ParseCommaSeparatedExpressions(const Token::Type stop)
+    ArenaList<ExpressionNode*> Parser::ParseCommaSeparatedExpressions(const Token::Type stop)
     {
-        std::vector<std::shared_ptr<ExpressionNode>> expressions;
+        std::vector<ExpressionNode*> expressions;
         while(current_token_->type != stop && current_token_->type != Token::Type::EOF_ 
           && !current_token_->IsIdentifier("of") && !current_token_->IsIdentifier("in"))
         {
@@ -601,10 +582,10 @@ namespace mildew
                     *current_token_, " or missing ", stop, " at ", current_token_->position));
         }
 
-        return expressions;
+        return arena_.MakeList(expressions);
     }
 
-    std::shared_ptr<DoWhileStatementNode> Parser::ParseDoWhileStatement(const std::string& label)
+    DoWhileStatementNode* Parser::ParseDoWhileStatement(const std::string_view label)
     {
         const auto kLineNumber = current_token_->position.line;
         NextToken();
@@ -614,32 +595,35 @@ namespace mildew
         auto condition = ParseExpression();
         Consume(Token::Type::RPAREN, "do while statement");
         Consume(Token::Type::SEMICOLON, "do while statement");
-        return std::make_shared<DoWhileStatementNode>(kLineNumber, loop_body, condition, label);
+        return arena_.Make<DoWhileStatementNode>(kLineNumber, loop_body, condition, label);
     }
 
-    std::shared_ptr<StatementNode> Parser::ParseForStatement(const std::string& label)
+    StatementNode* Parser::ParseForStatement(const std::string_view label)
     {
         const auto kLineNumber = current_token_->position.line;
         NextToken();
         Consume(Token::Type::LPAREN, "for statement");
-        std::shared_ptr<VarDeclarationStatementNode> decl = nullptr;
-        if(current_token_->type != Token::Type::SEMICOLON)
-            decl = ParseVarDeclarationStatement(false);
+        VarDeclarationStatementNode* decl = nullptr;
+        StatementNode* init = nullptr;
+        if(current_token_->IsKeyword("var") || current_token_->IsKeyword("let") || current_token_->IsKeyword("const"))
+            init = decl = ParseVarDeclarationStatement(false);
+        else if(current_token_->type != Token::Type::SEMICOLON)
+            init = arena_.Make<ExpressionStatementNode>(kLineNumber, ParseExpression());
         if(current_token_->IsKeyword("in") || current_token_->IsIdentifier("of"))
         {
-            const auto& kOfInToken = *current_token_;
+            const auto kOfInToken = *current_token_;
             if(decl == nullptr)
                 throw ScriptCompileError(MakeString("Invalid for in/of statement at ",
                     current_token_->position));
             const auto& qualifier = decl->qualifier_token;
-            std::vector<std::shared_ptr<VarAccessNode>> vans;
+            std::vector<VarAccessNode*> vans;
             if(decl->qualifier_token.text != "const" && decl->qualifier_token.text != "let")
                 throw ScriptCompileError(MakeString("For of/in loop declaration must be local at ",
                     decl->qualifier_token.position));
             int van_count = 0;
             for(const auto& va : decl->assignment_nodes)
             {
-                auto valid = std::dynamic_pointer_cast<VarAccessNode>(va);
+                auto valid = dynamic_cast<VarAccessNode*>(va);
                 if(valid == nullptr)
                     throw ScriptCompileError(MakeString("Invalid variable declaration in for of/in statement",
                         " at ", qualifier.position));
@@ -651,15 +635,15 @@ namespace mildew
                     " at ", qualifier.position));
             NextToken();
             auto obj_to_iterate = ParseExpression();
-            Consume(Token::Type::RPAREN, "for " + kOfInToken.text + " loop");
+            Consume(Token::Type::RPAREN, MakeString("for ", kOfInToken.text, " loop"));
             auto body_statement = ParseStatement();
-            return std::make_shared<ForOfStatementNode>(kLineNumber, qualifier, kOfInToken, vans, obj_to_iterate,
+            return arena_.Make<ForOfStatementNode>(kLineNumber, qualifier, kOfInToken, arena_.MakeList(vans), obj_to_iterate,
                 body_statement, label);
         }
         else if(current_token_->type == Token::Type::SEMICOLON)
         {
             NextToken();
-            std::shared_ptr<ExpressionNode> condition = nullptr;
+            ExpressionNode* condition = nullptr;
             if(current_token_->type != Token::Type::SEMICOLON)
             {
                 condition = ParseExpression();
@@ -669,27 +653,27 @@ namespace mildew
             }
             else 
             {
-                condition = std::make_shared<LiteralNode>(Token::CreateFakeToken(Token::Type::KEYWORD, "true"));
+                condition = arena_.Make<LiteralNode>(Token::CreateFakeToken(Token::Type::KEYWORD, "true"));
             }
             NextToken();
-            std::shared_ptr<ExpressionNode> increment = nullptr;
+            ExpressionNode* increment = nullptr;
             if(current_token_->type != Token::Type::RPAREN)
             {
                 increment = ParseExpression();
             }
             else 
             {
-                increment = std::make_shared<LiteralNode>(Token::CreateFakeToken(Token::Type::KEYWORD, "true"));
+                increment = arena_.Make<LiteralNode>(Token::CreateFakeToken(Token::Type::KEYWORD, "true"));
             }
             Consume(Token::Type::RPAREN, "for statement");
             auto body_node = ParseStatement();
-            return std::make_shared<ForStatementNode>(kLineNumber, decl, condition, increment, body_node, label);
+            return arena_.Make<ForStatementNode>(kLineNumber, init, condition, increment, body_node, label);
         }
         else 
             throw ScriptCompileError(MakeString("Invalid for statement at ", current_token_->position));
     }
 
-    std::shared_ptr<FunctionDeclarationStatementNode> Parser::ParseFunctionDeclarationStatement()
+    FunctionDeclarationStatementNode* Parser::ParseFunctionDeclarationStatement()
     {
         const auto kLineNumber = current_token_->position.line;
         bool is_generator = false;
@@ -699,7 +683,7 @@ namespace mildew
             is_generator = true;
             NextToken();
         }
-        std::string name = current_token_->text;
+        const auto name = current_token_->text;
         Consume(Token::Type::IDENTIFIER, "function declaration statement");
         Consume(Token::Type::LPAREN, " function declaration statement");
         auto [arg_names, def_args] = ParseArgumentList();
@@ -716,21 +700,21 @@ namespace mildew
         auto statements = ParseStatements(Token::Type::RBRACE);
         function_context_stack_.pop();
         NextToken(); // consume }
-        return std::make_shared<FunctionDeclarationStatementNode>(kLineNumber, name, arg_names, def_args, 
+        return arena_.Make<FunctionDeclarationStatementNode>(kLineNumber, name, arg_names, def_args, 
             statements, is_generator);
     }
 
-    std::shared_ptr<FunctionLiteralNode> Parser::ParseFunctionLiteral()
+    FunctionLiteralNode* Parser::ParseFunctionLiteral()
     {
         bool is_g = false;
-        const auto& token = *current_token_;
+        const auto token = *current_token_;
         NextToken();
         if(current_token_->type == Token::Type::STAR)
         {
             is_g = true;
             NextToken();
         }
-        std::string opt_name = "";
+        std::string_view opt_name;
         if(current_token_->type == Token::Type::IDENTIFIER)
         {
             opt_name = current_token_->text;
@@ -741,7 +725,6 @@ namespace mildew
         auto [arg_names, def_args] = ParseArgumentList();
         NextToken(); // consume )
         Consume(Token::Type::LBRACE, "function literal");
-        NextToken();
         function_context_stack_.push({
             is_g ? FunctionContext::Type::GENERATOR : FunctionContext::Type::NORMAL,
             0, 0, std::vector<std::string>()}
@@ -749,10 +732,10 @@ namespace mildew
         auto statements = ParseStatements(Token::Type::RBRACE);
         function_context_stack_.pop();
         NextToken(); // consume }
-        return std::make_shared<FunctionLiteralNode>(token, arg_names, def_args, statements, opt_name, false, is_g);
+        return arena_.Make<FunctionLiteralNode>(token, arg_names, def_args, statements, opt_name, false, is_g);
     }
 
-    std::shared_ptr<IfStatementNode> Parser::ParseIfStatement()
+    IfStatementNode* Parser::ParseIfStatement()
     {
         const auto kLineNumber = current_token_->position.line;
         NextToken();
@@ -760,19 +743,19 @@ namespace mildew
         auto condition = ParseExpression();
         Consume(Token::Type::RPAREN, "if statement");
         auto true_statement = ParseStatement();
-        std::shared_ptr<StatementNode> else_statement = nullptr;
+        StatementNode* else_statement = nullptr;
         if(current_token_->IsKeyword("else"))
         {
             NextToken();
             else_statement = ParseStatement();
         }
-        return std::make_shared<IfStatementNode>(kLineNumber, condition, true_statement, else_statement);
+        return arena_.Make<IfStatementNode>(kLineNumber, condition, true_statement, else_statement);
     }
 
-    std::shared_ptr<LambdaNode> Parser::ParseLambda(bool has_parentheses)
+    LambdaNode* Parser::ParseLambda(bool has_parentheses)
     {
-        std::vector<std::string> arg_list;
-        std::vector<std::shared_ptr<ExpressionNode>> default_args;
+        ArenaList<std::string_view> arg_list;
+        ArenaList<ExpressionNode*> default_args;
         if(has_parentheses)
         {
             NextToken(); // consume (
@@ -783,35 +766,35 @@ namespace mildew
         }
         else 
         {
-            arg_list.emplace_back(current_token_->text);
+            arg_list = arena_.MakeList(std::vector<std::string_view>{current_token_->text});
             Consume(Token::Type::IDENTIFIER, "lambda expression");
         }
-        const auto& arrow = *current_token_;
+        const auto arrow = *current_token_;
         Consume(Token::Type::ARROW, "lambda expression");
         if(current_token_->type == Token::Type::LBRACE)
         {
             NextToken(); // consume {
             auto stmts = ParseStatements(Token::Type::RBRACE);
             NextToken(); // consume }
-            return std::make_shared<LambdaNode>(arrow, arg_list, default_args, stmts);
+            return arena_.Make<LambdaNode>(arrow, arg_list, default_args, stmts);
         }
         else 
         {
             auto expr = ParseExpression();
-            return std::make_shared<LambdaNode>(arrow, arg_list, default_args, expr);
+            return arena_.Make<LambdaNode>(arrow, arg_list, default_args, expr);
         }
     }
 
-    std::shared_ptr<StatementNode> Parser::ParseLoopStatement()
+    StatementNode* Parser::ParseLoopStatement()
     {
-        std::string label = "";
+        std::string_view label;
         if(current_token_->type == Token::Type::LABEL)
         {
             label = current_token_->text;
             function_context_stack_.top().label_stack.emplace_back(label);
             NextToken();
         }
-        std::shared_ptr<StatementNode> statement;
+        StatementNode* statement;
         if(current_token_->IsKeyword("while"))
         {
             function_context_stack_.top().loop_stack++;
@@ -841,37 +824,36 @@ namespace mildew
         return statement;
     }
 
-    std::shared_ptr<NewExpressionNode> Parser::ParseNewExpression()
+    NewExpressionNode* Parser::ParseNewExpression()
     {
         NextToken();
         auto expression = ParseExpression();
-        auto fcn = std::dynamic_pointer_cast<FunctionCallNode>(expression);
+        auto fcn = dynamic_cast<FunctionCallNode*>(expression);
         if(fcn == nullptr)
         {
-            fcn = std::make_shared<FunctionCallNode>(expression, std::vector<std::shared_ptr<ExpressionNode>>(), 
-                true);
+            fcn = arena_.Make<FunctionCallNode>(expression, ArenaList<ExpressionNode*>(), true);
         }
         else 
         {
-            fcn = std::make_shared<FunctionCallNode>(fcn->function_to_call, fcn->argument_nodes, true);
+            fcn = arena_.Make<FunctionCallNode>(fcn->function_to_call, fcn->argument_nodes, true);
         }
-        return std::make_shared<NewExpressionNode>(fcn);
+        return arena_.Make<NewExpressionNode>(fcn);
     }
 
-    std::shared_ptr<ObjectLiteralNode> Parser::ParseObjectLiteral()
+    ObjectLiteralNode* Parser::ParseObjectLiteral()
     {
-        const auto& start_token = *current_token_;
+        const auto start_token = *current_token_;
         NextToken(); // consume {
-        std::vector<std::string> keys;
-        std::vector<std::shared_ptr<ExpressionNode>> value_expressions;
+        std::vector<std::string_view> keys;
+        std::vector<ExpressionNode*> value_expressions;
         while(current_token_->type != Token::Type::RBRACE)
         {
-            const auto& id_token = *current_token_;
+            const auto id_token = *current_token_;
             if(current_token_->type != Token::Type::IDENTIFIER && current_token_->type != Token::Type::STRING
               && current_token_->type != Token::Type::LABEL)
                 throw ScriptCompileError(MakeString("Invalid key for object literal ", *current_token_, " at ",
                     current_token_->position));
-            keys.push_back(current_token_->text);
+            keys.emplace_back(current_token_->text);
             NextToken();
             if(id_token.type != Token::Type::LABEL)
                 Consume(Token::Type::COLON, "object literal");
@@ -886,12 +868,12 @@ namespace mildew
         NextToken(); // consume }
         if(keys.size() != value_expressions.size())
             throw ScriptCompileError(MakeString("Malformed object literal at ", start_token.position));
-        return std::make_shared<ObjectLiteralNode>(keys, value_expressions);
+        return arena_.Make<ObjectLiteralNode>(arena_.MakeList(keys), arena_.MakeList(value_expressions));
     }
 
-    std::shared_ptr<ExpressionNode> Parser::ParsePrimaryExpression()
+    ExpressionNode* Parser::ParsePrimaryExpression()
     {
-        std::shared_ptr<ExpressionNode> left = nullptr;
+        ExpressionNode* left = nullptr;
         CheckEOF("primary expression");
         switch(current_token_->type)
         {
@@ -919,21 +901,21 @@ namespace mildew
         case Token::Type::DOUBLE: // compiler handles values in this version
         case Token::Type::INTEGER:
         case Token::Type::REGEX:
-            left = std::make_shared<LiteralNode>(*current_token_);
+            left = arena_.Make<LiteralNode>(*current_token_);
             NextToken();
             break;
         case Token::Type::STRING:
             if(current_token_->literal_flag == Token::LiteralFlag::TEMPLATE_STRING)
                 left = ParseTemplateString();
             else 
-                left = std::make_shared<LiteralNode>(*current_token_);
+                left = arena_.Make<LiteralNode>(*current_token_);
             NextToken();
             break;
         case Token::Type::KEYWORD:
             if(current_token_->text == "true" || current_token_->text == "false" || 
               current_token_->text == "null" || current_token_->text == "undefined")
             {
-                left = std::make_shared<LiteralNode>(*current_token_);
+                left = arena_.Make<LiteralNode>(*current_token_);
                 NextToken();
             }
             else if(current_token_->text == "function")
@@ -947,7 +929,7 @@ namespace mildew
             else if(current_token_->text == "yield")
                 left = ParseYield();
             else 
-                throw new ScriptCompileError(MakeString("Unexpected keyword ", current_token_->text, 
+                throw ScriptCompileError(MakeString("Unexpected keyword ", current_token_->text, 
                     " in primary expression at ", current_token_->position));
             break;
         case Token::Type::IDENTIFIER: {
@@ -958,7 +940,7 @@ namespace mildew
             }
             else 
             {
-                left = std::make_shared<VarAccessNode>(*current_token_);
+                left = arena_.Make<VarAccessNode>(*current_token_);
                 NextToken();
             }
             break;
@@ -967,7 +949,7 @@ namespace mildew
             NextToken(); // consume [
             auto values = ParseCommaSeparatedExpressions(Token::Type::RBRACKET);
             NextToken(); // consume ]
-            left = std::make_shared<ArrayLiteralNode>(values);
+            left = arena_.Make<ArrayLiteralNode>(values);
             break;
         }
         default:
@@ -977,7 +959,7 @@ namespace mildew
         return left;
     }
 
-    std::shared_ptr<StatementNode> Parser::ParseStatement()
+    StatementNode* Parser::ParseStatement()
     {
         CheckEOF("statement");
         const auto kLineNumber = current_token_->position.line;
@@ -992,13 +974,13 @@ namespace mildew
             NextToken(); // consume {
             auto statements = ParseStatements(Token::Type::RBRACE);
             NextToken(); // consume }
-            return std::make_shared<BlockStatementNode>(kLineNumber, statements);
+            return arena_.Make<BlockStatementNode>(kLineNumber, statements);
         }
         else if(current_token_->IsKeyword("if"))
         {
             return ParseIfStatement();
         }
-        else if(current_token_->IsKeyword("swtich"))
+        else if(current_token_->IsKeyword("switch"))
         {
             return ParseSwitchStatement();
         }
@@ -1014,9 +996,9 @@ namespace mildew
                 throw ScriptCompileError(MakeString("Break statement only allowed in loops or switch body at ",
                     current_token_->position));
             }
-            const auto& break_token = *current_token_;
+            const auto break_token = *current_token_;
             NextToken();
-            std::string label = "";
+            std::string_view label;
             if(current_token_->type == Token::Type::IDENTIFIER)
             {
                 label = current_token_->text;
@@ -1035,16 +1017,16 @@ namespace mildew
                 NextToken();
             }
             Consume(Token::Type::SEMICOLON, "break statement");
-            return std::make_shared<BreakOrContinueStatementNode>(break_token, label);
+            return arena_.Make<BreakOrContinueStatementNode>(break_token, label);
         }
         else if(current_token_->IsKeyword("continue"))
         {
             if(function_context_stack_.top().loop_stack == 0)
                 throw ScriptCompileError(MakeString("Continue statement only allowed in loops at ",
                     current_token_->position));
-            const auto& continue_token = *current_token_;
+            const auto continue_token = *current_token_;
             NextToken();
-            std::string label = "";
+            std::string_view label;
             if(current_token_->type == Token::Type::IDENTIFIER)
             {
                 label = current_token_->text;
@@ -1063,16 +1045,16 @@ namespace mildew
                 NextToken();
             }
             Consume(Token::Type::SEMICOLON, "continue statement");
-            return std::make_shared<BreakOrContinueStatementNode>(continue_token, label);
+            return arena_.Make<BreakOrContinueStatementNode>(continue_token, label);
         }
         else if(current_token_->IsKeyword("return"))
         {
             NextToken();
-            std::shared_ptr<ExpressionNode> expression = nullptr;
+            ExpressionNode* expression = nullptr;
             if(current_token_->type != Token::Type::SEMICOLON)
                 expression = ParseExpression();
             Consume(Token::Type::SEMICOLON, "return statement");
-            return std::make_shared<ReturnStatementNode>(kLineNumber, expression);
+            return arena_.Make<ReturnStatementNode>(kLineNumber, expression);
         }
         else if(current_token_->IsKeyword("function"))
         {
@@ -1083,7 +1065,7 @@ namespace mildew
             NextToken();
             auto expr = ParseExpression();
             Consume(Token::Type::SEMICOLON, "throw statement");
-            return std::make_shared<ThrowStatementNode>(kLineNumber, expr);
+            return arena_.Make<ThrowStatementNode>(kLineNumber, expr);
         }
         else if(current_token_->IsKeyword("try"))
         {
@@ -1091,14 +1073,14 @@ namespace mildew
         }
         else if(current_token_->IsKeyword("delete"))
         {
-            const auto& kDelToken = *current_token_;
+            const auto kDelToken = *current_token_;
             NextToken();
             auto expression = ParseExpression();
-            if(!(std::dynamic_pointer_cast<MemberAccessNode>(expression)
-              || std::dynamic_pointer_cast<ArrayIndexNode>(expression)))
+            if(!(dynamic_cast<MemberAccessNode*>(expression)
+              || dynamic_cast<ArrayIndexNode*>(expression)))
                 throw ScriptCompileError(MakeString("Invalid operand for delete: ", expression->to_string(), 
                     " at ", kDelToken.position));
-            return std::make_shared<DeleteStatementNode>(kDelToken, expression);
+            return arena_.Make<DeleteStatementNode>(kDelToken, expression);
         }
         else if(current_token_->IsKeyword("class"))
         {
@@ -1109,7 +1091,7 @@ namespace mildew
             if(current_token_->type == Token::Type::SEMICOLON)
             {
                 NextToken();
-                return std::make_shared<ExpressionStatementNode>(kLineNumber, nullptr);
+                return arena_.Make<ExpressionStatementNode>(kLineNumber, nullptr);
             }
             else 
             {
@@ -1117,37 +1099,38 @@ namespace mildew
                 if(current_token_->type != Token::Type::SEMICOLON && current_token_->type != Token::Type::EOF_)
                     throw ScriptCompileError(MakeString("Expected semicolon after expression statement at ",
                         current_token_->position));
-                NextToken();
-                return std::make_shared<ExpressionStatementNode>(kLineNumber, expression);
+                if(current_token_->type == Token::Type::SEMICOLON)
+                    NextToken();
+                return arena_.Make<ExpressionStatementNode>(kLineNumber, expression);
             }
         }
     }
 
-    std::vector<std::shared_ptr<StatementNode>> Parser::ParseStatements(const Token::Type stop)
+    ArenaList<StatementNode*> Parser::ParseStatements(const Token::Type stop)
     {
-        std::vector<std::shared_ptr<StatementNode>> statements;
+        std::vector<StatementNode*> statements;
         while(current_token_->type != stop && current_token_->type != Token::Type::EOF_)
         {
             statements.emplace_back(ParseStatement());
         }
-        return statements;
+        return arena_.MakeList(statements);
     }
 
-    std::shared_ptr<SuperNode> Parser::ParseSuper()
+    SuperNode* Parser::ParseSuper()
     {
-        const auto& stoken = *current_token_;
+        const auto stoken = *current_token_;
         if(base_class_stack_.size() < 1)
             throw ScriptCompileError(MakeString("Super expression only allowed in derived classes at ", 
                 stoken.position));
         NextToken(); // consume 'super'
-        return std::make_shared<SuperNode>(stoken, base_class_stack_.top());
+        return arena_.Make<SuperNode>(stoken, base_class_stack_.top());
     }
 
-    std::shared_ptr<SwitchStatementNode> Parser::ParseSwitchStatement()
+    SwitchStatementNode* Parser::ParseSwitchStatement()
     {
         function_context_stack_.top().switch_stack++;
         const auto kLineNumber = current_token_->position.line;
-        const auto& switch_token = *current_token_;
+        const auto switch_token = *current_token_;
         NextToken();
         Consume(Token::Type::LPAREN, "switch statement");
         auto expression = ParseExpression();
@@ -1155,9 +1138,10 @@ namespace mildew
         Consume(Token::Type::LBRACE, "switch statement");
         bool case_started = false;
         size_t statement_counter = 0;
-        std::vector<std::shared_ptr<StatementNode>> statement_nodes;
+        std::vector<StatementNode*> statement_nodes;
         size_t default_statement_id = static_cast<size_t>(-1);
-        std::unordered_map<ScriptAny, size_t> jump_table;
+        std::vector<SwitchStatementNode::Case> jump_table;
+        std::unordered_set<ScriptAny> case_values;
         while(current_token_->type != Token::Type::RBRACE)
         {
             if(current_token_->IsKeyword("case"))
@@ -1170,10 +1154,10 @@ namespace mildew
                     throw ScriptCompileError(MakeString("Case expressions must be known at compile time at ",
                         switch_token.position));
                 Consume(Token::Type::COLON, "switch statement");
-                if(jump_table.count(result) > 0)
+                if(!case_values.insert(result).second)
                     throw ScriptCompileError(MakeString("Duplicate case entries not allowed at ",
                         switch_token.position));
-                jump_table[result] = statement_counter;
+                jump_table.push_back({result, statement_counter});
             }
             else if(current_token_->IsKeyword("default"))
             {
@@ -1193,102 +1177,108 @@ namespace mildew
         }
         NextToken(); // consume }
         function_context_stack_.top().switch_stack--;
-        return std::make_shared<SwitchStatementNode>(kLineNumber, expression, statement_nodes, 
-            default_statement_id, jump_table);
+        return arena_.Make<SwitchStatementNode>(kLineNumber, expression, arena_.MakeList(statement_nodes),
+            default_statement_id, arena_.MakeList(jump_table));
     }
 
-    static std::string PeekTwo(const std::string& text, const size_t i)
-    {
-        std::string result;
-        result += ((i >= text.length()) ? '\0' : text[i]);
-        result += ((i + 1>= text.length()) ? '\0' : text[i+1]);
-        return result;
-    }
-
-    std::shared_ptr<TemplateStringNode> Parser::ParseTemplateString()
+    TemplateStringNode* Parser::ParseTemplateString()
     {
+        // the literal pieces and expressions are slices of the token text, which is kept alive by the source
+        const auto kText = current_token_->text;
         bool lit_state = true;
-        size_t text_index;
-        std::string current_expr;
-        std::string current_lit;
-        std::vector<std::shared_ptr<ExpressionNode>> nodes;
+        size_t text_index = 0;
+        size_t piece_start = 0;
+        std::vector<ExpressionNode*> nodes;
         int bracket_stack = 0;
 
-        while(text_index < current_token_->text.length())
+        while(text_index < kText.length())
         {
             if(lit_state)
             {
-                if(PeekTwo(current_token_->text, text_index) == "${")
+                if(kText.compare(text_index, 2, "${") == 0)
                 {
-                    current_expr = "";
+                    if(text_index > piece_start)
+                        nodes.emplace_back(arena_.Make<LiteralNode>(Token::CreateFakeToken(Token::Type::STRING,
+                            kText.substr(piece_start, text_index - piece_start))));
                     text_index += 2;
+                    piece_start = text_index;
                     lit_state = false;
-                    if(current_lit.length() > 0)
-                        nodes.emplace_back(std::make_shared<LiteralNode>(
-                            Token::CreateFakeToken(Token::Type::STRING, current_lit)));
                 }
                 else 
                 {
-                    current_lit += current_token_->text[text_index++];
+                    ++text_index;
                 }
             }
             else 
             {
-                if(current_token_->text[text_index] == '}')
+                if(kText[text_index] == '}')
                 {
                     if(bracket_stack)
                     {
-                        current_expr += current_token_->text[text_index++];
+                        ++text_index;
                         --bracket_stack;
                     }
                     else 
                     {
-                        current_lit = "";
+                        const auto kExpr = kText.substr(piece_start, text_index - piece_start);
                         text_index++;
+                        piece_start = text_index;
                         lit_state = true;
-                        if(current_expr.length() > 0)
+                        if(kExpr.length() > 0)
                         {
-                            auto lexer = Lexer(current_expr);
-                            auto tokens = lexer.Tokenize();
+                            auto lexer = Lexer(source_, kExpr);
+                            auto parser = Parser(lexer, arena_);
+                            ExpressionNode* expression = nullptr;
+                            try 
+                            {
+                                expression = parser.ParseExpression();
+                            }
+                            catch(const ScriptCompileError&)
+                            {
+                                // the tokens are read while parsing, so a bad token is reported as a lexer error
+                                if(!lexer.HasErrors())
+                                    throw;
+                            }
                             if(lexer.HasErrors())
                             {
                                 throw ScriptCompileError(MakeString("Invalid characters in template expression at ",
                                     current_token_->position));
                             }
-                            auto parser = Parser(tokens);
-                            nodes.emplace_back(parser.ParseExpression());
-                            if(parser.current_token_->type != Token::Type::EOF_)
+                            if(parser.current_token_ == nullptr || parser.current_token_->type != Token::Type::EOF_)
                             {
                                 throw ScriptCompileError(MakeString("Unexpected token in template expression: ",
-                                    parser.current_token_->type, " at ", current_token_->position));
+                                    parser.current_token_ ? parser.current_token_->type : Token::Type::EOF_, " at ",
+                                    current_token_->position));
                             }
+                            nodes.emplace_back(expression);
                         }
                     }
                 }
                 else 
                 {
-                    if(current_token_->text[text_index] == '{')
+                    if(kText[text_index] == '{')
                         ++bracket_stack;
-                    current_expr += current_token_->text[text_index++];
+                    ++text_index;
                 }
             }
         }
         if(lit_state == false)
             throw ScriptCompileError(MakeString("Unclosed template expression at ", current_token_->position));
-        if(current_lit.length() > 0)
-            nodes.emplace_back(std::make_shared<LiteralNode>(
-                Token::CreateFakeToken(Token::Type::STRING, current_lit)));
-        return std::make_shared<TemplateStringNode>(nodes);
+        if(text_index > piece_start)
+            nodes.emplace_back(arena_.Make<LiteralNode>(Token::CreateFakeToken(Token::Type::STRING,
+                kText.substr(piece_start))));
+        return arena_.Make<TemplateStringNode>(arena_.MakeList(nodes));
     }
 
-    std::shared_ptr<TryBlockStatementNode> Parser::ParseTryBlockStatement()
+    TryBlockStatementNode* Parser::ParseTryBlockStatement()
     {
         const auto kLineNumber = current_token_->position.line;
-        const auto& kTryToken = *current_token_;
+        const auto kTryToken = *current_token_;
         NextToken();
         auto try_block = ParseStatement();
-        std::shared_ptr<StatementNode> catch_block = nullptr, finally_block = nullptr;
-        std::string name = "";
+        StatementNode* catch_block = nullptr;
+        StatementNode* finally_block = nullptr;
+        std::string_view name;
         if(current_token_->IsKeyword("catch"))
         {
             NextToken();
@@ -1309,20 +1299,20 @@ namespace mildew
         if(catch_block == nullptr && finally_block == nullptr)
             throw ScriptCompileError(MakeString("Try statements must have catch and/or finally block",
                 " at ", kTryToken.position));
-        return std::make_shared<TryBlockStatementNode>(kLineNumber, try_block, name, catch_block, finally_block);
+        return arena_.Make<TryBlockStatementNode>(kLineNumber, try_block, name, catch_block, finally_block);
     }
 
-    std::shared_ptr<VarDeclarationStatementNode> Parser::ParseVarDeclarationStatement(const bool consume_semicolon)
+    VarDeclarationStatementNode* Parser::ParseVarDeclarationStatement(const bool consume_semicolon)
     {
-        const auto& kSpecifier = *current_token_;
+        const auto kSpecifier = *current_token_;
         NextToken();
-        std::vector<std::shared_ptr<ExpressionNode>> expressions;
+        std::vector<ExpressionNode*> expressions;
         while(current_token_->type != Token::Type::SEMICOLON
           && current_token_->type != Token::Type::EOF_
           && !current_token_->IsIdentifier("of")
           && !current_token_->IsKeyword("in"))
         {
-            std::string var_name = "";
+            std::string_view var_name;
             if(current_token_->type == Token::Type::IDENTIFIER)
             {
                 var_name = current_token_->text;
@@ -1330,7 +1320,8 @@ namespace mildew
             }
             else if(current_token_->type == Token::Type::LBRACE || current_token_->type == Token::Type::LBRACKET)
             {
-                var_name += current_token_->Symbol();
+                // the destructure pattern is kept in the source along with the token texts
+                std::string pattern = current_token_->Symbol();
                 const auto kEndTokenType = (current_token_->type == Token::Type::LBRACE) ? 
                     Token::Type::RBRACE : Token::Type::RBRACKET;
                 NextToken();
@@ -1339,9 +1330,9 @@ namespace mildew
                 {
                     if(current_token_->type == Token::Type::TDOT)
                     {
-                        var_name += '.';
+                        pattern += '.';
                         NextToken();
-                        var_name += current_token_->text;
+                        pattern += current_token_->text;
                         Consume(Token::Type::IDENTIFIER, "destructure var declaration");
                         if(spread_listed)
                             throw ScriptCompileError(MakeString("Only one spread variable allowed at ",
@@ -1350,12 +1341,12 @@ namespace mildew
                     }
                     else
                     {
-                        var_name += current_token_->text;
+                        pattern += current_token_->text;
                         Consume(Token::Type::IDENTIFIER, "destructure var declaration");
                     }
                     if(current_token_->type == Token::Type::COMMA)
                     {
-                        var_name += ',';
+                        pattern += ',';
                         NextToken();
                     }
                     else if(current_token_->type != kEndTokenType)
@@ -1364,40 +1355,42 @@ namespace mildew
                             " at ", current_token_->position));
                     }
                 }
-                if(var_name.length() < 2)
+                if(pattern.length() < 2)
                     throw ScriptCompileError(MakeString("Destructure declaration cannot be empty at ",
                         current_token_->position));
+                var_name = source_->Store(std::move(pattern));
                 NextToken(); // consume } or ]
             }
             if(current_token_->type == Token::Type::ASSIGN)
             {
-                const auto& kAssignToken = *current_token_;
+                const auto kAssignToken = *current_token_;
                 NextToken();
                 auto expression = ParseExpression();
-                expressions.emplace_back(std::make_shared<BinaryOpNode>(kAssignToken, 
-                    std::make_shared<VarAccessNode>(Token::CreateFakeToken(Token::Type::IDENTIFIER, var_name)),
+                expressions.emplace_back(arena_.Make<BinaryOpNode>(kAssignToken, 
+                    arena_.Make<VarAccessNode>(Token::CreateFakeToken(Token::Type::IDENTIFIER, var_name)),
                     expression));
             }
             else
             {
-                expressions.emplace_back(std::make_shared<VarAccessNode>(
+                expressions.emplace_back(arena_.Make<VarAccessNode>(
                     Token::CreateFakeToken(Token::Type::IDENTIFIER, var_name)));
             }
             if(current_token_->type == Token::Type::COMMA)
                 NextToken();
-            else if(current_token_->type != Token::Type::SEMICOLON && current_token_->type != Token::Type::EOF_)
+            else if(current_token_->type != Token::Type::SEMICOLON && current_token_->type != Token::Type::EOF_
+              && !current_token_->IsIdentifier("of") && !current_token_->IsKeyword("in"))
                 throw ScriptCompileError(MakeString("Expected ',' between variable declarations ",
                     "(or missing ';') at ", current_token_->position));
         }
 
         for(const auto& expr : expressions)
         {
-            if(auto node = std::dynamic_pointer_cast<BinaryOpNode>(expr) )
+            if(auto node = dynamic_cast<BinaryOpNode*>(expr) )
             {
-                if(!std::dynamic_pointer_cast<VarAccessNode>(node->left_node))
+                if(!dynamic_cast<VarAccessNode*>(node->left_node))
                     throw ScriptCompileError(MakeString("Invalid assignment node at ", node->op_token.position));
             }
-            else if(!std::dynamic_pointer_cast<VarAccessNode>(expr) )
+            else if(!dynamic_cast<VarAccessNode*>(expr) )
             {
                 throw ScriptCompileError(MakeString("Invalid variable name in declaration: ", expr->to_string(), 
                     " at ", kSpecifier.position));
@@ -1405,10 +1398,10 @@ namespace mildew
         }
         if(consume_semicolon)
             NextToken();
-        return std::make_shared<VarDeclarationStatementNode>(kSpecifier, expressions);
+        return arena_.Make<VarDeclarationStatementNode>(kSpecifier, arena_.MakeList(expressions));
     }
 
-    std::shared_ptr<WhileStatementNode> Parser::ParseWhileStatement(const std::string& label)
+    WhileStatementNode* Parser::ParseWhileStatement(const std::string_view label)
     {
         const auto kLineNumber = current_token_->position.line;
         NextToken();
@@ -1416,47 +1409,53 @@ namespace mildew
         auto condition = ParseExpression();
         Consume(Token::Type::RPAREN, "while statement");
         auto loop_body = ParseStatement();
-        return std::make_shared<WhileStatementNode>(kLineNumber, condition, loop_body, label);
+        return arena_.Make<WhileStatementNode>(kLineNumber, condition, loop_body, label);
     }
 
-    std::shared_ptr<YieldNode> Parser::ParseYield()
+    YieldNode* Parser::ParseYield()
     {
         if(function_context_stack_.size() == 0 
           || function_context_stack_.top().fct != FunctionContext::Type::GENERATOR)
             throw ScriptCompileError(MakeString("Yield may only be used in Generator functions at ",
                 current_token_->position));
-        const auto& ytoken = *current_token_;
+        const auto ytoken = *current_token_;
         NextToken();
-        std::shared_ptr<ExpressionNode> expr = nullptr;
+        ExpressionNode* expr = nullptr;
         if(current_token_->type != Token::Type::RBRACE && current_token_->type != Token::Type::SEMICOLON)
             expr = ParseExpression();
-        return std::make_shared<YieldNode>(ytoken, expr);
+        return arena_.Make<YieldNode>(ytoken, expr);
     }
 
     Token Parser::PeekToken()
     {
-        if(token_index_ < tokens_.size())
-            return tokens_[token_index_];
-        return Token();
+        return Lookahead(0);
     }
 
     std::vector<Token> Parser::PeekTokens(int num)
     {
+        if(num > kMaxLookahead)
+            throw std::out_of_range(MakeString("Cannot look ahead more than ", kMaxLookahead, " tokens"));
         std::vector<Token> list;
-        for(size_t i = token_index_; i < token_index_ + num; ++i)
-        {
-            if(i < tokens_.size())
-                list.emplace_back(tokens_[i]);
-            else 
-                list.emplace_back(Token());
-        }
+        for(int i = 0; i < num; ++i)
+            list.emplace_back(Lookahead(i));
         return list;
     }
 
     void Parser::PutbackToken()
     {
-        if(token_index_ > 0)
-            current_token_ = &tokens_[--token_index_];
+        // the token before the current one is only kept until the ring buffer wraps around to it
+        if(current_token_ == nullptr || cursor_ < 2 || num_read_ - (cursor_ - 2) > kRingSize)
+            return;
+        --cursor_;
+        current_token_ = &ring_[(cursor_ - 1) % kRingSize];
+    }
+
+    Token& Parser::Lookahead(const size_t offset)
+    {
+        const auto kIndex = cursor_ + offset;
+        while(num_read_ <= kIndex)
+            ring_[num_read_++ % kRingSize] = lexer_.NextToken();
+        return ring_[kIndex % kRingSize];
     }
 
 } // namespace mildew
\ No newline at end of file
@@ -15,6 +15,7 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #pragma once
 
+#include <array>
 #include <memory>
 #include <sstream>
 #include <stack>
@@ -25,48 +26,55 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "lexer.hpp"
 #include "nodes.hpp"
 #include "types/any.hpp"
+#include "util/arena.hpp"
 
 namespace mildew
 {
     struct Parser
     {
-        Parser(const std::vector<Token>& tokens) : tokens_(tokens) { NextToken(); }
-        // TODO Parser that accepts Compiler reference to use CTFE properly
+        /**
+         * Pulls tokens from the lexer as they are needed, so only a few tokens past the current one are held at
+         * any time. The trees are made in the arena, and both the arena and the source of the lexer must
+         * outlive them. The lexer must outlive the parser.
+         */
+        Parser(Lexer& lexer, Arena& arena) : lexer_(lexer), arena_(arena), source_(lexer.source()) { NextToken(); }
 
-        std::shared_ptr<BlockStatementNode> ParseProgram();
-        std::shared_ptr<ExpressionNode> ParseExpression(int min_prec = 1);
+        BlockStatementNode* ParseProgram();
+        ExpressionNode* ParseExpression(int min_prec = 1);
 
     private:
         void CheckEOF(const std::string& where="") const;
         void Consume(const Token::Type token_type, const std::string& where="");
         void ConsumeText(const Token::Type token_type, const std::string& text, const std::string& where="");
-        ScriptAny EvaluateCTFE(const std::shared_ptr<ExpressionNode>& expr);
+        ScriptAny EvaluateCTFE(ExpressionNode* expr);
         void NextToken();
-        std::tuple<std::vector<std::string>, std::vector<std::shared_ptr<ExpressionNode>>> ParseArgumentList();
-        std::shared_ptr<ClassDeclarationStatementNode> ParseClassDeclarationStatement();
-        std::shared_ptr<ClassDefinition> ParseClassDefinition(const Token& class_token, const std::string& class_name,
-            const std::shared_ptr<ExpressionNode>& base_class);
-        std::shared_ptr<ClassLiteralNode> ParseClassExpression();
-        std::vector<std::shared_ptr<ExpressionNode>> ParseCommaSeparatedExpressions(const Token::Type stop);
-        std::shared_ptr<DoWhileStatementNode> ParseDoWhileStatement(const std::string& label = "");
-        std::shared_ptr<StatementNode> ParseForStatement(const std::string& label = "");
-        std::shared_ptr<FunctionDeclarationStatementNode> ParseFunctionDeclarationStatement();
-        std::shared_ptr<FunctionLiteralNode> ParseFunctionLiteral();
-        std::shared_ptr<IfStatementNode> ParseIfStatement();
-        std::shared_ptr<LambdaNode> ParseLambda(bool has_parentheses);
-        std::shared_ptr<StatementNode> ParseLoopStatement();
-        std::shared_ptr<NewExpressionNode> ParseNewExpression();
-        std::shared_ptr<ObjectLiteralNode> ParseObjectLiteral();
-        std::shared_ptr<ExpressionNode> ParsePrimaryExpression();
-        std::shared_ptr<StatementNode> ParseStatement();
-        std::vector<std::shared_ptr<StatementNode>> ParseStatements(const Token::Type stop);
-        std::shared_ptr<SuperNode> ParseSuper();
-        std::shared_ptr<SwitchStatementNode> ParseSwitchStatement();
-        std::shared_ptr<TemplateStringNode> ParseTemplateString();
-        std::shared_ptr<TryBlockStatementNode> ParseTryBlockStatement();
-        std::shared_ptr<VarDeclarationStatementNode> ParseVarDeclarationStatement(const bool consume_semicolon = true);
-        std::shared_ptr<WhileStatementNode> ParseWhileStatement(const std::string& label = "");
-        std::shared_ptr<YieldNode> ParseYield();
+        std::tuple<ArenaList<std::string_view>, ArenaList<ExpressionNode*>> ParseArgumentList();
+        ClassDeclarationStatementNode* ParseClassDeclarationStatement();
+        ClassDefinition* ParseClassDefinition(const Token& class_token, std::string_view class_name,
+            ExpressionNode* base_class);
+        ClassLiteralNode* ParseClassExpression();
+        ArenaList<ExpressionNode*> ParseCommaSeparatedExpressions(const Token::Type stop);
+        DoWhileStatementNode* ParseDoWhileStatement(std::string_view label = {});
+        StatementNode* ParseForStatement(std::string_view label = {});
+        FunctionDeclarationStatementNode* ParseFunctionDeclarationStatement();
+        FunctionLiteralNode* ParseFunctionLiteral();
+        IfStatementNode* ParseIfStatement();
+        LambdaNode* ParseLambda(bool has_parentheses);
+        StatementNode* ParseLoopStatement();
+        NewExpressionNode* ParseNewExpression();
+        ObjectLiteralNode* ParseObjectLiteral();
+        ExpressionNode* ParsePrimaryExpression();
+        StatementNode* ParseStatement();
+        ArenaList<StatementNode*> ParseStatements(const Token::Type stop);
+        SuperNode* ParseSuper();
+        SwitchStatementNode* ParseSwitchStatement();
+        TemplateStringNode* ParseTemplateString();
+        TryBlockStatementNode* ParseTryBlockStatement();
+        VarDeclarationStatementNode* ParseVarDeclarationStatement(const bool consume_semicolon = true);
+        WhileStatementNode* ParseWhileStatement(std::string_view label = {});
+        YieldNode* ParseYield();
+        /// the token offset places after the current one, read from the lexer if needed
+        Token& Lookahead(size_t offset);
         Token PeekToken();
         std::vector<Token> PeekTokens(int num);
         void PutbackToken();
@@ -80,10 +88,18 @@ namespace mildew
             std::vector<std::string> label_stack;
         };
 
-        const std::vector<Token> tokens_;
-        size_t token_index_ = 0;
-        Token const* current_token_;
+        // the ring holds the current token, the tokens looked ahead at, and the token before the current one
+        static constexpr int kMaxLookahead = 3;
+        static constexpr size_t kRingSize = 8;
+
+        Lexer& lexer_;
+        Arena& arena_;
+        std::shared_ptr<Source> source_;
+        std::array<Token, kRingSize> ring_;
+        size_t cursor_ = 0; // the number of tokens consumed, the current token is the last of them
+        size_t num_read_ = 0;
+        Token const* current_token_ = nullptr;
         std::stack<FunctionContext> function_context_stack_;
-        std::stack<std::shared_ptr<ExpressionNode>> base_class_stack_;
+        std::stack<ExpressionNode*> base_class_stack_;
     };
 } // namespace mildew
\ No newline at end of file
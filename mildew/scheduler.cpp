@@ -0,0 +1,365 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "environment.hpp"
+#include "errors.hpp"
+#include "heap.hpp"
+#include "interpreter.hpp"
+#include "types/function.hpp"
+#include "util/sfmt.hpp"
+
+namespace mildew
+{
+    TaskValue TaskValue::From(const ScriptAny& value)
+    {
+        switch(value.type())
+        {
+        case ScriptAny::Type::UNDEFINED:
+        case ScriptAny::Type::NULL_:
+        case ScriptAny::Type::BOOLEAN:
+        case ScriptAny::Type::INTEGER:
+        case ScriptAny::Type::DOUBLE: {
+            TaskValue scalar;
+            scalar.scalar_ = value;
+            return scalar;
+        }
+        default:
+            return TaskValue(value.ToString());
+        }
+    }
+
+    ScriptAny TaskValue::ToScriptAny() const
+    {
+        return is_string_ ? ScriptAny(str_) : scalar_;
+    }
+
+    std::string TaskValue::ToString() const
+    {
+        return is_string_ ? str_ : scalar_.ToString();
+    }
+
+    void LatencyHistogram::Record(const std::chrono::nanoseconds duration)
+    {
+        size_t bucket = 0;
+        while(bucket + 1 < kNumBuckets && duration >= BucketLimit(bucket))
+            ++bucket;
+        ++buckets_[bucket];
+        ++count_;
+        max_ = std::max(max_, duration);
+        total_ += duration;
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::Percentile(const double fraction) const
+    {
+        if(count_ == 0)
+            return std::chrono::nanoseconds::zero();
+        const auto kTarget = std::max<size_t>(1, static_cast<size_t>(std::ceil(std::clamp(fraction, 0.0, 1.0)
+            * static_cast<double>(count_))));
+        size_t counted = 0;
+        for(size_t bucket = 0; bucket < kNumBuckets; ++bucket)
+        {
+            counted += buckets_[bucket];
+            if(counted >= kTarget)
+                return BucketLimit(bucket);
+        }
+        return BucketLimit(kNumBuckets - 1);
+    }
+
+    void LatencyHistogram::Merge(const LatencyHistogram& other)
+    {
+        for(size_t bucket = 0; bucket < kNumBuckets; ++bucket)
+            buckets_[bucket] += other.buckets_[bucket];
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+        total_ += other.total_;
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::BucketLimit(const size_t bucket)
+    {
+        return std::chrono::microseconds(std::int64_t(1) << bucket);
+    }
+
+    ScriptScheduler::ScriptScheduler(std::shared_ptr<const CompiledProgram> program)
+    : ScriptScheduler(std::move(program), Options())
+    {
+    }
+
+    ScriptScheduler::ScriptScheduler(std::shared_ptr<const CompiledProgram> program, Options options)
+    : program_(std::move(program)), setup_(std::move(options.setup)), max_queued_(std::max<size_t>(1,
+      options.max_queued))
+    {
+        auto num_threads = options.num_threads > 0 ? options.num_threads : std::thread::hardware_concurrency();
+        num_threads = std::max(1u, num_threads);
+        for(unsigned i = 0; i < num_threads; ++i)
+            workers_.emplace_back(std::make_unique<Worker>());
+        // the workers only start once every queue exists, since any of them may steal from the others
+        std::vector<std::future<void>> ready;
+        for(size_t i = 0; i < workers_.size(); ++i)
+        {
+            std::promise<void> set_up;
+            ready.emplace_back(set_up.get_future());
+            workers_[i]->thread = std::thread([this, i, set_up = std::move(set_up)]() mutable {
+                Work(i, std::move(set_up));
+            });
+        }
+        std::exception_ptr setup_error;
+        for(auto& worker_ready : ready)
+        {
+            try
+            {
+                worker_ready.get();
+            }
+            catch(...)
+            {
+                if(setup_error == nullptr)
+                    setup_error = std::current_exception();
+            }
+        }
+        if(setup_error != nullptr)
+        {
+            Stop();
+            std::rethrow_exception(setup_error);
+        }
+    }
+
+    ScriptScheduler::~ScriptScheduler()
+    {
+        Stop();
+    }
+
+    std::future<TaskValue> ScriptScheduler::Submit(const std::string& function, std::vector<TaskValue> args)
+    {
+        while(!Reserve())
+        {
+            std::unique_lock lock(mutex_);
+            ++sleeping_submitters_;
+            space_available_.wait(lock, [this] { return queue_depth_ < max_queued_; });
+            --sleeping_submitters_;
+        }
+        return Enqueue(function, std::move(args));
+    }
+
+    std::optional<std::future<TaskValue>> ScriptScheduler::TrySubmit(const std::string& function,
+        std::vector<TaskValue> args)
+    {
+        if(!Reserve())
+        {
+            ++rejected_;
+            return std::nullopt;
+        }
+        return Enqueue(function, std::move(args));
+    }
+
+    SchedulerStats ScriptScheduler::stats() const
+    {
+        SchedulerStats stats;
+        stats.submitted = submitted_;
+        stats.rejected = rejected_;
+        stats.completed = completed_;
+        stats.failed = failed_;
+        stats.stolen = stolen_;
+        stats.queue_depth = queue_depth_;
+        stats.max_queue_depth = max_queue_depth_;
+        for(const auto& worker : workers_)
+        {
+            std::lock_guard lock(worker->mutex);
+            stats.wait_latency.Merge(worker->wait_latency);
+            stats.run_latency.Merge(worker->run_latency);
+        }
+        return stats;
+    }
+
+    bool ScriptScheduler::Reserve()
+    {
+        auto depth = queue_depth_.load();
+        do
+        {
+            if(depth >= max_queued_)
+                return false;
+        } while(!queue_depth_.compare_exchange_weak(depth, depth + 1));
+        for(auto max_depth = max_queue_depth_.load(); depth + 1 > max_depth;)
+        {
+            if(max_queue_depth_.compare_exchange_weak(max_depth, depth + 1))
+                break;
+        }
+        return true;
+    }
+
+    std::future<TaskValue> ScriptScheduler::Enqueue(const std::string& function, std::vector<TaskValue> args)
+    {
+        Task task{function, std::move(args), std::promise<TaskValue>(), Clock::now()};
+        auto result = task.result.get_future();
+        auto& worker = *workers_[next_worker_++ % workers_.size()];
+        {
+            // counted under the lock a thief takes, so it is never taken before it is counted
+            std::lock_guard lock(worker.mutex);
+            worker.tasks.emplace_back(std::move(task));
+            ++queued_;
+        }
+        ++submitted_;
+        // a worker that is going to sleep counts itself first, and then either sees the call or is woken
+        if(sleeping_workers_ > 0)
+        {
+            std::lock_guard lock(mutex_);
+            work_available_.notify_one();
+        }
+        return result;
+    }
+
+    bool ScriptScheduler::TakeTask(const size_t index, Task& task, bool& stolen)
+    {
+        bool found = false;
+        stolen = false;
+        {
+            auto& own = *workers_[index];
+            std::lock_guard lock(own.mutex);
+            if(!own.tasks.empty())
+            {
+                task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+                --queued_;
+                found = true;
+            }
+        }
+        for(size_t offset = 1; !found && offset < workers_.size(); ++offset)
+        {
+            auto& victim = *workers_[(index + offset) % workers_.size()];
+            std::lock_guard lock(victim.mutex);
+            if(!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+                --queued_;
+                found = stolen = true;
+            }
+        }
+        if(!found)
+            return false;
+        if(stolen)
+            ++stolen_;
+        --queue_depth_;
+        if(sleeping_submitters_ > 0)
+        {
+            std::lock_guard lock(mutex_);
+            space_available_.notify_one();
+        }
+        return true;
+    }
+
+    void ScriptScheduler::Work(const size_t index, std::promise<void> ready)
+    {
+        Interpreter interpreter;
+        try
+        {
+            if(setup_)
+            {
+                Heap::Scope heap_scope(interpreter.heap());
+                setup_(interpreter);
+            }
+            interpreter.Run(program_);
+        }
+        catch(const ScriptRuntimeError& error)
+        {
+            // the constructor throws the error and stops the other workers, so this one takes no calls
+            ready.set_exception(std::make_exception_ptr(ScriptRuntimeError(error.what())));
+            return;
+        }
+        catch(...)
+        {
+            ready.set_exception(std::current_exception());
+            return;
+        }
+        ready.set_value();
+
+        auto& worker = *workers_[index];
+        for(;;)
+        {
+            Task task;
+            bool stolen = false;
+            if(!TakeTask(index, task, stolen))
+            {
+                if(stopping_ && queued_ == 0)
+                    return;
+                std::unique_lock lock(mutex_);
+                ++sleeping_workers_;
+                work_available_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+                --sleeping_workers_;
+                continue;
+            }
+            const auto kStart = Clock::now();
+            TaskValue value;
+            std::exception_ptr error;
+            try
+            {
+                value = Call(interpreter, task);
+            }
+            catch(const ScriptRuntimeError& script_error)
+            {
+                error = std::make_exception_ptr(ScriptRuntimeError(script_error.what()));
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+            // the call is counted before its future is ready, so a caller that waited on it sees it
+            {
+                std::lock_guard lock(worker.mutex);
+                worker.wait_latency.Record(kStart - task.submitted);
+                worker.run_latency.Record(Clock::now() - kStart);
+            }
+            ++completed_;
+            if(error != nullptr)
+            {
+                ++failed_;
+                task.result.set_exception(error);
+            }
+            else
+            {
+                task.result.set_value(std::move(value));
+            }
+        }
+    }
+
+    TaskValue ScriptScheduler::Call(Interpreter& interpreter, const Task& task)
+    {
+        Heap::Scope heap_scope(interpreter.heap());
+        const auto entry = interpreter.global_environment()->LookupVariable(task.function);
+        if(entry == nullptr || entry->value.type() != ScriptAny::Type::FUNCTION)
+            throw ScriptRuntimeError(MakeString(task.function, " is not a function"));
+        // nothing is collected before the call puts the arguments in its registers
+        std::vector<ScriptAny> args;
+        for(const auto& arg : task.args)
+            args.emplace_back(arg.ToScriptAny());
+        return TaskValue::From(interpreter.vm().Call(entry->value.ToValue<ScriptFunction>(), ScriptAny(), args));
+    }
+
+    void ScriptScheduler::Stop()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        for(auto& worker : workers_)
+            worker->thread.join();
+    }
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,211 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "types/any.hpp"
+#include "vm/compiledprogram.hpp"
+
+namespace mildew
+{
+    class Interpreter;
+
+    /**
+     * An argument or result of a scheduled call. It belongs to no heap so it can move between the thread that
+     * submits a call and the worker that runs it. It holds undefined, null, a boolean, a number, or a string.
+     */
+    class TaskValue
+    {
+    public:
+        TaskValue() {}
+        template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> || std::is_null_pointer_v<T>>>
+        TaskValue(const T& value) : scalar_(value) {}
+        TaskValue(const std::string& str) : scalar_(), str_(str), is_string_(true) {}
+        TaskValue(const char* str) : TaskValue(std::string(str)) {}
+
+        /// copies a value out of its heap, objects other than strings are replaced by their string form
+        static TaskValue From(const ScriptAny& value);
+        /// a string is allocated from the current heap
+        ScriptAny ToScriptAny() const;
+        std::string ToString() const;
+
+        bool is_string() const { return is_string_; }
+        /// the value when it is not a string
+        const ScriptAny& scalar() const { return scalar_; }
+        const std::string& str() const { return str_; }
+
+    private:
+        ScriptAny scalar_;
+        std::string str_;
+        bool is_string_ = false;
+    };
+
+    /**
+     * Counts durations in buckets whose limits double, from under a microsecond in the first bucket to over a
+     * minute in the last, so that percentiles are found to within a factor of two.
+     */
+    class LatencyHistogram
+    {
+    public:
+        static constexpr size_t kNumBuckets = 28;
+
+        void Record(std::chrono::nanoseconds duration);
+        /// adds the durations counted by another histogram
+        void Merge(const LatencyHistogram& other);
+        /// the limit of the bucket that holds the given fraction of the recorded durations, zero when empty
+        std::chrono::nanoseconds Percentile(double fraction) const;
+        /// durations counted in a bucket are shorter than its limit, except in the last bucket
+        static std::chrono::nanoseconds BucketLimit(size_t bucket);
+
+        const std::array<size_t, kNumBuckets>& buckets() const { return buckets_; }
+        size_t count() const { return count_; }
+        std::chrono::nanoseconds max() const { return max_; }
+        std::chrono::nanoseconds total() const { return total_; }
+
+    private:
+        std::array<size_t, kNumBuckets> buckets_ = {};
+        size_t count_ = 0;
+        std::chrono::nanoseconds max_ = std::chrono::nanoseconds::zero();
+        std::chrono::nanoseconds total_ = std::chrono::nanoseconds::zero();
+    };
+
+    struct SchedulerStats
+    {
+        size_t submitted = 0;
+        size_t rejected = 0; // calls TrySubmit turned away because the queue was full
+        size_t completed = 0;
+        size_t failed = 0; // calls that threw, also counted as completed
+        size_t stolen = 0; // calls run by a worker other than the one they were queued on
+        size_t queue_depth = 0; // calls waiting for a worker
+        size_t max_queue_depth = 0;
+        LatencyHistogram wait_latency; // from submission until a worker starts the call
+        LatencyHistogram run_latency;
+    };
+
+    /**
+     * Runs calls of the global functions of a program on a pool of threads, each with its own Interpreter.
+     * Every worker instantiates the same shared program, so the pool compiles nothing. Calls are queued on
+     * the workers in turn, and a worker whose queue is empty steals from the others, which keeps every core
+     * busy when some calls take longer than others. A worker runs its own queue oldest first and steals the
+     * newest call of another queue, so the owner and a thief rarely want the same end of a queue.
+     *
+     * At most max_queued calls wait at a time. Submit blocks while the queue is full and TrySubmit turns the
+     * call away, which lets a producer that outpaces the pool slow down rather than queue without limit.
+     * Script exceptions reach the future of the call as a ScriptRuntimeError without its thrown value, since
+     * that belongs to the heap of the worker. The destructor runs every queued call before it returns.
+     *
+     * The constructor waits until every worker has run setup and the program, and throws the first error of a
+     * worker that could not, so every worker of a scheduler can run calls. Submitting and running a call only
+     * lock the queues involved and update atomic counters, and each worker keeps its own latency histograms,
+     * which stats() merges. The mutex of the scheduler is only taken to sleep or wake a thread that sleeps.
+     */
+    class ScriptScheduler
+    {
+    public:
+        struct Options
+        {
+            unsigned num_threads = 0; // zero for one per hardware thread
+            size_t max_queued = 1024;
+            /// runs on each worker before the program with the worker's heap current, to declare native functions
+            std::function<void(Interpreter&)> setup;
+        };
+
+        explicit ScriptScheduler(std::shared_ptr<const CompiledProgram> program);
+        ScriptScheduler(std::shared_ptr<const CompiledProgram> program, Options options);
+        ScriptScheduler(const ScriptScheduler&) = delete;
+        ~ScriptScheduler();
+        ScriptScheduler& operator=(const ScriptScheduler&) = delete;
+
+        /// queues a call of a global function, waiting while the queue is full
+        std::future<TaskValue> Submit(const std::string& function, std::vector<TaskValue> args = {});
+        /// queues a call of a global function unless the queue is full
+        std::optional<std::future<TaskValue>> TrySubmit(const std::string& function,
+            std::vector<TaskValue> args = {});
+
+        size_t max_queued() const { return max_queued_; }
+        unsigned num_threads() const { return static_cast<unsigned>(workers_.size()); }
+        size_t queue_depth() const { return queue_depth_; }
+        SchedulerStats stats() const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Task
+        {
+            std::string function;
+            std::vector<TaskValue> args;
+            std::promise<TaskValue> result;
+            Clock::time_point submitted;
+        };
+
+        struct Worker
+        {
+            std::mutex mutex; // guards tasks and the histograms
+            std::deque<Task> tasks;
+            LatencyHistogram wait_latency;
+            LatencyHistogram run_latency;
+            std::thread thread;
+        };
+
+        /// takes a place in the queue unless it is full
+        bool Reserve();
+        /// the caller has reserved a place in the queue for the call
+        std::future<TaskValue> Enqueue(const std::string& function, std::vector<TaskValue> args);
+        bool TakeTask(size_t index, Task& task, bool& stolen);
+        void Work(size_t index, std::promise<void> ready);
+        TaskValue Call(Interpreter& interpreter, const Task& task);
+        /// runs the queued calls and joins the workers
+        void Stop();
+
+        std::shared_ptr<const CompiledProgram> program_;
+        std::function<void(Interpreter&)> setup_;
+        size_t max_queued_;
+        std::vector<std::unique_ptr<Worker>> workers_;
+        // only held to sleep on the condition variables, or to wake a thread that sleeps on them
+        std::mutex mutex_;
+        std::condition_variable work_available_;
+        std::condition_variable space_available_;
+        std::atomic<size_t> sleeping_workers_ = 0;
+        std::atomic<size_t> sleeping_submitters_ = 0;
+        std::atomic<size_t> next_worker_ = 0;
+        std::atomic<bool> stopping_ = false;
+        std::atomic<size_t> queued_ = 0; // calls in the queues of the workers, behind queue_depth_ while enqueued
+        std::atomic<size_t> submitted_ = 0;
+        std::atomic<size_t> rejected_ = 0;
+        std::atomic<size_t> completed_ = 0;
+        std::atomic<size_t> failed_ = 0;
+        std::atomic<size_t> stolen_ = 0;
+        std::atomic<size_t> queue_depth_ = 0;
+        std::atomic<size_t> max_queue_depth_ = 0;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,399 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "scopeanalyzer.hpp"
+
+#include "errors.hpp"
+#include "util/sfmt.hpp"
+
+namespace mildew
+{
+    bool ScopeAnalyzer::Scope::HasCaptures() const
+    {
+        for(const auto& variable : variables)
+        {
+            if(variable.is_captured)
+                return true;
+        }
+        return false;
+    }
+
+    void ScopeAnalyzer::Analyze(const BlockStatementNode& program)
+    {
+        scopes_.clear();
+        active_scopes_.clear();
+        function_depth_ = 0;
+        AnalyzeStatements(program.statement_nodes);
+    }
+
+    const ScopeAnalyzer::Scope* ScopeAnalyzer::Find(const void* owner) const
+    {
+        auto found = scopes_.find(owner);
+        if(found == scopes_.end() || found->second.variables.empty())
+            return nullptr;
+        return &found->second;
+    }
+
+    void ScopeAnalyzer::VisitLiteralNode(const LiteralNode&)
+    {
+    }
+
+    void ScopeAnalyzer::VisitFunctionLiteralNode(const FunctionLiteralNode& flnode)
+    {
+        AnalyzeFunction(&flnode, flnode.arg_list, flnode.default_arguments, flnode.statements, nullptr);
+    }
+
+    void ScopeAnalyzer::VisitLambdaNode(const LambdaNode& lnode)
+    {
+        AnalyzeFunction(&lnode, lnode.argument_list, lnode.default_arguments, lnode.statements,
+            lnode.return_expression);
+    }
+
+    void ScopeAnalyzer::VisitTemplateStringNode(const TemplateStringNode& tsnode)
+    {
+        for(const auto& node : tsnode.nodes)
+            AnalyzeExpression(node);
+    }
+
+    void ScopeAnalyzer::VisitArrayLiteralNode(const ArrayLiteralNode& alnode)
+    {
+        for(const auto& node : alnode.value_nodes)
+            AnalyzeExpression(node);
+    }
+
+    void ScopeAnalyzer::VisitObjectLiteralNode(const ObjectLiteralNode& olnode)
+    {
+        for(const auto& node : olnode.value_nodes)
+            AnalyzeExpression(node);
+    }
+
+    void ScopeAnalyzer::VisitClassLiteralNode(const ClassLiteralNode& clnode)
+    {
+        AnalyzeClass(*clnode.class_definition);
+    }
+
+    void ScopeAnalyzer::VisitBinaryOpNode(const BinaryOpNode& bonode)
+    {
+        AnalyzeExpression(bonode.left_node);
+        AnalyzeExpression(bonode.right_node);
+    }
+
+    void ScopeAnalyzer::VisitUnaryOpNode(const UnaryOpNode& uonode)
+    {
+        AnalyzeExpression(uonode.operand_node);
+    }
+
+    void ScopeAnalyzer::VisitTerniaryOpNode(const TerniaryOpNode& tonode)
+    {
+        AnalyzeExpression(tonode.condition_node);
+        AnalyzeExpression(tonode.on_true_node);
+        AnalyzeExpression(tonode.on_false_node);
+    }
+
+    void ScopeAnalyzer::VisitVarAccessNode(const VarAccessNode& vanode)
+    {
+        const auto& name = vanode.var_token.text;
+        for(size_t i = active_scopes_.size(); i > 0; --i)
+        {
+            const auto& active = active_scopes_[i - 1];
+            for(auto& variable : active.scope->variables)
+            {
+                if(variable.name != name)
+                    continue;
+                if(active.function_depth < function_depth_)
+                    variable.is_captured = true;
+                return;
+            }
+        }
+    }
+
+    void ScopeAnalyzer::VisitFunctionCallNode(const FunctionCallNode& fcnode)
+    {
+        AnalyzeExpression(fcnode.function_to_call);
+        for(const auto& arg : fcnode.argument_nodes)
+            AnalyzeExpression(arg);
+    }
+
+    void ScopeAnalyzer::VisitArrayIndexNode(const ArrayIndexNode& ainode)
+    {
+        AnalyzeExpression(ainode.object_node);
+        AnalyzeExpression(ainode.index_node);
+    }
+
+    void ScopeAnalyzer::VisitMemberAccessNode(const MemberAccessNode& manode)
+    {
+        // the member is a field name and not a variable
+        AnalyzeExpression(manode.object_node);
+    }
+
+    void ScopeAnalyzer::VisitNewExpressionNode(const NewExpressionNode& nenode)
+    {
+        VisitFunctionCallNode(*nenode.function_call_node);
+    }
+
+    void ScopeAnalyzer::VisitSuperNode(const SuperNode& snode)
+    {
+        AnalyzeExpression(snode.base_class);
+    }
+
+    void ScopeAnalyzer::VisitYieldNode(const YieldNode& ynode)
+    {
+        AnalyzeExpression(ynode.yield_expression_node);
+    }
+
+    void ScopeAnalyzer::VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode)
+    {
+        for(const auto& node : vdsnode.assignment_nodes)
+        {
+            if(auto bonode = dynamic_cast<const BinaryOpNode*>(node))
+                AnalyzeExpression(bonode->right_node);
+            if(IsLexical(vdsnode.qualifier_token))
+                DeclareLate(DeclaredName(*node), vdsnode.qualifier_token.text == "const");
+        }
+    }
+
+    void ScopeAnalyzer::VisitBlockStatementNode(const BlockStatementNode& bsnode)
+    {
+        PushScope(&bsnode);
+        DeclareLexical(bsnode.statement_nodes);
+        AnalyzeStatements(bsnode.statement_nodes);
+        PopScope();
+    }
+
+    void ScopeAnalyzer::VisitIfStatementNode(const IfStatementNode& isnode)
+    {
+        AnalyzeExpression(isnode.condition_node);
+        AnalyzeStatement(isnode.on_true_statement);
+        AnalyzeStatement(isnode.on_false_statement);
+    }
+
+    void ScopeAnalyzer::VisitSwitchStatementNode(const SwitchStatementNode& ssnode)
+    {
+        PushScope(&ssnode);
+        DeclareLexical(ssnode.statement_nodes);
+        AnalyzeExpression(ssnode.expression_node);
+        AnalyzeStatements(ssnode.statement_nodes);
+        PopScope();
+    }
+
+    void ScopeAnalyzer::VisitWhileStatementNode(const WhileStatementNode& wsnode)
+    {
+        AnalyzeExpression(wsnode.condition_node);
+        AnalyzeStatement(wsnode.body_node);
+    }
+
+    void ScopeAnalyzer::VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode)
+    {
+        AnalyzeStatement(dwsnode.body_node);
+        AnalyzeExpression(dwsnode.condition_node);
+    }
+
+    void ScopeAnalyzer::VisitForStatementNode(const ForStatementNode& fsnode)
+    {
+        PushScope(&fsnode);
+        if(fsnode.init_statement)
+            DeclareLexical(ArenaList<StatementNode*>(&fsnode.init_statement, 1));
+        AnalyzeStatement(fsnode.init_statement);
+        AnalyzeExpression(fsnode.condition_node);
+        AnalyzeExpression(fsnode.increment_node);
+        AnalyzeStatement(fsnode.body_node);
+        PopScope();
+    }
+
+    void ScopeAnalyzer::VisitForOfStatementNode(const ForOfStatementNode& fosnode)
+    {
+        AnalyzeExpression(fosnode.object_to_iterate);
+        PushScope(&fosnode);
+        if(IsLexical(fosnode.qualifier_token))
+        {
+            for(const auto& vanode : fosnode.var_access_nodes)
+                Declare(vanode->var_token.text, fosnode.qualifier_token.text == "const", true);
+        }
+        AnalyzeStatement(fosnode.body_node);
+        PopScope();
+    }
+
+    void ScopeAnalyzer::VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode&)
+    {
+    }
+
+    void ScopeAnalyzer::VisitReturnStatementNode(const ReturnStatementNode& rsnode)
+    {
+        AnalyzeExpression(rsnode.expression_node);
+    }
+
+    void ScopeAnalyzer::VisitFunctionDeclarationStatementNode(const FunctionDeclarationStatementNode& fdsnode)
+    {
+        DeclareLate(fdsnode.name, false);
+        AnalyzeFunction(&fdsnode, fdsnode.argument_names, fdsnode.default_arguments, fdsnode.statement_nodes,
+            nullptr);
+    }
+
+    void ScopeAnalyzer::VisitThrowStatementNode(const ThrowStatementNode& tsnode)
+    {
+        AnalyzeExpression(tsnode.expression_node);
+    }
+
+    void ScopeAnalyzer::VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode)
+    {
+        AnalyzeStatement(tbsnode.try_block_node);
+        if(tbsnode.catch_block_node)
+        {
+            PushScope(&tbsnode);
+            if(tbsnode.exception_name != "")
+                Declare(tbsnode.exception_name, false, true);
+            AnalyzeStatement(tbsnode.catch_block_node);
+            PopScope();
+        }
+        AnalyzeStatement(tbsnode.finally_block_node);
+    }
+
+    void ScopeAnalyzer::VisitDeleteStatementNode(const DeleteStatementNode& dsnode)
+    {
+        AnalyzeExpression(dsnode.access_node);
+    }
+
+    void ScopeAnalyzer::VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode)
+    {
+        DeclareLate(cdsnode.class_definition->class_name, false);
+        AnalyzeClass(*cdsnode.class_definition);
+    }
+
+    void ScopeAnalyzer::VisitExpressionStatementNode(const ExpressionStatementNode& esnode)
+    {
+        AnalyzeExpression(esnode.expression_node);
+    }
+
+    void ScopeAnalyzer::AnalyzeClass(const ClassDefinition& cdef)
+    {
+        AnalyzeExpression(cdef.base_class);
+        AnalyzeExpression(cdef.constructor);
+        for(const auto* methods : {&cdef.methods, &cdef.get_methods, &cdef.set_methods, &cdef.static_methods})
+        {
+            for(const auto& method : *methods)
+                AnalyzeExpression(method);
+        }
+    }
+
+    void ScopeAnalyzer::AnalyzeExpression(const ExpressionNode* node)
+    {
+        if(node)
+            VisitExpression(*node);
+    }
+
+    void ScopeAnalyzer::AnalyzeFunction(const void* owner, const ArenaList<std::string_view>& args,
+        const ArenaList<ExpressionNode*>& default_args, const ArenaList<StatementNode*>& statements,
+        const ExpressionNode* return_expression)
+    {
+        ++function_depth_;
+        PushScope(owner);
+        for(const auto& arg : args)
+            Declare(arg, false, false);
+        std::vector<std::string_view> var_names;
+        for(const auto& stmt : statements)
+            CollectVarNames(stmt, var_names);
+        for(const auto& name : var_names)
+            Declare(name, false, false);
+        DeclareLexical(statements);
+        for(const auto& default_arg : default_args)
+            AnalyzeExpression(default_arg);
+        if(return_expression)
+            AnalyzeExpression(return_expression);
+        else
+            AnalyzeStatements(statements);
+        PopScope();
+        --function_depth_;
+    }
+
+    void ScopeAnalyzer::AnalyzeStatement(const StatementNode* node)
+    {
+        if(node == nullptr)
+            return;
+        const auto kSavedLine = current_line_;
+        if(node->line != 0)
+            current_line_ = node->line;
+        VisitStatement(*node);
+        current_line_ = kSavedLine;
+    }
+
+    void ScopeAnalyzer::AnalyzeStatements(const ArenaList<StatementNode*>& statements)
+    {
+        for(const auto& stmt : statements)
+            AnalyzeStatement(stmt);
+    }
+
+    void ScopeAnalyzer::Declare(const std::string_view name, const bool is_const, const bool is_lexical)
+    {
+        auto& variables = active_scopes_.back().scope->variables;
+        for(const auto& variable : variables)
+        {
+            if(variable.name != name)
+                continue;
+            if(is_lexical)
+                throw ScriptCompileError(MakeString("Cannot redeclare variable ", name, " at line ", current_line_));
+            return;
+        }
+        variables.push_back({std::string(name), is_const, false});
+    }
+
+    void ScopeAnalyzer::DeclareLate(const std::string_view name, const bool is_const)
+    {
+        // declarations at the top level of the program are global
+        if(active_scopes_.empty())
+            return;
+        auto& variables = active_scopes_.back().scope->variables;
+        for(const auto& variable : variables)
+        {
+            if(variable.name == name)
+                return;
+        }
+        // a declaration outside of a statement list was not visible to references made before it, so it is
+        // kept in an environment in case one of those came from a nested function
+        variables.push_back({std::string(name), is_const, true});
+    }
+
+    void ScopeAnalyzer::DeclareLexical(const ArenaList<StatementNode*>& statements)
+    {
+        for(const auto& stmt : statements)
+        {
+            if(auto vdsnode = dynamic_cast<const VarDeclarationStatementNode*>(stmt))
+            {
+                if(!IsLexical(vdsnode->qualifier_token))
+                    continue;
+                for(const auto& node : vdsnode->assignment_nodes)
+                    Declare(DeclaredName(*node), vdsnode->qualifier_token.text == "const", true);
+            }
+            else if(auto fdsnode = dynamic_cast<const FunctionDeclarationStatementNode*>(stmt))
+            {
+                Declare(fdsnode->name, false, false);
+            }
+            else if(auto cdsnode = dynamic_cast<const ClassDeclarationStatementNode*>(stmt))
+            {
+                Declare(cdsnode->class_definition->class_name, false, true);
+            }
+        }
+    }
+
+    void ScopeAnalyzer::PopScope()
+    {
+        active_scopes_.pop_back();
+    }
+
+    void ScopeAnalyzer::PushScope(const void* owner)
+    {
+        active_scopes_.push_back({&scopes_[owner], function_depth_});
+    }
+
+} // namespace mildew
\ No newline at end of file
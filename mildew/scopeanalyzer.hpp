@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "nodes.hpp"
+#include "visitors.hpp"
+
+namespace mildew
+{
+    /**
+     * Finds the variables declared by every function and block scope of a program before it is compiled, and
+     * which of them are referenced from a nested function. The compiler keeps the other variables in registers
+     * and only boxes captured variables in heap allocated upvalue cells. Declarations made directly at
+     * the top level of the program are global and looked up by name, so they are not tracked here.
+     */
+    class ScopeAnalyzer : public ExpressionVisitor<ScopeAnalyzer>, public StatementVisitor<ScopeAnalyzer>
+    {
+    public:
+        struct Variable
+        {
+            std::string name;
+            bool is_const;
+            bool is_captured;
+        };
+
+        /// the variables of one scope in declaration order, function scopes list their parameters first
+        struct Scope
+        {
+            std::vector<Variable> variables;
+
+            bool HasCaptures() const;
+        };
+
+        ScopeAnalyzer() {}
+        ScopeAnalyzer(const ScopeAnalyzer&) = delete;
+        ScopeAnalyzer& operator=(const ScopeAnalyzer&) = delete;
+
+        void Analyze(const BlockStatementNode& program);
+        /// the scope opened by a function, block, loop, switch, or catch clause node, or nullptr if it has none
+        const Scope* Find(const void* owner) const;
+
+        void VisitLiteralNode(const LiteralNode& lnode);
+        void VisitFunctionLiteralNode(const FunctionLiteralNode& flnode);
+        void VisitLambdaNode(const LambdaNode& lnode);
+        void VisitTemplateStringNode(const TemplateStringNode& tsnode);
+        void VisitArrayLiteralNode(const ArrayLiteralNode& alnode);
+        void VisitObjectLiteralNode(const ObjectLiteralNode& olnode);
+        void VisitClassLiteralNode(const ClassLiteralNode& clnode);
+        void VisitBinaryOpNode(const BinaryOpNode& bonode);
+        void VisitUnaryOpNode(const UnaryOpNode& uonode);
+        void VisitTerniaryOpNode(const TerniaryOpNode& tonode);
+        void VisitVarAccessNode(const VarAccessNode& vanode);
+        void VisitFunctionCallNode(const FunctionCallNode& fcnode);
+        void VisitArrayIndexNode(const ArrayIndexNode& ainode);
+        void VisitMemberAccessNode(const MemberAccessNode& manode);
+        void VisitNewExpressionNode(const NewExpressionNode& nenode);
+        void VisitSuperNode(const SuperNode& snode);
+        void VisitYieldNode(const YieldNode& ynode);
+
+        void VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode);
+        void VisitBlockStatementNode(const BlockStatementNode& bsnode);
+        void VisitIfStatementNode(const IfStatementNode& isnode);
+        void VisitSwitchStatementNode(const SwitchStatementNode& ssnode);
+        void VisitWhileStatementNode(const WhileStatementNode& wsnode);
+        void VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode);
+        void VisitForStatementNode(const ForStatementNode& fsnode);
+        void VisitForOfStatementNode(const ForOfStatementNode& fosnode);
+        void VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode& bocsnode);
+        void VisitReturnStatementNode(const ReturnStatementNode& rsnode);
+        void VisitFunctionDeclarationStatementNode(const FunctionDeclarationStatementNode& fdsnode);
+        void VisitThrowStatementNode(const ThrowStatementNode& tsnode);
+        void VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode);
+        void VisitDeleteStatementNode(const DeleteStatementNode& dsnode);
+        void VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode);
+        void VisitExpressionStatementNode(const ExpressionStatementNode& esnode);
+
+    private:
+        struct ActiveScope
+        {
+            Scope* scope;
+            size_t function_depth;
+        };
+
+        void AnalyzeClass(const ClassDefinition& cdef);
+        void AnalyzeExpression(const ExpressionNode* node);
+        void AnalyzeFunction(const void* owner, const ArenaList<std::string_view>& args,
+            const ArenaList<ExpressionNode*>& default_args, const ArenaList<StatementNode*>& statements,
+            const ExpressionNode* return_expression);
+        void AnalyzeStatement(const StatementNode* node);
+        void AnalyzeStatements(const ArenaList<StatementNode*>& statements);
+        void Declare(std::string_view name, bool is_const, bool is_lexical);
+        /// declares a name when its declaration is reached unless it was declared on entering the scope
+        void DeclareLate(std::string_view name, bool is_const);
+        void DeclareLexical(const ArenaList<StatementNode*>& statements);
+        void PopScope();
+        void PushScope(const void* owner);
+
+        std::unordered_map<const void*, Scope> scopes_;
+        std::vector<ActiveScope> active_scopes_;
+        size_t function_depth_ = 0;
+        size_t current_line_ = 0;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,106 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "scriptcache.hpp"
+
+#include "heap.hpp"
+#include "types/function.hpp"
+
+namespace mildew
+{
+    // 64-bit FNV-1a
+    static std::uint64_t HashBytes(std::uint64_t hash, const std::string_view bytes)
+    {
+        for(const auto ch : bytes)
+        {
+            hash ^= static_cast<unsigned char>(ch);
+            hash *= 0x100000001B3ULL;
+        }
+        return hash;
+    }
+
+    void ScriptCache::Clear()
+    {
+        entries_.clear();
+        index_.clear();
+    }
+
+    ScriptFunction* ScriptCache::Find(const std::string_view code, const std::string_view name)
+    {
+        if(capacity_ == 0)
+            return nullptr;
+        auto found = index_.find(Hash(code, name));
+        if(found == index_.end() || found->second->code != code || found->second->name != name)
+        {
+            ++stats_.misses;
+            return nullptr;
+        }
+        ++stats_.hits;
+        entries_.splice(entries_.begin(), entries_, found->second);
+        return found->second->program;
+    }
+
+    void ScriptCache::Insert(const std::string_view code, const std::string_view name, ScriptFunction* program)
+    {
+        if(capacity_ == 0)
+            return;
+        const auto kHash = Hash(code, name);
+        auto found = index_.find(kHash);
+        if(found != index_.end())
+        {
+            // the same script compiled again or a collision, either way the newer program replaces it
+            entries_.erase(found->second);
+            index_.erase(found);
+        }
+        else
+        {
+            Evict(capacity_ - 1);
+        }
+        entries_.push_front({kHash, std::string(code), std::string(name), program});
+        index_.emplace(kHash, entries_.begin());
+    }
+
+    void ScriptCache::Trace(Heap& heap) const
+    {
+        for(const auto& entry : entries_)
+            heap.Mark(entry.program);
+    }
+
+    void ScriptCache::capacity(const size_t entries)
+    {
+        capacity_ = entries;
+        Evict(entries);
+    }
+
+    std::uint64_t ScriptCache::Hash(const std::string_view code, const std::string_view name)
+    {
+        auto hash = HashBytes(0xCBF29CE484222325ULL, name);
+        // the length keeps the boundary between the name and the code from being ambiguous
+        hash ^= name.size();
+        hash *= 0x100000001B3ULL;
+        return HashBytes(hash, code);
+    }
+
+    void ScriptCache::Evict(const size_t max_entries)
+    {
+        while(entries_.size() > max_entries)
+        {
+            index_.erase(entries_.back().hash);
+            entries_.pop_back();
+            ++stats_.evictions;
+        }
+    }
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,83 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace mildew
+{
+    class Heap;
+    class ScriptFunction;
+
+    struct ScriptCacheStats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0; // entries dropped to make room for newer ones
+    };
+
+    /**
+     * Remembers the programs compiled from the most recently evaluated scripts so that evaluating the same
+     * code again skips lexing, parsing, and compiling. Entries are found by a 64-bit hash of the name and
+     * code, and each keeps a copy of both so that a hash collision is only ever a miss. When the cache is
+     * full the least recently used program is dropped. The cached programs are script objects, so the owner
+     * of the cache must mark them with Trace from a root source of their heap.
+     */
+    class ScriptCache
+    {
+    public:
+        static constexpr size_t kDefaultCapacity = 64;
+
+        explicit ScriptCache(size_t capacity = kDefaultCapacity) : capacity_(capacity) {}
+        ScriptCache(const ScriptCache&) = delete;
+        ScriptCache& operator=(const ScriptCache&) = delete;
+
+        void Clear();
+        /// the program compiled from code and name or nullptr, counting a hit or a miss
+        ScriptFunction* Find(std::string_view code, std::string_view name);
+        void Insert(std::string_view code, std::string_view name, ScriptFunction* program);
+        void Trace(Heap& heap) const;
+
+        size_t capacity() const { return capacity_; }
+        /// a capacity of zero disables the cache, shrinking it drops the least recently used entries
+        void capacity(size_t entries);
+        size_t size() const { return entries_.size(); }
+        const ScriptCacheStats& stats() const { return stats_; }
+
+        static std::uint64_t Hash(std::string_view code, std::string_view name);
+
+    private:
+        struct Entry
+        {
+            std::uint64_t hash;
+            std::string code;
+            std::string name;
+            ScriptFunction* program;
+        };
+
+        void Evict(size_t max_entries);
+
+        size_t capacity_;
+        std::list<Entry> entries_; // most recently used first
+        std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index_;
+        ScriptCacheStats stats_;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -15,6 +15,10 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include "any.hpp"
 
+#include <cmath>
+#include <limits>
+
+#include "../heap.hpp"
 #include "object.hpp"
 #include "array.hpp"
 #include "function.hpp"
@@ -22,174 +26,329 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 namespace mildew
 {
-    ScriptAny::ScriptAny(const ScriptAny& other)
-    {
-        switch(other.type_)
-        {
-        case Type::UNDEFINED:
-        case Type::NULL_:
-            break;
-        case Type::BOOLEAN:
-            SetValue(other.as_boolean_);
-            break;
-        case Type::INTEGER:
-            SetValue(other.as_integer_);
-            break;
-        case Type::DOUBLE:
-            SetValue(other.as_double_);
-            break;
-        case Type::OBJECT:
-        case Type::ARRAY:
-        case Type::FUNCTION:
-        case Type::STRING:
-            SetValue(other.as_object_);
-            break;
-        }
-        type_ = other.type_;
-    }
-
     ScriptAny::ScriptAny(const std::string& str)
     {
-        DestructObject();
-        type_ = Type::STRING;
-        new (&as_object_) std::shared_ptr<ScriptString>(new ScriptString(str));
-    }
-
-    ScriptAny::~ScriptAny()
-    {
-        DestructObject();
+        SetObject(Heap::Current().Make<ScriptString>(str), Type::STRING);
     }
 
     ScriptAny& ScriptAny::operator=(const std::string& str)
     {
-        DestructObject();
-        type_ = Type::STRING;
-        new (&as_object_) std::shared_ptr<ScriptString>(new ScriptString(str));
+        SetObject(Heap::Current().Make<ScriptString>(str), Type::STRING);
         return *this;
     }
 
-    bool ScriptAny::operator==(const ScriptAny& other) const
+    bool ScriptAny::EqualsGeneric(const ScriptAny& other) const
     {
-        if(type_ == Type::UNDEFINED && other.type_ == Type::UNDEFINED)
+        if(type() == Type::UNDEFINED && other.type() == Type::UNDEFINED)
             return true;
-        else if((type_ == Type::UNDEFINED || type_ == Type::NULL_) &&
-          (other.type_ == Type::UNDEFINED || other.type_ == Type::NULL_))
+        else if((type() == Type::UNDEFINED || type() == Type::NULL_) &&
+          (other.type() == Type::UNDEFINED || other.type() == Type::NULL_))
             return true;
-        else if(type_ == Type::UNDEFINED || other.type_ == Type::UNDEFINED)
+        else if(type() == Type::UNDEFINED || other.type() == Type::UNDEFINED)
             return false;
 
-        if(type_ == Type::NULL_ || other.type_ == Type::NULL_)
+        if(type() == Type::NULL_ || other.type() == Type::NULL_)
             return false;
 
-        if(type_ == Type::STRING || other.type_ == Type::STRING)
+        if(type() == Type::STRING && other.type() == Type::STRING)
+            return *static_cast<ScriptString*>(as_object()) == *static_cast<ScriptString*>(other.as_object());
+        if(type() == Type::STRING || other.type() == Type::STRING)
         {
             return ToUTF8String() == other.ToUTF8String();
         }
         
         if(IsNumber() && other.IsNumber())
         {
-            if(type_ == Type::DOUBLE || other.type_ == Type::DOUBLE)
+            if(type() == Type::DOUBLE || other.type() == Type::DOUBLE)
                 return ToValue<double>() == other.ToValue<double>();
             return ToValue<std::int64_t>() == other.ToValue<std::int64_t>();
         }
 
-        if(type_ == Type::ARRAY && other.type_ == Type::ARRAY)
+        if(type() == Type::ARRAY && other.type() == Type::ARRAY)
         {
-            auto a = std::dynamic_pointer_cast<ScriptArray>(as_object_);
-            auto b = std::dynamic_pointer_cast<ScriptArray>(other.as_object_);
+            auto a = dynamic_cast<ScriptArray*>(as_object());
+            auto b = dynamic_cast<ScriptArray*>(other.as_object());
             return *a == *b;
         }
 
-        if(type_ == Type::FUNCTION && other.type_ == Type::FUNCTION)
-            return *std::dynamic_pointer_cast<ScriptFunction>(as_object_)
-                == *std::dynamic_pointer_cast<ScriptFunction>(other.as_object_);
+        if(type() == Type::FUNCTION && other.type() == Type::FUNCTION)
+            return *dynamic_cast<ScriptFunction*>(as_object())
+                == *dynamic_cast<ScriptFunction*>(other.as_object());
 
-        if(type_ != other.type_)
+        if(type() != other.type())
             return false;
 
-        return *as_object_ == *(other.as_object_);
+        return *as_object() == *(other.as_object());
     }
 
     bool ScriptAny::operator<(const ScriptAny& other) const
     {
-        if(type_ == Type::UNDEFINED)
-            return other.type_ >= Type::UNDEFINED;
-        if(type_ == Type::NULL_)
-            return other.type_ >= Type::NULL_;
+        if(type() == Type::UNDEFINED)
+            return other.type() >= Type::UNDEFINED;
+        if(type() == Type::NULL_)
+            return other.type() >= Type::NULL_;
         if(IsNumber() && !other.IsNumber())
             return true;
         else if(!IsNumber() && other.IsNumber())
             return false;
         else if(IsNumber() && other.IsNumber())
             return ToValue<double>() < other.ToValue<double>();
-        else if(type_ == Type::STRING || other.type_ == Type::STRING)
+        else if(type() == Type::STRING || other.type() == Type::STRING)
         {
             return ToUTF8String() < other.ToUTF8String();
         }
-        else if(type_ == Type::ARRAY && other.type_ == Type::ARRAY)
+        else if(type() == Type::ARRAY && other.type() == Type::ARRAY)
         {
-            auto a = std::dynamic_pointer_cast<ScriptArray>(as_object_);
-            auto b = std::dynamic_pointer_cast<ScriptArray>(other.as_object_);
+            auto a = dynamic_cast<ScriptArray*>(as_object());
+            auto b = dynamic_cast<ScriptArray*>(other.as_object());
             return *a < *b;
         }
-        else if(type_ == Type::FUNCTION && other.type_ == Type::FUNCTION)
+        else if(type() == Type::FUNCTION && other.type() == Type::FUNCTION)
         {
-            return *std::dynamic_pointer_cast<ScriptFunction>(as_object_)
-                < *std::dynamic_pointer_cast<ScriptFunction>(as_object_);
+            return *dynamic_cast<ScriptFunction*>(as_object())
+                < *dynamic_cast<ScriptFunction*>(other.as_object());
         }
         if(IsObject() && other.IsObject())
-            return *as_object_ < *(other.as_object_);
+            return *as_object() < *(other.as_object());
 
-        if(type_ != other.type_)
-            return type_ < other.type_;
+        if(type() != other.type())
+            return type() < other.type();
         
         return false;
     }
 
+    template<typename IntOp, typename DoubleOp>
+    static ScriptAny Arithmetic(const ScriptAny& lhs, const ScriptAny& rhs, IntOp int_op, DoubleOp double_op)
+    {
+        if(lhs.type() == ScriptAny::Type::INTEGER && rhs.type() == ScriptAny::Type::INTEGER)
+            return int_op(lhs.ToValue<std::int64_t>(), rhs.ToValue<std::int64_t>());
+        const auto kLeft = lhs.ToNumber();
+        const auto kRight = rhs.ToNumber();
+        if(kLeft.type() == ScriptAny::Type::INTEGER && kRight.type() == ScriptAny::Type::INTEGER)
+            return int_op(kLeft.ToValue<std::int64_t>(), kRight.ToValue<std::int64_t>());
+        return double_op(kLeft.ToValue<double>(), kRight.ToValue<double>());
+    }
+
+    ScriptAny ScriptAny::AddGeneric(const ScriptAny& rhs) const
+    {
+        if(type() == Type::STRING || rhs.type() == Type::STRING)
+        {
+            // a string built by repeated concatenation becomes a rope instead of being copied every time
+            const ScriptAny kPieces[] = {*this, rhs};
+            return ScriptAny(ScriptString::Join(kPieces, 2));
+        }
+        if(IsObject() || rhs.IsObject())
+            return ScriptAny(ToString() + rhs.ToString());
+        return Arithmetic(*this, rhs, CheckedAdd, [](double a, double b) { return ScriptAny(a + b); });
+    }
+
+    ScriptAny ScriptAny::SubtractGeneric(const ScriptAny& rhs) const
+    {
+        return Arithmetic(*this, rhs, CheckedSubtract, [](double a, double b) { return ScriptAny(a - b); });
+    }
+
+    ScriptAny ScriptAny::MultiplyGeneric(const ScriptAny& rhs) const
+    {
+        return Arithmetic(*this, rhs, CheckedMultiply, [](double a, double b) { return ScriptAny(a * b); });
+    }
+
+    ScriptAny ScriptAny::DivideGeneric(const ScriptAny& rhs) const
+    {
+        return Arithmetic(*this, rhs, IntegerDivide, [](double a, double b) { return ScriptAny(a / b); });
+    }
+
+    ScriptAny ScriptAny::ModuloGeneric(const ScriptAny& rhs) const
+    {
+        return Arithmetic(*this, rhs, IntegerModulo, [](double a, double b) { return ScriptAny(std::fmod(a, b)); });
+    }
+
+    ScriptAny ScriptAny::operator&(const ScriptAny& rhs) const
+    {
+        return ScriptAny(ToNumber().ToValue<std::int64_t>() & rhs.ToNumber().ToValue<std::int64_t>());
+    }
+
+    ScriptAny ScriptAny::operator|(const ScriptAny& rhs) const
+    {
+        return ScriptAny(ToNumber().ToValue<std::int64_t>() | rhs.ToNumber().ToValue<std::int64_t>());
+    }
+
+    ScriptAny ScriptAny::operator^(const ScriptAny& rhs) const
+    {
+        return ScriptAny(ToNumber().ToValue<std::int64_t>() ^ rhs.ToNumber().ToValue<std::int64_t>());
+    }
+
+    ScriptAny ScriptAny::operator<<(const ScriptAny& rhs) const
+    {
+        const auto kValue = static_cast<std::uint64_t>(ToNumber().ToValue<std::int64_t>());
+        return ScriptAny(static_cast<std::int64_t>(kValue << (rhs.ToNumber().ToValue<std::int64_t>() & 63)));
+    }
+
+    ScriptAny ScriptAny::operator>>(const ScriptAny& rhs) const
+    {
+        return ScriptAny(ToNumber().ToValue<std::int64_t>() >> (rhs.ToNumber().ToValue<std::int64_t>() & 63));
+    }
+
+    ScriptAny ScriptAny::operator-() const
+    {
+        const auto kValue = ToNumber();
+        if(kValue.type() == Type::INTEGER)
+            return CheckedSubtract(0, kValue.as_integer());
+        return ScriptAny(-kValue.as_double());
+    }
+
+    ScriptAny ScriptAny::operator~() const
+    {
+        return ScriptAny(~ToNumber().ToValue<std::int64_t>());
+    }
+
+    ScriptAny ScriptAny::Pow(const ScriptAny& rhs) const
+    {
+        const auto kBase = ToNumber();
+        const auto kExponent = rhs.ToNumber();
+        const double kResult = std::pow(kBase.ToValue<double>(), kExponent.ToValue<double>());
+        // 2^53 is the largest magnitude at which every integer is exactly representable in a double
+        if(kBase.type() == Type::INTEGER && kExponent.type() == Type::INTEGER && kExponent.as_integer() >= 0
+          && std::fabs(kResult) <= 9007199254740992.0)
+            return ScriptAny(static_cast<std::int64_t>(kResult));
+        return ScriptAny(kResult);
+    }
+
+    ScriptAny ScriptAny::UnsignedRightShift(const ScriptAny& rhs) const
+    {
+        const auto kValue = static_cast<std::uint64_t>(ToNumber().ToValue<std::int64_t>());
+        return ScriptAny(static_cast<std::int64_t>(kValue >> (rhs.ToNumber().ToValue<std::int64_t>() & 63)));
+    }
+
+    bool ScriptAny::IsLessThanGeneric(const ScriptAny& rhs) const
+    {
+        if(type() == Type::STRING && rhs.type() == Type::STRING)
+            return ToString() < rhs.ToString();
+        const auto kLeft = ToNumber();
+        const auto kRight = rhs.ToNumber();
+        if(kLeft.type() == Type::INTEGER && kRight.type() == Type::INTEGER)
+            return kLeft.as_integer() < kRight.as_integer();
+        return kLeft.ToValue<double>() < kRight.ToValue<double>();
+    }
+
+    bool ScriptAny::IsLessOrEqualGeneric(const ScriptAny& rhs) const
+    {
+        if(type() == Type::STRING && rhs.type() == Type::STRING)
+            return ToString() <= rhs.ToString();
+        const auto kLeft = ToNumber();
+        const auto kRight = rhs.ToNumber();
+        if(kLeft.type() == Type::INTEGER && kRight.type() == Type::INTEGER)
+            return kLeft.as_integer() <= kRight.as_integer();
+        return kLeft.ToValue<double>() <= kRight.ToValue<double>();
+    }
+
+    bool ScriptAny::StrictEqualsGeneric(const ScriptAny& other) const
+    {
+        const bool kIsNumber = type() == Type::INTEGER || type() == Type::DOUBLE;
+        const bool kOtherIsNumber = other.type() == Type::INTEGER || other.type() == Type::DOUBLE;
+        if(kIsNumber && kOtherIsNumber)
+        {
+            if(type() == Type::INTEGER && other.type() == Type::INTEGER)
+                return as_integer() == other.as_integer();
+            return ToValue<double>() == other.ToValue<double>();
+        }
+        if(type() != other.type())
+            return false;
+        switch(type())
+        {
+        case Type::UNDEFINED:
+        case Type::NULL_:
+            return true;
+        case Type::BOOLEAN:
+            return as_boolean() == other.as_boolean();
+        case Type::STRING:
+            return *static_cast<ScriptString*>(as_object()) == *static_cast<ScriptString*>(other.as_object());
+        default:
+            return as_object() == other.as_object();
+        }
+    }
+
     size_t ScriptAny::GetHash() const
     {
-        switch(type_)
+        switch(type())
         {
         case Type::UNDEFINED: return -1;
         case Type::NULL_: return 0;
-        case Type::BOOLEAN: return std::hash<bool>()(as_boolean_);
-        case Type::INTEGER: return std::hash<std::int64_t>()(as_integer_);
-        case Type::DOUBLE: return std::hash<double>()(as_double_);
+        case Type::BOOLEAN: return std::hash<bool>()(as_boolean());
+        case Type::INTEGER: return std::hash<std::int64_t>()(as_integer());
+        case Type::DOUBLE: return std::hash<double>()(as_double());
         case Type::OBJECT: 
         case Type::ARRAY:
         case Type::FUNCTION:
         case Type::STRING:
-            return as_object_->GetHash();
+            return as_object()->GetHash();
         }
         return -1;
     }
 
     bool ScriptAny::IsInteger() const 
     {
-        return type_ == Type::NULL_ || type_ == Type::BOOLEAN || type_ == Type::INTEGER;
+        return type() == Type::NULL_ || type() == Type::BOOLEAN || type() == Type::INTEGER;
     }
 
     bool ScriptAny::IsNumber() const
     {
-        return type_ == Type::DOUBLE || IsInteger();
+        return type() == Type::DOUBLE || IsInteger();
     }
 
     bool ScriptAny::IsObject() const
     {
+#if MILDEW_NAN_BOXING
+        return bits_ >= kTagObject;
+#else
         return type_ == Type::OBJECT 
             || type_ == Type::ARRAY
             || type_ == Type::FUNCTION
             || type_ == Type::STRING;
+#endif
     }
 
-    void ScriptAny::DestructObject()
+    ScriptAny ScriptAny::ToNumber() const
     {
-        if(IsObject())
-            as_object_.~shared_ptr<ScriptObject>();
+        switch(type())
+        {
+        case Type::NULL_:
+            return ScriptAny(static_cast<std::int64_t>(0));
+        case Type::BOOLEAN:
+            return ScriptAny(static_cast<std::int64_t>(as_boolean()));
+        case Type::INTEGER:
+        case Type::DOUBLE:
+            return *this;
+        case Type::STRING: {
+            const auto kText = ToString();
+            const auto kFirst = kText.find_first_not_of(" \t\n\r");
+            if(kFirst == std::string::npos)
+                return ScriptAny(static_cast<std::int64_t>(0));
+            const auto kLast = kText.find_last_not_of(" \t\n\r");
+            const auto kTrimmed = kText.substr(kFirst, kLast - kFirst + 1);
+            size_t consumed = 0;
+            try
+            {
+                const auto kInteger = std::stoll(kTrimmed, &consumed);
+                if(consumed == kTrimmed.length())
+                    return ScriptAny(static_cast<std::int64_t>(kInteger));
+                const auto kDouble = std::stod(kTrimmed, &consumed);
+                if(consumed == kTrimmed.length())
+                    return ScriptAny(kDouble);
+            }
+            catch(const std::logic_error&)
+            {
+            }
+            return ScriptAny(std::numeric_limits<double>::quiet_NaN());
+        }
+        default:
+            return ScriptAny(std::numeric_limits<double>::quiet_NaN());
+        }
     }
 
     std::string ScriptAny::ToString() const
     {
+        if(type() == Type::STRING)
+            return static_cast<ScriptString*>(as_object())->str();
         std::ostringstream ss;
         ss << *this;
         return ss.str();
@@ -197,30 +356,44 @@ namespace mildew
 
     cppd::UTF8String ScriptAny::ToUTF8String() const
     {
-        switch(type_)
+        switch(type())
         {
         case Type::UNDEFINED:
             return cppd::UTF8String("undefined");
         case Type::NULL_:
             return cppd::UTF8String("null");
         case Type::BOOLEAN:
-            return cppd::UTF8String(as_boolean_? "true" : "false");
+            return cppd::UTF8String(as_boolean()? "true" : "false");
         case Type::INTEGER:
-            return cppd::ToUTF8String(as_integer_);
+            return cppd::ToUTF8String(as_integer());
         case Type::DOUBLE:
-            return cppd::ToUTF8String(as_double_);
+            return cppd::ToUTF8String(as_double());
         case Type::OBJECT:
         case Type::ARRAY:
             return cppd::ToUTF8String(ToString());
         case Type::FUNCTION:
             return cppd::ToUTF8String(ToString());
         case Type::STRING:
-            return std::dynamic_pointer_cast<ScriptString>(as_object_)->str;
+            return cppd::UTF8String(static_cast<ScriptString*>(as_object())->str());
         default:
             return cppd::ToUTF8String("<invalid ScriptAny type>");
         }
     }
 
+    const char* ScriptAny::TypeOf() const
+    {
+        switch(type())
+        {
+        case Type::UNDEFINED: return "undefined";
+        case Type::BOOLEAN: return "boolean";
+        case Type::INTEGER:
+        case Type::DOUBLE: return "number";
+        case Type::FUNCTION: return "function";
+        case Type::STRING: return "string";
+        default: return "object";
+        }
+    }
+
     std::ostream& operator<<(std::ostream& os, const ScriptAny& any)
     {
         switch(any.type())
@@ -232,25 +405,25 @@ namespace mildew
                 os << "null";
                 break;
             case ScriptAny::Type::BOOLEAN:
-                os << (any.as_boolean_ ? "true" : "false");
+                os << (any.as_boolean() ? "true" : "false");
                 break;
             case ScriptAny::Type::INTEGER:
-                os << any.as_integer_;
+                os << any.as_integer();
                 break;
             case ScriptAny::Type::DOUBLE:
-                os << any.as_double_;
+                os << any.as_double();
                 break;
             case ScriptAny::Type::OBJECT:
-                os << *any.as_object_;
+                os << *any.as_object();
                 break;
             case ScriptAny::Type::ARRAY:
-                os << *std::dynamic_pointer_cast<ScriptArray>(any.as_object_);
+                os << *dynamic_cast<ScriptArray*>(any.as_object());
                 break;
             case ScriptAny::Type::FUNCTION:
-                os << *std::dynamic_pointer_cast<ScriptFunction>(any.as_object_);
+                os << *dynamic_cast<ScriptFunction*>(any.as_object());
                 break;
             case ScriptAny::Type::STRING:
-                os << *std::dynamic_pointer_cast<ScriptString>(any.as_object_);
+                os << *dynamic_cast<ScriptString*>(any.as_object());
                 break;
             default:
                 os << "<Unknown ScriptAny type>";
@@ -16,7 +16,8 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 
 #include <cstdint>
-#include <memory>
+#include <cstring>
+#include <limits>
 #include <ostream>
 #include <string>
 #include <type_traits>
@@ -24,6 +25,12 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "../../cppd/templates.hpp"
 #include "../../cppd/utf8string.hpp"
 
+#if defined(__GNUC__) || defined(__clang__)
+#define MILDEW_HAS_OVERFLOW_BUILTINS 1
+#else
+#define MILDEW_HAS_OVERFLOW_BUILTINS 0
+#endif
+
 namespace mildew
 {
     class ScriptObject;
@@ -40,35 +47,42 @@ namespace mildew
     template<>
     struct ConvertReturn<ScriptObject>
     {
-        using type = std::shared_ptr<ScriptObject>;
+        using type = ScriptObject*;
     };
 
     template<>
     struct ConvertReturn<ScriptArray>
     {
-        using type = std::shared_ptr<ScriptArray>;
+        using type = ScriptArray*;
     };
 
     template<>
     struct ConvertReturn<ScriptFunction>
     {
-        using type = std::shared_ptr<ScriptFunction>;
+        using type = ScriptFunction*;
     };
 
     template<>
     struct ConvertReturn<ScriptString>
     {
-        using type = std::shared_ptr<ScriptString>;
+        using type = ScriptString*;
     };
 
+    /**
+     * Dynamically typed script value. Objects are referenced by plain pointers into the Heap that owns them,
+     * so copying a ScriptAny never touches a reference count. By default this is a tagged union. When
+     * MILDEW_NAN_BOXING is enabled every value is packed into a single 64-bit word instead: doubles are
+     * stored as themselves and all other types are tagged payloads in the negative quiet NaN space.
+     * Integers that do not fit the 48-bit payload are stored as doubles in that mode.
+     */
     struct ScriptAny final
     {
         enum class Type { UNDEFINED, NULL_, BOOLEAN, INTEGER, DOUBLE, OBJECT, ARRAY, FUNCTION, STRING };
 
         ScriptAny() {}
-        ScriptAny(const ScriptAny& );
+        ScriptAny(const ScriptAny& ) = default;
+        /// allocates a ScriptString from the current heap
         ScriptAny(const std::string& str);
-        ~ScriptAny();
 
         template<typename T>
         ScriptAny(const T& value)
@@ -76,25 +90,135 @@ namespace mildew
             SetValue(value);
         }
 
-        bool operator==(const ScriptAny& other) const;
+        bool operator==(const ScriptAny& other) const
+        {
+            if(BothIntegers(*this, other))
+                return as_integer() == other.as_integer();
+            if(BothDoubles(*this, other))
+                return as_double() == other.as_double();
+            return EqualsGeneric(other);
+        }
+
         bool operator<(const ScriptAny& other) const;
 
-        template<typename T>
-        ScriptAny& operator=(const T& value)
+        // script operators, integers stay integers when the result is exact and fits in 64 bits. Two integers
+        // or two doubles are handled inline so numeric loops never convert their operands, anything else
+        // goes through the generic version of the operator.
+        ScriptAny operator+(const ScriptAny& rhs) const
         {
-            SetValue(value);
-            return *this;
+            if(BothIntegers(*this, rhs))
+                return CheckedAdd(as_integer(), rhs.as_integer());
+            if(BothDoubles(*this, rhs))
+                return ScriptAny(as_double() + rhs.as_double());
+            return AddGeneric(rhs);
+        }
+
+        ScriptAny operator-(const ScriptAny& rhs) const
+        {
+            if(BothIntegers(*this, rhs))
+                return CheckedSubtract(as_integer(), rhs.as_integer());
+            if(BothDoubles(*this, rhs))
+                return ScriptAny(as_double() - rhs.as_double());
+            return SubtractGeneric(rhs);
+        }
+
+        ScriptAny operator*(const ScriptAny& rhs) const
+        {
+            if(BothIntegers(*this, rhs))
+                return CheckedMultiply(as_integer(), rhs.as_integer());
+            if(BothDoubles(*this, rhs))
+                return ScriptAny(as_double() * rhs.as_double());
+            return MultiplyGeneric(rhs);
+        }
+
+        ScriptAny operator/(const ScriptAny& rhs) const
+        {
+            if(BothIntegers(*this, rhs))
+                return IntegerDivide(as_integer(), rhs.as_integer());
+            if(BothDoubles(*this, rhs))
+                return ScriptAny(as_double() / rhs.as_double());
+            return DivideGeneric(rhs);
+        }
+
+        ScriptAny operator%(const ScriptAny& rhs) const
+        {
+            if(BothIntegers(*this, rhs))
+                return IntegerModulo(as_integer(), rhs.as_integer());
+            return ModuloGeneric(rhs);
+        }
+
+        ScriptAny operator&(const ScriptAny& rhs) const;
+        ScriptAny operator|(const ScriptAny& rhs) const;
+        ScriptAny operator^(const ScriptAny& rhs) const;
+        ScriptAny operator<<(const ScriptAny& rhs) const;
+        ScriptAny operator>>(const ScriptAny& rhs) const;
+        ScriptAny operator-() const;
+        ScriptAny operator~() const;
+        ScriptAny Pow(const ScriptAny& rhs) const;
+        ScriptAny UnsignedRightShift(const ScriptAny& rhs) const;
+
+        bool IsLessThan(const ScriptAny& rhs) const
+        {
+            if(BothIntegers(*this, rhs))
+                return as_integer() < rhs.as_integer();
+            if(BothDoubles(*this, rhs))
+                return as_double() < rhs.as_double();
+            return IsLessThanGeneric(rhs);
+        }
+
+        bool IsLessOrEqual(const ScriptAny& rhs) const
+        {
+            if(BothIntegers(*this, rhs))
+                return as_integer() <= rhs.as_integer();
+            if(BothDoubles(*this, rhs))
+                return as_double() <= rhs.as_double();
+            return IsLessOrEqualGeneric(rhs);
         }
 
-        ScriptAny& operator=(const ScriptAny& value)
+        bool StrictEquals(const ScriptAny& other) const
+        {
+            if(BothIntegers(*this, other))
+                return as_integer() == other.as_integer();
+            if(BothDoubles(*this, other))
+                return as_double() == other.as_double();
+            return StrictEqualsGeneric(other);
+        }
+
+        template<typename T>
+        ScriptAny& operator=(const T& value)
         {
             SetValue(value);
             return *this;
         }
 
+        ScriptAny& operator=(const ScriptAny& value) = default;
+
         ScriptAny& operator=(const std::string& str);
 
+#if MILDEW_NAN_BOXING
+        Type type() const
+        {
+            if(bits_ < kTagSpecial)
+                return Type::DOUBLE;
+            switch(bits_ >> 48)
+            {
+            case kTagSpecial >> 48:
+                switch(bits_ & 3)
+                {
+                case 0: return Type::UNDEFINED;
+                case 1: return Type::NULL_;
+                default: return Type::BOOLEAN;
+                }
+            case kTagInteger >> 48: return Type::INTEGER;
+            case kTagObject >> 48: return Type::OBJECT;
+            case kTagArray >> 48: return Type::ARRAY;
+            case kTagFunction >> 48: return Type::FUNCTION;
+            default: return Type::STRING;
+            }
+        }
+#else
         Type type() const { return type_; }
+#endif
 
         size_t GetHash() const;
 
@@ -107,28 +231,28 @@ namespace mildew
         {
             if constexpr(std::is_same_v<bool, std::remove_cv_t<T>>)
             {
-                switch(type_)
+                switch(type())
                 {
                 case Type::NULL_: case Type::UNDEFINED: return false;
-                case Type::BOOLEAN: return as_boolean_;
-                case Type::INTEGER: return as_integer_ != 0;
-                case Type::DOUBLE: return as_double_ != 0.0;
+                case Type::BOOLEAN: return as_boolean();
+                case Type::INTEGER: return as_integer() != 0;
+                case Type::DOUBLE: return as_double() != 0.0;
                 case Type::OBJECT:
                 case Type::ARRAY:
                 case Type::FUNCTION:
                 case Type::STRING:
-                    return as_object_.get() != nullptr;
+                    return as_object() != nullptr;
                 }
                 return static_cast<T>(false);
             }
             else if constexpr(std::is_integral_v<T> || std::is_floating_point_v<T>)
             {
-                switch(type_)
+                switch(type())
                 {
                 case Type::NULL_: case Type::UNDEFINED: return static_cast<T>(0);
-                case Type::BOOLEAN: return static_cast<T>(as_boolean_);
-                case Type::INTEGER: return static_cast<T>(as_integer_);
-                case Type::DOUBLE: return static_cast<T>(as_double_);
+                case Type::BOOLEAN: return static_cast<T>(as_boolean());
+                case Type::INTEGER: return static_cast<T>(as_integer());
+                case Type::DOUBLE: return static_cast<T>(as_double());
                 case Type::OBJECT: 
                 case Type::ARRAY:
                 case Type::FUNCTION:
@@ -140,30 +264,30 @@ namespace mildew
             else if constexpr(std::is_same_v<ScriptObject, std::remove_cv_t<T>>)
             {
                 if(IsObject())
-                    return as_object_;
+                    return as_object();
                 else 
-                    return std::shared_ptr<T>(nullptr);
+                    return nullptr;
             }
             else if constexpr(std::is_same_v<ScriptArray, std::remove_cv_t<T>>)
             {
-                if(type_ == Type::ARRAY)
-                    return std::dynamic_pointer_cast<T>(as_object_);
+                if(type() == Type::ARRAY)
+                    return static_cast<T*>(as_object());
                 else 
-                    return std::shared_ptr<T>(nullptr);
+                    return nullptr;
             }
             else if constexpr(std::is_same_v<ScriptFunction, std::remove_cv_t<T>>)
             {
-                if(type_ == Type::FUNCTION)
-                    return std::dynamic_pointer_cast<T>(as_object_);
+                if(type() == Type::FUNCTION)
+                    return static_cast<T*>(as_object());
                 else 
-                    return std::shared_ptr<T>(nullptr);
+                    return nullptr;
             }
             else if constexpr(std::is_same_v<ScriptString, std::remove_cv_t<T>>)
             {
-                if(type_ == Type::STRING)
-                    return std::dynamic_pointer_cast<T>(as_object_);
+                if(type() == Type::STRING)
+                    return static_cast<T*>(as_object());
                 else 
-                    return std::shared_ptr<T>(nullptr);
+                    return nullptr;
             }
             else 
             {
@@ -171,72 +295,140 @@ namespace mildew
             }
         }
 
+        ScriptAny ToNumber() const;
         std::string ToString() const;
         cppd::UTF8String ToUTF8String() const;
+        const char* TypeOf() const;
 
     private:
+        bool EqualsGeneric(const ScriptAny& other) const;
+        ScriptAny AddGeneric(const ScriptAny& rhs) const;
+        ScriptAny SubtractGeneric(const ScriptAny& rhs) const;
+        ScriptAny MultiplyGeneric(const ScriptAny& rhs) const;
+        ScriptAny DivideGeneric(const ScriptAny& rhs) const;
+        ScriptAny ModuloGeneric(const ScriptAny& rhs) const;
+        bool IsLessThanGeneric(const ScriptAny& rhs) const;
+        bool IsLessOrEqualGeneric(const ScriptAny& rhs) const;
+        bool StrictEqualsGeneric(const ScriptAny& other) const;
+
+        // an integer result that overflows is computed again in double precision
+        static ScriptAny CheckedAdd(const std::int64_t a, const std::int64_t b)
+        {
+            std::int64_t result;
+#if MILDEW_HAS_OVERFLOW_BUILTINS
+            if(!__builtin_add_overflow(a, b, &result))
+                return ScriptAny(result);
+#else
+            if(b >= 0 ? a <= std::numeric_limits<std::int64_t>::max() - b
+                      : a >= std::numeric_limits<std::int64_t>::min() - b)
+            {
+                result = a + b;
+                return ScriptAny(result);
+            }
+#endif
+            return ScriptAny(static_cast<double>(a) + static_cast<double>(b));
+        }
+
+        static ScriptAny CheckedSubtract(const std::int64_t a, const std::int64_t b)
+        {
+            std::int64_t result;
+#if MILDEW_HAS_OVERFLOW_BUILTINS
+            if(!__builtin_sub_overflow(a, b, &result))
+                return ScriptAny(result);
+#else
+            if(b >= 0 ? a >= std::numeric_limits<std::int64_t>::min() + b
+                      : a <= std::numeric_limits<std::int64_t>::max() + b)
+            {
+                result = a - b;
+                return ScriptAny(result);
+            }
+#endif
+            return ScriptAny(static_cast<double>(a) - static_cast<double>(b));
+        }
+
+        static ScriptAny CheckedMultiply(const std::int64_t a, const std::int64_t b)
+        {
+            std::int64_t result;
+#if MILDEW_HAS_OVERFLOW_BUILTINS
+            if(!__builtin_mul_overflow(a, b, &result))
+                return ScriptAny(result);
+#else
+            result = static_cast<std::int64_t>(static_cast<std::uint64_t>(a) * static_cast<std::uint64_t>(b));
+            if(a == 0 || (result / a == b && !(a == -1 && b == std::numeric_limits<std::int64_t>::min())))
+                return ScriptAny(result);
+#endif
+            return ScriptAny(static_cast<double>(a) * static_cast<double>(b));
+        }
+
+        static ScriptAny IntegerDivide(const std::int64_t a, const std::int64_t b)
+        {
+            if(b == 0 || (b == -1 && a == std::numeric_limits<std::int64_t>::min()) || a % b != 0)
+                return ScriptAny(static_cast<double>(a) / static_cast<double>(b));
+            return ScriptAny(a / b);
+        }
+
+        static ScriptAny IntegerModulo(const std::int64_t a, const std::int64_t b)
+        {
+            if(b == 0)
+                return ScriptAny(std::numeric_limits<double>::quiet_NaN());
+            if(b == -1)
+                return ScriptAny(static_cast<std::int64_t>(0));
+            return ScriptAny(a % b);
+        }
 
         template<typename T>
         void SetValue(const T& value)
         {   
             if constexpr(std::is_same_v<decltype(nullptr), std::remove_cv_t<T>>)
             {
-                DestructObject();
-                type_ = Type::NULL_;
+                SetPrimitive(Type::NULL_);
             }
             else if constexpr(std::is_same_v<bool, std::remove_cv_t<T>>)
             {
-                DestructObject();
-                type_ = Type::BOOLEAN;
+                SetPrimitive(Type::BOOLEAN);
+#if MILDEW_NAN_BOXING
+                bits_ = kTagSpecial | (value ? 3 : 2);
+#else
                 as_boolean_ = value;
+#endif
             }
             else if constexpr(std::is_integral_v<T>)
             {
-                DestructObject();
-                type_ = Type::INTEGER;
+                SetPrimitive(Type::INTEGER);
+#if MILDEW_NAN_BOXING
+                const auto kValue = static_cast<std::int64_t>(value);
+                if(kValue >= kMinBoxedInteger && kValue <= kMaxBoxedInteger)
+                    bits_ = kTagInteger | (static_cast<std::uint64_t>(kValue) & kPayloadMask);
+                else 
+                    bits_ = BoxDouble(static_cast<double>(value));
+#else
                 as_integer_ = value;
+#endif
             }
             else if constexpr(std::is_floating_point_v<T>)
             {
-                DestructObject();
-                type_ = Type::DOUBLE;
+                SetPrimitive(Type::DOUBLE);
+#if MILDEW_NAN_BOXING
+                bits_ = BoxDouble(static_cast<double>(value));
+#else
                 as_double_ = value;
+#endif
             }
-            else if constexpr(std::is_same_v<std::shared_ptr<ScriptObject>, std::remove_cv_t<T>>)
+            else if constexpr(std::is_same_v<ScriptObject*, std::remove_cv_t<T>>)
             {
-                if(IsObject())
-                {
-                    as_object_ = value;
-                }
-                else 
-                {
-                    new (&as_object_) std::shared_ptr<ScriptObject>(value);
-                }
-                type_ = Type::OBJECT;
+                SetObject(value, Type::OBJECT);
             }
-            else if constexpr(std::is_same_v<std::shared_ptr<ScriptArray>, std::remove_cv_t<T>>)
+            else if constexpr(std::is_same_v<ScriptArray*, std::remove_cv_t<T>>)
             {
-                if(IsObject())
-                    as_object_ = value;
-                else 
-                    new (&as_object_) std::shared_ptr<ScriptArray>(value);
-                type_ = Type::ARRAY;
+                SetObject(value, Type::ARRAY);
             }
-            else if constexpr(std::is_same_v<std::shared_ptr<ScriptFunction>, std::remove_cv_t<T>>)
+            else if constexpr(std::is_same_v<ScriptFunction*, std::remove_cv_t<T>>)
             {
-                if(IsObject())
-                    as_object_ = value;
-                else 
-                    new (&as_object_) std::shared_ptr<ScriptFunction>(value);
-                type_ = Type::FUNCTION;
+                SetObject(value, Type::FUNCTION);
             }
-            else if constexpr(std::is_same_v<std::shared_ptr<ScriptString>, std::remove_cv_t<T>>)
+            else if constexpr(std::is_same_v<ScriptString*, std::remove_cv_t<T>>)
             {
-                if(IsObject())
-                    as_object_ = value;
-                else 
-                    new (&as_object_) std::shared_ptr<ScriptString>(value);
-                type_ = Type::STRING;
+                SetObject(value, Type::STRING);
             }
             else
             {
@@ -244,31 +436,95 @@ namespace mildew
             }
         }
 
-        void SetValue(const ScriptAny& value)
+
+#if MILDEW_NAN_BOXING
+        static constexpr std::uint64_t kPayloadMask = 0x0000FFFFFFFFFFFF;
+        static constexpr std::uint64_t kCanonicalNaN = 0x7FF8000000000000;
+        // every tag is above the bit pattern of any canonical double
+        static constexpr std::uint64_t kTagSpecial = 0xFFF9000000000000;
+        static constexpr std::uint64_t kTagInteger = 0xFFFA000000000000;
+        static constexpr std::uint64_t kTagObject = 0xFFFB000000000000;
+        static constexpr std::uint64_t kTagArray = 0xFFFC000000000000;
+        static constexpr std::uint64_t kTagFunction = 0xFFFD000000000000;
+        static constexpr std::uint64_t kTagString = 0xFFFE000000000000;
+        static constexpr std::int64_t kMinBoxedInteger = -(static_cast<std::int64_t>(1) << 47);
+        static constexpr std::int64_t kMaxBoxedInteger = (static_cast<std::int64_t>(1) << 47) - 1;
+
+        static std::uint64_t BoxDouble(const double value)
+        {
+            if(value != value)
+                return kCanonicalNaN;
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+
+        void SetPrimitive(const Type type)
         {
-            if(this == &value)
-                return;
-            switch(value.type_)
+            bits_ = kTagSpecial | (type == Type::NULL_ ? 1 : 0);
+        }
+
+        void SetObject(ScriptObject* value, const Type type)
+        {
+            static_assert(sizeof(void*) == sizeof(std::uint64_t), "NaN boxing requires 64-bit pointers");
+            std::uint64_t tag = kTagObject;
+            switch(type)
             {
-            case Type::UNDEFINED: DestructObject(); break;
-            case Type::NULL_: DestructObject(); break;
-            case Type::BOOLEAN: DestructObject(); as_boolean_ = value.as_boolean_; break;
-            case Type::INTEGER: DestructObject(); as_integer_ = value.as_integer_; break;
-            case Type::DOUBLE: DestructObject(); as_double_ = value.as_double_; break;
-            case Type::OBJECT: 
-            case Type::ARRAY:
-            case Type::FUNCTION:
-            case Type::STRING:
-                if(IsObject())
-                    as_object_ = value.as_object_;
-                else 
-                    new (&as_object_) std::shared_ptr<ScriptObject>(value.as_object_);
-                break;
+            case Type::ARRAY: tag = kTagArray; break;
+            case Type::FUNCTION: tag = kTagFunction; break;
+            case Type::STRING: tag = kTagString; break;
+            default: break;
             }
-            type_ = value.type_;
+            bits_ = tag | (reinterpret_cast<std::uintptr_t>(value) & kPayloadMask);
         }
 
-        void DestructObject();
+        static bool BothIntegers(const ScriptAny& a, const ScriptAny& b)
+        {
+            return (a.bits_ >> 48) == (kTagInteger >> 48) && (b.bits_ >> 48) == (kTagInteger >> 48);
+        }
+
+        static bool BothDoubles(const ScriptAny& a, const ScriptAny& b)
+        {
+            return a.bits_ < kTagSpecial && b.bits_ < kTagSpecial;
+        }
+
+        bool as_boolean() const { return (bits_ & 1) != 0; }
+        std::int64_t as_integer() const { return static_cast<std::int64_t>(bits_ << 16) >> 16; }
+        double as_double() const
+        {
+            double value;
+            std::memcpy(&value, &bits_, sizeof(value));
+            return value;
+        }
+        ScriptObject* as_object() const { return reinterpret_cast<ScriptObject*>(bits_ & kPayloadMask); }
+
+        std::uint64_t bits_ = kTagSpecial;
+#else
+        void SetPrimitive(const Type type)
+        {
+            type_ = type;
+        }
+
+        void SetObject(ScriptObject* value, const Type type)
+        {
+            as_object_ = value;
+            type_ = type;
+        }
+
+        static bool BothIntegers(const ScriptAny& a, const ScriptAny& b)
+        {
+            return a.type_ == Type::INTEGER && b.type_ == Type::INTEGER;
+        }
+
+        static bool BothDoubles(const ScriptAny& a, const ScriptAny& b)
+        {
+            return a.type_ == Type::DOUBLE && b.type_ == Type::DOUBLE;
+        }
+
+        bool as_boolean() const { return as_boolean_; }
+        std::int64_t as_integer() const { return as_integer_; }
+        double as_double() const { return as_double_; }
+        ScriptObject* as_object() const { return as_object_; }
 
         Type type_ = Type::UNDEFINED;
         union 
@@ -277,11 +533,15 @@ namespace mildew
             std::int64_t as_integer_;
             double as_double_;
             // Also stores function, string, and array
-            std::shared_ptr<ScriptObject> as_object_;
+            ScriptObject* as_object_;
         };
+#endif
 
+        // generates code that reads and writes integers and booleans in place
+        friend class JitCompiler;
         friend std::ostream& operator<<(std::ostream& os, const ScriptAny& any);
     };
+
 } // namespace mildew
 
 namespace std
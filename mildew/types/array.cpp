@@ -15,6 +15,8 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include "array.hpp"
 
+#include "../heap.hpp"
+
 namespace mildew
 {
     size_t ScriptArray::GetHash() const
@@ -26,6 +28,13 @@ namespace mildew
         return result;
     }
 
+    void ScriptArray::Trace(Heap& heap)
+    {
+        ScriptObject::Trace(heap);
+        for(const auto& item : array)
+            heap.Mark(item);
+    }
+
     bool ScriptArray::operator<(const ScriptArray& other)
     {
         return array < other.array;
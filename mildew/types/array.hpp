@@ -31,6 +31,7 @@ namespace mildew
         {}
 
         size_t GetHash() const override;
+        void Trace(Heap& heap) override;
 
         bool operator<(const ScriptArray& other);
         bool operator==(const ScriptArray& other);
@@ -16,37 +16,98 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "function.hpp"
 
+#include <algorithm>
+
+#include "../heap.hpp"
+#include "../vm/consttable.hpp"
+
 namespace mildew
 {
 
     ScriptFunction::ScriptFunction(const std::string& fname, const NativeFunction& nfunc, bool is_class)
     : ScriptObject(is_class ? "Class" : "Function", nullptr), type_(Type::NATIVE_FUNCTION), function_name_(fname),
-      closure_(nullptr), is_class_(is_class), is_generator_(false), native_function_(nfunc)
+      closure_(nullptr), is_class_(is_class), is_generator_(false), native_function_(nfunc),
+      compiled_(std::make_shared<std::vector<std::uint8_t>>()), lines_(std::make_shared<std::vector<LineInfo>>()),
+      inline_caches_(std::make_shared<std::vector<InlineCache>>()),
+      upvalue_infos_(std::make_shared<std::vector<UpvalueInfo>>()),
+      switch_tables_(std::make_shared<std::vector<SwitchTable>>()),
+      type_feedback_(std::make_shared<std::vector<TypeFeedback>>()), jit_(std::make_shared<JitState>())
     {
-        InitializePrototypeProperty();
     }
 
     ScriptFunction::ScriptFunction(const std::string& fname, const std::vector<std::string>& args,
-        const std::vector<std::uint8_t>& bc, bool is_c, bool is_g)
+        const std::vector<std::uint8_t>& bc, bool is_c, bool is_g, const std::shared_ptr<ConstTable>& ct,
+        int num_regs, const std::vector<LineInfo>& lines, size_t num_caches, int num_cells,
+        const std::vector<UpvalueInfo>& upvalue_infos, const std::vector<SwitchTable>& switch_tables)
     : ScriptObject(is_c? "Class": "Function", nullptr), type_(Type::SCRIPT_FUNCTION), function_name_(fname), 
       arg_names_(args), closure_(nullptr),
-      is_class_(is_c), is_generator_(is_g), native_function_(nullptr), compiled_(bc)
+      is_class_(is_c), is_generator_(is_g), native_function_(nullptr), 
+      compiled_(std::make_shared<std::vector<std::uint8_t>>(bc)), const_table_(ct), num_registers_(num_regs),
+      lines_(std::make_shared<std::vector<LineInfo>>(lines)),
+      inline_caches_(std::make_shared<std::vector<InlineCache>>(num_caches)), num_cells_(num_cells),
+      upvalue_infos_(std::make_shared<std::vector<UpvalueInfo>>(upvalue_infos)),
+      switch_tables_(std::make_shared<std::vector<SwitchTable>>(switch_tables)),
+      type_feedback_(std::make_shared<std::vector<TypeFeedback>>()), jit_(std::make_shared<JitState>())
+    {
+    }
+
+    ScriptFunction* ScriptFunction::Create(const std::string& fname, const NativeFunction& nfunc, bool is_class)
     {
-        InitializePrototypeProperty();
+        auto& heap = Heap::Current();
+        auto func = heap.Make<ScriptFunction>(fname, nfunc, is_class);
+        func->InitializePrototypeProperty(heap);
+        return func;
     }
 
-    std::shared_ptr<ScriptFunction> ScriptFunction::Copy(const std::shared_ptr<Environment>& env) const
+    ScriptFunction* ScriptFunction::Create(const std::string& fname, const NativeFunction& nfunc, bool is_class,
+        const std::shared_ptr<ConstTable>& ct, const std::shared_ptr<Environment>& env,
+        std::vector<std::shared_ptr<Upvalue>> upvalues)
+    {
+        auto func = Create(fname, nfunc, is_class);
+        func->const_table_ = ct;
+        func->closure_ = env;
+        func->upvalues_ = std::move(upvalues);
+        return func;
+    }
+
+    ScriptFunction* ScriptFunction::Create(const std::string& fname, const std::vector<std::string>& args,
+        const std::vector<std::uint8_t>& bc, bool is_c, bool is_g, const std::shared_ptr<ConstTable>& ct,
+        int num_regs, const std::vector<LineInfo>& lines, size_t num_caches, int num_cells,
+        const std::vector<UpvalueInfo>& upvalue_infos, const std::vector<SwitchTable>& switch_tables)
+    {
+        auto& heap = Heap::Current();
+        auto func = heap.Make<ScriptFunction>(fname, args, bc, is_c, is_g, ct, num_regs, lines, num_caches,
+            num_cells, upvalue_infos, switch_tables);
+        func->InitializePrototypeProperty(heap);
+        return func;
+    }
+
+    ScriptFunction* ScriptFunction::Copy(const std::shared_ptr<Environment>& env,
+        std::vector<std::shared_ptr<Upvalue>> upvalues) const
     {
         if(type_ == Type::SCRIPT_FUNCTION)
         {
-            auto newFunc = std::make_shared<ScriptFunction>(function_name_, arg_names_, compiled_, is_class_,
-                is_generator_);
+            auto& heap = Heap::Current();
+            auto newFunc = heap.Make<ScriptFunction>(function_name_, arg_names_, std::vector<std::uint8_t>(),
+                is_class_, is_generator_, const_table_, num_registers_);
+            // the bytecode and line table are immutable so closures share them instead of copying, and the
+            // inline caches, type feedback and native code belong to the instructions rather than to a closure
+            newFunc->compiled_ = compiled_;
+            newFunc->lines_ = lines_;
+            newFunc->inline_caches_ = inline_caches_;
+            newFunc->num_cells_ = num_cells_;
+            newFunc->upvalue_infos_ = upvalue_infos_;
+            newFunc->switch_tables_ = switch_tables_;
+            newFunc->type_feedback_ = type_feedback_;
+            newFunc->jit_ = jit_;
             newFunc->closure_ = env;
+            newFunc->upvalues_ = std::move(upvalues);
+            newFunc->InitializePrototypeProperty(heap);
             return newFunc;
         }
         else 
         {
-            return std::make_shared<ScriptFunction>(function_name_, native_function_, is_class_);
+            return Create(function_name_, native_function_, is_class_, const_table_, closure_, upvalues_);
         }
     }
 
@@ -55,9 +116,9 @@ namespace mildew
         bound_this_ = this_obj;
     }
 
-    std::shared_ptr<ScriptFunction> ScriptFunction::BindCopy(const ScriptAny& this_obj) const 
+    ScriptFunction* ScriptFunction::BindCopy(const ScriptAny& this_obj) const
     {
-        auto newFunc = Copy(closure_);
+        auto newFunc = Copy(closure_, upvalues_);
         newFunc->Bind(this_obj);
         return newFunc;
     }
@@ -69,16 +130,25 @@ namespace mildew
         return hash;
     }
 
-    bool ScriptFunction::IsInstanceOf(const std::shared_ptr<ScriptObject>& obj, 
-        const std::shared_ptr<ScriptFunction>& clazz)
+    void ScriptFunction::Trace(Heap& heap)
+    {
+        ScriptObject::Trace(heap);
+        heap.Mark(bound_this_);
+        heap.Mark(closure_.get());
+        for(const auto& upvalue : upvalues_)
+            heap.Mark(upvalue->value);
+        heap.Mark(const_table_.get());
+    }
+
+    bool ScriptFunction::IsInstanceOf(ScriptObject* obj, ScriptFunction* clazz)
     {
         if(obj == nullptr || clazz == nullptr)
             return false;
         auto proto = obj->prototype();
         while(proto != nullptr)
         {
-            auto ctor = proto->LookupField("constructor").ToValue<ScriptFunction>();
-            if(ctor.get() == clazz.get())
+            auto ctor = proto->LookupField(kAtomConstructor).ToValue<ScriptFunction>();
+            if(ctor == clazz)
                 return true;
             proto = proto->prototype();
         }
@@ -98,16 +168,27 @@ namespace mildew
         if(type_ != func.type_)
             return false;
         if(type_ == Type::SCRIPT_FUNCTION)
-            return compiled_ == func.compiled_;
+            return compiled_ == func.compiled_ || *compiled_ == *func.compiled_;
         else // TODO fix
             return &native_function_ == &func.native_function_;
     }
 
-    void ScriptFunction::InitializePrototypeProperty()
+    size_t ScriptFunction::LineOf(size_t instruction) const
+    {
+        const auto& lines = *lines_;
+        auto found = std::upper_bound(lines.begin(), lines.end(), instruction, 
+            [](size_t index, const LineInfo& info) { return index < info.instruction; });
+        if(found == lines.begin())
+            return 0;
+        return (found - 1)->line;
+    }
+
+    void ScriptFunction::InitializePrototypeProperty(Heap& heap)
     {
-        auto proto = std::make_shared<ScriptObject>("Object", nullptr);
-        (*proto)["constructor"] = ScriptAny(std::shared_ptr<ScriptFunction>(this));
-        dictionary_["prototype"] = proto;
+        // the constructor property refers back to this function, a cycle the collector frees as a whole
+        auto proto = heap.Make<ScriptObject>("Object", nullptr);
+        proto->AssignField(kAtomConstructor, this);
+        AssignField(kAtomPrototype, proto);
     }
 
     std::ostream& operator<<(std::ostream& os, const ScriptFunction& func)
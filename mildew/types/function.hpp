@@ -13,6 +13,7 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 You should have received a copy of the GNU General Public License along with 
 this program.  If not, see <https://www.gnu.org/licenses/>.
 */
+#pragma once
 
 #include <cstdint>
 #include <functional>
@@ -21,11 +22,17 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <vector>
 
 #include "../environment.hpp"
+#include "../vm/inlinecache.hpp"
+#include "../vm/jit.hpp"
+#include "../vm/switchtable.hpp"
+#include "../vm/typefeedback.hpp"
 #include "any.hpp"
 #include "object.hpp"
 
 namespace mildew
 {
+    class ConstTable;
+
     enum class NativeFunctionError
     {
         NO_ERROR = 0, 
@@ -37,6 +44,26 @@ namespace mildew
     using NativeFunction = std::function<ScriptAny(Environment&, ScriptAny&, 
         const std::vector<ScriptAny>&, NativeFunctionError&)>;
 
+    /// marks the first instruction generated for a source line
+    struct LineInfo
+    {
+        std::uint32_t instruction;
+        std::uint32_t line;
+    };
+
+    /// a local variable captured by a closure, shared by the frame that declares it and every closure using it
+    struct Upvalue
+    {
+        ScriptAny value;
+    };
+
+    /// where a closure finds an upvalue when it is created
+    struct UpvalueInfo
+    {
+        bool from_cell; // a cell of the creating frame, otherwise an upvalue of the creating closure
+        std::uint8_t index;
+    };
+
     class ScriptFunction : public ScriptObject
     {
     public:
@@ -44,15 +71,33 @@ namespace mildew
 
         ScriptFunction(const std::string& fname, const NativeFunction& nfunc, bool is_class = false);
         ScriptFunction(const std::string& fname, const std::vector<std::string>& args, 
-            const std::vector<std::uint8_t>& bc, bool is_c = false, bool is_g = false);
+            const std::vector<std::uint8_t>& bc, bool is_c = false, bool is_g = false,
+            const std::shared_ptr<ConstTable>& ct = nullptr, int num_regs = 0,
+            const std::vector<LineInfo>& lines = {}, size_t num_caches = 0, int num_cells = 0,
+            const std::vector<UpvalueInfo>& upvalue_infos = {}, const std::vector<SwitchTable>& switch_tables = {});
+
+        /// allocates a function with its prototype property from the current heap
+        static ScriptFunction* Create(const std::string& fname, const NativeFunction& nfunc,
+            bool is_class = false);
+        /// a native function running compiled code that keeps its constants, globals, and captures alive
+        static ScriptFunction* Create(const std::string& fname, const NativeFunction& nfunc, bool is_class,
+            const std::shared_ptr<ConstTable>& ct, const std::shared_ptr<Environment>& env,
+            std::vector<std::shared_ptr<Upvalue>> upvalues);
+        static ScriptFunction* Create(const std::string& fname, const std::vector<std::string>& args,
+            const std::vector<std::uint8_t>& bc, bool is_c = false, bool is_g = false,
+            const std::shared_ptr<ConstTable>& ct = nullptr, int num_regs = 0,
+            const std::vector<LineInfo>& lines = {}, size_t num_caches = 0, int num_cells = 0,
+            const std::vector<UpvalueInfo>& upvalue_infos = {}, const std::vector<SwitchTable>& switch_tables = {});
 
-        std::shared_ptr<ScriptFunction> Copy(const std::shared_ptr<Environment>& env) const;
+        /// creates a closure sharing the compiled code, env is where the closure looks up global names
+        ScriptFunction* Copy(const std::shared_ptr<Environment>& env,
+            std::vector<std::shared_ptr<Upvalue>> upvalues = {}) const;
         void Bind(const ScriptAny& this_obj);
-        std::shared_ptr<ScriptFunction> BindCopy(const ScriptAny& this_obj) const;
+        ScriptFunction* BindCopy(const ScriptAny& this_obj) const;
         size_t GetHash() const override;
+        void Trace(Heap& heap) override;
 
-        static bool IsInstanceOf(const std::shared_ptr<ScriptObject>& obj, 
-            const std::shared_ptr<ScriptFunction>& clazz);
+        static bool IsInstanceOf(ScriptObject* obj, ScriptFunction* clazz);
 
         bool operator<(const ScriptFunction& func) const;
         bool operator==(const ScriptFunction& func) const;
@@ -60,25 +105,50 @@ namespace mildew
         Type type() const { return type_; }
         const std::string& function_name() const { return function_name_; }
         const std::vector<std::string>& arg_names() const { return arg_names_; }
-        const std::vector<std::uint8_t>&  compiled() const { return compiled_; }
+        const std::vector<std::uint8_t>&  compiled() const { return *compiled_; }
+        const std::shared_ptr<ConstTable>& const_table() const { return const_table_; }
+        int num_registers() const { return num_registers_; }
+        const std::vector<LineInfo>& lines() const { return *lines_; }
+        InlineCache* inline_caches() const { return inline_caches_->data(); }
+        size_t num_inline_caches() const { return inline_caches_->size(); }
+        size_t LineOf(size_t instruction) const;
+        int num_cells() const { return num_cells_; }
+        const std::vector<UpvalueInfo>& upvalue_infos() const { return *upvalue_infos_; }
+        const std::vector<std::shared_ptr<Upvalue>>& upvalues() const { return upvalues_; }
+        const std::vector<SwitchTable>& switch_tables() const { return *switch_tables_; }
+        /// one slot per instruction word, empty until the function first runs while the VM is profiling
+        std::vector<TypeFeedback>& type_feedback() const { return *type_feedback_; }
+        /// the hotness and native code of the function, shared by its closures like the inline caches
+        JitState& jit() const { return *jit_; }
         ScriptAny bound_this() const { return bound_this_; }
         auto closure() const { return closure_; }
         bool is_class() const { return is_class_; }
         bool is_generator() const { return is_generator_; }
-        auto native_function() const { return native_function_; }
+        const NativeFunction& native_function() const { return native_function_; }
     private:
-        void InitializePrototypeProperty();
+        void InitializePrototypeProperty(Heap& heap);
 
         Type type_;
         std::string function_name_;
         std::vector<std::string> arg_names_;
         ScriptAny bound_this_;
-        std::shared_ptr<Environment> closure_;
+        std::shared_ptr<Environment> closure_; // global names, captured locals are in upvalues_
         bool is_class_;
         bool is_generator_;
-        // std::shared_ptr<ConstTable> const_table_;
         NativeFunction native_function_;
-        std::vector<std::uint8_t> compiled_;
+        // shared between every closure created from the same function literal
+        std::shared_ptr<const std::vector<std::uint8_t>> compiled_;
+        std::shared_ptr<ConstTable> const_table_;
+        int num_registers_ = 0;
+        std::shared_ptr<const std::vector<LineInfo>> lines_;
+        std::shared_ptr<std::vector<InlineCache>> inline_caches_;
+        int num_cells_ = 0;
+        std::shared_ptr<const std::vector<UpvalueInfo>> upvalue_infos_;
+        std::shared_ptr<const std::vector<SwitchTable>> switch_tables_;
+        std::shared_ptr<std::vector<TypeFeedback>> type_feedback_;
+        std::shared_ptr<JitState> jit_;
+        std::vector<std::shared_ptr<Upvalue>> upvalues_;
+        friend class CompiledProgram;
     };
 
     std::ostream& operator<<(std::ostream& os, const ScriptFunction& func);
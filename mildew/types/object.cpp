@@ -17,11 +17,13 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <sstream>
 
+#include "../heap.hpp"
+
 namespace mildew
 {
     using cppd::Object;
 
-    ScriptObject::ScriptObject(const std::string& type, std::shared_ptr<ScriptObject> proto, Object* native)
+    ScriptObject::ScriptObject(const std::string& type, ScriptObject* proto, Object* native)
     : name_(type), prototype_(proto), native_object_(native)
     {
         // todo: get object prototype
@@ -47,44 +49,185 @@ namespace mildew
         native_object_ = obj;
     }
 
-    void ScriptObject::AssignField(const std::string& name, const ScriptAny& value)
+    void ScriptObject::AssignField(const Atom key, const ScriptAny& value)
     {
         // TODO check __proto__ and __super__
-        dictionary_.emplace(name, value);
+        auto field = FindOwnField(key);
+        if(field != nullptr)
+            *field = value;
+        else
+            AddField(key) = value;
+    }
+
+    void ScriptObject::AssignField(const std::string& name, const ScriptAny& value)
+    {
+        // keys computed at run time are only atoms when the source already used them, the atom table is never
+        // trimmed, so any other key turns the object into a dictionary rather than interning it
+        const auto kAtom = shape_ != nullptr ? AtomTable::Find(name) : kNoAtom;
+        if(kAtom != kNoAtom)
+            return AssignField(kAtom, value);
+        if(shape_ != nullptr)
+            ConvertToDictionary();
+        (*dictionary_)[name] = value;
+    }
+
+    bool ScriptObject::DeleteField(const std::string& name)
+    {
+        if(FindOwnField(name) == nullptr)
+            return false;
+        // removing a slot would shift the others, so the object leaves the transition tree instead
+        if(shape_ != nullptr)
+            ConvertToDictionary();
+        dictionary_->erase(name);
+        return true;
+    }
+
+    ScriptAny* ScriptObject::FindOwnField(const Atom key)
+    {
+        if(shape_ == nullptr)
+        {
+            auto found = dictionary_->find(AtomTable::Name(key));
+            return found != dictionary_->end() ? &found->second : nullptr;
+        }
+        const auto kSlot = shape_->Find(key);
+        return kSlot != Shape::kNotFound ? &Slot(kSlot) : nullptr;
+    }
+
+    ScriptAny* ScriptObject::FindOwnField(const std::string& name)
+    {
+        if(shape_ == nullptr)
+        {
+            auto found = dictionary_->find(name);
+            return found != dictionary_->end() ? &found->second : nullptr;
+        }
+        const auto kAtom = AtomTable::Find(name);
+        return kAtom != kNoAtom ? FindOwnField(kAtom) : nullptr;
+    }
+
+    const ScriptAny* ScriptObject::FindOwnField(const Atom key) const
+    {
+        return const_cast<ScriptObject*>(this)->FindOwnField(key);
+    }
+
+    const ScriptAny* ScriptObject::FindOwnField(const std::string& name) const
+    {
+        return const_cast<ScriptObject*>(this)->FindOwnField(name);
     }
 
     size_t ScriptObject::GetHash() const
     {
         // TODO something better
-        return dictionary_.size();
+        return num_fields();
     }
 
-    ScriptAny ScriptObject::LookupField(const std::string& name) const
+    ScriptAny ScriptObject::LookupField(const Atom key) const
     {
         // TODO check __proto__
         // TODO check __super__
-        if(dictionary_.count(name) > 0)
-            return dictionary_.at(name);
-        if(prototype_.get() != nullptr)
-            return prototype_->LookupField(name);
+        for(auto obj = this; obj != nullptr; obj = obj->prototype_)
+        {
+            auto field = obj->FindOwnField(key);
+            if(field != nullptr)
+                return *field;
+        }
         return ScriptAny();
     }
 
+    ScriptAny ScriptObject::LookupField(const std::string& name) const
+    {
+        // a name that was never interned can only be a key of objects that are dictionaries
+        const auto kAtom = AtomTable::Find(name);
+        for(auto obj = this; obj != nullptr; obj = obj->prototype_)
+        {
+            const ScriptAny* field = nullptr;
+            if(obj->shape_ == nullptr)
+                field = obj->FindOwnField(name);
+            else if(kAtom != kNoAtom)
+                field = obj->FindOwnField(kAtom);
+            if(field != nullptr)
+                return *field;
+        }
+        return ScriptAny();
+    }
+
+    void ScriptObject::Trace(Heap& heap)
+    {
+        heap.Mark(prototype_);
+        if(shape_ == nullptr)
+        {
+            for(const auto& [key, value] : *dictionary_)
+                heap.Mark(value);
+            return;
+        }
+        for(std::uint32_t i = 0; i < kInlineSlots && i < shape_->num_slots(); ++i)
+            heap.Mark(inline_slots_[i]);
+        for(const auto& value : slots_)
+            heap.Mark(value);
+    }
+
     bool ScriptObject::operator<(const ScriptObject& other) const
     {
         // TODO, check keys and prototype
-        return dictionary_.size() < other.dictionary_.size();
+        return num_fields() < other.num_fields();
     }
 
     bool ScriptObject::operator==(const ScriptObject& other) const
     {
         // TODO: compare getters and setters once implemented
-        return dictionary_ == other.dictionary_ && prototype_ == other.prototype_;
+        if(prototype_ != other.prototype_ || num_fields() != other.num_fields())
+            return false;
+        bool equal = true;
+        ForEachField([&](const std::string& key, const ScriptAny& value) {
+            auto field = other.FindOwnField(key);
+            equal = equal && field != nullptr && *field == value;
+        });
+        return equal;
     } 
 
     ScriptAny& ScriptObject::operator[](const std::string& index)
     {
-        return dictionary_[index];
+        const auto kAtom = shape_ != nullptr ? AtomTable::Find(index) : kNoAtom;
+        if(kAtom != kNoAtom)
+        {
+            auto field = FindOwnField(kAtom);
+            return field != nullptr ? *field : AddField(kAtom);
+        }
+        // as in AssignField, a key that is not already an atom is not interned
+        if(shape_ != nullptr)
+            ConvertToDictionary();
+        return (*dictionary_)[index];
+    }
+
+    ScriptAny& ScriptObject::AddField(const Atom key)
+    {
+        if(shape_ != nullptr)
+        {
+            auto next = shape_->AddTransition(key);
+            if(next != nullptr)
+            {
+                shape_ = next;
+                const auto kSlot = next->num_slots() - 1;
+                if(kSlot >= kInlineSlots)
+                    slots_.emplace_back();
+                return Slot(kSlot);
+            }
+            ConvertToDictionary();
+        }
+        return (*dictionary_)[AtomTable::Name(key)];
+    }
+
+    void ScriptObject::ConvertToDictionary()
+    {
+        auto dictionary = std::make_unique<std::unordered_map<std::string, ScriptAny>>();
+        ForEachField([&](const std::string& key, const ScriptAny& value) {
+            dictionary->emplace(key, value);
+        });
+        dictionary_ = std::move(dictionary);
+        shape_ = nullptr;
+        for(auto& value : inline_slots_)
+            value = ScriptAny();
+        slots_.clear();
+        slots_.shrink_to_fit();
     }
 
     std::string ScriptObject::FormattedString() const
@@ -92,17 +235,16 @@ namespace mildew
         std::stringstream ss;
         ss << "{";
         size_t counter = 0;
-        for(const auto& [key, value] : dictionary_)
-        {
+        ForEachField([&](const std::string& key, const ScriptAny& value) {
             ss << '"' << key << "\": ";
             if(value.type() == ScriptAny::Type::OBJECT)
                 ss << value.ToValue<ScriptObject>()->FormattedString();
             else 
                 ss << value;
-            if(counter < dictionary_.size() - 1)
+            if(counter < num_fields() - 1)
                 ss << ", ";
             ++counter;
-        }
+        });
         ss << "}";
         return ss.str();
     }
@@ -15,51 +15,118 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <ostream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "../../cppd/object.hpp"
 #include "any.hpp"
+#include "shape.hpp"
 
 namespace mildew
 {
+    class Heap;
+
+    /**
+     * Base of every script object. Instances are allocated with Heap::Make and owned by that heap, which
+     * frees them once they are no longer reachable from its roots. Own fields are laid out by a Shape from
+     * that heap, with the first kInlineSlots values stored inside the object. Deleting a field or growing
+     * past Shape::kMaxSlots switches the object to a dictionary for the rest of its lifetime.
+     */
     class ScriptObject
     {
     public:
-        ScriptObject(const std::string& type, std::shared_ptr<ScriptObject> proto, cppd::Object* native = nullptr);
+        ScriptObject(const std::string& type, ScriptObject* proto, cppd::Object* native = nullptr);
         ScriptObject(const std::string& type);
         ScriptObject(const ScriptObject&) = delete;
         virtual ~ScriptObject();
         ScriptObject& operator=(const ScriptObject&) = delete;
 
-        std::unordered_map<std::string, ScriptAny>& dictionary() { return dictionary_; }
+        static constexpr std::uint32_t kInlineSlots = 4;
+
         const std::string& name() const { return name_; }
-        std::shared_ptr<ScriptObject> prototype() { return prototype_; }
-        void prototype(std::shared_ptr<ScriptObject> proto) { prototype_ = proto; }
+        ScriptObject* prototype() const { return prototype_; }
+        void prototype(ScriptObject* proto) { prototype_ = proto; }
         cppd::Object* native_object() const { return native_object_; }
         void native_object(cppd::Object* obj);
+        /// the layout of the own fields, nullptr once the object is a dictionary
+        Shape* shape() const { return shape_; }
+        size_t num_fields() const { return shape_ ? shape_->num_slots() : dictionary_->size(); }
 
+        /// adds the field described by next, which must be a transition from the current shape
+        void AppendField(Shape* next, const ScriptAny& value)
+        {
+            shape_ = next;
+            if(next->num_slots() > kInlineSlots)
+                slots_.push_back(value);
+            else
+                inline_slots_[next->num_slots() - 1] = value;
+        }
+        void AssignField(Atom key, const ScriptAny& value);
         void AssignField(const std::string& name, const ScriptAny& value);
+        bool DeleteField(const std::string& name);
+        /// the own field called key or nullptr
+        ScriptAny* FindOwnField(Atom key);
+        ScriptAny* FindOwnField(const std::string& name);
+        const ScriptAny* FindOwnField(Atom key) const;
+        const ScriptAny* FindOwnField(const std::string& name) const;
+        /// calls func(key, value) for each own field, in insertion order unless the object is a dictionary
+        template<typename F>
+        void ForEachField(F&& func) const
+        {
+            if(shape_ == nullptr)
+            {
+                for(const auto& [key, value] : *dictionary_)
+                    func(key, value);
+                return;
+            }
+            const auto kKeys = shape_->Keys();
+            for(std::uint32_t i = 0; i < kKeys.size(); ++i)
+                func(AtomTable::Name(kKeys[i]), Slot(i));
+        }
         virtual size_t GetHash() const;
+        ScriptAny LookupField(Atom key) const;
         ScriptAny LookupField(const std::string& name) const;
+        ScriptAny& Slot(const std::uint32_t index)
+        {
+            return index < kInlineSlots ? inline_slots_[index] : slots_[index - kInlineSlots];
+        }
+        const ScriptAny& Slot(const std::uint32_t index) const
+        {
+            return index < kInlineSlots ? inline_slots_[index] : slots_[index - kInlineSlots];
+        }
+        /// marks every object this object refers to
+        virtual void Trace(Heap& heap);
 
         bool operator<(const ScriptObject& other) const;
         bool operator==(const ScriptObject& other) const;
         ScriptAny& operator[](const std::string& index);
 
     protected:
-        std::unordered_map<std::string, ScriptAny> dictionary_;
         // std::unordered_map<std::string, std::shared_ptr<ScriptFunction>> getters_;
         // std::unordered_map<std::string, std::shared_ptr<ScriptFunction>> setters_;
     
     private:
+        ScriptAny& AddField(Atom key);
+        void ConvertToDictionary();
         std::string FormattedString() const;
-        
+
+        Shape* shape_ = nullptr;
+        ScriptAny inline_slots_[kInlineSlots];
+        std::vector<ScriptAny> slots_; // fields past kInlineSlots
+        std::unique_ptr<std::unordered_map<std::string, ScriptAny>> dictionary_;
+
         std::string name_;
-        std::shared_ptr<ScriptObject> prototype_;
+        ScriptObject* prototype_;
         cppd::Object* native_object_;
+
+        ScriptObject* gc_next_ = nullptr;
+        std::uint32_t gc_size_ = 0;
+        bool gc_marked_ = false;
+        friend class Heap;
     };
 
     std::ostream& operator<<(std::ostream& os, const ScriptObject& obj);
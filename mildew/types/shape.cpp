@@ -0,0 +1,66 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "shape.hpp"
+
+namespace mildew
+{
+    Shape::Shape(Shape* parent, const Atom key)
+    : parent_(parent), key_(key), num_slots_(parent->num_slots_ + 1)
+    {
+    }
+
+    Shape* Shape::AddTransition(const Atom key)
+    {
+        auto found = transitions_.find(key);
+        if(found != transitions_.end())
+            return found->second.get();
+        if(num_slots_ >= kMaxSlots || transitions_.size() >= kMaxTransitions)
+            return nullptr;
+        auto shape = new Shape(this, key);
+        transitions_.emplace(key, std::unique_ptr<Shape>(shape));
+        return shape;
+    }
+
+    int Shape::Find(const Atom key) const
+    {
+        if(num_slots_ <= kLinearSearchSlots)
+        {
+            for(auto shape = this; shape->parent_ != nullptr; shape = shape->parent_)
+            {
+                if(shape->key_ == key)
+                    return shape->num_slots_ - 1;
+            }
+            return kNotFound;
+        }
+        if(!table_)
+        {
+            table_ = std::make_unique<std::unordered_map<Atom, std::uint32_t>>();
+            for(auto shape = this; shape->parent_ != nullptr; shape = shape->parent_)
+                table_->emplace(shape->key_, shape->num_slots_ - 1);
+        }
+        auto found = table_->find(key);
+        return found != table_->end() ? static_cast<int>(found->second) : kNotFound;
+    }
+
+    std::vector<Atom> Shape::Keys() const
+    {
+        std::vector<Atom> keys(num_slots_);
+        for(auto shape = this; shape->parent_ != nullptr; shape = shape->parent_)
+            keys[shape->num_slots_ - 1] = shape->key_;
+        return keys;
+    }
+
+} // namespace mildew
\ No newline at end of file
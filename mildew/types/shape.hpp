@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "../atom.hpp"
+
+namespace mildew
+{
+    /**
+     * A hidden class describing the layout of an object's own fields. Each shape adds one key to its parent,
+     * so objects that receive the same keys in the same order share a shape and keep their values in the
+     * same slots. Shapes form a transition tree rooted at the empty shape owned by a Heap and live as long
+     * as that root.
+     */
+    class Shape
+    {
+    public:
+        /// objects with more fields than this are switched to a dictionary instead of growing the tree
+        static constexpr std::uint32_t kMaxSlots = 64;
+        /// a shape with this many transitions does not get any more, which bounds objects used as maps
+        static constexpr size_t kMaxTransitions = 64;
+        static constexpr int kNotFound = -1;
+
+        Shape() : parent_(nullptr), key_(kNoAtom), num_slots_(0) {}
+        Shape(const Shape&) = delete;
+        Shape& operator=(const Shape&) = delete;
+
+        /// returns the shape with key appended, or nullptr if the object should become a dictionary
+        Shape* AddTransition(Atom key);
+        /// the slot of key or kNotFound
+        int Find(Atom key) const;
+        /// the keys in slot order
+        std::vector<Atom> Keys() const;
+
+        Atom key() const { return key_; }
+        std::uint32_t num_slots() const { return num_slots_; }
+        Shape* parent() const { return parent_; }
+
+    private:
+        Shape(Shape* parent, Atom key);
+
+        // shapes this small are searched by walking up the parents, larger ones build a table on first use
+        static constexpr std::uint32_t kLinearSearchSlots = 8;
+
+        Shape* parent_;
+        Atom key_;
+        std::uint32_t num_slots_;
+        std::unordered_map<Atom, std::unique_ptr<Shape>> transitions_;
+        mutable std::unique_ptr<std::unordered_map<Atom, std::uint32_t>> table_;
+    };
+
+} // namespace mildew
\ No newline at end of file
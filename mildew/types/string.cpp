@@ -16,6 +16,10 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "string.hpp"
 
+#include <vector>
+
+#include "../heap.hpp"
+
 namespace mildew
 {
     ScriptString::ScriptString()
@@ -23,31 +27,112 @@ namespace mildew
     {}
 
     ScriptString::ScriptString(const std::string& s)
-    : ScriptObject("String", nullptr), str(s)
+    : ScriptObject("String", nullptr), text_(s), length_(s.length())
+    {}
+
+    ScriptString::ScriptString(std::string&& s)
+    : ScriptObject("String", nullptr), text_(std::move(s)), length_(text_.length())
+    {}
+
+    ScriptString::ScriptString(ScriptString* left, ScriptString* right)
+    : ScriptObject("String", nullptr), left_(left), right_(right), length_(left->length_ + right->length_)
     {}
 
+    ScriptString* ScriptString::Concat(ScriptString* left, ScriptString* right)
+    {
+        auto& heap = Heap::Current();
+        if(left->length_ + right->length_ >= kMinRopeLength)
+            return heap.Make<ScriptString>(left, right);
+        return heap.Make<ScriptString>(left->str() + right->str());
+    }
+
+    ScriptString* ScriptString::Join(const ScriptAny* values, const size_t count)
+    {
+        // short pieces are gathered in a buffer and long strings are linked into the rope as they are
+        ScriptString* result = nullptr;
+        std::string pending;
+        auto append = [&result](ScriptString* piece) {
+            result = result == nullptr ? piece : Concat(result, piece);
+        };
+        for(size_t i = 0; i < count; ++i)
+        {
+            const auto kString = values[i].ToValue<ScriptString>();
+            if(kString != nullptr && kString->length_ >= kMinRopeLength)
+            {
+                if(!pending.empty())
+                    append(Heap::Current().Make<ScriptString>(std::move(pending)));
+                pending.clear();
+                append(kString);
+            }
+            else if(kString != nullptr)
+            {
+                pending += kString->str();
+            }
+            else
+            {
+                pending += values[i].ToString();
+            }
+        }
+        if(!pending.empty() || result == nullptr)
+            append(Heap::Current().Make<ScriptString>(std::move(pending)));
+        return result;
+    }
+
     size_t ScriptString::GetHash() const
     {
         constexpr size_t MOD = sizeof(size_t) * 8;
-        size_t result = str.Length();
-        for(size_t i = 0; i < str.Length(); ++i)
-            result ^= str.At(i) << (i % MOD);
+        const auto& text = str();
+        size_t result = text.length();
+        for(size_t i = 0; i < text.length(); ++i)
+            result ^= text[i] << (i % MOD);
         return result;
     }
 
+    void ScriptString::Trace(Heap& heap)
+    {
+        ScriptObject::Trace(heap);
+        heap.Mark(left_);
+        heap.Mark(right_);
+    }
+
     bool ScriptString::operator<(const ScriptString& s) const 
     {
-        return str < s.str;
+        return str() < s.str();
     }
 
     bool ScriptString::operator==(const ScriptString& s) const
     {
-        return str == s.str;
+        return str() == s.str();
+    }
+
+    void ScriptString::Flatten() const
+    {
+        // the pieces are visited left to right without recursion because a string built in a loop is a
+        // rope as deep as the number of iterations
+        text_.reserve(length_);
+        std::vector<const ScriptString*> pending{right_, left_};
+        while(!pending.empty())
+        {
+            const auto* node = pending.back();
+            pending.pop_back();
+            if(node->left_ != nullptr)
+            {
+                pending.push_back(node->right_);
+                pending.push_back(node->left_);
+            }
+            else
+            {
+                text_ += node->text_;
+            }
+        }
+        left_ = nullptr;
+        right_ = nullptr;
     }
 
     std::ostream& operator<<(std::ostream& os, const ScriptString& s)
     {
-        os << s.str;
+        os << s.str();
         return os;
     }
-}
\ No newline at end of file
+
+} // namespace mildew
\ No newline at end of file
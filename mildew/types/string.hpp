@@ -14,7 +14,7 @@ You should have received a copy of the GNU General Public License along with
 this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include "../../cppd/utf8string.hpp"
+#pragma once
 
 #include <string>
 
@@ -22,20 +22,51 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 namespace mildew
 {
+    /**
+     * An immutable script string. The text is a std::string, so a short string is stored inside the object
+     * without a second allocation. Concatenating strings whose result is at least kMinRopeLength bytes long
+     * creates a rope node that only refers to both halves. The text of a rope is joined when it is first read,
+     * so building a string piece by piece copies each piece once instead of once per concatenation.
+     */
     class ScriptString : public ScriptObject
     {
     public:
+        static constexpr size_t kMinRopeLength = 64;
+
         ScriptString();
         ScriptString(const std::string& s);
+        ScriptString(std::string&& s);
+        ScriptString(ScriptString* left, ScriptString* right);
+
+        /// allocates the concatenation of two strings from the current heap
+        static ScriptString* Concat(ScriptString* left, ScriptString* right);
+        /// allocates the concatenation of the string forms of count values from the current heap
+        static ScriptString* Join(const ScriptAny* values, size_t count);
 
         size_t GetHash() const override;
+        bool IsRope() const { return left_ != nullptr; }
+        size_t Length() const { return length_; }
+        /// the text of the string, which joins the pieces of a rope on first use
+        const std::string& str() const
+        {
+            if(left_ != nullptr)
+                Flatten();
+            return text_;
+        }
+        void Trace(Heap& heap) override;
 
         bool operator<(const ScriptString& s) const;
         bool operator==(const ScriptString& s) const;
 
-        cppd::UTF8String str;
+    private:
+        void Flatten() const;
+
+        mutable std::string text_;
+        mutable ScriptString* left_ = nullptr; // both halves are set while the string is an unjoined rope
+        mutable ScriptString* right_ = nullptr;
+        size_t length_ = 0;
     };
 
     std::ostream& operator<<(std::ostream& os, const ScriptString& s);
 
-}
\ No newline at end of file
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace mildew
+{
+    void* Arena::Allocate(const size_t size, const size_t alignment)
+    {
+        auto address = reinterpret_cast<std::uintptr_t>(next_);
+        auto aligned = (address + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1);
+        if(next_ == nullptr || aligned + size > reinterpret_cast<std::uintptr_t>(end_))
+        {
+            // a value too large for a block gets a block of its own
+            const auto kSize = std::max(kBlockSize, size + alignment);
+            blocks_.emplace_back(new std::byte[kSize]);
+            next_ = blocks_.back().get();
+            end_ = next_ + kSize;
+            address = reinterpret_cast<std::uintptr_t>(next_);
+            aligned = (address + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1);
+        }
+        next_ = reinterpret_cast<std::byte*>(aligned + size);
+        bytes_used_ += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    std::string_view Arena::CopyString(const std::string_view text)
+    {
+        if(text.empty())
+            return std::string_view();
+        auto data = static_cast<char*>(Allocate(text.size(), 1));
+        std::memcpy(data, text.data(), text.size());
+        return std::string_view(data, text.size());
+    }
+
+} // namespace mildew
\ No newline at end of file
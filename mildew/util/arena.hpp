@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mildew
+{
+    /// a fixed list of values that lives in an Arena, it is copied as a pointer and a size
+    template<typename T>
+    class ArenaList
+    {
+    public:
+        ArenaList() {}
+        ArenaList(const T* data, const size_t size) : data_(data), size_(size) {}
+
+        const T* begin() const { return data_; }
+        const T* end() const { return data_ + size_; }
+        const T& back() const { return data_[size_ - 1]; }
+        bool empty() const { return size_ == 0; }
+        size_t size() const { return size_; }
+
+        const T& operator[](const size_t index) const { return data_[index]; }
+
+    private:
+        const T* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    /**
+     * Bump allocates the syntax tree of one compilation from a few large blocks that are all released at once
+     * when the arena is destroyed. Nothing made in an arena is ever destroyed, so it may only hold trivially
+     * destructible values such as plain pointers, ArenaLists, and string views.
+     */
+    class Arena final
+    {
+    public:
+        Arena() {}
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* Allocate(size_t size, size_t alignment);
+        std::string_view CopyString(std::string_view text);
+
+        template<typename T, typename ...Args>
+        T* Make(Args&&... args)
+        {
+            static_assert(std::is_trivially_destructible_v<T>, "Arena objects are never destroyed");
+            return new(Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        template<typename T>
+        ArenaList<T> MakeList(const std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Arena lists are copied bytewise");
+            if(values.empty())
+                return ArenaList<T>();
+            auto data = static_cast<T*>(Allocate(sizeof(T) * values.size(), alignof(T)));
+            std::memcpy(static_cast<void*>(data), values.data(), sizeof(T) * values.size());
+            return ArenaList<T>(data, values.size());
+        }
+
+        size_t bytes_used() const { return bytes_used_; }
+
+    private:
+        static constexpr size_t kBlockSize = 64 * 1024;
+
+        std::vector<std::unique_ptr<std::byte[]>> blocks_;
+        std::byte* next_ = nullptr;
+        std::byte* end_ = nullptr;
+        size_t bytes_used_ = 0;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -15,56 +15,119 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #pragma once
 
-#include <any>
+#include <stdexcept>
 
 #include "nodes.hpp"
 
 namespace mildew
 {
-    class IExpressionVisitor
+    /**
+     * Dispatches an expression node to the Visit method of Derived for its class, for example
+     * VisitLiteralNode(const LiteralNode&). Derived inherits this with itself as the first argument, and every
+     * Visit method returns Result, so a visitor can produce values of its own type without boxing them.
+     */
+    template<typename Derived, typename Result = void>
+    class ExpressionVisitor
     {
     public:
-        virtual ~IExpressionVisitor() {}
+        Result VisitExpression(const ExpressionNode& node)
+        {
+            using Kind = ExpressionNode::Kind;
+            auto& self = static_cast<Derived&>(*this);
+            switch(node.kind)
+            {
+            case Kind::LITERAL:
+                return self.VisitLiteralNode(static_cast<const LiteralNode&>(node));
+            case Kind::FUNCTION_LITERAL:
+                return self.VisitFunctionLiteralNode(static_cast<const FunctionLiteralNode&>(node));
+            case Kind::LAMBDA:
+                return self.VisitLambdaNode(static_cast<const LambdaNode&>(node));
+            case Kind::TEMPLATE_STRING:
+                return self.VisitTemplateStringNode(static_cast<const TemplateStringNode&>(node));
+            case Kind::ARRAY_LITERAL:
+                return self.VisitArrayLiteralNode(static_cast<const ArrayLiteralNode&>(node));
+            case Kind::OBJECT_LITERAL:
+                return self.VisitObjectLiteralNode(static_cast<const ObjectLiteralNode&>(node));
+            case Kind::CLASS_LITERAL:
+                return self.VisitClassLiteralNode(static_cast<const ClassLiteralNode&>(node));
+            case Kind::BINARY_OP:
+                return self.VisitBinaryOpNode(static_cast<const BinaryOpNode&>(node));
+            case Kind::UNARY_OP:
+                return self.VisitUnaryOpNode(static_cast<const UnaryOpNode&>(node));
+            case Kind::TERNIARY_OP:
+                return self.VisitTerniaryOpNode(static_cast<const TerniaryOpNode&>(node));
+            case Kind::VAR_ACCESS:
+                return self.VisitVarAccessNode(static_cast<const VarAccessNode&>(node));
+            case Kind::FUNCTION_CALL:
+                return self.VisitFunctionCallNode(static_cast<const FunctionCallNode&>(node));
+            case Kind::ARRAY_INDEX:
+                return self.VisitArrayIndexNode(static_cast<const ArrayIndexNode&>(node));
+            case Kind::MEMBER_ACCESS:
+                return self.VisitMemberAccessNode(static_cast<const MemberAccessNode&>(node));
+            case Kind::NEW_EXPRESSION:
+                return self.VisitNewExpressionNode(static_cast<const NewExpressionNode&>(node));
+            case Kind::SUPER:
+                return self.VisitSuperNode(static_cast<const SuperNode&>(node));
+            case Kind::YIELD:
+                return self.VisitYieldNode(static_cast<const YieldNode&>(node));
+            }
+            throw std::logic_error("Invalid expression node kind");
+        }
 
-        virtual std::any VisitLiteralNode(const LiteralNode& lnode) = 0;
-        virtual std::any VisitFunctionLiteralNode(const FunctionLiteralNode& flnode) = 0;
-        virtual std::any VisitLambdaNode(const LambdaNode& lnode) = 0;
-        virtual std::any VisitTemplateStringNode(const TemplateStringNode& tsnode) = 0;
-        virtual std::any VisitArrayLiteralNode(const ArrayLiteralNode& alnode) = 0;
-        virtual std::any VisitObjectLiteralNode(const ObjectLiteralNode& olnode) = 0;
-        virtual std::any VisitClassLiteralNode(const ClassLiteralNode& clnode) = 0;
-        virtual std::any VisitBinaryOpNode(const BinaryOpNode& bonode) = 0;
-        virtual std::any VisitUnaryOpNode(const UnaryOpNode& uonode) = 0;
-        virtual std::any VisitTerniaryOpNode(const TerniaryOpNode& tonode) = 0;
-        virtual std::any VisitVarAccessNode(const VarAccessNode& vanode) = 0;
-        virtual std::any VisitFunctionCallNode(const FunctionCallNode& fcnode) = 0;
-        virtual std::any VisitArrayIndexNode(const ArrayIndexNode& ainode) = 0;
-        virtual std::any VisitMemberAccessNode(const MemberAccessNode& manode) = 0;
-        virtual std::any VisitNewExpressionNode(const NewExpressionNode& nenode) = 0;
-        virtual std::any VisitSuperNode(const SuperNode& snode) = 0;
-        virtual std::any VisitYieldNode(const YieldNode& ynode) = 0;
+    protected:
+        ~ExpressionVisitor() = default;
     };
 
-    class IStatementVisitor
+    /// dispatches a statement node to the Visit method of Derived for its class, see ExpressionVisitor
+    template<typename Derived, typename Result = void>
+    class StatementVisitor
     {
     public:
-        virtual ~IStatementVisitor() {}
+        Result VisitStatement(const StatementNode& node)
+        {
+            using Kind = StatementNode::Kind;
+            auto& self = static_cast<Derived&>(*this);
+            switch(node.kind)
+            {
+            case Kind::VAR_DECLARATION:
+                return self.VisitVarDeclarationStatementNode(static_cast<const VarDeclarationStatementNode&>(node));
+            case Kind::BLOCK:
+                return self.VisitBlockStatementNode(static_cast<const BlockStatementNode&>(node));
+            case Kind::IF:
+                return self.VisitIfStatementNode(static_cast<const IfStatementNode&>(node));
+            case Kind::SWITCH:
+                return self.VisitSwitchStatementNode(static_cast<const SwitchStatementNode&>(node));
+            case Kind::WHILE:
+                return self.VisitWhileStatementNode(static_cast<const WhileStatementNode&>(node));
+            case Kind::DO_WHILE:
+                return self.VisitDoWhileStatementNode(static_cast<const DoWhileStatementNode&>(node));
+            case Kind::FOR:
+                return self.VisitForStatementNode(static_cast<const ForStatementNode&>(node));
+            case Kind::FOR_OF:
+                return self.VisitForOfStatementNode(static_cast<const ForOfStatementNode&>(node));
+            case Kind::BREAK_OR_CONTINUE:
+                return self.VisitBreakOrContinueStatementNode(static_cast<const BreakOrContinueStatementNode&>(node));
+            case Kind::RETURN:
+                return self.VisitReturnStatementNode(static_cast<const ReturnStatementNode&>(node));
+            case Kind::FUNCTION_DECLARATION:
+                return self.VisitFunctionDeclarationStatementNode(
+                    static_cast<const FunctionDeclarationStatementNode&>(node));
+            case Kind::THROW:
+                return self.VisitThrowStatementNode(static_cast<const ThrowStatementNode&>(node));
+            case Kind::TRY_BLOCK:
+                return self.VisitTryBlockStatementNode(static_cast<const TryBlockStatementNode&>(node));
+            case Kind::DELETE:
+                return self.VisitDeleteStatementNode(static_cast<const DeleteStatementNode&>(node));
+            case Kind::CLASS_DECLARATION:
+                return self.VisitClassDeclarationStatementNode(static_cast<const ClassDeclarationStatementNode&>(node));
+            case Kind::EXPRESSION:
+                return self.VisitExpressionStatementNode(static_cast<const ExpressionStatementNode&>(node));
+            }
+            throw std::logic_error("Invalid statement node kind");
+        }
 
-        virtual std::any VisitVarDeclarationStatementNode(const VarDeclarationStatementNode& vdsnode) = 0;
-        virtual std::any VisitBlockStatementNode(const BlockStatementNode& bsnode) = 0;
-        virtual std::any VisitIfStatementNode(const IfStatementNode& isnode) = 0;
-        virtual std::any VisitSwitchStatementNode(const SwitchStatementNode& ssnode) = 0;
-        virtual std::any VisitWhileStatementNode(const WhileStatementNode& wsnode) = 0;
-        virtual std::any VisitDoWhileStatementNode(const DoWhileStatementNode& dwsnode) = 0;
-        virtual std::any VisitForStatementNode(const ForStatementNode& fsnode) = 0;
-        virtual std::any VisitForOfStatementNode(const ForOfStatementNode& fosnode) = 0;
-        virtual std::any VisitBreakOrContinueStatementNode(const BreakOrContinueStatementNode& bocsnode) = 0;
-        virtual std::any VisitReturnStatementNode(const ReturnStatementNode& rsnode) = 0;
-        virtual std::any VisitFunctionDeclarationStatementNode(const FunctionDeclarationStatementNode& fdsnode) = 0;
-        virtual std::any VisitThrowStatementNode(const ThrowStatementNode& tsnode) = 0;
-        virtual std::any VisitTryBlockStatementNode(const TryBlockStatementNode& tbsnode) = 0;
-        virtual std::any VisitDeleteStatementNode(const DeleteStatementNode& dsnode) = 0;
-        virtual std::any VisitClassDeclarationStatementNode(const ClassDeclarationStatementNode& cdsnode) = 0;
-        virtual std::any VisitExpressionStatementNode(const ExpressionStatementNode& esnode) = 0;
+    protected:
+        ~StatementVisitor() = default;
     };
-}
\ No newline at end of file
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,170 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "compiledprogram.hpp"
+
+#include <unordered_map>
+
+#include "../errors.hpp"
+#include "../heap.hpp"
+#include "../util/sfmt.hpp"
+#include "consttable.hpp"
+
+namespace mildew
+{
+    // a value that holds no pointer into a heap
+    static bool IsScalar(const ScriptAny& value)
+    {
+        switch(value.type())
+        {
+        case ScriptAny::Type::UNDEFINED:
+        case ScriptAny::Type::NULL_:
+        case ScriptAny::Type::BOOLEAN:
+        case ScriptAny::Type::INTEGER:
+        case ScriptAny::Type::DOUBLE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// collects the functions of a program in the order BytecodeImage saves them
+    class ProgramCollector
+    {
+    public:
+        std::vector<const ScriptFunction*> functions;
+        std::unordered_map<const ScriptFunction*, std::uint32_t> indices;
+
+        void Collect(const ScriptFunction& func)
+        {
+            if(func.type() != ScriptFunction::Type::SCRIPT_FUNCTION)
+                throw ImageError(MakeString("Native function ", func.function_name(), " cannot be shared"));
+            indices[&func] = static_cast<std::uint32_t>(functions.size());
+            functions.emplace_back(&func);
+            for(const auto& value : *func.const_table())
+            {
+                if(value.type() == ScriptAny::Type::FUNCTION)
+                    Collect(*value.ToValue<ScriptFunction>());
+            }
+        }
+    };
+
+    std::shared_ptr<const CompiledProgram> CompiledProgram::Create(const ScriptFunction& program)
+    {
+        ProgramCollector collector;
+        collector.Collect(program);
+        std::shared_ptr<CompiledProgram> compiled(new CompiledProgram());
+        for(const auto func : collector.functions)
+        {
+            Function function;
+            function.name = func->function_name();
+            function.args = func->arg_names();
+            function.is_class = func->is_class();
+            function.is_generator = func->is_generator();
+            function.num_registers = func->num_registers();
+            function.num_cells = func->num_cells();
+            function.num_inline_caches = func->num_inline_caches();
+            const auto& consts = *func->const_table();
+            for(size_t i = 0; i < consts.size(); ++i)
+            {
+                const auto& value = consts.Get(i);
+                Constant constant;
+                constant.type = value.type();
+                if(IsScalar(value))
+                    constant.scalar = value;
+                else if(value.type() == ScriptAny::Type::STRING)
+                {
+                    constant.str = consts.GetString(i);
+                    constant.atom = consts.GetAtom(i);
+                }
+                else if(value.type() == ScriptAny::Type::FUNCTION)
+                    constant.function = collector.indices.at(value.ToValue<ScriptFunction>());
+                else
+                    throw ImageError(MakeString("Constant ", value, " cannot be shared"));
+                function.constants.emplace_back(std::move(constant));
+            }
+            // the instances share the code the program was compiled to rather than a copy of it
+            function.code = func->compiled_;
+            function.lines = func->lines_;
+            function.upvalue_infos = func->upvalue_infos_;
+            // strings are looked up by atom, which every heap shares, so only function cases tie a table to a heap
+            function.switch_tables = func->switch_tables_;
+            function.rebuild_switch_tables = false;
+            for(const auto& table : func->switch_tables())
+            {
+                for(const auto& entry : table.cases())
+                {
+                    if(consts.Get(entry.constant).type() == ScriptAny::Type::FUNCTION)
+                        function.rebuild_switch_tables = true;
+                }
+            }
+            compiled->functions_.emplace_back(std::move(function));
+        }
+        return compiled;
+    }
+
+    ScriptFunction* CompiledProgram::Instantiate() const
+    {
+        // nested functions come after the functions that refer to them, so they are built first
+        std::vector<ScriptFunction*> instances(functions_.size());
+        for(size_t i = functions_.size(); i > 0; --i)
+        {
+            const auto& function = functions_[i - 1];
+            auto const_table = std::make_shared<ConstTable>();
+            for(const auto& constant : function.constants)
+            {
+                // the constants were deduplicated when they were compiled, so they keep their indices
+                if(constant.type == ScriptAny::Type::STRING)
+                    const_table->AddString(constant.str, constant.atom);
+                else if(constant.type == ScriptAny::Type::FUNCTION)
+                    const_table->AddValue(ScriptAny(instances[constant.function]));
+                else
+                    const_table->AddValue(constant.scalar);
+            }
+            auto func = ScriptFunction::Create(function.name, function.args, {}, function.is_class,
+                function.is_generator, const_table, function.num_registers, {}, function.num_inline_caches,
+                function.num_cells);
+            func->compiled_ = function.code;
+            func->lines_ = function.lines;
+            func->upvalue_infos_ = function.upvalue_infos;
+            if(!function.rebuild_switch_tables)
+            {
+                func->switch_tables_ = function.switch_tables;
+            }
+            else
+            {
+                std::vector<SwitchTable> switch_tables;
+                for(const auto& table : *function.switch_tables)
+                    switch_tables.emplace_back(*const_table, table.cases(), table.default_target());
+                func->switch_tables_ = std::make_shared<const std::vector<SwitchTable>>(std::move(switch_tables));
+            }
+            instances[i - 1] = func;
+        }
+        return instances[0];
+    }
+
+    size_t CompiledProgram::shared_bytes() const
+    {
+        size_t bytes = 0;
+        for(const auto& function : functions_)
+        {
+            bytes += function.code->size() + function.lines->size() * sizeof(LineInfo)
+                + function.upvalue_infos->size() * sizeof(UpvalueInfo);
+        }
+        return bytes;
+    }
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../atom.hpp"
+#include "../types/any.hpp"
+#include "../types/function.hpp"
+
+namespace mildew
+{
+    /**
+     * A compiled program that belongs to no heap, so that any number of interpreters, on any number of
+     * threads, can run it without compiling it again. The bytecode, line tables, upvalue layouts, and switch
+     * tables of its functions are immutable and shared by every instance, while each instance gets its own
+     * constant table, inline caches, type feedback, and native code, which refer to objects of one heap. A
+     * CompiledProgram is never changed after it is created and is always handled through a shared_ptr to
+     * const. Interpreters do not keep it alive, so it is freed once its hosts release it, while the functions
+     * it instantiated keep the code they share.
+     */
+    class CompiledProgram
+    {
+    public:
+        /// a constant as it is kept outside of any heap
+        struct Constant
+        {
+            ScriptAny scalar; // undefined, null, a boolean, or a number, which need no heap
+            std::string str;
+            Atom atom = kNoAtom; // of str when the constant is a string
+            std::uint32_t function = 0; // index of a nested function when the constant is a function
+            ScriptAny::Type type = ScriptAny::Type::UNDEFINED;
+        };
+
+        struct Function
+        {
+            std::string name;
+            std::vector<std::string> args;
+            bool is_class;
+            bool is_generator;
+            int num_registers;
+            int num_cells;
+            size_t num_inline_caches;
+            std::vector<Constant> constants;
+            std::shared_ptr<const std::vector<std::uint8_t>> code;
+            std::shared_ptr<const std::vector<LineInfo>> lines;
+            std::shared_ptr<const std::vector<UpvalueInfo>> upvalue_infos;
+            std::shared_ptr<const std::vector<SwitchTable>> switch_tables;
+            /// a case value is a function, which each instance has its own of, so it builds its own tables
+            bool rebuild_switch_tables;
+        };
+
+        /// takes the code of a program from Compiler or BytecodeImage, throws ImageError for native functions
+        static std::shared_ptr<const CompiledProgram> Create(const ScriptFunction& program);
+
+        /// builds the functions of the program in the current heap and returns the program
+        ScriptFunction* Instantiate() const;
+
+        const std::string& name() const { return functions_[0].name; }
+        /// the program first, then nested functions, each after the functions whose constants refer to it
+        const std::vector<Function>& functions() const { return functions_; }
+        /// bytes of bytecode, line tables, and upvalue layouts that instances share instead of copying
+        size_t shared_bytes() const;
+
+    private:
+        CompiledProgram() {}
+
+        std::vector<Function> functions_;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "consttable.hpp"
+
+#include "../errors.hpp"
+#include "opcodes.hpp"
+
+namespace mildew
+{
+    size_t ConstTable::AddValue(const ScriptAny& value)
+    {
+        switch(value.type())
+        {
+        case ScriptAny::Type::INTEGER: {
+            const auto kValue = value.ToValue<std::int64_t>();
+            const auto found = integer_indices_.find(kValue);
+            if(found != integer_indices_.end())
+                return found->second;
+            return integer_indices_[kValue] = Append(value);
+        }
+        case ScriptAny::Type::DOUBLE: {
+            const auto kValue = value.ToValue<double>();
+            const auto found = double_indices_.find(kValue);
+            if(found != double_indices_.end())
+                return found->second;
+            return double_indices_[kValue] = Append(value);
+        }
+        case ScriptAny::Type::STRING:
+            return AddString(value.ToString());
+        default:
+            // functions and other objects are never shared between sites
+            return Append(value);
+        }
+    }
+
+    size_t ConstTable::AddString(const std::string& str, const Atom atom)
+    {
+        const auto found = string_indices_.find(str);
+        if(found != string_indices_.end())
+            return found->second;
+        const auto kIndex = Append(ScriptAny(str));
+        strings_[kIndex] = str;
+        atoms_[kIndex] = atom != kNoAtom ? atom : AtomTable::Intern(str);
+        return string_indices_[str] = kIndex;
+    }
+
+    size_t ConstTable::Append(const ScriptAny& value)
+    {
+        if(constants_.size() > kMaxBx)
+            throw ScriptCompileError("Too many constants in one function");
+        constants_.emplace_back(value);
+        strings_.emplace_back();
+        atoms_.emplace_back(kNoAtom);
+        return constants_.size() - 1;
+    }
+}
@@ -0,0 +1,61 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../atom.hpp"
+#include "../types/any.hpp"
+
+namespace mildew
+{
+    /**
+     * Holds the literal values, names, and nested function prototypes referenced by the bytecode of one
+     * function. Primitive values and strings are deduplicated so each distinct constant is stored once.
+     */
+    class ConstTable
+    {
+    public:
+        size_t AddValue(const ScriptAny& value);
+        /// adds a string constant, atom may be given when the caller already interned it
+        size_t AddString(const std::string& str, Atom atom = kNoAtom);
+        const ScriptAny& Get(const size_t index) const { return constants_[index]; }
+        const ScriptAny* data() const { return constants_.data(); }
+        /// the std::string form of a string constant, so name lookups do not have to convert
+        const std::string& GetString(const size_t index) const { return strings_[index]; }
+        /// the interned form of a string constant, used for variable and field names
+        Atom GetAtom(const size_t index) const { return atoms_[index]; }
+        size_t size() const { return constants_.size(); }
+
+        auto begin() const { return constants_.begin(); }
+        auto end() const { return constants_.end(); }
+
+    private:
+        size_t Append(const ScriptAny& value);
+
+        std::vector<ScriptAny> constants_;
+        std::vector<std::string> strings_;
+        std::vector<Atom> atoms_;
+        std::unordered_map<std::string, size_t> string_indices_;
+        std::unordered_map<std::int64_t, size_t> integer_indices_;
+        std::unordered_map<double, size_t> double_indices_;
+        mutable std::uint32_t gc_epoch_ = 0;
+        friend class Heap;
+    };
+}
@@ -0,0 +1,505 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "image.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MILDEW_HAS_MMAP 1
+#else
+#define MILDEW_HAS_MMAP 0
+#endif
+
+#include "../errors.hpp"
+#include "../types/function.hpp"
+#include "../util/sfmt.hpp"
+#include "consttable.hpp"
+#include "inlinecache.hpp"
+#include "opcodes.hpp"
+
+namespace mildew
+{
+    // every section starts at a multiple of 8 bytes from the start of the image, and all offsets are from there
+    struct ImageHeader
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t num_opcodes;
+        std::uint32_t num_strings;
+        std::uint32_t strings_offset; // ImageString records
+        std::uint32_t num_functions;
+        std::uint32_t functions_offset; // ImageFunction records, the program first
+    };
+
+    struct ImageString
+    {
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+
+    // a nested function always comes after the function whose constants refer to it
+    struct ImageFunction
+    {
+        std::uint32_t name; // string index
+        std::uint32_t flags;
+        std::uint32_t num_registers;
+        std::uint32_t num_cells;
+        std::uint32_t num_inline_caches;
+        std::uint32_t num_args;
+        std::uint32_t args_offset; // string indices
+        std::uint32_t num_code_words;
+        std::uint32_t code_offset;
+        std::uint32_t num_constants;
+        std::uint32_t constants_offset; // ImageConstant records
+        std::uint32_t num_lines;
+        std::uint32_t lines_offset; // LineInfo records
+        std::uint32_t num_upvalues;
+        std::uint32_t upvalues_offset; // the from_cell flag in bit 8 and the index in the low byte
+        std::uint32_t num_switch_tables;
+        std::uint32_t switch_tables_offset; // ImageSwitchTable records
+    };
+
+    // a switch table is stored as the cases it was built from, which refer to constants rather than to atoms
+    struct ImageSwitchTable
+    {
+        std::uint32_t default_target;
+        std::uint32_t num_cases;
+        std::uint32_t cases_offset; // SwitchTable::Case records
+        std::uint32_t reserved;
+    };
+
+    enum class ImageConstantType : std::uint32_t { UNDEFINED, NULL_, BOOLEAN, INTEGER, DOUBLE, STRING, FUNCTION };
+
+    struct ImageConstant
+    {
+        std::uint32_t type;
+        std::uint32_t reserved;
+        std::uint64_t payload; // the value, or a string or function index
+    };
+
+    constexpr char kImageMagic[4] = {'M', 'D', 'W', 'I'};
+    constexpr std::uint32_t kByteOrderMark = 0x01020304;
+    constexpr std::uint32_t kFlagClass = 1;
+    constexpr std::uint32_t kFlagGenerator = 2;
+
+    class ImageWriter
+    {
+    public:
+        std::vector<std::uint8_t> Write(const ScriptFunction& program)
+        {
+            CollectFunctions(program);
+            Append(ImageHeader{});
+            std::vector<ImageFunction> records;
+            for(const auto func : functions_)
+                records.emplace_back(WriteFunction(*func));
+
+            ImageHeader header{};
+            std::memcpy(header.magic, kImageMagic, sizeof(kImageMagic));
+            header.version = kImageVersion;
+            header.byte_order = kByteOrderMark;
+            header.num_opcodes = static_cast<std::uint32_t>(OpCode::NUM_OPCODES);
+            std::vector<ImageString> string_records;
+            for(const auto& str : strings_)
+                string_records.push_back({AppendArray(str.data(), str.size()), Count(str.size())});
+            header.num_strings = Count(string_records.size());
+            header.strings_offset = AppendArray(string_records.data(), string_records.size());
+            header.num_functions = Count(records.size());
+            header.functions_offset = AppendArray(records.data(), records.size());
+            std::memcpy(data_.data(), &header, sizeof(header));
+            return std::move(data_);
+        }
+
+    private:
+        template<typename T>
+        std::uint32_t Append(const T& value)
+        {
+            return AppendArray(&value, 1);
+        }
+
+        template<typename T>
+        std::uint32_t AppendArray(const T* values, const size_t count)
+        {
+            data_.resize((data_.size() + 7) & ~static_cast<size_t>(7));
+            const auto kOffset = data_.size();
+            if(kOffset + sizeof(T) * count > std::numeric_limits<std::uint32_t>::max())
+                throw ImageError("Program is too large for an image");
+            data_.resize(kOffset + sizeof(T) * count);
+            if(count > 0)
+                std::memcpy(data_.data() + kOffset, values, sizeof(T) * count);
+            return static_cast<std::uint32_t>(kOffset);
+        }
+
+        void CollectFunctions(const ScriptFunction& func)
+        {
+            if(func.type() != ScriptFunction::Type::SCRIPT_FUNCTION)
+                throw ImageError(MakeString("Native function ", func.function_name(), " cannot be saved"));
+            function_indices_[&func] = Count(functions_.size());
+            functions_.emplace_back(&func);
+            for(const auto& value : *func.const_table())
+            {
+                if(value.type() == ScriptAny::Type::FUNCTION)
+                    CollectFunctions(*value.ToValue<ScriptFunction>());
+            }
+        }
+
+        static std::uint32_t Count(const size_t count)
+        {
+            if(count > std::numeric_limits<std::uint32_t>::max())
+                throw ImageError("Program is too large for an image");
+            return static_cast<std::uint32_t>(count);
+        }
+
+        std::uint32_t StringIndex(const std::string& str)
+        {
+            auto found = string_indices_.find(str);
+            if(found != string_indices_.end())
+                return found->second;
+            strings_.emplace_back(str);
+            return string_indices_[str] = Count(strings_.size() - 1);
+        }
+
+        ImageConstant WriteConstant(const ScriptAny& value)
+        {
+            ImageConstant constant{};
+            switch(value.type())
+            {
+            case ScriptAny::Type::UNDEFINED:
+                constant.type = static_cast<std::uint32_t>(ImageConstantType::UNDEFINED);
+                break;
+            case ScriptAny::Type::NULL_:
+                constant.type = static_cast<std::uint32_t>(ImageConstantType::NULL_);
+                break;
+            case ScriptAny::Type::BOOLEAN:
+                constant.type = static_cast<std::uint32_t>(ImageConstantType::BOOLEAN);
+                constant.payload = value.ToValue<bool>() ? 1 : 0;
+                break;
+            case ScriptAny::Type::INTEGER: {
+                constant.type = static_cast<std::uint32_t>(ImageConstantType::INTEGER);
+                const auto kValue = value.ToValue<std::int64_t>();
+                std::memcpy(&constant.payload, &kValue, sizeof(kValue));
+                break;
+            }
+            case ScriptAny::Type::DOUBLE: {
+                constant.type = static_cast<std::uint32_t>(ImageConstantType::DOUBLE);
+                const auto kValue = value.ToValue<double>();
+                std::memcpy(&constant.payload, &kValue, sizeof(kValue));
+                break;
+            }
+            case ScriptAny::Type::STRING:
+                constant.type = static_cast<std::uint32_t>(ImageConstantType::STRING);
+                constant.payload = StringIndex(value.ToString());
+                break;
+            case ScriptAny::Type::FUNCTION:
+                constant.type = static_cast<std::uint32_t>(ImageConstantType::FUNCTION);
+                constant.payload = function_indices_.at(value.ToValue<ScriptFunction>());
+                break;
+            default:
+                throw ImageError(MakeString("Constant ", value, " cannot be saved"));
+            }
+            return constant;
+        }
+
+        ImageFunction WriteFunction(const ScriptFunction& func)
+        {
+            ImageFunction record{};
+            record.name = StringIndex(func.function_name());
+            record.flags = (func.is_class() ? kFlagClass : 0) | (func.is_generator() ? kFlagGenerator : 0);
+            record.num_registers = Count(func.num_registers());
+            record.num_cells = Count(func.num_cells());
+            record.num_inline_caches = Count(func.num_inline_caches());
+
+            std::vector<std::uint32_t> args;
+            for(const auto& arg : func.arg_names())
+                args.emplace_back(StringIndex(arg));
+            record.num_args = Count(args.size());
+            record.args_offset = AppendArray(args.data(), args.size());
+
+            const auto& code = func.compiled();
+            record.num_code_words = Count(code.size() / sizeof(std::uint32_t));
+            record.code_offset = AppendArray(code.data(), code.size());
+
+            std::vector<ImageConstant> constants;
+            for(const auto& value : *func.const_table())
+                constants.emplace_back(WriteConstant(value));
+            record.num_constants = Count(constants.size());
+            record.constants_offset = AppendArray(constants.data(), constants.size());
+
+            record.num_lines = Count(func.lines().size());
+            record.lines_offset = AppendArray(func.lines().data(), func.lines().size());
+
+            std::vector<std::uint32_t> upvalues;
+            for(const auto& info : func.upvalue_infos())
+                upvalues.emplace_back((info.from_cell ? 0x100u : 0u) | info.index);
+            record.num_upvalues = Count(upvalues.size());
+            record.upvalues_offset = AppendArray(upvalues.data(), upvalues.size());
+
+            std::vector<ImageSwitchTable> switch_tables;
+            for(const auto& table : func.switch_tables())
+            {
+                switch_tables.push_back({table.default_target(), Count(table.cases().size()),
+                    AppendArray(table.cases().data(), table.cases().size()), 0});
+            }
+            record.num_switch_tables = Count(switch_tables.size());
+            record.switch_tables_offset = AppendArray(switch_tables.data(), switch_tables.size());
+            return record;
+        }
+
+        std::vector<std::uint8_t> data_;
+        std::vector<const ScriptFunction*> functions_;
+        std::unordered_map<const ScriptFunction*, std::uint32_t> function_indices_;
+        std::vector<std::string> strings_;
+        std::unordered_map<std::string, std::uint32_t> string_indices_;
+    };
+
+    class ImageReader
+    {
+    public:
+        ImageReader(const std::uint8_t* data, const size_t size) : data_(data), size_(size) {}
+
+        ScriptFunction* Read()
+        {
+            const auto kHeader = Get<ImageHeader>(0);
+            if(std::memcmp(kHeader.magic, kImageMagic, sizeof(kImageMagic)) != 0)
+                throw ImageError("Not a bytecode image");
+            if(kHeader.version != kImageVersion || kHeader.num_opcodes != static_cast<std::uint32_t>(
+              OpCode::NUM_OPCODES))
+                throw ImageError(MakeString("Image version ", kHeader.version, " does not match version ",
+                    kImageVersion));
+            if(kHeader.byte_order != kByteOrderMark)
+                throw ImageError("Image was saved on a machine with a different byte order");
+            Span(kHeader.strings_offset, kHeader.num_strings, sizeof(ImageString));
+            for(std::uint32_t i = 0; i < kHeader.num_strings; ++i)
+            {
+                const auto kRecord = Get<ImageString>(Offset(kHeader.strings_offset, i, sizeof(ImageString)));
+                strings_.emplace_back(reinterpret_cast<const char*>(Span(kRecord.offset, kRecord.length, 1)),
+                    kRecord.length);
+            }
+            if(kHeader.num_functions == 0)
+                throw ImageError("Image has no program");
+            Span(kHeader.functions_offset, kHeader.num_functions, sizeof(ImageFunction));
+            // nested functions come after the functions that refer to them, so they are built first
+            functions_.resize(kHeader.num_functions);
+            for(auto i = kHeader.num_functions; i > 0; --i)
+            {
+                const auto kRecord = Get<ImageFunction>(Offset(kHeader.functions_offset, i - 1,
+                    sizeof(ImageFunction)));
+                functions_[i - 1] = ReadFunction(i - 1, kRecord);
+            }
+            return functions_[0];
+        }
+
+    private:
+        template<typename T>
+        T Get(const size_t offset) const
+        {
+            T value;
+            std::memcpy(&value, Span(offset, 1, sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        static size_t Offset(const size_t start, const size_t index, const size_t element_size)
+        {
+            return start + index * element_size;
+        }
+
+        const std::uint8_t* Span(const size_t offset, const size_t count, const size_t element_size) const
+        {
+            // the counts are 32-bit so this cannot overflow
+            if(offset > size_ || count * element_size > size_ - offset)
+                throw ImageError("Image is truncated or corrupt");
+            return data_ + offset;
+        }
+
+        const std::string& String(const std::uint64_t index) const
+        {
+            if(index >= strings_.size())
+                throw ImageError("Image refers to a missing string");
+            return strings_[index];
+        }
+
+        /// any constant but a string, which is added to the constant table directly
+        ScriptAny ReadConstant(const std::uint32_t function_index, const ImageConstant& constant)
+        {
+            switch(static_cast<ImageConstantType>(constant.type))
+            {
+            case ImageConstantType::UNDEFINED:
+                return ScriptAny();
+            case ImageConstantType::NULL_:
+                return ScriptAny(nullptr);
+            case ImageConstantType::BOOLEAN:
+                return ScriptAny(constant.payload != 0);
+            case ImageConstantType::INTEGER: {
+                std::int64_t value;
+                std::memcpy(&value, &constant.payload, sizeof(value));
+                return ScriptAny(value);
+            }
+            case ImageConstantType::DOUBLE: {
+                double value;
+                std::memcpy(&value, &constant.payload, sizeof(value));
+                return ScriptAny(value);
+            }
+            case ImageConstantType::FUNCTION:
+                if(constant.payload <= function_index || constant.payload >= functions_.size())
+                    throw ImageError("Image refers to a missing function");
+                return ScriptAny(functions_[constant.payload]);
+            default:
+                break;
+            }
+            throw ImageError("Image has a constant of unknown type");
+        }
+
+        ScriptFunction* ReadFunction(const std::uint32_t index, const ImageFunction& record)
+        {
+            if(record.num_registers > static_cast<std::uint32_t>(kMaxRegisters)
+              || record.num_cells > static_cast<std::uint32_t>(kMaxCells)
+              || record.num_upvalues > static_cast<std::uint32_t>(kMaxUpvalues)
+              || record.num_inline_caches > InlineCache::kNone)
+                throw ImageError("Image has a function with too many registers, upvalues, or caches");
+
+            // every array is checked against the size of the image before anything is allocated for it
+            Span(record.args_offset, record.num_args, sizeof(std::uint32_t));
+            const auto kCode = Span(record.code_offset, record.num_code_words, sizeof(std::uint32_t));
+            Span(record.constants_offset, record.num_constants, sizeof(ImageConstant));
+            const auto kLines = Span(record.lines_offset, record.num_lines, sizeof(LineInfo));
+            Span(record.upvalues_offset, record.num_upvalues, sizeof(std::uint32_t));
+            Span(record.switch_tables_offset, record.num_switch_tables, sizeof(ImageSwitchTable));
+
+            std::vector<std::string> args;
+            for(std::uint32_t i = 0; i < record.num_args; ++i)
+                args.emplace_back(String(Get<std::uint32_t>(Offset(record.args_offset, i, sizeof(std::uint32_t)))));
+
+            if(record.num_code_words == 0)
+                throw ImageError("Image has a function without code");
+            std::vector<std::uint8_t> bytecode(kCode, kCode + record.num_code_words * sizeof(std::uint32_t));
+
+            auto const_table = std::make_shared<ConstTable>();
+            for(std::uint32_t i = 0; i < record.num_constants; ++i)
+            {
+                const auto kConstant = Get<ImageConstant>(Offset(record.constants_offset, i,
+                    sizeof(ImageConstant)));
+                // the constants were deduplicated when they were compiled, so they keep their indices
+                const auto kIndex = kConstant.type == static_cast<std::uint32_t>(ImageConstantType::STRING)
+                    ? const_table->AddString(String(kConstant.payload))
+                    : const_table->AddValue(ReadConstant(index, kConstant));
+                if(kIndex != i)
+                    throw ImageError("Image has duplicate constants");
+            }
+
+            std::vector<LineInfo> lines(record.num_lines);
+            if(record.num_lines > 0)
+                std::memcpy(lines.data(), kLines, record.num_lines * sizeof(LineInfo));
+
+            std::vector<UpvalueInfo> upvalues;
+            for(std::uint32_t i = 0; i < record.num_upvalues; ++i)
+            {
+                const auto kInfo = Get<std::uint32_t>(Offset(record.upvalues_offset, i, sizeof(std::uint32_t)));
+                upvalues.push_back({(kInfo & 0x100) != 0, static_cast<std::uint8_t>(kInfo & 0xFF)});
+            }
+
+            std::vector<SwitchTable> switch_tables;
+            for(std::uint32_t i = 0; i < record.num_switch_tables; ++i)
+            {
+                const auto kTable = Get<ImageSwitchTable>(Offset(record.switch_tables_offset, i,
+                    sizeof(ImageSwitchTable)));
+                const auto kCases = Span(kTable.cases_offset, kTable.num_cases, sizeof(SwitchTable::Case));
+                std::vector<SwitchTable::Case> cases(kTable.num_cases);
+                if(kTable.num_cases > 0)
+                    std::memcpy(cases.data(), kCases, kTable.num_cases * sizeof(SwitchTable::Case));
+                bool valid = kTable.default_target < record.num_code_words;
+                for(const auto& entry : cases)
+                    valid = valid && entry.constant < const_table->size() && entry.target < record.num_code_words;
+                if(!valid)
+                    throw ImageError("Image has a switch table that refers outside its function");
+                switch_tables.emplace_back(*const_table, cases, kTable.default_target);
+            }
+
+            return ScriptFunction::Create(String(record.name), args, bytecode, (record.flags & kFlagClass) != 0,
+                (record.flags & kFlagGenerator) != 0, const_table, static_cast<int>(record.num_registers), lines,
+                record.num_inline_caches, static_cast<int>(record.num_cells), upvalues, switch_tables);
+        }
+
+        const std::uint8_t* data_;
+        size_t size_;
+        std::vector<std::string> strings_;
+        std::vector<ScriptFunction*> functions_;
+    };
+
+    std::vector<std::uint8_t> BytecodeImage::Serialize(const ScriptFunction& program)
+    {
+        return ImageWriter().Write(program);
+    }
+
+    ScriptFunction* BytecodeImage::Deserialize(const std::uint8_t* data, const size_t size)
+    {
+        return ImageReader(data, size).Read();
+    }
+
+    void BytecodeImage::Save(const ScriptFunction& program, const std::string& path)
+    {
+        const auto kImage = Serialize(program);
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(kImage.data()), static_cast<std::streamsize>(kImage.size()));
+        if(!file)
+            throw ImageError(MakeString("Could not write image ", path));
+    }
+
+    ScriptFunction* BytecodeImage::Load(const std::string& path)
+    {
+#if MILDEW_HAS_MMAP
+        const int kFile = open(path.c_str(), O_RDONLY);
+        if(kFile < 0)
+            throw ImageError(MakeString("Could not open image ", path));
+        struct stat info;
+        if(fstat(kFile, &info) != 0 || info.st_size <= 0)
+        {
+            close(kFile);
+            throw ImageError(MakeString("Could not read image ", path));
+        }
+        const auto kSize = static_cast<size_t>(info.st_size);
+        auto mapping = mmap(nullptr, kSize, PROT_READ, MAP_PRIVATE, kFile, 0);
+        close(kFile);
+        if(mapping == MAP_FAILED)
+            throw ImageError(MakeString("Could not map image ", path));
+        try
+        {
+            auto program = Deserialize(static_cast<const std::uint8_t*>(mapping), kSize);
+            munmap(mapping, kSize);
+            return program;
+        }
+        catch(...)
+        {
+            munmap(mapping, kSize);
+            throw;
+        }
+#else
+        std::ifstream file(path, std::ios::binary);
+        if(!file)
+            throw ImageError(MakeString("Could not open image ", path));
+        std::vector<std::uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return Deserialize(data.data(), data.size());
+#endif
+    }
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mildew
+{
+    class ScriptFunction;
+
+    /// bumped whenever the layout of an image or the instruction set changes
+    constexpr std::uint32_t kImageVersion = 2;
+
+    /**
+     * Saves compiled programs as binary images that load without lexing, parsing, or compiling. An image
+     * holds every function of a program with its bytecode, constants, argument names, line table, upvalue
+     * layout, and switch tables, and one table of the strings they use. Bytecode is stored as the same words the
+     * virtual machine executes, so loading copies each function's code in one piece instead of decoding
+     * it. The offsets and references of an image are checked when it is loaded but the instructions are
+     * not, so images must come from a trusted source just like the interpreter itself.
+     */
+    class BytecodeImage
+    {
+    public:
+        static std::vector<std::uint8_t> Serialize(const ScriptFunction& program);
+        /// builds the program and its nested functions from the current heap
+        static ScriptFunction* Deserialize(const std::uint8_t* data, size_t size);
+
+        static void Save(const ScriptFunction& program, const std::string& path);
+        /// maps the file into memory where possible and deserializes it
+        static ScriptFunction* Load(const std::string& path);
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,83 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "inlinecache.hpp"
+
+namespace mildew
+{
+    ScriptAny InlineCache::GetMiss(ScriptObject* obj, const Atom key)
+    {
+        Entry entry{obj->shape(), nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0};
+        ScriptObject* holder = obj;
+        // only objects whose fields are described by a shape can be cached
+        for(; holder != nullptr && holder->shape() != nullptr && entry.depth <= 2; ++entry.depth)
+        {
+            const auto kSlot = holder->shape()->Find(key);
+            if(kSlot != Shape::kNotFound)
+            {
+                entry.slot = kSlot;
+                if(entry.shape != nullptr)
+                    AddEntry(entry);
+                return holder->Slot(kSlot);
+            }
+            holder = holder->prototype();
+            if(entry.depth == 0)
+            {
+                entry.prototype = holder;
+                entry.prototype_shape = holder != nullptr ? holder->shape() : nullptr;
+            }
+            else
+            {
+                entry.holder = holder;
+                entry.holder_shape = holder != nullptr ? holder->shape() : nullptr;
+            }
+        }
+        return obj->LookupField(key);
+    }
+
+    void InlineCache::SetMiss(ScriptObject* obj, const Atom key, const ScriptAny& value)
+    {
+        const auto kShape = obj->shape();
+        obj->AssignField(key, value);
+        const auto kNewShape = obj->shape();
+        if(kShape == nullptr || kNewShape == nullptr)
+            return;
+        Entry entry{kShape, kShape != kNewShape ? kNewShape : nullptr, nullptr, nullptr, nullptr, nullptr,
+            static_cast<std::uint32_t>(kNewShape->Find(key)), 0};
+        AddEntry(entry);
+    }
+
+    void InlineCache::AddEntry(const Entry& entry)
+    {
+        if(megamorphic_)
+            return;
+        // an entry for the same shape went stale because a prototype changed, so it is replaced
+        for(std::uint8_t i = 0; i < num_entries_; ++i)
+        {
+            if(entries_[i].shape == entry.shape)
+            {
+                entries_[i] = entry;
+                return;
+            }
+        }
+        if(num_entries_ == kMaxEntries)
+        {
+            megamorphic_ = true;
+            return;
+        }
+        entries_[num_entries_++] = entry;
+    }
+
+} // namespace mildew
\ No newline at end of file
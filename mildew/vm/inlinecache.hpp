@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+
+#include "../atom.hpp"
+#include "../types/any.hpp"
+#include "../types/object.hpp"
+
+namespace mildew
+{
+    /**
+     * Remembers where a GET_FIELD or SET_FIELD instruction found its field for the last few shapes seen at
+     * that instruction. A read caches the slot of an own field or of a field held by the prototype or the
+     * prototype's prototype. A write caches either the slot of an existing own field or the transition that
+     * adds the field. Cached objects are only compared by address and never dereferenced, so entries do not
+     * keep anything alive and a stale entry simply misses.
+     */
+    class InlineCache
+    {
+    public:
+        static constexpr size_t kMaxEntries = 4;
+        /// the cache slot of a field operand that has no inline cache
+        static constexpr std::uint32_t kNone = 0xFFFF;
+
+        ScriptAny Get(ScriptObject* obj, const Atom key)
+        {
+            const auto kShape = obj->shape();
+            for(std::uint8_t i = 0; i < num_entries_; ++i)
+            {
+                const auto& entry = entries_[i];
+                if(entry.shape != kShape || entry.transition != nullptr)
+                    continue;
+                if(entry.depth == 0)
+                    return obj->Slot(entry.slot);
+                auto holder = obj->prototype();
+                if(holder != entry.prototype || holder->shape() != entry.prototype_shape)
+                    continue;
+                if(entry.depth == 2)
+                {
+                    holder = holder->prototype();
+                    if(holder != entry.holder || holder->shape() != entry.holder_shape)
+                        continue;
+                }
+                return holder->Slot(entry.slot);
+            }
+            return GetMiss(obj, key);
+        }
+
+        void Set(ScriptObject* obj, const Atom key, const ScriptAny& value)
+        {
+            const auto kShape = obj->shape();
+            for(std::uint8_t i = 0; i < num_entries_; ++i)
+            {
+                const auto& entry = entries_[i];
+                if(entry.shape != kShape || entry.depth != 0)
+                    continue;
+                if(entry.transition != nullptr)
+                    obj->AppendField(entry.transition, value);
+                else
+                    obj->Slot(entry.slot) = value;
+                return;
+            }
+            SetMiss(obj, key, value);
+        }
+
+        size_t num_entries() const { return num_entries_; }
+        /// true once more shapes than kMaxEntries were seen, after which the cache stops updating
+        bool megamorphic() const { return megamorphic_; }
+
+    private:
+        struct Entry
+        {
+            Shape* shape;
+            Shape* transition; // set only for a write that adds a field
+            ScriptObject* prototype;
+            Shape* prototype_shape;
+            ScriptObject* holder;
+            Shape* holder_shape;
+            std::uint32_t slot;
+            std::uint8_t depth; // how many prototypes up the field is
+        };
+
+        ScriptAny GetMiss(ScriptObject* obj, const Atom key);
+        void SetMiss(ScriptObject* obj, const Atom key, const ScriptAny& value);
+        void AddEntry(const Entry& entry);
+
+        Entry entries_[kMaxEntries];
+        std::uint8_t num_entries_ = 0;
+        bool megamorphic_ = false;
+    };
+
+} // namespace mildew
\ No newline at end of file
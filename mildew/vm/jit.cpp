@@ -0,0 +1,467 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "jit.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+#if MILDEW_HAS_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "../types/function.hpp"
+#include "consttable.hpp"
+#include "opcodes.hpp"
+#include "virtualmachine.hpp"
+
+namespace mildew
+{
+    // the registers that hold the same values in all of the code of a function
+    static constexpr X64Assembler::Reg kRegisters = X64Assembler::RBX;
+    static constexpr X64Assembler::Reg kVm = X64Assembler::R12;
+    static constexpr X64Assembler::Reg kFrame = X64Assembler::R13;
+    // five pushes after the return address leave the stack aligned for calls
+    static constexpr X64Assembler::Reg kSavedRegisters[] = {
+        X64Assembler::RBX, X64Assembler::R12, X64Assembler::R13, X64Assembler::R14, X64Assembler::R15
+    };
+
+    static bool IsTruthy(const ScriptAny* value)
+    {
+        return value->ToValue<bool>();
+    }
+
+    std::unique_ptr<JitCode> JitCode::Create(const std::vector<std::uint8_t>& code,
+        const std::vector<std::uint32_t>& offsets)
+    {
+#if MILDEW_HAS_JIT
+        const auto kPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const auto kSize = (code.size() + kPageSize - 1) / kPageSize * kPageSize;
+        auto memory = mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(memory == MAP_FAILED)
+            return nullptr;
+        std::memcpy(memory, code.data(), code.size());
+        // the pages are never writable and executable at the same time
+        if(mprotect(memory, kSize, PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(memory, kSize);
+            return nullptr;
+        }
+        return std::unique_ptr<JitCode>(new JitCode(memory, kSize, offsets));
+#else
+        (void)code;
+        (void)offsets;
+        return nullptr;
+#endif
+    }
+
+    JitCode::~JitCode()
+    {
+#if MILDEW_HAS_JIT
+        munmap(memory_, size_);
+#endif
+    }
+
+    std::unique_ptr<JitCode> JitCompiler::Compile(const ScriptFunction& func)
+    {
+        if(!kSupported || func.type() != ScriptFunction::Type::SCRIPT_FUNCTION || func.compiled().empty())
+            return nullptr;
+        return JitCompiler(func).Generate();
+    }
+
+    std::unique_ptr<JitCode> JitCompiler::Generate()
+    {
+        const auto& bytecode = func_.compiled();
+        const auto kNumWords = bytecode.size() / sizeof(std::uint32_t);
+        labels_.resize(kNumWords);
+        std::vector<std::uint32_t> offsets(kNumWords, 0);
+
+        // called as Entry with the virtual machine, frame, registers, and start address in RDI, RSI, RDX, RCX
+        for(const auto reg : kSavedRegisters)
+            masm_.Push(reg);
+        masm_.Mov(kVm, X64Assembler::RDI);
+        masm_.Mov(kFrame, X64Assembler::RSI);
+        masm_.Mov(kRegisters, X64Assembler::RDX);
+        masm_.JmpReg(X64Assembler::RCX);
+
+        for(size_t i = 0; i < kNumWords; i += 1 + ExtraWords(GetOp(FetchInstruction(bytecode.data(), i))))
+        {
+            masm_.Bind(labels_[i]);
+            offsets[i] = static_cast<std::uint32_t>(masm_.size());
+            if(!CompileInstruction(i))
+                return nullptr;
+        }
+        // the compiler ends every function with a return, so the last instruction never falls through
+        for(auto& slow_path : slow_paths_)
+        {
+            masm_.Bind(slow_path.entry);
+            CallRuntime(slow_path.instruction, slow_path.ext, slow_path.next);
+            masm_.TestAl();
+            masm_.Jcc(X64Assembler::EQUAL, throw_exit_);
+            masm_.Jmp(slow_path.resume);
+        }
+        Label epilogue;
+        masm_.Bind(throw_exit_);
+        masm_.MovImm(X64Assembler::RAX, 0);
+        masm_.Jmp(epilogue);
+        masm_.Bind(return_exit_);
+        masm_.MovImm(X64Assembler::RAX, 1);
+        masm_.Bind(epilogue);
+        for(auto reg = std::rbegin(kSavedRegisters); reg != std::rend(kSavedRegisters); ++reg)
+            masm_.Pop(*reg);
+        masm_.Ret();
+
+        // a jump into the middle of an instruction would never be bound
+        for(const auto& label : labels_)
+        {
+            if(label.pending())
+                return nullptr;
+        }
+        return JitCode::Create(masm_.code(), offsets);
+    }
+
+    bool JitCompiler::CompileInstruction(const size_t index)
+    {
+        const auto* code = func_.compiled().data();
+        const auto kInstruction = FetchInstruction(code, index);
+        const auto kOp = GetOp(kInstruction);
+        const auto kNext = index + 1 + ExtraWords(kOp);
+        const auto kExt = ExtraWords(kOp) != 0 ? FetchInstruction(code, index + 1) : 0;
+        switch(kOp)
+        {
+        case OpCode::NOP:
+            break;
+        case OpCode::MOVE:
+            Copy(GetA(kInstruction), GetB(kInstruction));
+            break;
+        case OpCode::LOADK:
+            // the constant table lives as long as the function and so as long as this code
+            StoreConstant(GetA(kInstruction), func_.const_table()->Get(GetBx(kInstruction)));
+            break;
+        case OpCode::LOADI:
+            StoreConstant(GetA(kInstruction), ScriptAny(static_cast<std::int64_t>(GetSBx(kInstruction))));
+            break;
+        case OpCode::LOAD_UNDEFINED:
+            StoreConstant(GetA(kInstruction), ScriptAny());
+            break;
+        case OpCode::LOAD_NULL:
+            StoreConstant(GetA(kInstruction), ScriptAny(nullptr));
+            break;
+        case OpCode::LOAD_BOOL:
+            StoreConstant(GetA(kInstruction), ScriptAny(GetB(kInstruction) != 0));
+            break;
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL:
+            CompileArithmetic(kInstruction, kNext);
+            break;
+        case OpCode::EQUALS:
+        case OpCode::NEQUALS:
+        case OpCode::STRICT_EQUALS:
+        case OpCode::STRICT_NEQUALS:
+        case OpCode::LT:
+        case OpCode::LE:
+        case OpCode::GT:
+        case OpCode::GE:
+            CompileComparison(kInstruction, kNext);
+            break;
+        case OpCode::JMP:
+            CompileJump(index, GetSJ(kInstruction));
+            break;
+        case OpCode::JMP_TRUE:
+        case OpCode::JMP_FALSE:
+            CompileBranch(GetA(kInstruction), kOp == OpCode::JMP_TRUE, index, GetSBx(kInstruction));
+            break;
+        case OpCode::JMP_NOT_NULLISH: {
+            Label nullish;
+            JumpIfType(GetA(kInstruction), ScriptAny::Type::UNDEFINED, true, nullish);
+            JumpIfType(GetA(kInstruction), ScriptAny::Type::NULL_, true, nullish);
+            masm_.Jmp(labels_[index + 1 + GetSBx(kInstruction)]);
+            masm_.Bind(nullish);
+            break;
+        }
+        case OpCode::SWITCH:
+            // the runtime function returns the address of the case
+            CallRuntime(kInstruction, kExt, kNext);
+            masm_.CmpImm(X64Assembler::RAX, 0);
+            masm_.Jcc(X64Assembler::EQUAL, throw_exit_);
+            masm_.JmpReg(X64Assembler::RAX);
+            break;
+        case OpCode::ITER_NEXT:
+            // the runtime function returns 1 when the iteration is done and 2 when it continues
+            CallRuntime(kInstruction, kExt, kNext);
+            masm_.TestAl();
+            masm_.Jcc(X64Assembler::EQUAL, throw_exit_);
+            masm_.CmpImm(X64Assembler::RAX, 1);
+            masm_.Jcc(X64Assembler::EQUAL, labels_[index + 1 + GetSBx(kInstruction)]);
+            break;
+        case OpCode::RETURN:
+        case OpCode::RETURN_UNDEFINED:
+            CallRuntime(kInstruction, kExt, kNext);
+            masm_.Jmp(return_exit_);
+            break;
+        case OpCode::TRY:
+        case OpCode::END_TRY:
+            return false;
+        default:
+            CallRuntime(kInstruction, kExt, kNext);
+            masm_.TestAl();
+            masm_.Jcc(X64Assembler::EQUAL, throw_exit_);
+            break;
+        }
+        return true;
+    }
+
+    void JitCompiler::CompileArithmetic(const std::uint32_t instruction, const size_t next)
+    {
+        auto& slow_path = AddSlowPath(instruction, next);
+        JumpIfType(GetB(instruction), ScriptAny::Type::INTEGER, false, slow_path.entry);
+        JumpIfType(GetC(instruction), ScriptAny::Type::INTEGER, false, slow_path.entry);
+        LoadInteger(X64Assembler::RAX, GetB(instruction));
+        LoadInteger(X64Assembler::RDX, GetC(instruction));
+        switch(GetOp(instruction))
+        {
+        case OpCode::ADD:
+            masm_.Add(X64Assembler::RAX, X64Assembler::RDX);
+            break;
+        case OpCode::SUB:
+            masm_.Sub(X64Assembler::RAX, X64Assembler::RDX);
+            break;
+        default:
+            masm_.Imul(X64Assembler::RAX, X64Assembler::RDX);
+            break;
+        }
+        // the runtime function computes an overflowing result in double precision
+        masm_.Jcc(X64Assembler::OVERFLOWED, slow_path.entry);
+        StoreInteger(GetA(instruction), X64Assembler::RAX, slow_path.entry);
+        masm_.Bind(slow_path.resume);
+    }
+
+    void JitCompiler::CompileComparison(const std::uint32_t instruction, const size_t next)
+    {
+        auto& slow_path = AddSlowPath(instruction, next);
+        JumpIfType(GetB(instruction), ScriptAny::Type::INTEGER, false, slow_path.entry);
+        JumpIfType(GetC(instruction), ScriptAny::Type::INTEGER, false, slow_path.entry);
+        LoadInteger(X64Assembler::RDX, GetB(instruction));
+        LoadInteger(X64Assembler::RCX, GetC(instruction));
+        masm_.Cmp(X64Assembler::RDX, X64Assembler::RCX);
+        switch(GetOp(instruction))
+        {
+        case OpCode::EQUALS:
+        case OpCode::STRICT_EQUALS:
+            masm_.SetAl(X64Assembler::EQUAL);
+            break;
+        case OpCode::NEQUALS:
+        case OpCode::STRICT_NEQUALS:
+            masm_.SetAl(X64Assembler::NOT_EQUAL);
+            break;
+        case OpCode::LT:
+            masm_.SetAl(X64Assembler::LESS);
+            break;
+        case OpCode::LE:
+            masm_.SetAl(X64Assembler::LESS_OR_EQUAL);
+            break;
+        case OpCode::GT:
+            masm_.SetAl(X64Assembler::GREATER);
+            break;
+        default:
+            masm_.SetAl(X64Assembler::GREATER_OR_EQUAL);
+            break;
+        }
+        StoreBoolean(GetA(instruction));
+        masm_.Bind(slow_path.resume);
+    }
+
+    void JitCompiler::CompileBranch(const std::uint8_t reg, const bool jump_if, const size_t index,
+        const std::int32_t offset)
+    {
+        const auto kTaken = jump_if ? X64Assembler::NOT_EQUAL : X64Assembler::EQUAL;
+        Label back_edge;
+        Label not_taken;
+        auto& target = offset < 0 ? back_edge : labels_[index + 1 + offset];
+#if MILDEW_NAN_BOXING
+        masm_.Load(X64Assembler::R10, kRegisters, Offset(reg));
+        masm_.MovImm(X64Assembler::R11, ScriptAny::kTagSpecial | 3);
+        masm_.Cmp(X64Assembler::R10, X64Assembler::R11);
+        masm_.Jcc(X64Assembler::EQUAL, jump_if ? target : not_taken);
+        masm_.MovImm(X64Assembler::R11, ScriptAny::kTagSpecial | 2);
+        masm_.Cmp(X64Assembler::R10, X64Assembler::R11);
+        masm_.Jcc(X64Assembler::EQUAL, jump_if ? not_taken : target);
+#else
+        Label slow;
+        masm_.Cmp32(kRegisters, Offset(reg) + offsetof(ScriptAny, type_),
+            static_cast<std::int32_t>(ScriptAny::Type::BOOLEAN));
+        masm_.Jcc(X64Assembler::NOT_EQUAL, slow);
+        masm_.Cmp8(kRegisters, Offset(reg) + offsetof(ScriptAny, as_boolean_), 0);
+        masm_.Jcc(kTaken, target);
+        masm_.Jmp(not_taken);
+        masm_.Bind(slow);
+#endif
+        masm_.Lea(X64Assembler::RDI, kRegisters, Offset(reg));
+        masm_.Call(reinterpret_cast<const void*>(&IsTruthy));
+        masm_.TestAl();
+        masm_.Jcc(kTaken, target);
+        if(offset < 0)
+        {
+            masm_.Jmp(not_taken);
+            masm_.Bind(back_edge);
+            CompileJump(index, offset);
+        }
+        masm_.Bind(not_taken);
+    }
+
+    void JitCompiler::CompileJump(const size_t index, const std::int32_t offset)
+    {
+        if(offset < 0)
+        {
+            masm_.Mov(X64Assembler::RDI, kVm);
+            masm_.Call(reinterpret_cast<const void*>(&VirtualMachine::JitSafepoint));
+        }
+        masm_.Jmp(labels_[index + 1 + offset]);
+    }
+
+    void JitCompiler::CallRuntime(const std::uint32_t instruction, const std::uint32_t ext, const size_t next)
+    {
+        masm_.Mov(X64Assembler::RDI, kVm);
+        masm_.Mov(X64Assembler::RSI, kFrame);
+        masm_.MovImm(X64Assembler::RDX, instruction);
+        masm_.MovImm(X64Assembler::RCX, ext);
+        masm_.MovImm(X64Assembler::R8, next);
+        masm_.Call(VirtualMachine::JitFunction(GetOp(instruction)));
+    }
+
+    JitCompiler::SlowPath& JitCompiler::AddSlowPath(const std::uint32_t instruction, const size_t next)
+    {
+        slow_paths_.emplace_back();
+        auto& slow_path = slow_paths_.back();
+        slow_path.instruction = instruction;
+        slow_path.ext = 0;
+        slow_path.next = static_cast<std::uint32_t>(next);
+        return slow_path;
+    }
+
+#if MILDEW_NAN_BOXING
+
+    void JitCompiler::Copy(const std::uint8_t dst, const std::uint8_t src)
+    {
+        masm_.Load(X64Assembler::RAX, kRegisters, Offset(src));
+        masm_.Store(kRegisters, Offset(dst), X64Assembler::RAX);
+    }
+
+    void JitCompiler::JumpIfType(const std::uint8_t reg, const ScriptAny::Type type, const bool equal, Label& label)
+    {
+        masm_.Load(X64Assembler::R10, kRegisters, Offset(reg));
+        if(type == ScriptAny::Type::INTEGER)
+        {
+            masm_.Shr(X64Assembler::R10, 48);
+            masm_.CmpImm(X64Assembler::R10, static_cast<std::int32_t>(ScriptAny::kTagInteger >> 48));
+        }
+        else
+        {
+            // undefined and null each have a single representation
+            ScriptAny value;
+            value.SetPrimitive(type);
+            masm_.MovImm(X64Assembler::R11, value.bits_);
+            masm_.Cmp(X64Assembler::R10, X64Assembler::R11);
+        }
+        masm_.Jcc(equal ? X64Assembler::EQUAL : X64Assembler::NOT_EQUAL, label);
+    }
+
+    void JitCompiler::LoadInteger(const Reg dst, const std::uint8_t reg)
+    {
+        masm_.Load(dst, kRegisters, Offset(reg));
+        masm_.Shl(dst, 16);
+        masm_.Sar(dst, 16);
+    }
+
+    void JitCompiler::StoreInteger(const std::uint8_t reg, const Reg src, Label& overflow)
+    {
+        // the value must survive being truncated to the 48-bit payload
+        masm_.Mov(X64Assembler::R10, src);
+        masm_.Shl(X64Assembler::R10, 16);
+        masm_.Sar(X64Assembler::R10, 16);
+        masm_.Cmp(X64Assembler::R10, src);
+        masm_.Jcc(X64Assembler::NOT_EQUAL, overflow);
+        masm_.MovImm(X64Assembler::R11, ScriptAny::kPayloadMask);
+        masm_.And(X64Assembler::R10, X64Assembler::R11);
+        masm_.MovImm(X64Assembler::R11, ScriptAny::kTagInteger);
+        masm_.Or(X64Assembler::R10, X64Assembler::R11);
+        masm_.Store(kRegisters, Offset(reg), X64Assembler::R10);
+    }
+
+    void JitCompiler::StoreBoolean(const std::uint8_t reg)
+    {
+        masm_.MovImm(X64Assembler::R11, ScriptAny::kTagSpecial | 2);
+        masm_.Or(X64Assembler::RAX, X64Assembler::R11);
+        masm_.Store(kRegisters, Offset(reg), X64Assembler::RAX);
+    }
+
+#else
+
+    void JitCompiler::Copy(const std::uint8_t dst, const std::uint8_t src)
+    {
+        for(std::int32_t word = 0; word < static_cast<std::int32_t>(sizeof(ScriptAny)); word += 8)
+        {
+            masm_.Load(X64Assembler::RAX, kRegisters, Offset(src) + word);
+            masm_.Store(kRegisters, Offset(dst) + word, X64Assembler::RAX);
+        }
+    }
+
+    void JitCompiler::JumpIfType(const std::uint8_t reg, const ScriptAny::Type type, const bool equal, Label& label)
+    {
+        masm_.Cmp32(kRegisters, Offset(reg) + offsetof(ScriptAny, type_), static_cast<std::int32_t>(type));
+        masm_.Jcc(equal ? X64Assembler::EQUAL : X64Assembler::NOT_EQUAL, label);
+    }
+
+    void JitCompiler::LoadInteger(const Reg dst, const std::uint8_t reg)
+    {
+        masm_.Load(dst, kRegisters, Offset(reg) + offsetof(ScriptAny, as_integer_));
+    }
+
+    void JitCompiler::StoreInteger(const std::uint8_t reg, const Reg src, Label&)
+    {
+        masm_.Store32(kRegisters, Offset(reg) + offsetof(ScriptAny, type_),
+            static_cast<std::uint32_t>(ScriptAny::Type::INTEGER));
+        masm_.Store(kRegisters, Offset(reg) + offsetof(ScriptAny, as_integer_), src);
+    }
+
+    void JitCompiler::StoreBoolean(const std::uint8_t reg)
+    {
+        masm_.Store32(kRegisters, Offset(reg) + offsetof(ScriptAny, type_),
+            static_cast<std::uint32_t>(ScriptAny::Type::BOOLEAN));
+        masm_.Store(kRegisters, Offset(reg) + offsetof(ScriptAny, as_boolean_), X64Assembler::RAX);
+    }
+
+#endif
+
+    void JitCompiler::StoreConstant(const std::uint8_t reg, const ScriptAny& value)
+    {
+        std::uint64_t words[sizeof(ScriptAny) / sizeof(std::uint64_t)];
+        std::memcpy(words, &value, sizeof(ScriptAny));
+        for(size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+        {
+            masm_.MovImm(X64Assembler::RAX, words[i]);
+            masm_.Store(kRegisters, Offset(reg) + static_cast<std::int32_t>(i * sizeof(std::uint64_t)),
+                X64Assembler::RAX);
+        }
+    }
+
+    std::int32_t JitCompiler::Offset(const std::uint8_t reg)
+    {
+        return static_cast<std::int32_t>(reg * sizeof(ScriptAny));
+    }
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,150 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "../types/any.hpp"
+#include "x64assembler.hpp"
+
+#ifndef MILDEW_JIT
+#define MILDEW_JIT 1
+#endif
+
+#if MILDEW_JIT && defined(__x86_64__) && defined(__linux__)
+#define MILDEW_HAS_JIT 1
+#else
+#define MILDEW_HAS_JIT 0
+#endif
+
+namespace mildew
+{
+    class ScriptFunction;
+
+    /**
+     * The native code of one function, in executable pages of its own. The address where the code of each
+     * bytecode instruction starts is kept, so the code can be entered at the head of a loop as well as at
+     * the start of the function.
+     */
+    class JitCode
+    {
+    public:
+        /// returns false if the code stopped on an exception, which the virtual machine then holds
+        using Entry = bool (*)(void* vm, void* frame, void* registers, const void* start);
+
+        /// nullptr if the pages could not be mapped
+        static std::unique_ptr<JitCode> Create(const std::vector<std::uint8_t>& code,
+            const std::vector<std::uint32_t>& offsets);
+        JitCode(const JitCode&) = delete;
+        ~JitCode();
+        JitCode& operator=(const JitCode&) = delete;
+
+        bool Enter(void* vm, void* frame, void* registers, const size_t instruction) const
+        {
+            return reinterpret_cast<Entry>(memory_)(vm, frame, registers, address(instruction));
+        }
+
+        /// where the code of a bytecode instruction starts
+        const void* address(const size_t instruction) const
+        {
+            return static_cast<const std::uint8_t*>(memory_) + offsets_[instruction];
+        }
+        size_t size() const { return size_; }
+
+    private:
+        JitCode(void* memory, size_t size, const std::vector<std::uint32_t>& offsets)
+        : memory_(memory), size_(size), offsets_(offsets) {}
+
+        void* memory_;
+        size_t size_;
+        std::vector<std::uint32_t> offsets_;
+    };
+
+    /// how often a function was called or looped and its native code, shared by every closure of it
+    struct JitState
+    {
+        std::uint32_t hotness = 0;
+        bool failed = false; // set when the function cannot be compiled, so it is not tried again
+        std::unique_ptr<JitCode> code;
+    };
+
+    /**
+     * The baseline compiler that translates the bytecode of a hot function into x86-64 code, one instruction
+     * at a time and in the same order. Registers stay in the register file of the VirtualMachine, so the
+     * code of an instruction only loads and stores the registers it names and the garbage collector finds
+     * every value where it would while interpreting. Moves, loads of constants, jumps, and integer arithmetic
+     * and comparisons are done inline, and each other instruction or slow path calls a function of the
+     * VirtualMachine that does what the interpreter would. Functions with try blocks are left to the
+     * interpreter, because an exception must unwind through native code to reach the handler.
+     */
+    class JitCompiler
+    {
+    public:
+        static constexpr bool kSupported = MILDEW_HAS_JIT != 0;
+
+        /// nullptr when the function cannot be compiled or the JIT is not supported here
+        static std::unique_ptr<JitCode> Compile(const ScriptFunction& func);
+
+    private:
+        using Reg = X64Assembler::Reg;
+        using Label = X64Assembler::Label;
+
+        /// calls the runtime function of an instruction and resumes after the instruction
+        struct SlowPath
+        {
+            Label entry;
+            Label resume;
+            std::uint32_t instruction;
+            std::uint32_t ext;
+            std::uint32_t next;
+        };
+
+        explicit JitCompiler(const ScriptFunction& func) : func_(func) {}
+
+        std::unique_ptr<JitCode> Generate();
+        bool CompileInstruction(const size_t index);
+        void CompileArithmetic(const std::uint32_t instruction, const size_t next);
+        void CompileComparison(const std::uint32_t instruction, const size_t next);
+        void CompileBranch(const std::uint8_t reg, const bool jump_if, const size_t index, const std::int32_t offset);
+        /// a backward jump is a loop, where the heap may be collected first
+        void CompileJump(const size_t index, const std::int32_t offset);
+        void CallRuntime(const std::uint32_t instruction, const std::uint32_t ext, const size_t next);
+        SlowPath& AddSlowPath(const std::uint32_t instruction, const size_t next);
+
+        // these depend on how ScriptAny is represented
+        void Copy(const std::uint8_t dst, const std::uint8_t src);
+        void StoreConstant(const std::uint8_t reg, const ScriptAny& value);
+        void JumpIfType(const std::uint8_t reg, const ScriptAny::Type type, const bool equal, Label& label);
+        void LoadInteger(const Reg dst, const std::uint8_t reg);
+        /// jumps to overflow if the value cannot be stored as an integer
+        void StoreInteger(const std::uint8_t reg, const Reg src, Label& overflow);
+        /// stores the boolean in RAX, which is 0 or 1
+        void StoreBoolean(const std::uint8_t reg);
+
+        static std::int32_t Offset(const std::uint8_t reg);
+
+        const ScriptFunction& func_;
+        X64Assembler masm_;
+        std::vector<Label> labels_; // where the code of each bytecode instruction starts
+        std::deque<SlowPath> slow_paths_; // emitted after the code of the instructions
+        Label throw_exit_;
+        Label return_exit_;
+    };
+
+} // namespace mildew
\ No newline at end of file
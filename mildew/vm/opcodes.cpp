@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "opcodes.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+#include "../types/function.hpp"
+#include "consttable.hpp"
+
+namespace mildew
+{
+    static const char* const kOpCodeNames[] = {
+        "NOP", "MOVE", "LOADK", "LOADI", "LOAD_UNDEFINED", "LOAD_NULL", "LOAD_BOOL", "LOAD_THIS",
+        "GET_VAR", "SET_VAR", "DECL_VAR", "DECL_LET", "DECL_CONST", "NEW_CELL", "GET_CELL", "SET_CELL",
+        "GET_UPVAL", "SET_UPVAL",
+        "NEW_OBJECT", "NEW_ARRAY", "ARRAY_APPEND", "GET_FIELD", "SET_FIELD", "GET_INDEX", "SET_INDEX",
+        "DELETE", "CLOSURE", "LAMBDA", "INHERIT", "CALL", "NEW", "RETURN", "RETURN_UNDEFINED",
+        "JMP", "JMP_TRUE", "JMP_FALSE", "JMP_NOT_NULLISH", "SWITCH",
+        "ADD", "SUB", "MUL", "DIV", "MOD", "POW", "BIT_AND", "BIT_OR", "BIT_XOR", "BIT_LSHIFT",
+        "BIT_RSHIFT", "BIT_URSHIFT", "EQUALS", "NEQUALS", "STRICT_EQUALS", "STRICT_NEQUALS",
+        "LT", "LE", "GT", "GE", "INSTANCEOF", "NOT", "NEGATE", "TO_NUMBER", "BIT_NOT", "TYPEOF",
+        "CONCAT", "THROW", "TRY", "END_TRY", "ITER_PREP", "ITER_NEXT"
+    };
+
+    static_assert(sizeof(kOpCodeNames) / sizeof(kOpCodeNames[0]) == static_cast<size_t>(OpCode::NUM_OPCODES),
+        "Every opcode needs a name");
+
+    int ExtraWords(const OpCode op)
+    {
+        switch(op)
+        {
+        case OpCode::GET_FIELD:
+        case OpCode::SET_FIELD:
+        case OpCode::TRY:
+            return 1;
+        default:
+            return 0;
+        }
+    }
+
+    const char* OpCodeName(const OpCode op)
+    {
+        if(op >= OpCode::NUM_OPCODES)
+            return "INVALID";
+        return kOpCodeNames[static_cast<size_t>(op)];
+    }
+
+    static void DisassembleInstruction(std::ostream& os, const ScriptFunction& func, const std::uint8_t* code,
+        const size_t index)
+    {
+        const auto kInstruction = FetchInstruction(code, index);
+        const auto kOp = GetOp(kInstruction);
+        const auto& consts = *func.const_table();
+        os << std::setw(5) << index << " [" << std::setw(4) << func.LineOf(index) << "] "
+           << std::left << std::setw(18) << OpCodeName(kOp) << std::right;
+        switch(kOp)
+        {
+        case OpCode::LOADK:
+        case OpCode::GET_VAR:
+        case OpCode::SET_VAR:
+        case OpCode::DECL_VAR:
+        case OpCode::DECL_LET:
+        case OpCode::DECL_CONST:
+        case OpCode::CLOSURE:
+        case OpCode::LAMBDA:
+            os << GetA(kInstruction) << " " << GetBx(kInstruction) << "\t; " << consts.Get(GetBx(kInstruction));
+            break;
+        case OpCode::LOADI:
+            os << GetA(kInstruction) << " " << GetSBx(kInstruction);
+            break;
+        case OpCode::GET_FIELD:
+        case OpCode::SET_FIELD: {
+            const auto kExt = FetchInstruction(code, index + 1);
+            os << GetA(kInstruction) << " " << GetB(kInstruction) << "\t; " << consts.Get(kExt & 0xFFFF);
+            break;
+        }
+        case OpCode::JMP:
+            os << GetSJ(kInstruction) << "\t; to " << index + 1 + GetSJ(kInstruction);
+            break;
+        case OpCode::JMP_TRUE:
+        case OpCode::JMP_FALSE:
+        case OpCode::JMP_NOT_NULLISH:
+        case OpCode::ITER_NEXT:
+            os << GetA(kInstruction) << " " << GetSBx(kInstruction) << "\t; to " 
+               << index + 1 + GetSBx(kInstruction);
+            break;
+        case OpCode::SWITCH: {
+            const auto& table = func.switch_tables()[GetBx(kInstruction)];
+            os << GetA(kInstruction) << " " << GetBx(kInstruction) << "\t;";
+            for(const auto& entry : table.cases())
+                os << " " << consts.Get(entry.constant) << " to " << entry.target << ",";
+            os << " default to " << table.default_target();
+            break;
+        }
+        case OpCode::TRY: {
+            const auto kOffset = static_cast<std::int32_t>(FetchInstruction(code, index + 1));
+            os << GetA(kInstruction) << "\t; catch at " << index + 2 + kOffset;
+            break;
+        }
+        default:
+            os << GetA(kInstruction) << " " << GetB(kInstruction) << " " << GetC(kInstruction);
+            break;
+        }
+        os << "\n";
+    }
+
+    std::string Disassemble(const ScriptFunction& func)
+    {
+        std::ostringstream ss;
+        if(func.type() != ScriptFunction::Type::SCRIPT_FUNCTION || func.const_table() == nullptr)
+            return "<native function " + func.function_name() + ">\n";
+        const auto& bytecode = func.compiled();
+        const auto kNumInstructions = bytecode.size() / sizeof(std::uint32_t);
+        ss << "function " << func.function_name() << " (" << func.arg_names().size() << " args, "
+           << func.num_registers() << " registers, " << func.num_cells() << " cells, "
+           << func.upvalue_infos().size() << " upvalues, " << func.const_table()->size() << " constants)\n";
+        for(size_t i = 0; i < kNumInstructions; i += 1 + ExtraWords(GetOp(FetchInstruction(bytecode.data(), i))))
+            DisassembleInstruction(ss, func, bytecode.data(), i);
+        for(const auto& constant : *func.const_table())
+        {
+            if(auto nested = constant.ToValue<ScriptFunction>())
+                ss << "\n" << Disassemble(*nested);
+        }
+        return ss.str();
+    }
+
+    std::ostream& operator<<(std::ostream& os, const OpCode op)
+    {
+        return os << OpCodeName(op);
+    }
+
+} // namespace mildew
\ No newline at end of file
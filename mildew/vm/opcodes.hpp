@@ -0,0 +1,164 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mildew
+{
+    class ScriptFunction;
+
+    /**
+     * Every instruction is one 32-bit little endian word. The low byte is the opcode and the remaining
+     * 24 bits are operands in one of the following layouts:
+     *   ABC:  A(8) B(8) C(8)
+     *   ABx:  A(8) Bx(16)           Bx is unsigned, sBx is Bx biased by kSBxBias
+     *   sJ:   sJ(24)                signed jump offset relative to the next instruction
+     * Instructions marked "+ext" are followed by one extra word. For field access the low 16 bits of
+     * the extra word are a constant index and the high 16 bits are an inline cache slot of the function.
+     */
+    enum class OpCode : std::uint8_t
+    {
+        NOP,
+        MOVE,           // A B      R[A] = R[B]
+        LOADK,          // A Bx     R[A] = K[Bx]
+        LOADI,          // A sBx    R[A] = sBx
+        LOAD_UNDEFINED, // A        R[A] = undefined
+        LOAD_NULL,      // A        R[A] = null
+        LOAD_BOOL,      // A B      R[A] = B != 0
+        LOAD_THIS,      // A        R[A] = this
+        GET_VAR,        // A Bx     R[A] = variable named K[Bx]
+        SET_VAR,        // A Bx     variable named K[Bx] = R[A]
+        DECL_VAR,       // A Bx     declare var K[Bx] = R[A] in the function scope
+        DECL_LET,       // A Bx     declare let K[Bx] = R[A] in the current scope
+        DECL_CONST,     // A Bx     declare const K[Bx] = R[A] in the current scope
+        NEW_CELL,       // A        cell A = a fresh upvalue holding undefined
+        GET_CELL,       // A B      R[A] = cell B
+        SET_CELL,       // A B      cell B = R[A]
+        GET_UPVAL,      // A B      R[A] = upvalue B of the running closure
+        SET_UPVAL,      // A B      upvalue B of the running closure = R[A]
+        NEW_OBJECT,     // A        R[A] = {}
+        NEW_ARRAY,      // A        R[A] = []
+        ARRAY_APPEND,   // A B C    R[A].push(R[B] ... R[B+C-1])
+        GET_FIELD,      // A B +ext R[A] = R[B][K[ext]]
+        SET_FIELD,      // A B +ext R[A][K[ext]] = R[B]
+        GET_INDEX,      // A B C    R[A] = R[B][R[C]]
+        SET_INDEX,      // A B C    R[A][R[B]] = R[C]
+        DELETE,         // A B      delete R[A][R[B]]
+        CLOSURE,        // A Bx     R[A] = closure of function prototype K[Bx]
+        LAMBDA,         // A Bx     same as CLOSURE but the current this is bound to the closure
+        INHERIT,        // A B      R[A].prototype.__proto__ = R[B].prototype
+        CALL,           // A B      R[A] = R[A](this=R[A+1], R[A+2] ... R[A+1+B])
+        NEW,            // A B      R[A] = new R[A](R[A+2] ... R[A+1+B])
+        RETURN,         // A        return R[A]
+        RETURN_UNDEFINED,
+        JMP,            // sJ
+        JMP_TRUE,       // A sBx    if R[A] then jump
+        JMP_FALSE,      // A sBx    if not R[A] then jump
+        JMP_NOT_NULLISH,// A sBx    if R[A] is neither null nor undefined then jump
+        SWITCH,         // A Bx     jump to the instruction switch table Bx of the function gives for R[A]
+        ADD,            // A B C    R[A] = R[B] op R[C]
+        SUB,
+        MUL,
+        DIV,
+        MOD,
+        POW,
+        BIT_AND,
+        BIT_OR,
+        BIT_XOR,
+        BIT_LSHIFT,
+        BIT_RSHIFT,
+        BIT_URSHIFT,
+        EQUALS,
+        NEQUALS,
+        STRICT_EQUALS,
+        STRICT_NEQUALS,
+        LT,
+        LE,
+        GT,
+        GE,
+        INSTANCEOF,
+        NOT,            // A B      R[A] = op R[B]
+        NEGATE,
+        TO_NUMBER,
+        BIT_NOT,
+        TYPEOF,
+        CONCAT,         // A B C    R[A] = string of R[B] ... R[B+C-1]
+        THROW,          // A        throw R[A]
+        TRY,            // A +ext   push handler, on throw store exception in R[A] and jump by signed ext
+        END_TRY,        //          pop handler
+        ITER_PREP,      // A B C    R[A..A+2] = iteration state over R[B]; C != 0 iterates keys only
+        ITER_NEXT,      // A sBx    if done jump, else R[A+3] = key and R[A+4] = value
+
+        NUM_OPCODES
+    };
+
+    constexpr int kMaxRegisters = 256;
+    constexpr int kMaxCells = 256;
+    constexpr int kMaxUpvalues = 256;
+    constexpr std::uint32_t kMaxBx = 0xFFFF;
+    constexpr std::int32_t kSBxBias = 0x7FFF;
+    constexpr std::int32_t kMaxSJ = 0x7FFFFF;
+
+    constexpr std::uint32_t EncodeABC(const OpCode op, const std::uint32_t a = 0, const std::uint32_t b = 0,
+        const std::uint32_t c = 0)
+    {
+        return static_cast<std::uint32_t>(op) | (a & 0xFF) << 8 | (b & 0xFF) << 16 | (c & 0xFF) << 24;
+    }
+
+    constexpr std::uint32_t EncodeABx(const OpCode op, const std::uint32_t a, const std::uint32_t bx)
+    {
+        return static_cast<std::uint32_t>(op) | (a & 0xFF) << 8 | (bx & 0xFFFF) << 16;
+    }
+
+    constexpr std::uint32_t EncodeAsBx(const OpCode op, const std::uint32_t a, const std::int32_t sbx)
+    {
+        return EncodeABx(op, a, static_cast<std::uint32_t>(sbx + kSBxBias));
+    }
+
+    constexpr std::uint32_t EncodeSJ(const OpCode op, const std::int32_t sj)
+    {
+        return static_cast<std::uint32_t>(op) | (static_cast<std::uint32_t>(sj) & 0xFFFFFF) << 8;
+    }
+
+    constexpr OpCode GetOp(const std::uint32_t i) { return static_cast<OpCode>(i & 0xFF); }
+    constexpr std::uint32_t GetA(const std::uint32_t i) { return (i >> 8) & 0xFF; }
+    constexpr std::uint32_t GetB(const std::uint32_t i) { return (i >> 16) & 0xFF; }
+    constexpr std::uint32_t GetC(const std::uint32_t i) { return i >> 24; }
+    constexpr std::uint32_t GetBx(const std::uint32_t i) { return i >> 16; }
+    constexpr std::int32_t GetSBx(const std::uint32_t i) { return static_cast<std::int32_t>(i >> 16) - kSBxBias; }
+    constexpr std::int32_t GetSJ(const std::uint32_t i) { return static_cast<std::int32_t>(i) >> 8; }
+
+    /// reads the instruction word at the given instruction index of a bytecode buffer
+    inline std::uint32_t FetchInstruction(const std::uint8_t* code, const size_t index)
+    {
+        std::uint32_t word;
+        std::memcpy(&word, code + index * sizeof(std::uint32_t), sizeof(std::uint32_t));
+        return word;
+    }
+
+    /// returns 1 if the opcode is followed by an extension word, 0 otherwise
+    int ExtraWords(const OpCode op);
+    const char* OpCodeName(const OpCode op);
+    std::string Disassemble(const ScriptFunction& func);
+
+    std::ostream& operator<<(std::ostream& os, const OpCode op);
+
+} // namespace mildew
\ No newline at end of file
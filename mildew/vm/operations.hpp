@@ -0,0 +1,242 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "../errors.hpp"
+#include "../heap.hpp"
+#include "../types/any.hpp"
+#include "../types/array.hpp"
+#include "../types/function.hpp"
+#include "../types/object.hpp"
+#include "../types/string.hpp"
+#include "../util/sfmt.hpp"
+
+namespace mildew
+{
+    // the semantics of property access and iteration, shared by VirtualMachine and ClosureRuntime
+
+    [[noreturn]] inline void ThrowRuntimeError(const std::string& message)
+    {
+        throw ScriptRuntimeError(message, ScriptAny(message));
+    }
+
+    inline ScriptObject* ToObject(const ScriptAny& value)
+    {
+        return value.ToValue<ScriptObject>();
+    }
+
+    inline ScriptAny GetField(const ScriptAny& object, const std::string& name)
+    {
+        switch(object.type())
+        {
+        case ScriptAny::Type::UNDEFINED:
+        case ScriptAny::Type::NULL_:
+            ThrowRuntimeError(MakeString("Cannot access property ", name, " of ", object));
+        case ScriptAny::Type::ARRAY:
+            if(name == "length")
+                return ScriptAny(static_cast<std::int64_t>(object.ToValue<ScriptArray>()->array.Length()));
+            return ToObject(object)->LookupField(name);
+        case ScriptAny::Type::STRING:
+            if(name == "length")
+                return ScriptAny(static_cast<std::int64_t>(object.ToValue<ScriptString>()->Length()));
+            return ToObject(object)->LookupField(name);
+        case ScriptAny::Type::OBJECT:
+        case ScriptAny::Type::FUNCTION:
+            return ToObject(object)->LookupField(name);
+        default:
+            return ScriptAny();
+        }
+    }
+
+    inline void SetField(const ScriptAny& object, const std::string& name, const ScriptAny& value)
+    {
+        switch(object.type())
+        {
+        case ScriptAny::Type::UNDEFINED:
+        case ScriptAny::Type::NULL_:
+            ThrowRuntimeError(MakeString("Cannot set property ", name, " of ", object));
+        case ScriptAny::Type::OBJECT:
+        case ScriptAny::Type::ARRAY:
+        case ScriptAny::Type::FUNCTION:
+            ToObject(object)->AssignField(name, value);
+            break;
+        default:
+            // properties of primitive values are discarded
+            break;
+        }
+    }
+
+    inline ScriptAny GetIndex(const ScriptAny& object, const ScriptAny& index)
+    {
+        if(index.type() == ScriptAny::Type::INTEGER)
+        {
+            const auto kIndex = index.ToValue<std::int64_t>();
+            if(object.type() == ScriptAny::Type::ARRAY)
+            {
+                const auto& array = object.ToValue<ScriptArray>()->array;
+                if(kIndex < 0 || static_cast<size_t>(kIndex) >= array.Length())
+                    return ScriptAny();
+                return array.At(kIndex);
+            }
+            else if(object.type() == ScriptAny::Type::STRING)
+            {
+                const auto& str = object.ToValue<ScriptString>()->str();
+                if(kIndex < 0 || static_cast<size_t>(kIndex) >= str.length())
+                    return ScriptAny();
+                return ScriptAny(std::string(1, str[kIndex]));
+            }
+        }
+        return GetField(object, index.ToString());
+    }
+
+    inline void SetIndex(const ScriptAny& object, const ScriptAny& index, const ScriptAny& value)
+    {
+        if(object.type() == ScriptAny::Type::ARRAY && index.type() == ScriptAny::Type::INTEGER)
+        {
+            const auto kIndex = index.ToValue<std::int64_t>();
+            if(kIndex < 0)
+                ThrowRuntimeError(MakeString("Invalid array index ", kIndex));
+            auto& array = object.ToValue<ScriptArray>()->array;
+            while(array.Length() < static_cast<size_t>(kIndex))
+                array.Push(ScriptAny());
+            if(array.Length() == static_cast<size_t>(kIndex))
+                array.Push(value);
+            else
+                array[kIndex] = value;
+            return;
+        }
+        SetField(object, index.ToString(), value);
+    }
+
+    inline void DeleteField(const ScriptAny& object, const ScriptAny& key)
+    {
+        if(object.type() == ScriptAny::Type::ARRAY && key.type() == ScriptAny::Type::INTEGER)
+        {
+            auto& array = object.ToValue<ScriptArray>()->array;
+            const auto kIndex = key.ToValue<std::int64_t>();
+            if(kIndex >= 0 && static_cast<size_t>(kIndex) < array.Length())
+                array[kIndex] = ScriptAny();
+            return;
+        }
+        if(!object.IsObject())
+            ThrowRuntimeError(MakeString("Cannot delete property ", key, " of ", object));
+        ToObject(object)->DeleteField(key.ToString());
+    }
+
+    // iteration state is R[A] = object, R[A+1] = position, R[A+2] = snapshot of object keys
+    inline void PrepareIteration(Heap& heap, ScriptAny* state, const ScriptAny& object)
+    {
+        state[0] = object;
+        state[1] = static_cast<std::int64_t>(0);
+        switch(object.type())
+        {
+        case ScriptAny::Type::ARRAY:
+        case ScriptAny::Type::STRING:
+            state[2] = ScriptAny();
+            break;
+        case ScriptAny::Type::OBJECT:
+        case ScriptAny::Type::FUNCTION: {
+            auto keys = heap.Make<ScriptArray>(std::initializer_list<ScriptAny>());
+            ToObject(object)->ForEachField([keys](const std::string& key, const ScriptAny&) {
+                keys->array.Push(ScriptAny(key));
+            });
+            state[2] = keys;
+            break;
+        }
+        default:
+            ThrowRuntimeError(MakeString("Cannot iterate over ", object));
+        }
+    }
+
+    inline bool NextIteration(ScriptAny* state)
+    {
+        const auto kPosition = state[1].ToValue<std::int64_t>();
+        switch(state[0].type())
+        {
+        case ScriptAny::Type::ARRAY: {
+            const auto& array = state[0].ToValue<ScriptArray>()->array;
+            if(static_cast<size_t>(kPosition) >= array.Length())
+                return false;
+            state[3] = kPosition;
+            state[4] = array.At(kPosition);
+            break;
+        }
+        case ScriptAny::Type::STRING: {
+            const auto& str = state[0].ToValue<ScriptString>()->str();
+            if(static_cast<size_t>(kPosition) >= str.length())
+                return false;
+            state[3] = kPosition;
+            state[4] = ScriptAny(std::string(1, str[kPosition]));
+            break;
+        }
+        default: {
+            const auto& keys = state[2].ToValue<ScriptArray>()->array;
+            if(static_cast<size_t>(kPosition) >= keys.Length())
+                return false;
+            state[3] = keys.At(kPosition);
+            state[4] = ToObject(state[0])->LookupField(keys.At(kPosition).ToString());
+            break;
+        }
+        }
+        state[1] = kPosition + 1;
+        return true;
+    }
+
+    /// sets up the this value of a call, which is a new object for new and the bound value of a lambda
+    inline void PrepareThis(Heap& heap, ScriptFunction* func, ScriptAny& this_value, const bool is_new)
+    {
+        if(is_new)
+        {
+            auto proto = func->LookupField(kAtomPrototype).ToValue<ScriptObject>();
+            this_value = heap.Make<ScriptObject>(func->function_name(), proto);
+        }
+        else if(func->bound_this().type() != ScriptAny::Type::UNDEFINED)
+        {
+            this_value = func->bound_this();
+        }
+        else if(func->is_class() && !this_value.IsObject())
+        {
+            ThrowRuntimeError(MakeString("Class constructor ", func->function_name(), 
+                " cannot be invoked without new"));
+        }
+    }
+
+    /// calls a native function and turns the error it reports into an exception
+    inline ScriptAny CallNative(ScriptFunction* func, Environment& env, ScriptAny& this_value,
+        const std::vector<ScriptAny>& args)
+    {
+        auto nfe = NativeFunctionError::NO_ERROR;
+        auto result = func->native_function()(env, this_value, args, nfe);
+        switch(nfe)
+        {
+        case NativeFunctionError::NO_ERROR:
+            break;
+        case NativeFunctionError::WRONG_NUMBER_OF_ARGS:
+            ThrowRuntimeError(MakeString("Wrong number of arguments to ", func->function_name()));
+        case NativeFunctionError::WRONG_TYPE_OF_ARG:
+            ThrowRuntimeError(MakeString("Wrong type of argument to ", func->function_name()));
+        case NativeFunctionError::RETURN_VALUE_IS_EXCEPTION:
+            throw ScriptRuntimeError(MakeString("Uncaught exception: ", result), result);
+        }
+        return result;
+    }
+
+} // namespace mildew
\ No newline at end of file
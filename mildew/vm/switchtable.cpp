@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "switchtable.hpp"
+
+#include "consttable.hpp"
+
+namespace mildew
+{
+    SwitchTable::SwitchTable(const ConstTable& consts, const std::vector<Case>& cases,
+        const std::uint32_t default_target)
+    : cases_(cases), default_target_(default_target)
+    {
+        std::vector<std::pair<std::int64_t, std::uint32_t>> integers;
+        std::vector<std::pair<std::int64_t, std::uint32_t>> atoms;
+        for(const auto& entry : cases)
+        {
+            const auto& value = consts.Get(entry.constant);
+            switch(value.type())
+            {
+            case ScriptAny::Type::INTEGER:
+                if(IsExact(value.ToValue<std::int64_t>()))
+                    integers.emplace_back(value.ToValue<std::int64_t>(), entry.target);
+                else
+                    others_.emplace_back(value, entry.target);
+                break;
+            case ScriptAny::Type::DOUBLE:
+                if(IsExact(value.ToValue<double>()))
+                    integers.emplace_back(static_cast<std::int64_t>(value.ToValue<double>()), entry.target);
+                else
+                    others_.emplace_back(value, entry.target);
+                break;
+            case ScriptAny::Type::STRING:
+                atoms.emplace_back(static_cast<std::int64_t>(consts.GetAtom(entry.constant)), entry.target);
+                break;
+            default:
+                others_.emplace_back(value, entry.target);
+                break;
+            }
+        }
+        integers_.Build(std::move(integers));
+        atoms_.Build(std::move(atoms));
+    }
+
+    void SwitchTable::KeyTable::Build(std::vector<std::pair<std::int64_t, std::uint32_t>> entries)
+    {
+        // a stable sort keeps the first of several equal keys in front, and that case is the one that matches
+        std::stable_sort(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+        entries.erase(std::unique(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.first == b.first; }), entries.end());
+        if(entries.empty())
+            return;
+        const auto kSpan = static_cast<std::uint64_t>(entries.back().first)
+            - static_cast<std::uint64_t>(entries.front().first) + 1;
+        if(kSpan > 2 * static_cast<std::uint64_t>(entries.size()))
+        {
+            sorted_ = std::move(entries);
+            return;
+        }
+        min_ = entries.front().first;
+        size_ = entries.size();
+        dense_.assign(kSpan, kNotFound);
+        for(const auto& [key, target] : entries)
+            dense_[static_cast<std::uint64_t>(key) - static_cast<std::uint64_t>(min_)] = target;
+    }
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,151 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "../atom.hpp"
+#include "../types/any.hpp"
+#include "../types/string.hpp"
+
+namespace mildew
+{
+    class ConstTable;
+
+    /**
+     * Finds where a SWITCH instruction jumps for a value without comparing it to every case. Integral numbers
+     * are looked up by their value and strings by their atom, each in a table indexed directly by the key
+     * when the keys are close together or searched by binary search when they are not. Any other case value
+     * is compared with strict equality, the same test the cases would otherwise run in order. A string that
+     * was never interned cannot equal a case string, since every case string is interned when it is added to
+     * the constant table.
+     */
+    class SwitchTable
+    {
+    public:
+        /// a case value by its constant index and the instruction its statements start at
+        struct Case
+        {
+            std::uint32_t constant;
+            std::uint32_t target;
+        };
+
+        /// a case equal to an earlier case can never be reached, so it is left out of the lookup
+        SwitchTable(const ConstTable& consts, const std::vector<Case>& cases, std::uint32_t default_target);
+
+        /// the instruction to jump to for the value of a switch
+        std::uint32_t Find(const ScriptAny& value) const
+        {
+            auto target = kNotFound;
+            switch(value.type())
+            {
+            case ScriptAny::Type::INTEGER: {
+                const auto kKey = value.ToValue<std::int64_t>();
+                target = IsExact(kKey) ? integers_.Find(kKey) : FindOther(value);
+                break;
+            }
+            case ScriptAny::Type::DOUBLE: {
+                const auto kValue = value.ToValue<double>();
+                target = IsExact(kValue) ? integers_.Find(static_cast<std::int64_t>(kValue)) : FindOther(value);
+                break;
+            }
+            case ScriptAny::Type::STRING:
+                if(atoms_.size() > 0)
+                {
+                    const auto kAtom = AtomTable::Find(value.ToValue<ScriptString>()->str());
+                    if(kAtom != kNoAtom)
+                        target = atoms_.Find(static_cast<std::int64_t>(kAtom));
+                }
+                break;
+            default:
+                target = FindOther(value);
+                break;
+            }
+            return target != kNotFound ? target : default_target_;
+        }
+
+        /// the cases in the order they were given
+        const std::vector<Case>& cases() const { return cases_; }
+        std::uint32_t default_target() const { return default_target_; }
+        /// true when the integer cases are looked up by index rather than by binary search
+        bool dense() const { return integers_.dense(); }
+
+    private:
+        static constexpr std::uint32_t kNotFound = 0xFFFFFFFF;
+        /// numbers up to this magnitude compare equal exactly when their integer values do
+        static constexpr std::int64_t kMaxExactInteger = std::int64_t(1) << 53;
+
+        /// maps integer keys to targets, directly by index when at least half of the key range is used
+        class KeyTable
+        {
+        public:
+            void Build(std::vector<std::pair<std::int64_t, std::uint32_t>> entries);
+
+            std::uint32_t Find(const std::int64_t key) const
+            {
+                if(!dense_.empty())
+                {
+                    // keys below the minimum wrap around to large indices
+                    const auto kIndex = static_cast<std::uint64_t>(key) - static_cast<std::uint64_t>(min_);
+                    return kIndex < dense_.size() ? dense_[kIndex] : kNotFound;
+                }
+                const auto found = std::lower_bound(sorted_.begin(), sorted_.end(), key,
+                    [](const auto& entry, const std::int64_t k) { return entry.first < k; });
+                return found != sorted_.end() && found->first == key ? found->second : kNotFound;
+            }
+
+            bool dense() const { return !dense_.empty(); }
+            size_t size() const { return dense_.empty() ? sorted_.size() : size_; }
+
+        private:
+            std::int64_t min_ = 0;
+            size_t size_ = 0;
+            std::vector<std::uint32_t> dense_;
+            std::vector<std::pair<std::int64_t, std::uint32_t>> sorted_;
+        };
+
+        static bool IsExact(const std::int64_t value)
+        {
+            return value >= -kMaxExactInteger && value <= kMaxExactInteger;
+        }
+        static bool IsExact(const double value)
+        {
+            return std::trunc(value) == value && value >= -kMaxExactInteger && value <= kMaxExactInteger;
+        }
+
+        std::uint32_t FindOther(const ScriptAny& value) const
+        {
+            for(const auto& [other, target] : others_)
+            {
+                if(value.StrictEquals(other))
+                    return target;
+            }
+            return kNotFound;
+        }
+
+        std::vector<Case> cases_;
+        std::uint32_t default_target_;
+        KeyTable integers_;
+        KeyTable atoms_;
+        // the values are also held by the constant table, which keeps any object among them alive
+        std::vector<std::pair<ScriptAny, std::uint32_t>> others_;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,131 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "typefeedback.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+#include "../types/function.hpp"
+#include "inlinecache.hpp"
+
+namespace mildew
+{
+    std::vector<std::pair<ScriptAny::Type, ScriptAny::Type>> TypeFeedback::Combinations() const
+    {
+        std::vector<std::pair<ScriptAny::Type, ScriptAny::Type>> combinations;
+        for(unsigned bit = 0; bit < kNumTypes * kNumTypes; ++bit)
+        {
+            if(seen_[bit / 64] & (std::uint64_t(1) << (bit % 64)))
+                combinations.emplace_back(static_cast<ScriptAny::Type>(bit / kNumTypes),
+                    static_cast<ScriptAny::Type>(bit % kNumTypes));
+        }
+        return combinations;
+    }
+
+    TypeFeedback::State TypeFeedback::state() const
+    {
+        const auto kNumCombinations = Combinations().size();
+        if(kNumCombinations == 0)
+            return State::UNINITIALIZED;
+        if(kNumCombinations == 1)
+            return State::MONOMORPHIC;
+        if(kNumCombinations <= InlineCache::kMaxEntries)
+            return State::POLYMORPHIC;
+        return State::MEGAMORPHIC;
+    }
+
+    bool HasTypeFeedback(const OpCode op)
+    {
+        switch(op)
+        {
+        case OpCode::GET_FIELD:
+        case OpCode::SET_FIELD:
+        case OpCode::GET_INDEX:
+        case OpCode::SET_INDEX:
+        case OpCode::CALL:
+        case OpCode::NEW:
+            return true;
+        default:
+            // every binary arithmetic, bitwise and comparison operator
+            return op >= OpCode::ADD && op <= OpCode::GE;
+        }
+    }
+
+    static const char* TypeName(const ScriptAny::Type type)
+    {
+        switch(type)
+        {
+        case ScriptAny::Type::UNDEFINED: return "undefined";
+        case ScriptAny::Type::NULL_: return "null";
+        case ScriptAny::Type::BOOLEAN: return "boolean";
+        case ScriptAny::Type::INTEGER: return "integer";
+        case ScriptAny::Type::DOUBLE: return "double";
+        case ScriptAny::Type::OBJECT: return "object";
+        case ScriptAny::Type::ARRAY: return "array";
+        case ScriptAny::Type::FUNCTION: return "function";
+        case ScriptAny::Type::STRING: return "string";
+        }
+        return "?";
+    }
+
+    const char* TypeFeedbackStateName(const TypeFeedback::State state)
+    {
+        switch(state)
+        {
+        case TypeFeedback::State::UNINITIALIZED: return "uninitialized";
+        case TypeFeedback::State::MONOMORPHIC: return "monomorphic";
+        case TypeFeedback::State::POLYMORPHIC: return "polymorphic";
+        case TypeFeedback::State::MEGAMORPHIC: return "megamorphic";
+        }
+        return "?";
+    }
+
+    std::string FormatTypeFeedback(const std::vector<ScriptFunction*>& functions)
+    {
+        std::ostringstream ss;
+        size_t counts[4] = {};
+        for(const auto* func : functions)
+        {
+            const auto& bytecode = func->compiled();
+            const auto& feedback = func->type_feedback();
+            ss << "function " << func->function_name() << "\n";
+            for(size_t i = 0; i < feedback.size(); i += 1 + ExtraWords(GetOp(FetchInstruction(bytecode.data(), i))))
+            {
+                const auto kOp = GetOp(FetchInstruction(bytecode.data(), i));
+                if(!HasTypeFeedback(kOp) || feedback[i].count() == 0)
+                    continue;
+                const auto kState = feedback[i].state();
+                ++counts[static_cast<int>(kState)];
+                ss << std::setw(5) << i << " [" << std::setw(4) << func->LineOf(i) << "] "
+                   << std::left << std::setw(18) << OpCodeName(kOp) << std::right
+                   << std::setw(10) << feedback[i].count() << "  " << std::left << std::setw(13)
+                   << TypeFeedbackStateName(kState) << std::right;
+                const char* separator = "";
+                for(const auto& [first, second] : feedback[i].Combinations())
+                {
+                    ss << separator << TypeName(first) << " " << TypeName(second);
+                    separator = ", ";
+                }
+                ss << "\n";
+            }
+        }
+        ss << counts[static_cast<int>(TypeFeedback::State::MONOMORPHIC)] << " monomorphic, "
+           << counts[static_cast<int>(TypeFeedback::State::POLYMORPHIC)] << " polymorphic, "
+           << counts[static_cast<int>(TypeFeedback::State::MEGAMORPHIC)] << " megamorphic sites\n";
+        return ss.str();
+    }
+
+} // namespace mildew
\ No newline at end of file
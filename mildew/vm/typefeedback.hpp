@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../types/any.hpp"
+#include "opcodes.hpp"
+
+namespace mildew
+{
+    class ScriptFunction;
+
+    /**
+     * Counts how often a profiled instruction ran and which combinations of operand types it saw there.
+     * Arithmetic and comparisons record both operands, GET_FIELD the object and the value read, SET_FIELD the
+     * object and the value stored, GET_INDEX and SET_INDEX the object and the index, and CALL and NEW the
+     * callee and this. A site that saw one combination is monomorphic, one that saw no more combinations than
+     * an inline cache holds shapes is polymorphic, and any other site is megamorphic.
+     */
+    class TypeFeedback
+    {
+    public:
+        enum class State { UNINITIALIZED, MONOMORPHIC, POLYMORPHIC, MEGAMORPHIC };
+
+        static constexpr unsigned kNumTypes = static_cast<unsigned>(ScriptAny::Type::STRING) + 1;
+
+        void Record(const ScriptAny::Type first, const ScriptAny::Type second)
+        {
+            const auto kBit = static_cast<unsigned>(first) * kNumTypes + static_cast<unsigned>(second);
+            seen_[kBit / 64] |= std::uint64_t(1) << (kBit % 64);
+            ++count_;
+        }
+
+        /// every combination seen, ordered by the first type and then the second
+        std::vector<std::pair<ScriptAny::Type, ScriptAny::Type>> Combinations() const;
+        State state() const;
+        std::uint64_t count() const { return count_; }
+
+    private:
+        std::uint64_t count_ = 0;
+        std::uint64_t seen_[(kNumTypes * kNumTypes + 63) / 64] = {};
+    };
+
+    /// true for the instructions that record type feedback while the virtual machine is profiling
+    bool HasTypeFeedback(const OpCode op);
+    /// lists every site of the functions that ran with the types it saw, followed by how many are of each state
+    std::string FormatTypeFeedback(const std::vector<ScriptFunction*>& functions);
+    const char* TypeFeedbackStateName(const TypeFeedback::State state);
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,910 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "virtualmachine.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "../errors.hpp"
+#include "../types/array.hpp"
+#include "../types/object.hpp"
+#include "../types/string.hpp"
+#include "../util/sfmt.hpp"
+#include "opcodes.hpp"
+#include "operations.hpp"
+
+// the handlers shared with the JIT are compiled into every dispatch case as if they were written there
+#if defined(__GNUC__) || defined(__clang__)
+#define MILDEW_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define MILDEW_ALWAYS_INLINE inline
+#endif
+
+namespace mildew
+{
+    VirtualMachine::VirtualMachine(const std::shared_ptr<Environment>& global_env, Heap& heap)
+    : global_env_(global_env), heap_(heap), registers_(kRegisterFileSize), cells_(kCellFileSize)
+    {
+        frames_.reserve(kMaxCallDepth + 1);
+        heap_.AddRoots(this, [this](Heap& h) { TraceRoots(h); });
+    }
+
+    VirtualMachine::~VirtualMachine()
+    {
+        heap_.RemoveRoots(this);
+    }
+
+    ScriptAny VirtualMachine::Call(ScriptFunction* func, const ScriptAny& this_obj, const std::vector<ScriptAny>& args)
+    {
+        Heap::Scope heap_scope(heap_);
+        const auto kTop = StackTop();
+        if(kTop + 2 + args.size() > registers_.size())
+            ThrowRuntimeError("Maximum call stack size exceeded");
+        registers_[kTop] = func;
+        registers_[kTop + 1] = this_obj;
+        for(size_t i = 0; i < args.size(); ++i)
+            registers_[kTop + 2 + i] = args[i];
+        if(!PrepareCall(kTop, args.size(), false))
+            return registers_[kTop];
+        const auto kEntryDepth = frames_.size() - 1;
+        if(dispatch_mode_ == DispatchMode::THREADED)
+            return Execute<true>(kEntryDepth);
+        return Execute<false>(kEntryDepth);
+    }
+
+    ScriptAny VirtualMachine::Run(ScriptFunction* program, const std::shared_ptr<Environment>& env)
+    {
+        Heap::Scope heap_scope(heap_);
+        if(program->type() != ScriptFunction::Type::SCRIPT_FUNCTION)
+            throw std::invalid_argument("VirtualMachine can only run compiled script functions");
+        if(frames_.size() >= kMaxCallDepth)
+            ThrowRuntimeError("Maximum call stack size exceeded");
+        const auto kBase = StackTop();
+        const auto kCellBase = CellTop();
+        if(kBase + program->num_registers() > registers_.size()
+          || kCellBase + program->num_cells() > cells_.size())
+            ThrowRuntimeError("Maximum call stack size exceeded");
+        CallFrame frame;
+        frame.function = program;
+        frame.code = program->compiled().data();
+        frame.consts = program->const_table().get();
+        frame.caches = program->inline_caches();
+        frame.feedback = profiling_ ? Profile(program) : nullptr;
+        frame.base = kBase;
+        frame.cell_base = kCellBase;
+        frame.result_index = kBase;
+        frame.env = env.get();
+        frame.program_env = env;
+        for(size_t i = 0; i < static_cast<size_t>(program->num_registers()); ++i)
+            registers_[kBase + i] = ScriptAny();
+        ClearCells(kCellBase, program->num_cells());
+        frames_.push_back(frame);
+        const auto kEntryDepth = frames_.size() - 1;
+        if(dispatch_mode_ == DispatchMode::THREADED)
+            return Execute<true>(kEntryDepth);
+        return Execute<false>(kEntryDepth);
+    }
+
+    void VirtualMachine::dispatch_mode(const DispatchMode mode)
+    {
+        dispatch_mode_ = kHasThreadedDispatch ? mode : DispatchMode::SWITCH;
+    }
+
+    bool VirtualMachine::CatchException(const ScriptAny& thrown, const size_t entry_depth)
+    {
+        if(handlers_.empty() || handlers_.back().frame_index < entry_depth)
+            return false;
+        auto handler = handlers_.back();
+        handlers_.pop_back();
+        frames_.resize(handler.frame_index + 1);
+        auto& frame = frames_.back();
+        frame.pc = handler.catch_pc;
+        registers_[handler.exception_index] = thrown;
+        return true;
+    }
+
+    template<bool kThreaded>
+    ScriptAny VirtualMachine::Execute(const size_t entry_depth, const bool unwind)
+    {
+        if constexpr(kThreaded && !kHasThreadedDispatch)
+        {
+            return Execute<false>(entry_depth, unwind);
+        }
+        else
+        {
+            for(;;)
+            {
+                try
+                {
+                    return ExecuteUntilThrow<kThreaded>(entry_depth);
+                }
+                catch(const ScriptRuntimeError& error)
+                {
+                    if(CatchException(error.thrown_value(), entry_depth))
+                        continue;
+                    // native code called this invocation, and its caller reports the error
+                    if(!unwind)
+                        throw;
+                    // report where the exception escaped and discard the frames of this invocation
+                    std::string where;
+                    if(frames_.size() > entry_depth)
+                    {
+                        const auto& frame = frames_.back();
+                        where = MakeString(" (", frame.function->function_name(), " line ", 
+                            frame.function->LineOf(frame.pc == 0 ? 0 : frame.pc - 1), ")");
+                    }
+                    frames_.resize(entry_depth);
+                    while(!handlers_.empty() && handlers_.back().frame_index >= entry_depth)
+                        handlers_.pop_back();
+                    throw ScriptRuntimeError(error.what() + where, error.thrown_value());
+                }
+            }
+        }
+    }
+
+    template ScriptAny VirtualMachine::Execute<false>(const size_t, const bool);
+    template ScriptAny VirtualMachine::Execute<true>(const size_t, const bool);
+
+    template<OpCode kOp>
+    MILDEW_ALWAYS_INLINE void VirtualMachine::Operate(VirtualMachine& vm, CallFrame& frame, ScriptAny* const R,
+        const std::uint32_t instruction, const std::uint32_t ext)
+    {
+        const auto* consts = frame.consts;
+        switch(kOp)
+        {
+        case OpCode::MOVE:
+            R[GetA(instruction)] = R[GetB(instruction)];
+            break;
+        case OpCode::LOADK:
+            R[GetA(instruction)] = consts->data()[GetBx(instruction)];
+            break;
+        case OpCode::LOADI:
+            R[GetA(instruction)] = static_cast<std::int64_t>(GetSBx(instruction));
+            break;
+        case OpCode::LOAD_UNDEFINED:
+            R[GetA(instruction)] = ScriptAny();
+            break;
+        case OpCode::LOAD_NULL:
+            R[GetA(instruction)] = nullptr;
+            break;
+        case OpCode::LOAD_BOOL:
+            R[GetA(instruction)] = GetB(instruction) != 0;
+            break;
+        case OpCode::LOAD_THIS:
+            R[GetA(instruction)] = frame.this_value;
+            break;
+        case OpCode::GET_VAR: {
+            auto entry = frame.env->LookupVariable(consts->GetAtom(GetBx(instruction)));
+            if(entry == nullptr)
+                ThrowRuntimeError(MakeString("Undefined variable ", consts->GetString(GetBx(instruction))));
+            R[GetA(instruction)] = entry->value;
+            break;
+        }
+        case OpCode::SET_VAR: {
+            bool failed_const = false;
+            if(frame.env->ReassignVariable(consts->GetAtom(GetBx(instruction)), R[GetA(instruction)],
+              failed_const) == nullptr)
+            {
+                if(failed_const)
+                    ThrowRuntimeError(MakeString("Cannot reassign const ", consts->GetString(GetBx(instruction))));
+                ThrowRuntimeError(MakeString("Cannot assign to undeclared variable ",
+                    consts->GetString(GetBx(instruction))));
+            }
+            break;
+        }
+        case OpCode::DECL_VAR: {
+            const auto kName = consts->GetAtom(GetBx(instruction));
+            if(!frame.env->DeclareVariable(kName, R[GetA(instruction)], false))
+            {
+                bool failed_const = false;
+                frame.env->ReassignVariable(kName, R[GetA(instruction)], failed_const);
+                if(failed_const)
+                    ThrowRuntimeError(MakeString("Cannot redeclare const ", consts->GetString(GetBx(instruction))));
+            }
+            break;
+        }
+        case OpCode::DECL_LET:
+        case OpCode::DECL_CONST:
+            if(!frame.env->DeclareVariable(consts->GetAtom(GetBx(instruction)), R[GetA(instruction)],
+              kOp == OpCode::DECL_CONST))
+                ThrowRuntimeError(MakeString("Cannot redeclare variable ", consts->GetString(GetBx(instruction))));
+            break;
+        case OpCode::NEW_CELL:
+            vm.cells_[frame.cell_base + GetA(instruction)] = std::make_shared<Upvalue>();
+            break;
+        case OpCode::GET_CELL:
+            R[GetA(instruction)] = vm.cells_[frame.cell_base + GetB(instruction)]->value;
+            break;
+        case OpCode::SET_CELL:
+            vm.cells_[frame.cell_base + GetB(instruction)]->value = R[GetA(instruction)];
+            break;
+        case OpCode::GET_UPVAL:
+            R[GetA(instruction)] = frame.function->upvalues()[GetB(instruction)]->value;
+            break;
+        case OpCode::SET_UPVAL:
+            frame.function->upvalues()[GetB(instruction)]->value = R[GetA(instruction)];
+            break;
+        case OpCode::NEW_OBJECT:
+            R[GetA(instruction)] = vm.heap_.Make<ScriptObject>("Object", nullptr);
+            break;
+        case OpCode::NEW_ARRAY:
+            R[GetA(instruction)] = vm.heap_.Make<ScriptArray>(std::initializer_list<ScriptAny>());
+            break;
+        case OpCode::ARRAY_APPEND: {
+            auto& array = R[GetA(instruction)].ToValue<ScriptArray>()->array;
+            for(std::uint32_t i = 0; i < GetC(instruction); ++i)
+                array.Push(R[GetB(instruction) + i]);
+            break;
+        }
+        case OpCode::GET_FIELD: {
+            const auto& object = R[GetB(instruction)];
+            if((object.type() == ScriptAny::Type::OBJECT || object.type() == ScriptAny::Type::FUNCTION)
+              && (ext >> 16) != InlineCache::kNone)
+                R[GetA(instruction)] = frame.caches[ext >> 16].Get(ToObject(object), consts->GetAtom(ext & 0xFFFF));
+            else
+                R[GetA(instruction)] = GetField(object, consts->GetString(ext & 0xFFFF));
+            break;
+        }
+        case OpCode::SET_FIELD: {
+            const auto& object = R[GetA(instruction)];
+            if((object.type() == ScriptAny::Type::OBJECT || object.type() == ScriptAny::Type::FUNCTION)
+              && (ext >> 16) != InlineCache::kNone)
+                frame.caches[ext >> 16].Set(ToObject(object), consts->GetAtom(ext & 0xFFFF), R[GetB(instruction)]);
+            else
+                SetField(object, consts->GetString(ext & 0xFFFF), R[GetB(instruction)]);
+            break;
+        }
+        case OpCode::GET_INDEX:
+            R[GetA(instruction)] = GetIndex(R[GetB(instruction)], R[GetC(instruction)]);
+            break;
+        case OpCode::SET_INDEX:
+            SetIndex(R[GetA(instruction)], R[GetB(instruction)], R[GetC(instruction)]);
+            break;
+        case OpCode::DELETE:
+            DeleteField(R[GetA(instruction)], R[GetB(instruction)]);
+            break;
+        case OpCode::CLOSURE:
+            R[GetA(instruction)] = vm.MakeClosure(frame, consts->data()[GetBx(instruction)].ToValue<ScriptFunction>());
+            break;
+        case OpCode::LAMBDA: {
+            auto lambda = vm.MakeClosure(frame, consts->data()[GetBx(instruction)].ToValue<ScriptFunction>());
+            lambda->Bind(frame.this_value);
+            R[GetA(instruction)] = lambda;
+            break;
+        }
+        case OpCode::INHERIT: {
+            auto ctor = R[GetA(instruction)].ToValue<ScriptFunction>();
+            auto base = R[GetB(instruction)].ToValue<ScriptFunction>();
+            if(base == nullptr)
+                ThrowRuntimeError(MakeString("Class extends value ", R[GetB(instruction)], " is not a class"));
+            ctor->LookupField(kAtomPrototype).ToValue<ScriptObject>()->prototype(
+                base->LookupField(kAtomPrototype).ToValue<ScriptObject>());
+            // static methods are inherited through the constructor's own prototype
+            ctor->prototype(base);
+            break;
+        }
+        case OpCode::ADD:
+            R[GetA(instruction)] = R[GetB(instruction)] + R[GetC(instruction)];
+            break;
+        case OpCode::SUB:
+            R[GetA(instruction)] = R[GetB(instruction)] - R[GetC(instruction)];
+            break;
+        case OpCode::MUL:
+            R[GetA(instruction)] = R[GetB(instruction)] * R[GetC(instruction)];
+            break;
+        case OpCode::DIV:
+            R[GetA(instruction)] = R[GetB(instruction)] / R[GetC(instruction)];
+            break;
+        case OpCode::MOD:
+            R[GetA(instruction)] = R[GetB(instruction)] % R[GetC(instruction)];
+            break;
+        case OpCode::POW:
+            R[GetA(instruction)] = R[GetB(instruction)].Pow(R[GetC(instruction)]);
+            break;
+        case OpCode::BIT_AND:
+            R[GetA(instruction)] = R[GetB(instruction)] & R[GetC(instruction)];
+            break;
+        case OpCode::BIT_OR:
+            R[GetA(instruction)] = R[GetB(instruction)] | R[GetC(instruction)];
+            break;
+        case OpCode::BIT_XOR:
+            R[GetA(instruction)] = R[GetB(instruction)] ^ R[GetC(instruction)];
+            break;
+        case OpCode::BIT_LSHIFT:
+            R[GetA(instruction)] = R[GetB(instruction)] << R[GetC(instruction)];
+            break;
+        case OpCode::BIT_RSHIFT:
+            R[GetA(instruction)] = R[GetB(instruction)] >> R[GetC(instruction)];
+            break;
+        case OpCode::BIT_URSHIFT:
+            R[GetA(instruction)] = R[GetB(instruction)].UnsignedRightShift(R[GetC(instruction)]);
+            break;
+        case OpCode::EQUALS:
+            R[GetA(instruction)] = R[GetB(instruction)] == R[GetC(instruction)];
+            break;
+        case OpCode::NEQUALS:
+            R[GetA(instruction)] = !(R[GetB(instruction)] == R[GetC(instruction)]);
+            break;
+        case OpCode::STRICT_EQUALS:
+            R[GetA(instruction)] = R[GetB(instruction)].StrictEquals(R[GetC(instruction)]);
+            break;
+        case OpCode::STRICT_NEQUALS:
+            R[GetA(instruction)] = !R[GetB(instruction)].StrictEquals(R[GetC(instruction)]);
+            break;
+        case OpCode::LT:
+            R[GetA(instruction)] = R[GetB(instruction)].IsLessThan(R[GetC(instruction)]);
+            break;
+        case OpCode::LE:
+            R[GetA(instruction)] = R[GetB(instruction)].IsLessOrEqual(R[GetC(instruction)]);
+            break;
+        case OpCode::GT:
+            R[GetA(instruction)] = R[GetC(instruction)].IsLessThan(R[GetB(instruction)]);
+            break;
+        case OpCode::GE:
+            R[GetA(instruction)] = R[GetC(instruction)].IsLessOrEqual(R[GetB(instruction)]);
+            break;
+        case OpCode::INSTANCEOF:
+            R[GetA(instruction)] = ScriptFunction::IsInstanceOf(R[GetB(instruction)].ToValue<ScriptObject>(),
+                R[GetC(instruction)].ToValue<ScriptFunction>());
+            break;
+        case OpCode::NOT:
+            R[GetA(instruction)] = !R[GetB(instruction)].ToValue<bool>();
+            break;
+        case OpCode::NEGATE:
+            R[GetA(instruction)] = -R[GetB(instruction)];
+            break;
+        case OpCode::TO_NUMBER:
+            R[GetA(instruction)] = R[GetB(instruction)].ToNumber();
+            break;
+        case OpCode::BIT_NOT:
+            R[GetA(instruction)] = ~R[GetB(instruction)];
+            break;
+        case OpCode::TYPEOF:
+            R[GetA(instruction)] = ScriptAny(std::string(R[GetB(instruction)].TypeOf()));
+            break;
+        case OpCode::CONCAT:
+            R[GetA(instruction)] = ScriptString::Join(R + GetB(instruction), GetC(instruction));
+            break;
+        case OpCode::THROW:
+            throw ScriptRuntimeError(MakeString("Uncaught exception: ", R[GetA(instruction)]), R[GetA(instruction)]);
+        case OpCode::ITER_PREP:
+            PrepareIteration(vm.heap_, R + GetA(instruction), R[GetB(instruction)]);
+            break;
+        default:
+            // jumps, calls, and returns continue differently in the dispatch loop and in native code
+            ThrowRuntimeError(MakeString("Invalid opcode ", static_cast<int>(kOp)));
+        }
+    }
+
+    ScriptAny VirtualMachine::ReturnValue(const CallFrame& frame, const ScriptAny* const R,
+        const std::uint32_t instruction)
+    {
+        ScriptAny result;
+        if(GetOp(instruction) == OpCode::RETURN)
+            result = R[GetA(instruction)];
+        if(frame.is_construct && !result.IsObject())
+            result = frame.this_value;
+        return result;
+    }
+
+    std::uint32_t VirtualMachine::SwitchTarget(const CallFrame& frame, const ScriptAny* const R,
+        const std::uint32_t instruction)
+    {
+        // every case starts after the switch instruction, so this never jumps backwards
+        return frame.function->switch_tables()[GetBx(instruction)].Find(R[GetA(instruction)]);
+    }
+
+// the dispatch loop is written once, kThreaded selects how each handler jumps to the next instruction
+#define VM_CASE(op) case OpCode::op: L_##op:
+#if MILDEW_COMPUTED_GOTO
+#define VM_NEXT() \
+    do \
+    { \
+        if constexpr(kThreaded) \
+        { \
+            instruction = FetchInstruction(code, pc++); \
+            goto *kLabels[static_cast<std::uint8_t>(GetOp(instruction))]; \
+        } \
+        goto dispatch; \
+    } while(false)
+#else
+#define VM_NEXT() goto dispatch
+#endif
+#define VM_LOAD_FRAME() \
+    frame = &frames_.back(); \
+    code = frame->code; \
+    feedback = frame->feedback; \
+    R = registers_.data() + frame->base; \
+    pc = frame->pc
+// handlers that can throw save the program counter first so the error reports the right line
+#define VM_SAVE_PC() frame->pc = pc
+// counts the operand types seen by a profiled instruction, which is at pc - 1 until an extension word is fetched
+#define VM_FEEDBACK(site, first, second) \
+    do \
+    { \
+        if(feedback != nullptr) \
+            feedback[site].Record((first).type(), (second).type()); \
+    } while(false)
+// the handlers shared with JitExecute, for instructions that neither jump nor call
+#define VM_OPERATE(op) \
+    VM_CASE(op) \
+        Operate<OpCode::op>(*this, *frame, R, instruction); \
+        VM_NEXT()
+#define VM_OPERATE_CHECKED(op) \
+    VM_CASE(op) \
+        VM_SAVE_PC(); \
+        Operate<OpCode::op>(*this, *frame, R, instruction); \
+        VM_NEXT()
+#define VM_OPERATE_BINARY(op) \
+    VM_CASE(op) \
+        VM_FEEDBACK(pc - 1, R[GetB(instruction)], R[GetC(instruction)]); \
+        Operate<OpCode::op>(*this, *frame, R, instruction); \
+        VM_NEXT()
+// every live value is in a register or frame here, so the heap can be collected
+#define VM_SAFEPOINT() \
+    do \
+    { \
+        if(heap_.collect_requested()) \
+            heap_.Collect(); \
+    } while(false)
+// a loop that makes its function hot continues in native code from the jump target
+#define VM_ON_STACK_REPLACE() \
+    do \
+    { \
+        if(jit_enabled_ && TierUp(frame->function)) \
+        { \
+            frame->pc = pc; \
+            goto run_compiled; \
+        } \
+    } while(false)
+
+    template<bool kThreaded>
+    ScriptAny VirtualMachine::ExecuteUntilThrow(const size_t entry_depth)
+    {
+#if MILDEW_COMPUTED_GOTO
+        static const void* const kLabels[] = {
+            &&L_NOP, &&L_MOVE, &&L_LOADK, &&L_LOADI, &&L_LOAD_UNDEFINED, &&L_LOAD_NULL, &&L_LOAD_BOOL,
+            &&L_LOAD_THIS, &&L_GET_VAR, &&L_SET_VAR, &&L_DECL_VAR, &&L_DECL_LET, &&L_DECL_CONST,
+            &&L_NEW_CELL, &&L_GET_CELL, &&L_SET_CELL, &&L_GET_UPVAL, &&L_SET_UPVAL, &&L_NEW_OBJECT,
+            &&L_NEW_ARRAY, &&L_ARRAY_APPEND, &&L_GET_FIELD, &&L_SET_FIELD, &&L_GET_INDEX, &&L_SET_INDEX, &&L_DELETE, &&L_CLOSURE, &&L_LAMBDA, &&L_INHERIT,
+            &&L_CALL, &&L_NEW, &&L_RETURN, &&L_RETURN_UNDEFINED, &&L_JMP, &&L_JMP_TRUE, &&L_JMP_FALSE,
+            &&L_JMP_NOT_NULLISH, &&L_SWITCH, &&L_ADD, &&L_SUB, &&L_MUL, &&L_DIV, &&L_MOD, &&L_POW,
+            &&L_BIT_AND, &&L_BIT_OR, &&L_BIT_XOR, &&L_BIT_LSHIFT, &&L_BIT_RSHIFT, &&L_BIT_URSHIFT, &&L_EQUALS,
+            &&L_NEQUALS, &&L_STRICT_EQUALS, &&L_STRICT_NEQUALS, &&L_LT, &&L_LE, &&L_GT, &&L_GE,
+            &&L_INSTANCEOF, &&L_NOT, &&L_NEGATE, &&L_TO_NUMBER, &&L_BIT_NOT, &&L_TYPEOF, &&L_CONCAT,
+            &&L_THROW, &&L_TRY, &&L_END_TRY, &&L_ITER_PREP, &&L_ITER_NEXT
+        };
+        static_assert(sizeof(kLabels) / sizeof(kLabels[0]) == static_cast<size_t>(OpCode::NUM_OPCODES),
+            "Every opcode needs a label");
+#endif
+        CallFrame* frame;
+        const std::uint8_t* code;
+        TypeFeedback* feedback;
+        ScriptAny* R;
+        size_t pc;
+        std::uint32_t instruction;
+        VM_LOAD_FRAME();
+        if(UseJit() && frame->function->jit().code != nullptr)
+            goto run_compiled;
+
+    dispatch:
+        instruction = FetchInstruction(code, pc++);
+        switch(GetOp(instruction))
+        {
+        VM_CASE(NOP)
+            VM_NEXT();
+        VM_OPERATE(MOVE);
+        VM_OPERATE(LOADK);
+        VM_OPERATE(LOADI);
+        VM_OPERATE(LOAD_UNDEFINED);
+        VM_OPERATE(LOAD_NULL);
+        VM_OPERATE(LOAD_BOOL);
+        VM_OPERATE(LOAD_THIS);
+        VM_OPERATE_CHECKED(GET_VAR);
+        VM_OPERATE_CHECKED(SET_VAR);
+        VM_OPERATE_CHECKED(DECL_VAR);
+        VM_OPERATE_CHECKED(DECL_LET);
+        VM_OPERATE_CHECKED(DECL_CONST);
+        VM_OPERATE(NEW_CELL);
+        VM_OPERATE(GET_CELL);
+        VM_OPERATE(SET_CELL);
+        VM_OPERATE(GET_UPVAL);
+        VM_OPERATE(SET_UPVAL);
+        VM_OPERATE(NEW_OBJECT);
+        VM_OPERATE(NEW_ARRAY);
+        VM_OPERATE(ARRAY_APPEND);
+        VM_CASE(GET_FIELD)
+        {
+            const auto kExt = FetchInstruction(code, pc++);
+            VM_SAVE_PC();
+            // the object register may be the destination, so its type is read before the field
+            const auto kType = R[GetB(instruction)].type();
+            Operate<OpCode::GET_FIELD>(*this, *frame, R, instruction, kExt);
+            if(feedback != nullptr)
+                feedback[pc - 2].Record(kType, R[GetA(instruction)].type());
+            VM_NEXT();
+        }
+        VM_CASE(SET_FIELD)
+        {
+            VM_FEEDBACK(pc - 1, R[GetA(instruction)], R[GetB(instruction)]);
+            const auto kExt = FetchInstruction(code, pc++);
+            VM_SAVE_PC();
+            Operate<OpCode::SET_FIELD>(*this, *frame, R, instruction, kExt);
+            VM_NEXT();
+        }
+        VM_CASE(GET_INDEX)
+            VM_FEEDBACK(pc - 1, R[GetB(instruction)], R[GetC(instruction)]);
+            VM_SAVE_PC();
+            Operate<OpCode::GET_INDEX>(*this, *frame, R, instruction);
+            VM_NEXT();
+        VM_CASE(SET_INDEX)
+            VM_FEEDBACK(pc - 1, R[GetA(instruction)], R[GetB(instruction)]);
+            VM_SAVE_PC();
+            Operate<OpCode::SET_INDEX>(*this, *frame, R, instruction);
+            VM_NEXT();
+        VM_OPERATE_CHECKED(DELETE);
+        VM_OPERATE(CLOSURE);
+        VM_OPERATE(LAMBDA);
+        VM_OPERATE_CHECKED(INHERIT);
+        VM_CASE(CALL)
+        VM_CASE(NEW)
+            VM_FEEDBACK(pc - 1, R[GetA(instruction)], R[GetA(instruction) + 1]);
+            VM_SAVE_PC();
+            if(PrepareCall(frame->base + GetA(instruction), GetB(instruction), GetOp(instruction) == OpCode::NEW))
+            {
+                VM_LOAD_FRAME();
+                VM_SAFEPOINT();
+                if(UseJit() && frame->function->jit().code != nullptr)
+                    goto run_compiled;
+            }
+            VM_NEXT();
+        VM_CASE(RETURN)
+        VM_CASE(RETURN_UNDEFINED)
+        {
+            auto result = ReturnValue(*frame, R, instruction);
+            const auto kResultIndex = frame->result_index;
+            frames_.pop_back();
+            if(frames_.size() == entry_depth)
+                return result;
+            registers_[kResultIndex] = result;
+            VM_LOAD_FRAME();
+            VM_NEXT();
+        }
+        VM_CASE(JMP)
+            pc += GetSJ(instruction);
+            if(GetSJ(instruction) < 0)
+            {
+                VM_SAFEPOINT();
+                VM_ON_STACK_REPLACE();
+            }
+            VM_NEXT();
+        VM_CASE(JMP_TRUE)
+            if(R[GetA(instruction)].ToValue<bool>())
+            {
+                pc += GetSBx(instruction);
+                if(GetSBx(instruction) < 0)
+                {
+                    VM_SAFEPOINT();
+                    VM_ON_STACK_REPLACE();
+                }
+            }
+            VM_NEXT();
+        VM_CASE(JMP_FALSE)
+            if(!R[GetA(instruction)].ToValue<bool>())
+                pc += GetSBx(instruction);
+            VM_NEXT();
+        VM_CASE(JMP_NOT_NULLISH)
+        {
+            const auto kType = R[GetA(instruction)].type();
+            if(kType != ScriptAny::Type::UNDEFINED && kType != ScriptAny::Type::NULL_)
+                pc += GetSBx(instruction);
+            VM_NEXT();
+        }
+        VM_CASE(SWITCH)
+            pc = SwitchTarget(*frame, R, instruction);
+            VM_NEXT();
+        VM_OPERATE_BINARY(ADD);
+        VM_OPERATE_BINARY(SUB);
+        VM_OPERATE_BINARY(MUL);
+        VM_OPERATE_BINARY(DIV);
+        VM_OPERATE_BINARY(MOD);
+        VM_OPERATE_BINARY(POW);
+        VM_OPERATE_BINARY(BIT_AND);
+        VM_OPERATE_BINARY(BIT_OR);
+        VM_OPERATE_BINARY(BIT_XOR);
+        VM_OPERATE_BINARY(BIT_LSHIFT);
+        VM_OPERATE_BINARY(BIT_RSHIFT);
+        VM_OPERATE_BINARY(BIT_URSHIFT);
+        VM_OPERATE_BINARY(EQUALS);
+        VM_OPERATE_BINARY(NEQUALS);
+        VM_OPERATE_BINARY(STRICT_EQUALS);
+        VM_OPERATE_BINARY(STRICT_NEQUALS);
+        VM_OPERATE_BINARY(LT);
+        VM_OPERATE_BINARY(LE);
+        VM_OPERATE_BINARY(GT);
+        VM_OPERATE_BINARY(GE);
+        VM_OPERATE(INSTANCEOF);
+        VM_OPERATE(NOT);
+        VM_OPERATE(NEGATE);
+        VM_OPERATE(TO_NUMBER);
+        VM_OPERATE(BIT_NOT);
+        VM_OPERATE(TYPEOF);
+        VM_OPERATE(CONCAT);
+        VM_OPERATE_CHECKED(THROW);
+        VM_CASE(TRY)
+        {
+            const auto kOffset = static_cast<std::int32_t>(FetchInstruction(code, pc++));
+            handlers_.push_back({frames_.size() - 1, pc + kOffset, frame->base + GetA(instruction)});
+            VM_NEXT();
+        }
+        VM_CASE(END_TRY)
+            handlers_.pop_back();
+            VM_NEXT();
+        VM_OPERATE_CHECKED(ITER_PREP);
+        VM_CASE(ITER_NEXT)
+            if(!NextIteration(R + GetA(instruction)))
+                pc += GetSBx(instruction);
+            VM_NEXT();
+        default:
+            VM_SAVE_PC();
+            ThrowRuntimeError(MakeString("Invalid opcode ", static_cast<int>(GetOp(instruction))));
+        }
+
+    run_compiled:
+        {
+            const auto kResultIndex = frame->result_index;
+            auto result = RunCompiled(*frame);
+            if(frames_.size() == entry_depth)
+                return result;
+            registers_[kResultIndex] = result;
+            VM_LOAD_FRAME();
+            VM_NEXT();
+        }
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_LOAD_FRAME
+#undef VM_SAVE_PC
+#undef VM_FEEDBACK
+#undef VM_OPERATE
+#undef VM_OPERATE_CHECKED
+#undef VM_OPERATE_BINARY
+#undef VM_SAFEPOINT
+#undef VM_ON_STACK_REPLACE
+
+    bool VirtualMachine::PrepareCall(const size_t func_index, const size_t num_args, const bool is_new)
+    {
+        auto func = registers_[func_index].ToValue<ScriptFunction>();
+        if(func == nullptr)
+            ThrowRuntimeError(MakeString(registers_[func_index], " is not a function"));
+        auto& this_value = registers_[func_index + 1];
+        PrepareThis(heap_, func, this_value, is_new);
+
+        if(func->type() == ScriptFunction::Type::NATIVE_FUNCTION)
+        {
+            std::vector<ScriptAny> args(registers_.begin() + func_index + 2, 
+                registers_.begin() + func_index + 2 + num_args);
+            auto& env = frames_.empty() ? *global_env_ : *frames_.back().env;
+            auto result = CallNative(func, env, this_value, args);
+            if(is_new && !result.IsObject())
+                result = this_value;
+            registers_[func_index] = result;
+            return false;
+        }
+
+        if(jit_enabled_)
+            TierUp(func);
+        const size_t kBase = func_index + 2;
+        const size_t kNumRegisters = func->num_registers();
+        const size_t kCellBase = CellTop();
+        if(frames_.size() >= kMaxCallDepth || kBase + kNumRegisters > registers_.size()
+          || kCellBase + func->num_cells() > cells_.size())
+            ThrowRuntimeError("Maximum call stack size exceeded");
+        for(size_t i = num_args; i < kNumRegisters; ++i)
+            registers_[kBase + i] = ScriptAny();
+        ClearCells(kCellBase, func->num_cells());
+        CallFrame frame;
+        frame.function = func;
+        frame.code = func->compiled().data();
+        frame.consts = func->const_table().get();
+        frame.caches = func->inline_caches();
+        frame.feedback = profiling_ ? Profile(func) : nullptr;
+        frame.base = kBase;
+        frame.cell_base = kCellBase;
+        frame.result_index = func_index;
+        // captured locals are in cells, so a call only needs the environment holding the global names
+        frame.env = func->closure() ? func->closure().get() : global_env_.get();
+        frame.this_value = this_value;
+        frame.is_construct = is_new;
+        frames_.push_back(std::move(frame));
+        return true;
+    }
+
+    void VirtualMachine::ClearCells(const size_t cell_base, const size_t num_cells)
+    {
+        // the cells left behind by a returned call may hold values the heap has already freed
+        for(size_t i = 0; i < num_cells; ++i)
+            cells_[cell_base + i] = nullptr;
+    }
+
+    size_t VirtualMachine::CellTop() const
+    {
+        if(frames_.empty())
+            return 0;
+        const auto& frame = frames_.back();
+        return frame.cell_base + frame.function->num_cells();
+    }
+
+    ScriptFunction* VirtualMachine::MakeClosure(const CallFrame& frame, const ScriptFunction* prototype)
+    {
+        std::vector<std::shared_ptr<Upvalue>> upvalues;
+        upvalues.reserve(prototype->upvalue_infos().size());
+        for(const auto& info : prototype->upvalue_infos())
+        {
+            upvalues.emplace_back(info.from_cell ? cells_[frame.cell_base + info.index] :
+                frame.function->upvalues()[info.index]);
+        }
+        auto env = frame.program_env;
+        if(env == nullptr)
+            env = frame.function->closure() ? frame.function->closure() : global_env_;
+        return prototype->Copy(env, std::move(upvalues));
+    }
+
+    TypeFeedback* VirtualMachine::Profile(ScriptFunction* func)
+    {
+        auto& feedback = func->type_feedback();
+        if(feedback.empty())
+        {
+            feedback.resize(func->compiled().size() / sizeof(std::uint32_t));
+            profiled_functions_.push_back(func);
+        }
+        return feedback.data();
+    }
+
+    ScriptAny VirtualMachine::RunCompiled(CallFrame& frame)
+    {
+        const auto& code = *frame.function->jit().code;
+        if(!code.Enter(this, &frame, registers_.data() + frame.base, frame.pc))
+            std::rethrow_exception(std::exchange(jit_exception_, nullptr));
+        // the native code leaves the frame in place like an exception does, so the result is read first
+        auto result = registers_[frame.result_index];
+        frames_.pop_back();
+        return result;
+    }
+
+    size_t VirtualMachine::StackTop() const
+    {
+        if(frames_.empty())
+            return 0;
+        const auto& frame = frames_.back();
+        return frame.base + frame.function->num_registers();
+    }
+
+    bool VirtualMachine::TierUp(ScriptFunction* func)
+    {
+        auto& jit = func->jit();
+        if(jit.code != nullptr)
+            return !profiling_;
+        // native code records no type feedback, so nothing is counted or compiled while profiling
+        if(jit.failed || profiling_ || ++jit.hotness < jit_threshold_)
+            return false;
+        jit.code = JitCompiler::Compile(*func);
+        jit.failed = jit.code == nullptr;
+        return !jit.failed;
+    }
+
+    void VirtualMachine::TraceRoots(Heap& heap)
+    {
+        heap.Mark(global_env_.get());
+        // a callee can end below the registers of its caller, which must not be freed while they are left
+        // unmarked because they are marked again once the call returns
+        size_t top = 0;
+        for(const auto& frame : frames_)
+            top = std::max(top, frame.base + frame.function->num_registers());
+        for(size_t i = 0; i < top; ++i)
+            heap.Mark(registers_[i]);
+        const auto kCellTop = CellTop();
+        for(size_t i = 0; i < kCellTop; ++i)
+        {
+            if(cells_[i] != nullptr)
+                heap.Mark(cells_[i]->value);
+        }
+        // the report names the profiled functions after every closure of them may be gone
+        for(auto func : profiled_functions_)
+            heap.Mark(func);
+        for(auto& frame : frames_)
+        {
+            heap.Mark(frame.function);
+            heap.Mark(frame.env);
+            heap.Mark(frame.this_value);
+        }
+    }
+
+    template<OpCode kOp>
+    std::uintptr_t VirtualMachine::JitExecute(VirtualMachine& vm, CallFrame& frame, const std::uint32_t instruction,
+        const std::uint32_t ext, const std::uint32_t next_pc)
+    {
+        // the handlers are those of ExecuteUntilThrow, but the native code takes the jumps
+        frame.pc = next_pc;
+        auto* R = vm.registers_.data() + frame.base;
+        try
+        {
+            switch(kOp)
+            {
+            case OpCode::CALL:
+            case OpCode::NEW: {
+                const auto kFuncIndex = frame.base + GetA(instruction);
+                if(!vm.PrepareCall(kFuncIndex, GetB(instruction), kOp == OpCode::NEW))
+                    break;
+                JitSafepoint(vm);
+                // the callee returns to this native code, so it runs in an invocation of its own
+                auto& callee = vm.frames_.back();
+                ScriptAny result;
+                if(vm.UseJit() && callee.function->jit().code != nullptr)
+                    result = vm.RunCompiled(callee);
+                else if(vm.dispatch_mode_ == DispatchMode::THREADED)
+                    result = vm.Execute<true>(vm.frames_.size() - 1, false);
+                else
+                    result = vm.Execute<false>(vm.frames_.size() - 1, false);
+                vm.registers_[kFuncIndex] = result;
+                break;
+            }
+            case OpCode::RETURN:
+            case OpCode::RETURN_UNDEFINED:
+                vm.registers_[frame.result_index] = ReturnValue(frame, R, instruction);
+                break;
+            case OpCode::SWITCH:
+                return reinterpret_cast<std::uintptr_t>(frame.function->jit().code->address(
+                    SwitchTarget(frame, R, instruction)));
+            case OpCode::ITER_NEXT:
+                // 1 jumps out of the loop and 2 continues it
+                return NextIteration(R + GetA(instruction)) ? 2 : 1;
+            default:
+                Operate<kOp>(vm, frame, R, instruction, ext);
+            }
+        }
+        catch(...)
+        {
+            vm.jit_exception_ = std::current_exception();
+            return 0;
+        }
+        return 1;
+    }
+
+    template<size_t... kOps>
+    const void* const* VirtualMachine::JitFunctions(std::index_sequence<kOps...>)
+    {
+        static const void* const kFunctions[] = {
+            reinterpret_cast<const void*>(&JitExecute<static_cast<OpCode>(kOps)>)...
+        };
+        return kFunctions;
+    }
+
+    const void* VirtualMachine::JitFunction(const OpCode op)
+    {
+        static const auto kFunctions = JitFunctions(
+            std::make_index_sequence<static_cast<size_t>(OpCode::NUM_OPCODES)>());
+        return kFunctions[static_cast<size_t>(op)];
+    }
+
+    void VirtualMachine::JitSafepoint(VirtualMachine& vm)
+    {
+        if(vm.heap_.collect_requested())
+            vm.heap_.Collect();
+    }
+
+} // namespace mildew
\ No newline at end of file
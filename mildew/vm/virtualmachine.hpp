@@ -0,0 +1,172 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../environment.hpp"
+#include "../heap.hpp"
+#include "../types/any.hpp"
+#include "../types/function.hpp"
+#include "consttable.hpp"
+#include "inlinecache.hpp"
+#include "jit.hpp"
+#include "opcodes.hpp"
+#include "typefeedback.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MILDEW_COMPUTED_GOTO 1
+#else
+#define MILDEW_COMPUTED_GOTO 0
+#endif
+
+#ifndef MILDEW_THREADED_DISPATCH
+#define MILDEW_THREADED_DISPATCH 1
+#endif
+
+namespace mildew
+{
+    /**
+     * Executes the bytecode produced by Compiler. The registers of every active call live in one register
+     * file, the cells in one cell file, and the call frames in one frame stack, all allocated when the
+     * VirtualMachine is created, so a loop only allocates when the script itself creates objects or closures.
+     * A local variable captured by a closure is boxed in an Upvalue that the frame keeps in a cell, and calls
+     * that capture nothing allocate nothing. The registers, cells, frames, and global environment are the roots
+     * of the heap, which is collected at backward jumps and function entry once enough has been allocated. A
+     * function that is called or loops often enough is compiled by JitCompiler, and its calls then run as
+     * native code in the same frames and registers, entered at the head of a loop if the function was in one
+     * when it became hot.
+     */
+    class VirtualMachine
+    {
+    public:
+        enum class DispatchMode { SWITCH, THREADED };
+
+        static constexpr size_t kRegisterFileSize = 1 << 16;
+        static constexpr size_t kCellFileSize = 1 << 14;
+        static constexpr size_t kMaxCallDepth = 1024;
+        static constexpr bool kHasThreadedDispatch = MILDEW_COMPUTED_GOTO != 0;
+        static constexpr DispatchMode kDefaultDispatchMode = (kHasThreadedDispatch && MILDEW_THREADED_DISPATCH) ?
+            DispatchMode::THREADED : DispatchMode::SWITCH;
+        static constexpr bool kHasJit = JitCompiler::kSupported;
+        static constexpr std::uint32_t kDefaultJitThreshold = 1000;
+
+        VirtualMachine(const std::shared_ptr<Environment>& global_env, Heap& heap);
+        VirtualMachine(const VirtualMachine&) = delete;
+        ~VirtualMachine();
+        VirtualMachine& operator=(const VirtualMachine&) = delete;
+
+        ScriptAny Call(ScriptFunction* func, const ScriptAny& this_obj, const std::vector<ScriptAny>& args);
+        ScriptAny Run(ScriptFunction* program, const std::shared_ptr<Environment>& env);
+
+        DispatchMode dispatch_mode() const { return dispatch_mode_; }
+        /// selects the dispatch loop at runtime, threaded dispatch falls back to switch if unsupported
+        void dispatch_mode(const DispatchMode mode);
+        bool profiling() const { return profiling_; }
+        /// records type feedback in the functions called from now on, which costs a branch per profiled site
+        void profiling(const bool enabled) { profiling_ = enabled; }
+        /// every function that ran while profiling, once for all closures sharing its feedback
+        const std::vector<ScriptFunction*>& profiled_functions() const { return profiled_functions_; }
+        bool jit_enabled() const { return jit_enabled_; }
+        /// native code is not run while profiling, and the JIT stays disabled if it is unsupported
+        void jit_enabled(const bool enabled) { jit_enabled_ = kHasJit && enabled; }
+        std::uint32_t jit_threshold() const { return jit_threshold_; }
+        /// how many calls and loop iterations make a function hot enough to compile
+        void jit_threshold(const std::uint32_t threshold) { jit_threshold_ = threshold; }
+
+        /// the function native code calls to run an instruction, which returns 0 if it threw
+        static const void* JitFunction(const OpCode op);
+        /// called by native code at backward jumps
+        static void JitSafepoint(VirtualMachine& vm);
+
+    private:
+        struct CallFrame
+        {
+            ScriptFunction* function;
+            const std::uint8_t* code = nullptr;
+            const ConstTable* consts = nullptr;
+            InlineCache* caches = nullptr;
+            TypeFeedback* feedback = nullptr; // only set while profiling
+            size_t pc = 0;
+            size_t base = 0;
+            size_t cell_base = 0;
+            size_t result_index = 0;
+            Environment* env = nullptr; // where global names are looked up
+            std::shared_ptr<Environment> program_env; // only set by Run, kept alive for the closures of a program
+            ScriptAny this_value;
+            bool is_construct = false;
+        };
+
+        struct Handler
+        {
+            size_t frame_index;
+            size_t catch_pc;
+            size_t exception_index;
+        };
+
+        bool CatchException(const ScriptAny& thrown, const size_t entry_depth);
+        size_t CellTop() const;
+        void ClearCells(const size_t cell_base, const size_t num_cells);
+        /// an exception that is not caught in the invocation unwinds its frames unless a caller will
+        template<bool kThreaded>
+        ScriptAny Execute(const size_t entry_depth, const bool unwind = true);
+        template<bool kThreaded>
+        ScriptAny ExecuteUntilThrow(const size_t entry_depth);
+        ScriptFunction* MakeClosure(const CallFrame& frame, const ScriptFunction* prototype);
+        bool PrepareCall(const size_t func_index, const size_t num_args, const bool is_new);
+        TypeFeedback* Profile(ScriptFunction* func);
+        /// runs the native code of the top frame from its pc until it returns, then pops the frame
+        ScriptAny RunCompiled(CallFrame& frame);
+        /// counts a call or loop iteration and returns true if the function has native code to run
+        bool TierUp(ScriptFunction* func);
+        bool UseJit() const { return jit_enabled_ && !profiling_; }
+        size_t StackTop() const;
+        void TraceRoots(Heap& heap);
+
+        /// the effect of an instruction that does not jump or call, shared by the dispatch loop and the JIT
+        template<OpCode kOp>
+        static void Operate(VirtualMachine& vm, CallFrame& frame, ScriptAny* const R, const std::uint32_t instruction,
+            const std::uint32_t ext = 0);
+        /// the value a RETURN or RETURN_UNDEFINED instruction returns from its frame
+        static ScriptAny ReturnValue(const CallFrame& frame, const ScriptAny* const R, const std::uint32_t instruction);
+        static std::uint32_t SwitchTarget(const CallFrame& frame, const ScriptAny* const R,
+            const std::uint32_t instruction);
+        template<OpCode kOp>
+        static std::uintptr_t JitExecute(VirtualMachine& vm, CallFrame& frame, const std::uint32_t instruction,
+            const std::uint32_t ext, const std::uint32_t next_pc);
+        template<size_t... kOps>
+        static const void* const* JitFunctions(std::index_sequence<kOps...>);
+
+        std::shared_ptr<Environment> global_env_;
+        Heap& heap_;
+        std::vector<ScriptAny> registers_;
+        std::vector<std::shared_ptr<Upvalue>> cells_; // the captured locals of every active call
+        std::vector<CallFrame> frames_;
+        std::vector<Handler> handlers_;
+        DispatchMode dispatch_mode_ = kDefaultDispatchMode;
+        bool profiling_ = false;
+        std::vector<ScriptFunction*> profiled_functions_;
+        bool jit_enabled_ = kHasJit;
+        std::uint32_t jit_threshold_ = kDefaultJitThreshold;
+        std::exception_ptr jit_exception_; // thrown by an instruction that native code called
+    };
+
+} // namespace mildew
\ No newline at end of file
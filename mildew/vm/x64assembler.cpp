@@ -0,0 +1,271 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "x64assembler.hpp"
+
+#include <cstring>
+
+namespace mildew
+{
+    void X64Assembler::Bind(Label& label)
+    {
+        label.position_ = static_cast<std::int64_t>(code_.size());
+        for(const auto use : label.uses_)
+        {
+            const auto kOffset = static_cast<std::int32_t>(label.position_ - static_cast<std::int64_t>(use + 4));
+            std::memcpy(code_.data() + use, &kOffset, sizeof(kOffset));
+        }
+        label.uses_.clear();
+    }
+
+    void X64Assembler::Jmp(Label& label)
+    {
+        Emit(0xE9);
+        Use(label);
+    }
+
+    void X64Assembler::Jcc(const Condition condition, Label& label)
+    {
+        Emit(0x0F);
+        Emit(0x80 | condition);
+        Use(label);
+    }
+
+    void X64Assembler::Load(const Reg dst, const Reg base, const std::int32_t disp)
+    {
+        Rex(true, dst, base);
+        Emit(0x8B);
+        Memory(dst, base, disp);
+    }
+
+    void X64Assembler::Store(const Reg base, const std::int32_t disp, const Reg src)
+    {
+        Rex(true, src, base);
+        Emit(0x89);
+        Memory(src, base, disp);
+    }
+
+    void X64Assembler::Store32(const Reg base, const std::int32_t disp, const std::uint32_t imm)
+    {
+        Rex(false, 0, base);
+        Emit(0xC7);
+        Memory(0, base, disp);
+        Emit32(imm);
+    }
+
+    void X64Assembler::Lea(const Reg dst, const Reg base, const std::int32_t disp)
+    {
+        Rex(true, dst, base);
+        Emit(0x8D);
+        Memory(dst, base, disp);
+    }
+
+    void X64Assembler::Mov(const Reg dst, const Reg src)
+    {
+        RegReg(0x89, src, dst);
+    }
+
+    void X64Assembler::MovImm(const Reg dst, const std::uint64_t imm)
+    {
+        if(imm <= 0xFFFFFFFF)
+        {
+            // writing a 32-bit register clears the upper half
+            Rex(false, 0, dst);
+            Emit(0xB8 | (dst & 7));
+            Emit32(static_cast<std::uint32_t>(imm));
+            return;
+        }
+        Rex(true, 0, dst);
+        Emit(0xB8 | (dst & 7));
+        Emit64(imm);
+    }
+
+    void X64Assembler::Add(const Reg dst, const Reg src)
+    {
+        RegReg(0x01, src, dst);
+    }
+
+    void X64Assembler::Sub(const Reg dst, const Reg src)
+    {
+        RegReg(0x29, src, dst);
+    }
+
+    void X64Assembler::Imul(const Reg dst, const Reg src)
+    {
+        Rex(true, dst, src);
+        Emit(0x0F);
+        Emit(0xAF);
+        Emit(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+
+    void X64Assembler::And(const Reg dst, const Reg src)
+    {
+        RegReg(0x21, src, dst);
+    }
+
+    void X64Assembler::Or(const Reg dst, const Reg src)
+    {
+        RegReg(0x09, src, dst);
+    }
+
+    void X64Assembler::Cmp(const Reg a, const Reg b)
+    {
+        RegReg(0x39, b, a);
+    }
+
+    void X64Assembler::CmpImm(const Reg reg, const std::int32_t imm)
+    {
+        Rex(true, 0, reg);
+        Emit(0x81);
+        Emit(0xF8 | (reg & 7));
+        Emit32(static_cast<std::uint32_t>(imm));
+    }
+
+    void X64Assembler::Cmp32(const Reg base, const std::int32_t disp, const std::int32_t imm)
+    {
+        Rex(false, 0, base);
+        Emit(0x81);
+        Memory(7, base, disp);
+        Emit32(static_cast<std::uint32_t>(imm));
+    }
+
+    void X64Assembler::Cmp8(const Reg base, const std::int32_t disp, const std::uint8_t imm)
+    {
+        Rex(false, 0, base);
+        Emit(0x80);
+        Memory(7, base, disp);
+        Emit(imm);
+    }
+
+    void X64Assembler::Shl(const Reg reg, const std::uint8_t count)
+    {
+        ShiftImm(4, reg, count);
+    }
+
+    void X64Assembler::Sar(const Reg reg, const std::uint8_t count)
+    {
+        ShiftImm(7, reg, count);
+    }
+
+    void X64Assembler::Shr(const Reg reg, const std::uint8_t count)
+    {
+        ShiftImm(5, reg, count);
+    }
+
+    void X64Assembler::SetAl(const Condition condition)
+    {
+        // setcc al; movzx eax, al
+        Emit(0x0F);
+        Emit(0x90 | condition);
+        Emit(0xC0);
+        Emit(0x0F);
+        Emit(0xB6);
+        Emit(0xC0);
+    }
+
+    void X64Assembler::TestAl()
+    {
+        Emit(0x84);
+        Emit(0xC0);
+    }
+
+    void X64Assembler::Call(const void* target)
+    {
+        MovImm(RAX, reinterpret_cast<std::uintptr_t>(target));
+        Emit(0xFF);
+        Emit(0xD0);
+    }
+
+    void X64Assembler::JmpReg(const Reg reg)
+    {
+        Rex(false, 0, reg);
+        Emit(0xFF);
+        Emit(0xE0 | (reg & 7));
+    }
+
+    void X64Assembler::Push(const Reg reg)
+    {
+        Rex(false, 0, reg);
+        Emit(0x50 | (reg & 7));
+    }
+
+    void X64Assembler::Pop(const Reg reg)
+    {
+        Rex(false, 0, reg);
+        Emit(0x58 | (reg & 7));
+    }
+
+    void X64Assembler::Ret()
+    {
+        Emit(0xC3);
+    }
+
+    void X64Assembler::Emit32(const std::uint32_t value)
+    {
+        for(int i = 0; i < 4; ++i)
+            Emit(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+
+    void X64Assembler::Emit64(const std::uint64_t value)
+    {
+        for(int i = 0; i < 8; ++i)
+            Emit(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+
+    void X64Assembler::Rex(const bool wide, const std::uint8_t reg, const std::uint8_t base)
+    {
+        const std::uint8_t kRex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+        if(kRex != 0x40)
+            Emit(kRex);
+    }
+
+    void X64Assembler::Memory(const std::uint8_t reg, const Reg base, const std::int32_t disp)
+    {
+        Emit(0x80 | ((reg & 7) << 3) | (base & 7));
+        // RSP and R12 as a base can only be encoded with a SIB byte
+        if((base & 7) == RSP)
+            Emit(0x24);
+        Emit32(static_cast<std::uint32_t>(disp));
+    }
+
+    void X64Assembler::RegReg(const std::uint8_t opcode, const Reg reg, const Reg rm)
+    {
+        Rex(true, reg, rm);
+        Emit(opcode);
+        Emit(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void X64Assembler::ShiftImm(const std::uint8_t extension, const Reg reg, const std::uint8_t count)
+    {
+        Rex(true, 0, reg);
+        Emit(0xC1);
+        Emit(0xC0 | (extension << 3) | (reg & 7));
+        Emit(count);
+    }
+
+    void X64Assembler::Use(Label& label)
+    {
+        if(label.bound())
+        {
+            const auto kOffset = static_cast<std::int32_t>(label.position_
+                - static_cast<std::int64_t>(code_.size() + 4));
+            Emit32(static_cast<std::uint32_t>(kOffset));
+            return;
+        }
+        label.uses_.push_back(code_.size());
+        Emit32(0);
+    }
+
+} // namespace mildew
\ No newline at end of file
@@ -0,0 +1,113 @@
+/*
+Copyright (C) 2021 pillager86.rf.gd
+
+This program is free software: you can redistribute it and/or modify it under 
+the terms of the GNU General Public License as published by the Free Software 
+Foundation, either version 3 of the License, or (at your option) any later 
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with 
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mildew
+{
+    /**
+     * Encodes the few x86-64 instructions the JIT compiler emits into a byte buffer. Memory operands are
+     * always a base register plus a 32-bit displacement. A Label is a position in the buffer that jumps can
+     * refer to before it is bound, and binding it patches every jump already emitted to it.
+     */
+    class X64Assembler
+    {
+    public:
+        enum Reg : std::uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+        enum Condition : std::uint8_t
+        {
+            OVERFLOWED = 0x0, NOT_OVERFLOWED = 0x1, BELOW = 0x2, ABOVE_OR_EQUAL = 0x3, EQUAL = 0x4, NOT_EQUAL = 0x5,
+            BELOW_OR_EQUAL = 0x6, ABOVE = 0x7, LESS = 0xC, GREATER_OR_EQUAL = 0xD, LESS_OR_EQUAL = 0xE,
+            GREATER = 0xF
+        };
+
+        class Label
+        {
+        public:
+            bool bound() const { return position_ >= 0; }
+            /// true while a jump to the label waits for it to be bound
+            bool pending() const { return !uses_.empty(); }
+        private:
+            std::int64_t position_ = -1;
+            std::vector<size_t> uses_; // the rel32 fields that jump here, patched when bound
+            friend class X64Assembler;
+        };
+
+        void Bind(Label& label);
+        void Jmp(Label& label);
+        void Jcc(const Condition condition, Label& label);
+
+        /// mov dst, qword [base + disp]
+        void Load(const Reg dst, const Reg base, const std::int32_t disp);
+        /// mov qword [base + disp], src
+        void Store(const Reg base, const std::int32_t disp, const Reg src);
+        /// mov dword [base + disp], imm
+        void Store32(const Reg base, const std::int32_t disp, const std::uint32_t imm);
+        /// lea dst, [base + disp]
+        void Lea(const Reg dst, const Reg base, const std::int32_t disp);
+        void Mov(const Reg dst, const Reg src);
+        /// uses the shortest encoding that produces the 64-bit value
+        void MovImm(const Reg dst, const std::uint64_t imm);
+
+        void Add(const Reg dst, const Reg src);
+        void Sub(const Reg dst, const Reg src);
+        void Imul(const Reg dst, const Reg src);
+        void And(const Reg dst, const Reg src);
+        void Or(const Reg dst, const Reg src);
+        void Cmp(const Reg a, const Reg b);
+        /// cmp reg, imm sign extended to 64 bits
+        void CmpImm(const Reg reg, const std::int32_t imm);
+        /// cmp dword [base + disp], imm
+        void Cmp32(const Reg base, const std::int32_t disp, const std::int32_t imm);
+        /// cmp byte [base + disp], imm
+        void Cmp8(const Reg base, const std::int32_t disp, const std::uint8_t imm);
+        void Shl(const Reg reg, const std::uint8_t count);
+        void Sar(const Reg reg, const std::uint8_t count);
+        void Shr(const Reg reg, const std::uint8_t count);
+        /// sets the low byte of RAX to the condition and clears the rest of it
+        void SetAl(const Condition condition);
+        void TestAl();
+
+        /// calls an absolute address through RAX, which is clobbered
+        void Call(const void* target);
+        void JmpReg(const Reg reg);
+        void Push(const Reg reg);
+        void Pop(const Reg reg);
+        void Ret();
+
+        size_t size() const { return code_.size(); }
+        const std::vector<std::uint8_t>& code() const { return code_; }
+
+    private:
+        void Emit(const std::uint8_t byte) { code_.push_back(byte); }
+        void Emit32(const std::uint32_t value);
+        void Emit64(const std::uint64_t value);
+        /// a REX prefix is only emitted when it carries a bit
+        void Rex(const bool wide, const std::uint8_t reg, const std::uint8_t base);
+        /// the ModRM, SIB and displacement of [base + disp32] with reg in the reg field
+        void Memory(const std::uint8_t reg, const Reg base, const std::int32_t disp);
+        /// an instruction with two register operands, reg in the reg field and rm in the r/m field
+        void RegReg(const std::uint8_t opcode, const Reg reg, const Reg rm);
+        void ShiftImm(const std::uint8_t extension, const Reg reg, const std::uint8_t count);
+        void Use(Label& label);
+
+        std::vector<std::uint8_t> code_;
+    };
+
+} // namespace mildew
\ No newline at end of file
@@ -13,13 +13,28 @@ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
 You should have received a copy of the GNU General Public License along with 
 this program.  If not, see <https://www.gnu.org/licenses/>.
 */
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include "mildew/errors.hpp"
 #include "mildew/interpreter.hpp"
+#include "mildew/vm/image.hpp"
+#include "mildew/vm/typefeedback.hpp"
+
+static void PrintErrors(const mildew::Interpreter& interpreter)
+{
+    for(const auto& error : interpreter.errors())
+        std::cerr << error << std::endl;
+}
 
 /**
- * Implements a basic REPL that lists tokens of script input
+ * Implements a basic REPL that evaluates script input and prints the result. The input #profile turns
+ * profiling on or off, and #feedback prints the types seen by each operation of the code evaluated while it
+ * was on. Code runs without the JIT while profiling, and every function profiled is kept alive for the
+ * report, so it is off until asked for.
  */
-int main()
+static int RunRepl()
 {
     std::string input;
     mildew::Interpreter interpreter;
@@ -29,6 +44,17 @@ int main()
         std::getline(std::cin, input);
         if(input == "" || input == "#exit")
             break;
+        if(input == "#profile")
+        {
+            interpreter.vm().profiling(!interpreter.vm().profiling());
+            std::cout << "Profiling is " << (interpreter.vm().profiling() ? "on" : "off") << std::endl;
+            continue;
+        }
+        if(input == "#feedback")
+        {
+            std::cout << mildew::FormatTypeFeedback(interpreter.vm().profiled_functions());
+            continue;
+        }
         while(input.length() > 0 && input[input.length() - 1] == '\\')
         {
             input.resize(input.length() - 1);
@@ -37,14 +63,96 @@ int main()
             std::getline(std::cin, line);
             input += '\n' + line;
         }
-        interpreter.Evaluate(input, "<repl>");
-        if(interpreter.HasErrors())
+        try 
         {
-            for(const auto& error : interpreter.errors())
-                std::cerr << error << std::endl;
-            continue;
+            auto result = interpreter.Evaluate(input, "<repl>");
+            if(interpreter.HasErrors())
+            {
+                PrintErrors(interpreter);
+                continue;
+            }
+            std::cout << "The program successfully returned " << result << std::endl;
+        }
+        catch(const mildew::ScriptRuntimeError& runtime_error)
+        {
+            std::cerr << runtime_error.what() << std::endl;
         }
-        std::cout << "Successful parse" << std::endl;
+    }
+    return 0;
+}
+
+static bool ReadFile(const std::string& path, std::string& text)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file)
+    {
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+    return true;
+}
+
+static int Usage()
+{
+    std::cerr << "usage: run                             read and evaluate input\n"
+              << "       run <script>                    run a script file\n"
+              << "       run --profile <script>          run a script file and report the types each site saw\n"
+              << "       run --compile <script> <image>  save a script as a bytecode image without running it\n"
+              << "       run --image <image>             run a bytecode image" << std::endl;
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc == 1)
+        return RunRepl();
+    const std::string kCommand = argv[1];
+    if(!(kCommand == "--compile" && argc == 4) && !(kCommand == "--image" && argc == 3)
+      && !(kCommand == "--profile" && argc == 3) && !(kCommand[0] != '-' && argc == 2))
+        return Usage();
+    mildew::Interpreter interpreter;
+    try
+    {
+        mildew::ScriptFunction* program;
+        if(kCommand == "--image")
+        {
+            program = interpreter.LoadImage(argv[2]);
+        }
+        else
+        {
+            const std::string kPath = kCommand[0] == '-' ? argv[2] : argv[1];
+            std::string source;
+            if(!ReadFile(kPath, source))
+                return 1;
+            program = interpreter.Compile(source, kPath);
+            if(program == nullptr)
+            {
+                PrintErrors(interpreter);
+                return 1;
+            }
+            if(kCommand == "--compile")
+            {
+                mildew::BytecodeImage::Save(*program, argv[3]);
+                return 0;
+            }
+        }
+        interpreter.vm().profiling(kCommand == "--profile");
+        std::cout << interpreter.Run(program) << std::endl;
+        if(kCommand == "--profile")
+            std::cerr << mildew::FormatTypeFeedback(interpreter.vm().profiled_functions());
+    }
+    catch(const mildew::ImageError& image_error)
+    {
+        std::cerr << image_error.what() << std::endl;
+        return 1;
+    }
+    catch(const mildew::ScriptRuntimeError& runtime_error)
+    {
+        std::cerr << runtime_error.what() << std::endl;
+        return 1;
     }
     return 0;
 }
\ No newline at end of file
@@ -1,13 +1,33 @@
 #include <gtest/gtest.h>
+#include <atomic>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <stdexcept>
+#include <thread>
 
 #include <cppd/array.hpp>
+#include <mildew/atom.hpp>
+#include <mildew/compiler.hpp>
+#include <mildew/errors.hpp>
+#include <mildew/heap.hpp>
+#include <mildew/interpreter.hpp>
 #include <mildew/lexer.hpp>
 #include <mildew/nodes.hpp>
+#include <mildew/optimizer.hpp>
+#include <mildew/parser.hpp>
+#include <mildew/scheduler.hpp>
+#include <mildew/scopeanalyzer.hpp>
+#include <mildew/scriptcache.hpp>
 #include <mildew/types/any.hpp>
 #include <mildew/types/array.hpp>
+#include <mildew/types/function.hpp>
 #include <mildew/types/object.hpp>
+#include <mildew/types/string.hpp>
+#include <mildew/visitors.hpp>
+#include <mildew/vm/image.hpp>
+#include <mildew/vm/opcodes.hpp>
+#include <mildew/vm/typefeedback.hpp>
 
 TEST(MainTest, ArrayTest)
 {
@@ -24,6 +44,59 @@ TEST(MainTest, TokenTest)
     EXPECT_EQ(token.type, Token::Type::EQUALS) << token;
 }
 
+TEST(MainTest, Atoms)
+{
+    using namespace mildew;
+    EXPECT_EQ(AtomTable::Name(kAtomPrototype), "prototype");
+    EXPECT_EQ(AtomTable::Find("length"), kAtomLength);
+    EXPECT_EQ(AtomTable::Find("an_identifier_that_was_never_lexed"), kNoAtom);
+    const auto kBefore = AtomTable::stats();
+    Lexer lexer("let first_atom_test = first_atom_test + second_atom_test;");
+    const auto kTokens = lexer.Tokenize();
+    EXPECT_NE(kTokens[1].atom, kNoAtom);
+    EXPECT_EQ(kTokens[1].atom, kTokens[3].atom);
+    EXPECT_NE(kTokens[1].atom, kTokens[5].atom);
+    EXPECT_EQ(kTokens[0].atom, kNoAtom); // keywords are not interned
+    EXPECT_EQ(AtomTable::Name(kTokens[5].atom), "second_atom_test");
+    const auto kAfter = AtomTable::stats();
+    EXPECT_EQ(kAfter.size, kBefore.size + 2);
+    EXPECT_GT(kAfter.hits, kBefore.hits);
+
+    // keys computed at run time are not interned, since the atom table is never trimmed
+    Interpreter interpreter;
+    const auto kBeforeKeys = AtomTable::stats();
+    const auto kResult = interpreter.Evaluate("let last = null; for(let i = 0; i < 2000; ++i) { "
+        "let o = {known: i}; o['req' + i] = i; o['known'] += 1; last = o; } "
+        "`${last.req1999} ${last['req' + 1999]} ${last.known} ${last.req5}`;");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(kResult.ToString(), "1999 1999 2000 undefined");
+    EXPECT_LT(AtomTable::stats().size, kBeforeKeys.size + 10);
+
+    // threads look names up without a lock while others add them, and count their lookups apart
+    const auto kMainLookups = AtomTable::stats().lookups;
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches = 0;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([t, &mismatches] {
+            for(int i = 0; i < 3000; ++i)
+            {
+                const auto kName = "concurrent_atom_" + std::to_string(i * 4 + t);
+                const auto kOther = "concurrent_atom_" + std::to_string(i * 4 + (t + 1) % 4);
+                const auto kAtom = AtomTable::Intern(kName);
+                const auto kFound = AtomTable::Find(kOther);
+                if(AtomTable::Name(kAtom) != kName || AtomTable::Find(kName) != kAtom
+                  || (kFound != kNoAtom && AtomTable::Name(kFound) != kOther))
+                    ++mismatches;
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+    EXPECT_EQ(mismatches, 0);
+    EXPECT_EQ(AtomTable::stats().lookups, kMainLookups);
+}
+
 TEST(MainTest, AnyTest)
 {
     using namespace mildew;
@@ -39,6 +112,69 @@ TEST(MainTest, AnyTest)
     EXPECT_EQ(foo, bar);
 }
 
+TEST(MainTest, AnyRepresentation)
+{
+    using namespace mildew;
+#if MILDEW_NAN_BOXING
+    EXPECT_EQ(sizeof(ScriptAny), sizeof(std::uint64_t));
+#endif
+    ScriptAny big = static_cast<std::int64_t>(1) << 40;
+    EXPECT_EQ(big.ToValue<std::int64_t>(), static_cast<std::int64_t>(1) << 40);
+    ScriptAny negative = -12345;
+    EXPECT_TRUE(negative.type() == ScriptAny::Type::INTEGER);
+    EXPECT_EQ(negative.ToValue<int>(), -12345);
+    ScriptAny nan = std::numeric_limits<double>::quiet_NaN();
+    EXPECT_TRUE(nan.type() == ScriptAny::Type::DOUBLE);
+    ScriptAny null_value = nullptr;
+    EXPECT_TRUE(null_value.type() == ScriptAny::Type::NULL_);
+    EXPECT_FALSE(ScriptAny(false).ToValue<bool>());
+
+    Heap heap;
+    auto obj = heap.Make<ScriptObject>("test_object", nullptr);
+    ScriptAny first = obj;
+    ScriptAny second = first;
+    first = 1;
+    EXPECT_TRUE(second.ToValue<ScriptObject>() == obj);
+    EXPECT_TRUE(second.type() == ScriptAny::Type::OBJECT);
+}
+
+TEST(MainTest, CheckedArithmetic)
+{
+    using namespace mildew;
+    const auto kMax = std::numeric_limits<std::int64_t>::max();
+    const auto kMin = std::numeric_limits<std::int64_t>::min();
+    // integers that overflow become doubles instead of wrapping around
+    auto sum = ScriptAny(kMax) + ScriptAny(1);
+    EXPECT_TRUE(sum.type() == ScriptAny::Type::DOUBLE);
+    EXPECT_EQ(sum.ToValue<double>(), 9223372036854775808.0);
+    EXPECT_TRUE((ScriptAny(kMin) - ScriptAny(1)).ToValue<double>() < 0);
+    const ScriptAny kLarge = static_cast<std::int64_t>(1) << 40;
+    auto product = kLarge * kLarge;
+    EXPECT_TRUE(product.type() == ScriptAny::Type::DOUBLE);
+    EXPECT_EQ(product.ToValue<double>(), 1208925819614629174706176.0);
+    EXPECT_EQ((-ScriptAny(kMin)).ToValue<double>(), 9223372036854775808.0);
+    auto exact = ScriptAny(6) * ScriptAny(7);
+    EXPECT_TRUE(exact.type() == ScriptAny::Type::INTEGER);
+    EXPECT_EQ(exact.ToValue<int>(), 42);
+    EXPECT_TRUE((ScriptAny(7) / ScriptAny(2)).type() == ScriptAny::Type::DOUBLE);
+    EXPECT_EQ((ScriptAny(-7) % ScriptAny(2)).ToValue<int>(), -1);
+
+    // mixed operands take the generic path and agree with the inline one
+    const ScriptAny kNaN = std::numeric_limits<double>::quiet_NaN();
+    EXPECT_TRUE(ScriptAny(1).IsLessThan(ScriptAny(1.5)));
+    EXPECT_TRUE(ScriptAny(2.0).IsLessOrEqual(ScriptAny(2)));
+    EXPECT_FALSE(kNaN.IsLessThan(kNaN) || kNaN.IsLessOrEqual(kNaN) || kNaN.StrictEquals(kNaN));
+    EXPECT_TRUE(ScriptAny(3).StrictEquals(ScriptAny(3.0)));
+    EXPECT_EQ((ScriptAny(0.5) + ScriptAny(2)).ToValue<double>(), 2.5);
+    EXPECT_EQ((ScriptAny(std::string("4")) * ScriptAny(2)).ToValue<int>(), 8);
+
+    Interpreter interpreter;
+    auto result = interpreter.Evaluate("let x = 0.5; let n = 0; for(let i = 0; i < 100; ++i) { x *= 1.5; n += i; }"
+        " let big = 4611686018427387904; `${x > 1e17} ${n} ${big * 4 > big}`;");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(result.ToString(), "true 4950 true");
+}
+
 class TestClass
 {
 public:
@@ -50,12 +186,975 @@ public:
 TEST(MainTest, Objects)
 {
     using namespace mildew;
-    auto my_object = std::make_shared<ScriptObject>("test_object", nullptr, new cppd::Object(new TestClass(100)));
+    Heap heap;
+    auto my_object = heap.Make<ScriptObject>("test_object", nullptr, new cppd::Object(new TestClass(100)));
     ScriptAny foo = my_object;
     auto test_object = foo.ToValue<ScriptObject>();
     EXPECT_EQ(my_object, test_object) << test_object;
-    EXPECT_NE(test_object, std::shared_ptr<ScriptObject>(nullptr)) << test_object;
+    EXPECT_NE(test_object, nullptr) << test_object;
     auto obj = test_object->native_object()->Cast<TestClass>();
     EXPECT_EQ(obj->x, 100);
     EXPECT_EQ(obj->TestMethod(), 42);
+}
+
+static mildew::ScriptFunction* CompileSource(const std::string& source)
+{
+    using namespace mildew;
+    Lexer lexer(source);
+    Arena arena;
+    Parser parser(lexer, arena);
+    auto program = parser.ParseProgram();
+    Compiler compiler;
+    return compiler.Compile(*program);
+}
+
+TEST(MainTest, Compiler)
+{
+    using namespace mildew;
+    auto program = CompileSource(
+        "function add(a, b = 2) { return a + b; }\n"
+        "let total = 0;\n"
+        "for(let i = 0; i < 10; ++i) { if(i % 2 == 0) continue; total += add(i); }\n"
+        "try { throw total; } catch(e) { total = e; } finally { total = -total; }\n"
+        "total;");
+    ASSERT_GT(program->compiled().size(), 0u);
+    EXPECT_EQ(program->compiled().size() % sizeof(std::uint32_t), 0u);
+    const auto kLast = FetchInstruction(program->compiled().data(), program->compiled().size() / 4 - 1);
+    EXPECT_EQ(GetOp(kLast), OpCode::RETURN);
+    const auto kListing = Disassemble(*program);
+    EXPECT_NE(kListing.find("function add"), std::string::npos) << kListing;
+    EXPECT_NE(kListing.find("TRY"), std::string::npos) << kListing;
+    EXPECT_NE(kListing.find("CALL"), std::string::npos) << kListing;
+    EXPECT_EQ(program->LineOf(3), 2u) << kListing;
+
+    EXPECT_THROW(CompileSource("function* gen() { yield 1; }"), UnimplementedError);
+    EXPECT_THROW(CompileSource("break;"), ScriptCompileError);
+}
+
+TEST(MainTest, VirtualMachine)
+{
+    using namespace mildew;
+    const std::string kSource =
+        "class Point { constructor(x, y) { this.x = x; this.y = y; } sum() { return this.x + this.y; } }\n"
+        "function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }\n"
+        "let total = 0;\n"
+        "for(let v of [1, 2, 3]) total += v;\n"
+        "try { throw 10; } catch(e) { total += e; }\n"
+        "total + fib(10) + (new Point(3, 4)).sum();";
+    for(const auto kMode : {VirtualMachine::DispatchMode::SWITCH, VirtualMachine::DispatchMode::THREADED})
+    {
+        Interpreter interpreter;
+        interpreter.vm().dispatch_mode(kMode);
+        auto result = interpreter.Evaluate(kSource);
+        ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+        EXPECT_TRUE(result.type() == ScriptAny::Type::INTEGER);
+        EXPECT_EQ(result.ToValue<int>(), 16 + 55 + 7);
+    }
+
+    Interpreter interpreter;
+    EXPECT_EQ(interpreter.Evaluate("let s = 'a'; s + 1 + 2.5;").ToString(), "a12.5");
+    EXPECT_THROW(interpreter.Evaluate("undefinedVariable;"), ScriptRuntimeError);
+    try
+    {
+        interpreter.Evaluate("throw 'boom';");
+        FAIL() << "uncaught script exception did not propagate";
+    }
+    catch(const ScriptRuntimeError& error)
+    {
+        EXPECT_EQ(error.thrown_value().ToString(), "boom");
+    }
+}
+
+TEST(MainTest, GarbageCollector)
+{
+    using namespace mildew;
+    Interpreter interpreter;
+    auto& heap = interpreter.heap();
+    heap.min_threshold(16 * 1024);
+    interpreter.Evaluate(R"(
+        var keep = {a: [1, 2, 3]};
+        function make() { return function() {}; }
+        for(let i = 0; i < 2000; ++i) 
+        {
+            make();
+            let o = {self: null};
+            o.self = o;
+        }
+    )");
+    EXPECT_FALSE(interpreter.HasErrors());
+    EXPECT_GT(heap.stats().num_collections, 0u);
+    heap.Collect();
+    // function prototypes and self referencing objects from the loop are cycles
+    EXPECT_GT(heap.stats().total_freed, 4000u);
+    EXPECT_LT(heap.stats().num_objects, 100u);
+    EXPECT_GE(heap.stats().max_pause, heap.stats().last_pause);
+    auto result = interpreter.Evaluate("keep.a[2] + keep.a.length");
+    EXPECT_EQ(result.ToValue<int>(), 6);
+    result = interpreter.Evaluate("typeof make.prototype.constructor()");
+    EXPECT_EQ(result.ToString(), "function");
+
+    // interpreters destroyed in the order they were created must not leave a freed heap current
+    auto first = std::make_unique<Interpreter>();
+    auto second = std::make_unique<Interpreter>();
+    const auto kFirstHeap = &first->heap();
+    {
+        Heap::Scope heap_scope(first->heap());
+        EXPECT_EQ(&Heap::Current(), kFirstHeap);
+    }
+    first.reset();
+    second.reset();
+    EXPECT_NE(&Heap::Current(), kFirstHeap);
+    EXPECT_EQ(ScriptAny(std::string("after")).ToString(), "after");
+}
+
+TEST(MainTest, Shapes)
+{
+    using namespace mildew;
+    Interpreter interpreter;
+    auto a = interpreter.Evaluate("var a = {x: 1, y: 2}; a;").ToValue<ScriptObject>();
+    auto b = interpreter.Evaluate("var b = {x: 3}; b.y = 4; b;").ToValue<ScriptObject>();
+    auto c = interpreter.Evaluate("var c = {y: 5, x: 6}; c;").ToValue<ScriptObject>();
+    EXPECT_NE(a->shape(), nullptr);
+    EXPECT_EQ(a->shape(), b->shape());
+    EXPECT_NE(a->shape(), c->shape());
+    EXPECT_EQ(interpreter.Evaluate("let k = ''; for(let key in c) k += key; k;").ToString(), "yx");
+
+    auto big = interpreter.Evaluate(R"(
+        var big = {};
+        for(let i = 0; i < 100; ++i) big["f" + i] = i;
+        big;
+    )").ToValue<ScriptObject>();
+    EXPECT_EQ(big->shape(), nullptr);
+    EXPECT_EQ(big->num_fields(), 100u);
+    EXPECT_EQ(interpreter.Evaluate("big.f99 + big.f3").ToValue<int>(), 102);
+
+    EXPECT_EQ(interpreter.Evaluate("delete a.x; a.y;").ToValue<int>(), 2);
+    EXPECT_EQ(a->shape(), nullptr);
+    EXPECT_TRUE(interpreter.Evaluate("a.x").type() == ScriptAny::Type::UNDEFINED);
+    EXPECT_FALSE(interpreter.HasErrors());
+}
+
+TEST(MainTest, InlineCaches)
+{
+    using namespace mildew;
+    Interpreter interpreter;
+    auto get = interpreter.Evaluate(R"(
+        function get(o) { return o.x; }
+        class Base { constructor() { this.y = 1; } m() { return "base"; } }
+        class Derived extends Base { constructor() { super(); } }
+        var d = new Derived();
+        var result = get({x: 1}) + get({x: 2}) + get({a: 0, x: 3});
+        get;
+    )").ToValue<ScriptFunction>();
+    EXPECT_EQ(interpreter.Evaluate("result").ToValue<int>(), 6);
+    EXPECT_EQ(get->inline_caches()[0].num_entries(), 2u);
+    EXPECT_FALSE(get->inline_caches()[0].megamorphic());
+
+    // shapes beyond the cache size make the site megamorphic without changing the results
+    EXPECT_EQ(interpreter.Evaluate(R"(
+        get({b: 0, x: 4}) + get({c: 0, x: 5}) + get({d: 0, x: 6}) + get({x: 1});
+    )").ToValue<int>(), 16);
+    EXPECT_TRUE(get->inline_caches()[0].megamorphic());
+
+    // inherited methods are found through the prototype chain and follow changes to it
+    auto call_m = interpreter.Evaluate("function callM(o) { return o.m(); } callM(d); callM;")
+        .ToValue<ScriptFunction>();
+    EXPECT_EQ(call_m->inline_caches()[0].num_entries(), 1u);
+    EXPECT_EQ(interpreter.Evaluate(R"(
+        Base.prototype.m = function() { return "changed"; };
+        callM(d);
+    )").ToString(), "changed");
+    EXPECT_EQ(interpreter.Evaluate(R"(
+        Derived.prototype.m = function() { return "derived"; };
+        callM(d);
+    )").ToString(), "derived");
+    EXPECT_EQ(interpreter.Evaluate("d.m = function() { return 'own'; }; callM(d);").ToString(), "own");
+
+    // a cached write that adds a field leaves objects with the same shape as an uncached one
+    auto objects = interpreter.Evaluate(R"(
+        function make(v) { let o = {}; o.p = v; o.q = v; return o; }
+        var objects = [make(1), make(2)];
+        objects;
+    )").ToValue<ScriptArray>();
+    EXPECT_EQ(objects->array[0].ToValue<ScriptObject>()->shape(), objects->array[1].ToValue<ScriptObject>()->shape());
+    EXPECT_EQ(interpreter.Evaluate("objects[1].q + objects[0].p").ToValue<int>(), 3);
+    EXPECT_FALSE(interpreter.HasErrors());
+}
+
+TEST(MainTest, ScopeResolution)
+{
+    using namespace mildew;
+    Lexer lexer("function f(a) { let b = a; var c = 2; return () => c + b; }");
+    Arena arena;
+    Parser parser(lexer, arena);
+    auto tree = parser.ParseProgram();
+    ScopeAnalyzer analyzer;
+    analyzer.Analyze(*tree);
+    auto scope = analyzer.Find(tree->statement_nodes[0]);
+    ASSERT_NE(scope, nullptr);
+    ASSERT_EQ(scope->variables.size(), 3u);
+    EXPECT_EQ(scope->variables[0].name, "a");
+    EXPECT_FALSE(scope->variables[0].is_captured);
+    EXPECT_EQ(scope->variables[1].name, "c");
+    EXPECT_TRUE(scope->variables[1].is_captured);
+    EXPECT_TRUE(scope->variables[2].is_captured);
+    EXPECT_TRUE(scope->HasCaptures());
+
+    // locals that are not captured live in registers and need no cells
+    const auto kListing = Disassemble(*CompileSource(
+        "function sum(n) { let s = 0; for(let i = 0; i < n; ++i) { let sq = i * i; s += sq; } return s; }"));
+    EXPECT_EQ(kListing.find("GET_VAR"), std::string::npos) << kListing;
+    EXPECT_EQ(kListing.find("NEW_CELL"), std::string::npos) << kListing;
+    const auto kClosureListing = Disassemble(*CompileSource("function g() { let x = 1; return () => x; }"));
+    EXPECT_NE(kClosureListing.find("NEW_CELL"), std::string::npos) << kClosureListing;
+    EXPECT_NE(kClosureListing.find("GET_UPVAL"), std::string::npos) << kClosureListing;
+    EXPECT_THROW(CompileSource("function h() { const k = 1; k = 2; }"), ScriptCompileError);
+    EXPECT_THROW(CompileSource("function h() { let k = 1; let k = 2; }"), ScriptCompileError);
+
+    Interpreter interpreter;
+    auto result = interpreter.Evaluate(R"(
+        function make() { let n = 0; return {inc: () => ++n, get: function() { return n; }}; }
+        function collect() { let fs = []; for(let v of [1, 2, 3]) fs[v - 1] = () => v * 10; return fs; }
+        function shadow(x) { let y = x; { let y = 100; x += y; } try { let x = -1; return y; } finally { y = x; } }
+        let counter = make();
+        counter.inc(); counter.inc();
+        let fs = collect();
+        counter.get() + fs[0]() + fs[2]() + shadow(1);
+    )");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(result.ToValue<int>(), 2 + 10 + 30 + 1);
+}
+
+TEST(MainTest, Upvalues)
+{
+    using namespace mildew;
+    Interpreter interpreter;
+    auto result = interpreter.Evaluate(R"(
+        function outer() {
+            let a = 1;
+            function middle() { return function inner() { a += 10; return a; }; }
+            return [middle(), () => a];
+        }
+        let first = outer(), second = outer();
+        first[0](); first[0]();
+        second[0]();
+        first[1]() * 100 + second[1]();
+    )");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    // each call of outer boxes its own a, shared by the closures created during that call
+    EXPECT_EQ(result.ToValue<int>(), 21 * 100 + 11);
+    result = interpreter.Evaluate(R"(
+        function loops() {
+            let fs = [];
+            for(let i = 0; i < 3; ++i) fs[i] = () => i;
+            return fs[0]() + fs[1]() * 10 + fs[2]() * 100;
+        }
+        loops();
+    )");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(result.ToValue<int>(), 210);
+}
+
+TEST(MainTest, StringRopes)
+{
+    using namespace mildew;
+    Interpreter interpreter;
+    auto result = interpreter.Evaluate(R"(
+        var log = "";
+        for(let i = 0; i < 1000; ++i) log += `line ${i};`;
+        log;
+    )");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    auto str = result.ToValue<ScriptString>();
+    ASSERT_NE(str, nullptr);
+    // the pieces are only joined once the text is read
+    EXPECT_TRUE(str->IsRope());
+    EXPECT_EQ(interpreter.Evaluate("log.length").ToValue<int>(), static_cast<int>(str->Length()));
+    EXPECT_EQ(str->str().substr(0, 14), "line 0;line 1;");
+    EXPECT_FALSE(str->IsRope());
+    EXPECT_EQ(str->str().length(), str->Length());
+    EXPECT_TRUE(interpreter.Evaluate("log[5] == '0' && log == `${log}` && 'ab' + 1 == 'ab1' && 1 + 'c' === '1c'")
+        .ToValue<bool>());
+    EXPECT_FALSE(interpreter.Evaluate("'ab' + 'cd'").ToValue<ScriptString>()->IsRope());
+}
+
+TEST(MainTest, ZeroCopyLexer)
+{
+    using namespace mildew;
+    Lexer lexer("let name = 'plain'; let escaped = \"a\\tb\"; let t = `x${name + 1}y`;");
+    auto tokens = lexer.Tokenize();
+    ASSERT_FALSE(lexer.HasErrors());
+    const auto kText = lexer.source()->text();
+    auto in_source = [&kText](std::string_view view) {
+        return view.data() >= kText.data() && view.data() + view.size() <= kText.data() + kText.size();
+    };
+    EXPECT_EQ(tokens[1].text, "name");
+    EXPECT_TRUE(in_source(tokens[1].text));
+    EXPECT_EQ(tokens[3].text, "plain");
+    EXPECT_TRUE(in_source(tokens[3].text));
+    // only the literal with an escape sequence is decoded into a copy
+    EXPECT_EQ(tokens[8].text, "a\tb");
+    EXPECT_FALSE(in_source(tokens[8].text));
+    EXPECT_TRUE(in_source(tokens[13].text));
+
+    Lexer parser_lexer(lexer.source());
+    Arena arena;
+    Parser parser(parser_lexer, arena);
+    auto program = parser.ParseProgram();
+    EXPECT_EQ(program->statement_nodes.size(), 3u);
+    Interpreter interpreter;
+    auto result = interpreter.Evaluate("let name = 'n'; let escaped = \"a\\tb\"; `x${name + 1}y` + escaped;");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(result.ToString(), "xn1ya\tb");
+}
+
+TEST(MainTest, StreamingParser)
+{
+    using namespace mildew;
+    // tokens are only read from the lexer when the parser needs them
+    Lexer lexer("(a, b) => a + b; # is never read");
+    Arena arena;
+    Parser parser(lexer, arena);
+    EXPECT_NE(dynamic_cast<LambdaNode*>(parser.ParseExpression()), nullptr);
+    EXPECT_FALSE(lexer.HasErrors());
+
+    Interpreter interpreter;
+    interpreter.Evaluate("let x = 1 # 2;");
+    ASSERT_TRUE(interpreter.HasErrors());
+    EXPECT_EQ(interpreter.errors()[0], "Lexer Errors");
+    auto result = interpreter.Evaluate("String.raw `a\\tb`.length + ((x, y) => x * y)(3, 4) + `${[1, 2][1]}`");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(result.ToString(), "162");
+}
+
+TEST(MainTest, ArenaTree)
+{
+    using namespace mildew;
+    // every node of the tree is carved out of the arena and released with it
+    Lexer lexer("let o = {a: 1, b: [2, 3]}; switch(o.a) { case 1: o.a = `${o.b[0]}`; break; default: o.a = 0; }");
+    Arena arena;
+    Parser parser(lexer, arena);
+    auto program = parser.ParseProgram();
+    ASSERT_EQ(program->statement_nodes.size(), 2u);
+    EXPECT_GT(arena.bytes_used(), 0u);
+    auto ssnode = dynamic_cast<SwitchStatementNode*>(program->statement_nodes[1]);
+    ASSERT_NE(ssnode, nullptr);
+    ASSERT_EQ(ssnode->jump_table.size(), 1u);
+    EXPECT_EQ(ssnode->jump_table[0].statement_index, 0u);
+    EXPECT_EQ(ssnode->default_statement_id, 2u);
+    EXPECT_EQ(sizeof(Position), 4u);
+
+    Compiler compiler;
+    auto function = compiler.Compile(*program);
+    ASSERT_NE(function, nullptr);
+    Interpreter interpreter;
+    auto result = interpreter.Evaluate("let o = {a: 1, b: [2, 3]}; switch(o.a) { case 1: o.a = `${o.b[0]}`; break; }"
+        " o.a + o.b.length;");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(result.ToString(), "22");
+}
+
+// a tree walking evaluator of integer arithmetic that returns its results directly from the visits
+class IntegerEvaluator : public mildew::ExpressionVisitor<IntegerEvaluator, long>
+{
+public:
+    using Unsupported = std::invalid_argument;
+
+    long VisitLiteralNode(const mildew::LiteralNode& lnode) { return std::stol(std::string(lnode.literal_token.text)); }
+    long VisitBinaryOpNode(const mildew::BinaryOpNode& bonode)
+    {
+        const auto kLeft = VisitExpression(*bonode.left_node);
+        const auto kRight = VisitExpression(*bonode.right_node);
+        return bonode.op_token.type == mildew::Token::Type::STAR ? kLeft * kRight : kLeft + kRight;
+    }
+    long VisitUnaryOpNode(const mildew::UnaryOpNode& uonode) { return -VisitExpression(*uonode.operand_node); }
+    long VisitTerniaryOpNode(const mildew::TerniaryOpNode& tonode)
+    {
+        return VisitExpression(*tonode.condition_node) ? VisitExpression(*tonode.on_true_node)
+            : VisitExpression(*tonode.on_false_node);
+    }
+    long VisitFunctionLiteralNode(const mildew::FunctionLiteralNode&) { throw Unsupported("function"); }
+    long VisitLambdaNode(const mildew::LambdaNode&) { throw Unsupported("lambda"); }
+    long VisitTemplateStringNode(const mildew::TemplateStringNode&) { throw Unsupported("template"); }
+    long VisitArrayLiteralNode(const mildew::ArrayLiteralNode&) { throw Unsupported("array"); }
+    long VisitObjectLiteralNode(const mildew::ObjectLiteralNode&) { throw Unsupported("object"); }
+    long VisitClassLiteralNode(const mildew::ClassLiteralNode&) { throw Unsupported("class"); }
+    long VisitVarAccessNode(const mildew::VarAccessNode&) { throw Unsupported("variable"); }
+    long VisitFunctionCallNode(const mildew::FunctionCallNode&) { throw Unsupported("call"); }
+    long VisitArrayIndexNode(const mildew::ArrayIndexNode&) { throw Unsupported("index"); }
+    long VisitMemberAccessNode(const mildew::MemberAccessNode&) { throw Unsupported("member"); }
+    long VisitNewExpressionNode(const mildew::NewExpressionNode&) { throw Unsupported("new"); }
+    long VisitSuperNode(const mildew::SuperNode&) { throw Unsupported("super"); }
+    long VisitYieldNode(const mildew::YieldNode&) { throw Unsupported("yield"); }
+};
+
+TEST(MainTest, TypedVisitor)
+{
+    using namespace mildew;
+    Lexer lexer("1 ? 2 * (3 + -4) : 5");
+    Arena arena;
+    Parser parser(lexer, arena);
+    auto expression = parser.ParseExpression();
+    ASSERT_EQ(expression->kind, ExpressionNode::Kind::TERNIARY_OP);
+    IntegerEvaluator evaluator;
+    EXPECT_EQ(evaluator.VisitExpression(*expression), -2);
+
+    Lexer call_lexer("f(1)");
+    Parser call_parser(call_lexer, arena);
+    EXPECT_THROW(evaluator.VisitExpression(*call_parser.ParseExpression()), IntegerEvaluator::Unsupported);
+}
+
+TEST(MainTest, ScriptCache)
+{
+    using namespace mildew;
+    Interpreter interpreter;
+    auto& cache = interpreter.script_cache();
+    cache.capacity(2);
+    interpreter.Evaluate("var total = 0;");
+    for(int i = 0; i < 3; ++i)
+        interpreter.Evaluate("total += [1, 2, 3].length;", "add");
+    EXPECT_EQ(cache.stats().misses, 2u);
+    EXPECT_EQ(cache.stats().hits, 2u);
+    // the same code under another name is a different entry
+    interpreter.Evaluate("total += [1, 2, 3].length;", "other");
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_EQ(cache.stats().evictions, 1u);
+    // cached programs are roots of the heap
+    interpreter.heap().Collect();
+    auto result = interpreter.Evaluate("total += [1, 2, 3].length;", "add");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(result.ToString(), "15");
+    EXPECT_EQ(cache.stats().hits, 3u);
+    // failed compilations are not cached
+    interpreter.Evaluate("let = ;");
+    interpreter.Evaluate("let = ;");
+    EXPECT_TRUE(interpreter.HasErrors());
+    EXPECT_EQ(cache.stats().misses, 5u);
+    cache.capacity(0);
+    EXPECT_EQ(cache.size(), 0u);
+    EXPECT_NE(ScriptCache::Hash("ab", "c"), ScriptCache::Hash("b", "ca"));
+}
+
+TEST(MainTest, BytecodeImage)
+{
+    using namespace mildew;
+    const std::string kSource =
+        "class Point { constructor(x, y) { this.x = x; this.y = y; } sum() { return this.x + this.y; } }\n"
+        "function counter(start = 10) { let n = start; return () => ++n; }\n"
+        "const next = counter();\n"
+        "next(); let p = new Point(1.5, next());\n"
+        "`${p.sum()} ${null} ${true} ${0x10}`;";
+    std::vector<std::uint8_t> image;
+    {
+        Interpreter compiling;
+        auto program = compiling.Compile(kSource, "image");
+        ASSERT_NE(program, nullptr) << compiling.errors()[0];
+        image = BytecodeImage::Serialize(*program);
+    }
+    Interpreter interpreter;
+    Heap::Scope heap_scope(interpreter.heap());
+    auto program = BytecodeImage::Deserialize(image.data(), image.size());
+    EXPECT_EQ(program->function_name(), "image");
+    EXPECT_EQ(interpreter.Run(program).ToString(), "13.5 null true 16");
+
+    const std::string kPath = ::testing::TempDir() + "mildew_image_test.mdc";
+    BytecodeImage::Save(*program, kPath);
+    Interpreter loading;
+    EXPECT_EQ(loading.Run(loading.LoadImage(kPath)).ToString(), "13.5 null true 16");
+    std::remove(kPath.c_str());
+
+    auto truncated = image;
+    truncated.resize(truncated.size() / 2);
+    EXPECT_THROW(BytecodeImage::Deserialize(truncated.data(), truncated.size()), ImageError);
+    auto wrong_version = image;
+    wrong_version[4] ^= 0xFF;
+    EXPECT_THROW(BytecodeImage::Deserialize(wrong_version.data(), wrong_version.size()), ImageError);
+    EXPECT_THROW(loading.LoadImage(kPath), ImageError);
+
+    // a corrupt count must be rejected before anything is allocated for it
+    size_t rejected = 0;
+    for(size_t byte = 0; byte < image.size(); ++byte)
+    {
+        for(int bit = 0; bit < 8; ++bit)
+        {
+            auto corrupt = image;
+            corrupt[byte] ^= static_cast<std::uint8_t>(1 << bit);
+            try
+            {
+                BytecodeImage::Deserialize(corrupt.data(), corrupt.size());
+            }
+            catch(const ImageError&)
+            {
+                ++rejected;
+            }
+        }
+    }
+    EXPECT_GT(rejected, 0u);
+}
+
+TEST(MainTest, ConstantFolding)
+{
+    using namespace mildew;
+    Lexer lexer("const a = 2 * 3; let b = a + -1; if(a > 10) { b = 0; } else { b = ~b; } a ? 'x' + a : y;"
+        "function f() { return a; }");
+    Arena arena;
+    Parser parser(lexer, arena);
+    auto program = parser.ParseProgram();
+    auto optimized = Optimizer(arena).Optimize(*program);
+    ASSERT_EQ(optimized->statement_nodes.size(), 5u);
+    auto literal_text = [](const StatementNode* node) {
+        auto vdsnode = static_cast<const VarDeclarationStatementNode*>(node);
+        auto bonode = static_cast<const BinaryOpNode*>(vdsnode->assignment_nodes[0]);
+        EXPECT_TRUE(Optimizer::IsConstant(bonode->right_node));
+        return std::string(static_cast<const LiteralNode*>(bonode->right_node)->literal_token.text);
+    };
+    EXPECT_EQ(literal_text(optimized->statement_nodes[0]), "6");
+    EXPECT_EQ(literal_text(optimized->statement_nodes[1]), "5");
+    // only the else branch is left, and the original tree is unchanged
+    EXPECT_EQ(optimized->statement_nodes[2]->kind, StatementNode::Kind::BLOCK);
+    EXPECT_EQ(program->statement_nodes[2]->kind, StatementNode::Kind::IF);
+    auto esnode = static_cast<const ExpressionStatementNode*>(optimized->statement_nodes[3]);
+    ASSERT_TRUE(Optimizer::IsConstant(esnode->expression_node));
+    EXPECT_EQ(static_cast<const LiteralNode*>(esnode->expression_node)->Value().ToString(), "x6");
+    // a hoisted function can run before the const is initialized
+    EXPECT_EQ(optimized->statement_nodes[4], program->statement_nodes[4]);
+
+    Interpreter interpreter;
+    auto result = interpreter.Evaluate("const k = 4; let s = ''; for(let i = 0; i < 3; ++i) { switch(i * k) {"
+        " case 2 * 2: s += 'a'; break; case -(-8): s += 'b'; break; default: s += typeof k; } }"
+        " function h() { if(false) { var v = 1; } v = k; return v; } s + h();");
+    ASSERT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    EXPECT_EQ(result.ToString(), "numberab4");
+}
+
+TEST(MainTest, SwitchTables)
+{
+    using namespace mildew;
+    const std::string kSource =
+        "function dense(v) { switch(v) { case 1: return 'a'; case 2: case 3: return 'b'; case 5: return 'c'; }"
+        " return '-'; }\n"
+        "function sparse(v) { switch(v) { case -7: return 'x'; case 1000: return 'y'; case 2.5: return 'z';"
+        " default: return '-'; } }\n"
+        "function named(v) { switch(v) { case 'get': return 1; case 'put': return 2; case null: return 3; }"
+        " return 0; }\n"
+        "let s = ''; for(let v of [1, 2, 3, 4, 5, 6, 2.0, '1']) { s += dense(v); } s += ' ';\n"
+        "for(let v of [-7, 1000, 2.5, 1000.5, -8]) { s += sparse(v); } s += ' ';\n"
+        "for(let v of ['get', 'p' + 'ut', 'delete', null, undefined, 1]) { s += named(v); } s;";
+    Interpreter interpreter;
+    auto program = interpreter.Compile(kSource, "switch");
+    ASSERT_NE(program, nullptr) << interpreter.errors()[0];
+    std::vector<bool> dense_tables;
+    for(const auto& constant : *program->const_table())
+    {
+        if(auto func = constant.ToValue<ScriptFunction>())
+        {
+            ASSERT_EQ(func->switch_tables().size(), 1u);
+            dense_tables.push_back(func->switch_tables()[0].dense());
+        }
+    }
+    EXPECT_EQ(dense_tables, (std::vector<bool>{true, false, false}));
+    EXPECT_EQ(interpreter.Run(program).ToString(), "abb-c-b- xyz-- 120300");
+
+    // the tables are rebuilt from their cases when an image is loaded
+    const auto kImage = BytecodeImage::Serialize(*program);
+    Interpreter loading;
+    EXPECT_EQ(loading.Run(BytecodeImage::Deserialize(kImage.data(), kImage.size())).ToString(),
+        "abb-c-b- xyz-- 120300");
+}
+
+TEST(MainTest, TypeFeedback)
+{
+    using namespace mildew;
+    const std::string kSource =
+        "function add(a, b) { return a + b; }\n"
+        "function get(o) { return o.x; }\n"
+        "let t = 0; for(let i = 0; i < 10; ++i) { t = add(t, i); }\n"
+        "add('a', 1); add(1.5, 2); add(true, null); add([], {});\n"
+        "get({x: 1}); get({x: 's'}); t;";
+    Interpreter plain;
+    auto unprofiled = plain.Compile(kSource, "feedback");
+    ASSERT_NE(unprofiled, nullptr) << plain.errors()[0];
+    EXPECT_EQ(plain.Run(unprofiled).ToString(), "45");
+    EXPECT_TRUE(plain.vm().profiled_functions().empty());
+    EXPECT_TRUE(unprofiled->type_feedback().empty());
+
+    Interpreter interpreter;
+    interpreter.vm().profiling(true);
+    auto program = interpreter.Compile(kSource, "feedback");
+    ASSERT_NE(program, nullptr) << interpreter.errors()[0];
+    EXPECT_EQ(interpreter.Run(program).ToString(), "45");
+    const auto& functions = interpreter.vm().profiled_functions();
+    ASSERT_EQ(functions.size(), 3u);
+    auto state_of = [&](const std::string& name, const OpCode op) {
+        for(const auto* func : functions)
+        {
+            if(func->function_name() != name)
+                continue;
+            for(size_t i = 0; i < func->type_feedback().size(); ++i)
+            {
+                if(GetOp(FetchInstruction(func->compiled().data(), i)) == op)
+                    return func->type_feedback()[i].state();
+            }
+        }
+        return TypeFeedback::State::UNINITIALIZED;
+    };
+    EXPECT_EQ(state_of("add", OpCode::ADD), TypeFeedback::State::MEGAMORPHIC);
+    EXPECT_EQ(state_of("get", OpCode::GET_FIELD), TypeFeedback::State::POLYMORPHIC);
+    EXPECT_EQ(state_of("feedback", OpCode::LT), TypeFeedback::State::MONOMORPHIC);
+    EXPECT_EQ(state_of("feedback", OpCode::CALL), TypeFeedback::State::MONOMORPHIC);
+
+    const auto kReport = FormatTypeFeedback(functions);
+    EXPECT_NE(kReport.find("boolean null, integer integer, double integer, array object, string integer"),
+        std::string::npos) << kReport;
+    EXPECT_NE(kReport.find("object integer, object string"), std::string::npos) << kReport;
+    EXPECT_NE(kReport.find("11 monomorphic, 1 polymorphic, 1 megamorphic sites"), std::string::npos) << kReport;
+}
+
+TEST(MainTest, JitCompiler)
+{
+    using namespace mildew;
+    const std::string kSource =
+        "function fib(n) { if(n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+        "function fail(n) { if(n > 3) throw 'too big ' + n; return n * 2; }\n"
+        "function guard(n) { try { return fail(n); } catch(e) { return e; } }\n"
+        "function counter() { let c = 0; return function() { c = c + 1; return c; }; }\n"
+        "class Point { constructor(x) { this.x = x; } norm() { return this.x * this.x; } }\n"
+        "function name(v) { switch(v) { case 1: return 'one'; case 'b': return 'bee'; default: return '?'; } }\n"
+        "let big = 9007199254740000; for(let i = 0; i < 3; ++i) big = big * 1000;\n"
+        "let next = counter(); let total = 0;\n"
+        "for(let i = 0; i < 50; ++i) { total = total + next() - (i % 7); if(i >= 48) total = total + 0.5; }\n"
+        "let names = ''; for(let v of [1, 'b', null]) names += name(v);\n"
+        "[fib(15), guard(2), guard(5), total, (new Point(3)).norm(), names, big > 1e24, 7 / 2];";
+    Interpreter interpreted;
+    interpreted.vm().jit_enabled(false);
+    const auto kExpected = interpreted.Evaluate(kSource).ToString();
+    EXPECT_EQ(kExpected, "[610, 4, too big 5, 1129, 9, onebee?, true, 3.5]");
+
+    Interpreter interpreter;
+    interpreter.vm().jit_threshold(0);
+    auto program = interpreter.Compile(kSource, "jit");
+    ASSERT_NE(program, nullptr) << interpreter.errors()[0];
+    EXPECT_EQ(interpreter.Run(program).ToString(), kExpected);
+    // the loops of the program make it hot before it returns
+    EXPECT_EQ(program->jit().code != nullptr, VirtualMachine::kHasJit);
+
+    // an uncaught exception leaves native code with the same error as the interpreter reports
+    Interpreter failing;
+    failing.vm().jit_threshold(0);
+    try
+    {
+        failing.Evaluate("function f(n) { return n.x.y; }\n"
+            "let r = 0; for(let i = 0; i < 3; ++i) r = f({x: {y: i}});\nf({});");
+        FAIL() << "expected a runtime error";
+    }
+    catch(const ScriptRuntimeError& error)
+    {
+        EXPECT_NE(std::string(error.what()).find("Cannot access property y of undefined (f line 1)"),
+            std::string::npos) << error.what();
+    }
+}
+
+TEST(MainTest, ClosureCompiler)
+{
+    using namespace mildew;
+    const std::string kSource =
+        "function counter() { let c = 0; return () => ++c; }\n"
+        "class Shape { constructor(n) { this.n = n; } sides() { return this.n; } }\n"
+        "class Square extends Shape { constructor() { super(4); } sides() { return super.sides() * 10; } }\n"
+        "function kind(v) { switch(v) { case 1: return 'one'; case 'b': return 'bee'; default: return '?'; } }\n"
+        "function guarded(n) { let log = ''; try { if(n > 1) throw 'big'; log += 'ok'; }\n"
+        "    catch(e) { log += e; } finally { log += '!'; } return log; }\n"
+        "let next = counter(); next(); let names = ''; for(let v of [1, 'b', null]) names += kind(v);\n"
+        "let pairs = 0; outer: for(let i = 0; i < 5; ++i) { for(let j = 0; j < 5; ++j) {\n"
+        "    if(j > i) continue outer; if(i == 4) break outer; ++pairs; } }\n"
+        "let o = {x: 1, items: [1, 2]}; o.items[1] += o.x; o.y = `${o.x}-${o.items[1]}`;\n"
+        "function captured() { let fs = []; for(let i = 0; i < 3; ++i) fs[i] = () => i;\n"
+        "    return fs[0]() + fs[1]() * 10 + fs[2]() * 100; }\n"
+        "[next(), (new Square()).sides(), names, guarded(1), guarded(2), pairs, o.y, 7 / 2, captured()];";
+    Interpreter bytecode;
+    const auto kExpected = bytecode.Evaluate(kSource).ToString();
+    EXPECT_EQ(kExpected, "[2, 40, onebee?, ok!, big!, 10, 1-3, 3.5, 210]");
+
+    Interpreter interpreter;
+    interpreter.backend(Interpreter::Backend::CLOSURES);
+    // collect at every safepoint so values held only in slots and cells are checked to be roots
+    interpreter.heap().growth_factor(0);
+    interpreter.heap().min_threshold(0);
+    auto program = interpreter.Compile(kSource, "closures");
+    ASSERT_NE(program, nullptr) << interpreter.errors()[0];
+    EXPECT_EQ(program->type(), ScriptFunction::Type::NATIVE_FUNCTION);
+    EXPECT_EQ(interpreter.Run(program).ToString(), kExpected);
+
+    // programs of both backends run in the same interpreter
+    interpreter.backend(Interpreter::Backend::BYTECODE);
+    auto bytecode_program = interpreter.Compile("let total = 0; for(let i = 0; i < 4; ++i) total += i; total;");
+    ASSERT_NE(bytecode_program, nullptr) << interpreter.errors()[0];
+    EXPECT_EQ(bytecode_program->type(), ScriptFunction::Type::SCRIPT_FUNCTION);
+    EXPECT_EQ(interpreter.Run(bytecode_program).ToString(), "6");
+    interpreter.backend(Interpreter::Backend::CLOSURES);
+
+    try
+    {
+        interpreter.Evaluate("function f(n) { return n.x.y; }\nf({});");
+        FAIL() << "expected a runtime error";
+    }
+    catch(const ScriptRuntimeError& error)
+    {
+        EXPECT_NE(std::string(error.what()).find("Cannot access property y of undefined (f line 1)"),
+            std::string::npos) << error.what();
+    }
+}
+
+class IsolateTag
+{
+public:
+    int tag = 5;
+};
+
+class IsolateBase
+{
+public:
+    int id = 0;
+};
+
+class IsolateHost : public IsolateTag, public IsolateBase
+{
+};
+
+TEST(MainTest, Isolates)
+{
+    using namespace mildew;
+    constexpr int kThreads = 8;
+    constexpr int kRounds = 20;
+    const std::string kDefinitions =
+        "function make(n) { let c = n; return () => c++; }\n"
+        "class Acc { constructor(s) { this.s = s; } add(v) { this.s += v; return this; } }\n"
+        "function label(i) {\n"
+        "    switch('k' + i % 4) { case 'k0': return 'a'; case 'k1': return 'b'; default: return 'c'; } }\n"
+        "function run(round) { let acc = new Acc(round); let text = ''; let next = make(id);\n"
+        "    for(let i = 0; i < 500; ++i) { acc.add(next() % 13); let o = {v: i, w: [i, `${i}`]};\n"
+        "        text = label(o.w[0]) + (text.length > 40 ? '' : text); }\n"
+        "    return `${id} ${acc.s} ${text} ${host()}`; }";
+    // every isolate declares its own globals and a native function returning its own id
+    const auto make_isolate = [&](Interpreter& interpreter, const int id) {
+        if(id % 2)
+            interpreter.backend(Interpreter::Backend::CLOSURES);
+        interpreter.vm().jit_threshold(id % 3 == 0 ? 0 : 100);
+        interpreter.heap().min_threshold(16 * 1024);
+        Heap::Scope heap_scope(interpreter.heap());
+        interpreter.ForceSetGlobal("id", ScriptAny(id), true);
+        interpreter.ForceSetGlobal("host", ScriptFunction::Create("host",
+            [id](Environment&, ScriptAny&, const std::vector<ScriptAny>&, NativeFunctionError&) {
+                return ScriptAny(id * 2);
+            }));
+        interpreter.Evaluate(kDefinitions);
+        EXPECT_FALSE(interpreter.HasErrors()) << interpreter.errors()[0];
+    };
+    std::vector<std::string> expected;
+    for(int id = 0; id < kThreads; ++id)
+    {
+        Interpreter interpreter;
+        make_isolate(interpreter, id);
+        for(int round = 0; round < kRounds; ++round)
+            expected.emplace_back(interpreter.Evaluate("run(" + std::to_string(round) + ");").ToString());
+    }
+    EXPECT_EQ(expected[3 * kRounds + 1].substr(0, 2), "3 ");
+
+    std::vector<std::string> results(kThreads * kRounds);
+    std::vector<int> casts(kThreads);
+    std::vector<std::thread> threads;
+    for(int id = 0; id < kThreads; ++id)
+    {
+        threads.emplace_back([&, id] {
+            Interpreter interpreter;
+            make_isolate(interpreter, id);
+            // the class registry of cppd is the one structure every thread reads and writes
+            cppd::Object::RegisterClass<IsolateTag>();
+            cppd::Object::RegisterClass<IsolateBase>();
+            cppd::Object::RegisterClass<IsolateHost, IsolateTag, IsolateBase>();
+            cppd::Object native(new IsolateHost());
+            for(int round = 0; round < kRounds; ++round)
+            {
+                results[id * kRounds + round] =
+                    interpreter.Evaluate("run(" + std::to_string(round) + ");").ToString();
+                if(native.Cast<IsolateBase>() == static_cast<IsolateBase*>(native.Cast<IsolateHost>()))
+                    ++casts[id];
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+    EXPECT_EQ(results, expected);
+    EXPECT_EQ(casts, std::vector<int>(kThreads, kRounds));
+}
+
+TEST(MainTest, SharedCode)
+{
+    using namespace mildew;
+    constexpr int kThreads = 4;
+    constexpr int kRounds = 10;
+    const std::string kCode =
+        "function counter(n) { let c = n; return () => c++; }\n"
+        "class Point { constructor(x, y) { this.x = x; this.y = y; } sum() { return this.x + this.y; } }\n"
+        "function kind(v) { switch(v) { case 'a': return 1; case 2: return 2; case 2.5: return 3; } return 0; }\n"
+        "var total = 0; var next = counter(seed);\n"
+        "for(let i = 0; i < 300; ++i) total += (new Point(i, next())).sum() % 7 + kind(['a', 2, 2.5, 'z'][i % 4]);\n"
+        "`${seed} ${total} ${kind('a')}`;";
+    std::shared_ptr<const CompiledProgram> program;
+    std::string expected;
+    {
+        Interpreter interpreter;
+        EXPECT_EQ(interpreter.CompileShared("let 1 = x;"), nullptr);
+        EXPECT_TRUE(interpreter.HasErrors());
+        // closures are tied to their heap, so shared programs are compiled to bytecode on any backend
+        interpreter.backend(Interpreter::Backend::CLOSURES);
+        program = interpreter.CompileShared(kCode);
+        ASSERT_NE(program, nullptr);
+        interpreter.ForceSetGlobal("seed", ScriptAny(1));
+        expected = interpreter.Evaluate(kCode).ToString();
+    }
+    // the program outlives the interpreter that compiled it
+    EXPECT_EQ(program->functions().size(), 6);
+    EXPECT_GT(program->shared_bytes(), 0);
+    EXPECT_EQ(expected.substr(0, 2), "1 ");
+
+    std::vector<std::string> results(kThreads * kRounds);
+    std::vector<int> shared(kThreads);
+    std::vector<std::thread> threads;
+    for(int id = 0; id < kThreads; ++id)
+    {
+        threads.emplace_back([&, id] {
+            // a worker starts a new interpreter for each script without compiling it again
+            for(int round = 0; round < kRounds; ++round)
+            {
+                Interpreter interpreter;
+                interpreter.vm().jit_threshold((id + round) % 2 ? 0 : 100);
+                interpreter.heap().min_threshold(16 * 1024);
+                interpreter.ForceSetGlobal("seed", ScriptAny(1));
+                const auto instance = interpreter.Instantiate(program);
+                results[id * kRounds + round] = interpreter.Run(program).ToString();
+                if(interpreter.Instantiate(program) == instance
+                  && &instance->compiled() == program->functions()[0].code.get())
+                    ++shared[id];
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+    EXPECT_EQ(results, std::vector<std::string>(kThreads * kRounds, expected));
+    EXPECT_EQ(shared, std::vector<int>(kThreads, kRounds));
+
+    // an interpreter does not keep the programs it ran alive
+    Interpreter interpreter;
+    auto transient = [] {
+        Interpreter compiler;
+        return compiler.CompileShared("let value = 1 + 2; value;");
+    }();
+    const std::weak_ptr<const CompiledProgram> released = transient;
+    EXPECT_EQ(interpreter.Run(transient).ToString(), "3");
+    transient.reset();
+    EXPECT_TRUE(released.expired());
+    interpreter.ForceSetGlobal("seed", ScriptAny(1));
+    EXPECT_EQ(interpreter.Run(program).ToString(), expected);
+}
+
+TEST(MainTest, Scheduler)
+{
+    using namespace mildew;
+    LatencyHistogram histogram;
+    histogram.Record(std::chrono::nanoseconds(500));
+    histogram.Record(std::chrono::microseconds(3));
+    EXPECT_EQ(histogram.buckets()[0], 1);
+    EXPECT_EQ(histogram.buckets()[2], 1);
+    EXPECT_EQ(histogram.Percentile(0.5), std::chrono::microseconds(1));
+    EXPECT_EQ(histogram.Percentile(1.0), std::chrono::microseconds(4));
+
+    std::shared_ptr<const CompiledProgram> program;
+    {
+        Interpreter interpreter;
+        program = interpreter.CompileShared(
+            "function work(n, tag) { let t = 0; for(let i = 0; i < n; ++i) t += i % 7; return `${tag}:${t}`; }\n"
+            "function fail(message) { throw message; }\n"
+            "function wait() { return gate(); }");
+        ASSERT_NE(program, nullptr);
+    }
+    std::promise<void> open;
+    std::shared_future<void> opened = open.get_future().share();
+    ScriptScheduler::Options options;
+    options.num_threads = 2;
+    options.max_queued = 4;
+    options.setup = [opened](Interpreter& interpreter) {
+        interpreter.ForceSetGlobal("gate", ScriptFunction::Create("gate",
+            [opened](Environment&, ScriptAny&, const std::vector<ScriptAny>&, NativeFunctionError&) {
+                opened.wait();
+                return ScriptAny(true);
+            }));
+    };
+    ScriptScheduler scheduler(program, options);
+    EXPECT_EQ(scheduler.num_threads(), 2u);
+
+    // both workers wait at the gate, so the queue fills up and turns the next call away
+    auto first_wait = scheduler.Submit("wait");
+    auto second_wait = scheduler.Submit("wait");
+    while(scheduler.queue_depth() > 0)
+        std::this_thread::yield();
+    std::vector<std::future<TaskValue>> queued;
+    for(int i = 0; i < 4; ++i)
+    {
+        auto submitted = scheduler.TrySubmit("work", {10, i});
+        ASSERT_TRUE(submitted.has_value());
+        queued.emplace_back(std::move(*submitted));
+    }
+    EXPECT_FALSE(scheduler.TrySubmit("work", {10, 4}).has_value());
+    EXPECT_EQ(scheduler.queue_depth(), 4);
+    open.set_value();
+    EXPECT_TRUE(first_wait.get().scalar().ToValue<bool>());
+    EXPECT_TRUE(second_wait.get().scalar().ToValue<bool>());
+    for(int i = 0; i < 4; ++i)
+        EXPECT_EQ(queued[i].get().str(), std::to_string(i) + ":24");
+
+    // calls of uneven length, more than the queue holds, so Submit waits for room
+    std::vector<std::future<TaskValue>> results;
+    for(int i = 0; i < 100; ++i)
+        results.emplace_back(scheduler.Submit("work", {i % 10 == 0 ? 20000 : 100, "call" + std::to_string(i)}));
+    auto failed = scheduler.Submit("fail", {"boom"});
+    auto missing = scheduler.Submit("missing");
+    for(int i = 0; i < 100; ++i)
+    {
+        const int kN = i % 10 == 0 ? 20000 : 100;
+        int expected = 0;
+        for(int j = 0; j < kN; ++j)
+            expected += j % 7;
+        EXPECT_EQ(results[i].get().ToString(), "call" + std::to_string(i) + ":" + std::to_string(expected));
+    }
+    EXPECT_THROW(failed.get(), ScriptRuntimeError);
+    EXPECT_THROW(missing.get(), ScriptRuntimeError);
+    // a worker keeps running calls after one throws
+    EXPECT_EQ(scheduler.Submit("work", {3, "after"}).get().str(), "after:3");
+
+    const auto kStats = scheduler.stats();
+    EXPECT_EQ(kStats.submitted, 109);
+    EXPECT_EQ(kStats.rejected, 1);
+    EXPECT_EQ(kStats.completed, 109);
+    EXPECT_EQ(kStats.failed, 2);
+    EXPECT_EQ(kStats.queue_depth, 0);
+    EXPECT_EQ(kStats.max_queue_depth, 4);
+    EXPECT_EQ(kStats.wait_latency.count(), 109);
+    EXPECT_EQ(kStats.run_latency.count(), 109);
+    EXPECT_LE(kStats.run_latency.Percentile(0.5), kStats.run_latency.Percentile(0.99));
+
+    // a worker that cannot run the program stops the scheduler from being created
+    std::shared_ptr<const CompiledProgram> broken;
+    {
+        Interpreter interpreter;
+        broken = interpreter.CompileShared("missing();");
+        ASSERT_NE(broken, nullptr);
+    }
+    EXPECT_THROW(ScriptScheduler failing(broken, options), ScriptRuntimeError);
+    std::atomic<int> setups = 0;
+    options.setup = [&setups](Interpreter&) {
+        if(++setups == 2)
+            throw std::runtime_error("setup failed");
+    };
+    EXPECT_THROW(ScriptScheduler failing(program, options), std::runtime_error);
 }
\ No newline at end of file